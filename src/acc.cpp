@@ -0,0 +1,288 @@
+/**
+ * @file acc.cpp
+ * @brief RAK1904 LIS3DH accelerometer, motion and tamper detection
+ *        The sensor runs on its own at a low ODR, buffers samples in its
+ *        hardware FIFO and raises INT1 when the high-pass filtered
+ *        acceleration crosses the wake threshold. The MCU sleeps until then,
+ *        the interrupt wakes the app task with ACC_TRIGGER and the FIFO is
+ *        drained in one burst to classify the event.
+ * @version 0.1
+ * @date 2022-09-17
+ */
+#include "app.h"
+
+#ifdef ENABLE_ACC
+#include "SparkFunLIS3DH.h" // Click to install library: http://librarymanager/All#SparkFun_LIS3DH
+#include "zero_heap.h"
+
+/** RAK1904 in WisBlock slot C, INT1 is routed to WB_IO5 */
+#define ACC_INT_PIN WB_IO5
+
+/** Full scale range is +/-8g, normal mode (10 bit) gives 16 mg/digit */
+#define ACC_MG_PER_DIGIT 16
+/** INT1_THS LSB at +/-8g */
+#define ACC_THS_MG_PER_LSB 62
+
+/** The accelerometer */
+#define ACC_I2C_ADDR 0x18
+LIS3DH acc_sensor(I2C_MODE, ACC_I2C_ADDR);
+
+/** Last read acceleration in mg, x, y, z */
+int16_t acc_values[3] = {0};
+
+/** Resting orientation used as tamper reference */
+int32_t acc_ref[3] = {0};
+bool acc_ref_valid = false;
+
+RAM_BUDGET(ACC, sizeof(acc_sensor) + sizeof(acc_values) + sizeof(acc_ref) + sizeof(acc_ref_valid), 128);
+
+/**
+ * @brief INT1 handler, wake up the app task
+ *
+ */
+void acc_int_handler(void)
+{
+	api_wake_loop(ACC_TRIGGER);
+}
+
+/**
+ * @brief Read one sample from the output registers (FIFO head)
+ *
+ * @param xyz acceleration in mg
+ */
+static void acc_read_sample(int16_t *xyz)
+{
+	uint8_t raw[6] = {0};
+	(void)TRACE_I2C_READ(ACC_I2C_ADDR, LIS3DH_OUT_X_L, acc_sensor.readRegisterRegion(raw, LIS3DH_OUT_X_L, 6), raw, 6);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		// Left aligned 10 bit value
+		int16_t val = (int16_t)(raw[2 * axis] | (raw[2 * axis + 1] << 8));
+		xyz[axis] = (val >> 6) * ACC_MG_PER_DIGIT;
+	}
+}
+
+/**
+ * @brief Read one register
+ *
+ * @return uint8_t register value, 0 if the read failed
+ */
+static uint8_t acc_read_register(uint8_t reg)
+{
+	uint8_t val = 0;
+	uint8_t status = TRACE_I2C_READ(ACC_I2C_ADDR, reg, acc_sensor.readRegister(&val, reg), &val, 1);
+	return status == IMU_SUCCESS ? val : 0;
+}
+
+/**
+ * @brief Initialize the LIS3DH for wake on motion with FIFO batching
+ *
+ * @return true sensor found and configured
+ * @return false no sensor
+ */
+bool init_acc(void)
+{
+	if (TRACE_I2C_READ(ACC_I2C_ADDR, LIS3DH_WHO_AM_I, acc_sensor.begin(), NULL, 0) != IMU_SUCCESS)
+	{
+		MYLOG("ACC", "LIS3DH not found");
+		return false;
+	}
+
+	// 10 Hz, normal mode, X, Y and Z enabled
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG1, 0x27);
+	// High-pass filter on the interrupt generator only, FIFO keeps gravity for the tilt check
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG2, 0x01);
+	// AOI1 interrupt on INT1
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG3, 0x40);
+	// Block data update, +/-8g
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG4, 0xA0);
+	// FIFO enabled, INT1 latched until INT1_SRC is read
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG5, 0x48);
+	// No interrupt on INT2
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG6, 0x00);
+	// FIFO in stream mode, always holds the last 32 samples
+	acc_sensor.writeRegister(LIS3DH_FIFO_CTRL_REG, 0x80);
+
+	// Wake on X, Y or Z high event
+	acc_apply_config();
+	// Event must last 2 samples (200 ms) to filter single spikes
+	acc_sensor.writeRegister(LIS3DH_INT1_DURATION, 0x02);
+	acc_sensor.writeRegister(LIS3DH_INT1_CFG, 0x2A);
+
+	// Reset the high-pass filter reference
+	acc_read_register(LIS3DH_REFERENCE);
+	delay(200);
+
+	// Resting orientation as tamper reference
+	read_acc();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		acc_ref[axis] = acc_values[axis];
+	}
+	acc_ref_valid = true;
+
+	clear_acc_int();
+
+	pinMode(ACC_INT_PIN, INPUT);
+	attachInterrupt(ACC_INT_PIN, acc_int_handler, RISING);
+	return true;
+}
+
+/**
+ * @brief Set the wake threshold from g_app_config
+ *
+ */
+void acc_apply_config(void)
+{
+	uint8_t ths = g_app_config.acc_wake_mg / ACC_THS_MG_PER_LSB;
+	acc_sensor.writeRegister(LIS3DH_INT1_THS, ths > 0x7F ? 0x7F : (ths ? ths : 1));
+}
+
+/**
+ * @brief Clear the latched interrupt
+ *
+ */
+void clear_acc_int(void)
+{
+	acc_read_register(LIS3DH_INT1_SRC);
+}
+
+/**
+ * @brief Read the most recent acceleration
+ *
+ * @return uint16_t* x, y, z in mg (two's complement)
+ */
+uint16_t *read_acc(void)
+{
+	acc_read_sample(acc_values);
+	MYLOG("ACC", "X %d Y %d Z %d mg", acc_values[0], acc_values[1], acc_values[2]);
+	return (uint16_t *)acc_values;
+}
+
+/**
+ * @brief Capture a burst at 400 Hz through the FIFO
+ *        Wake on motion is paused meanwhile, the 10 Hz watch setup is
+ *        restored afterwards.
+ *
+ * @param xyz buffer for samples * 3 values in mg, x, y, z interleaved
+ * @param samples number of samples to capture
+ * @return uint16_t number of samples captured
+ */
+uint16_t acc_capture(int16_t *xyz, uint16_t samples)
+{
+	uint16_t collected = 0;
+
+	acc_sensor.writeRegister(LIS3DH_INT1_CFG, 0x00);
+	// 400 Hz, restart the FIFO so it holds only new samples
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG1, 0x77);
+	acc_sensor.writeRegister(LIS3DH_FIFO_CTRL_REG, 0x00);
+	acc_sensor.writeRegister(LIS3DH_FIFO_CTRL_REG, 0x80);
+
+	time_t start = millis();
+	while ((collected < samples) && ((millis() - start) < 1000))
+	{
+		// 32 samples FIFO at 400 Hz fills in 80 ms
+		delay(40);
+		uint8_t fifo_src = acc_read_register(LIS3DH_FIFO_SRC_REG);
+		uint8_t level = (fifo_src & 0x40) ? 32 : (fifo_src & 0x1F);
+		for (uint8_t idx = 0; (idx < level) && (collected < samples); idx++)
+		{
+			acc_read_sample(&xyz[3 * collected]);
+			collected++;
+		}
+	}
+
+	acc_sensor.writeRegister(LIS3DH_CTRL_REG1, 0x27);
+	acc_read_register(LIS3DH_REFERENCE);
+	clear_acc_int();
+	acc_sensor.writeRegister(LIS3DH_INT1_CFG, 0x2A);
+	return collected;
+}
+
+/**
+ * @brief Drain the FIFO and classify what woke us up
+ *        Call on ACC_TRIGGER, clears the interrupt.
+ *
+ * @param peak filled with the sample with the largest deviation from 1g, in mg
+ * @return uint8_t ACC_EVENT_xxx flags, 0 if nothing worth reporting
+ */
+uint8_t acc_check_event(int16_t *peak)
+{
+	uint8_t fifo_src = acc_read_register(LIS3DH_FIFO_SRC_REG);
+	uint8_t samples = fifo_src & 0x1F;
+	if (fifo_src & 0x40)
+	{
+		// Overrun, the FIFO is full
+		samples = 32;
+	}
+
+	int32_t sum[3] = {0};
+	int32_t peak_dev = 0;
+	int16_t xyz[3];
+	for (uint8_t idx = 0; idx < samples; idx++)
+	{
+		acc_read_sample(xyz);
+		// Deviation from 1g, squared, avoids the sqrt
+		int32_t mag2 = (int32_t)xyz[0] * xyz[0] + (int32_t)xyz[1] * xyz[1] + (int32_t)xyz[2] * xyz[2];
+		int32_t dev = mag2 > 1000000 ? mag2 - 1000000 : 1000000 - mag2;
+		if (dev >= peak_dev)
+		{
+			peak_dev = dev;
+			memcpy(peak, xyz, sizeof(xyz));
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			sum[axis] += xyz[axis];
+		}
+	}
+	clear_acc_int();
+
+	if (samples == 0)
+	{
+		return 0;
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		acc_values[axis] = sum[axis] / samples;
+	}
+
+	uint8_t events = ACC_EVENT_MOTION;
+
+	// |a|^2 beyond (1g +/- impact threshold)^2
+	int32_t hi = 1000 + g_app_config.acc_impact_mg;
+	int32_t lo = 1000 > g_app_config.acc_impact_mg ? 1000 - g_app_config.acc_impact_mg : 0;
+	int32_t mag2 = (int32_t)peak[0] * peak[0] + (int32_t)peak[1] * peak[1] + (int32_t)peak[2] * peak[2];
+	if (mag2 > hi * hi || mag2 < lo * lo)
+	{
+		events |= ACC_EVENT_IMPACT;
+	}
+
+	// Tilt against the resting orientation: cos^2(angle) < cos^2(30 deg)
+	if (acc_ref_valid)
+	{
+		int64_t dot = 0;
+		int64_t len_a = 0;
+		int64_t len_b = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			dot += (int64_t)acc_values[axis] * acc_ref[axis];
+			len_a += (int64_t)acc_values[axis] * acc_values[axis];
+			len_b += (int64_t)acc_ref[axis] * acc_ref[axis];
+		}
+		// cos^2(30 deg) = 3/4
+		if (dot <= 0 || 4 * dot * dot < 3 * len_a * len_b)
+		{
+			events |= ACC_EVENT_TILT;
+			// Report a new orientation only once
+			for (int axis = 0; axis < 3; axis++)
+			{
+				acc_ref[axis] = acc_values[axis];
+			}
+		}
+	}
+
+	MYLOG("ACC", "%d samples, peak %d/%d/%d mg, events 0x%02X", samples, peak[0], peak[1], peak[2], events);
+	return events;
+}
+
+#endif // ENABLE_ACC
@@ -34,9 +34,26 @@
 // Enable RS232 Renogy sections
 #define ENABLE_RS232 
 
+// Enable accelerometer (RAK1904) motion and tamper sections
+#define ENABLE_ACC
+
+// Enable vibration analysis sections, needs ENABLE_ACC
+//#define ENABLE_VIBRATION
+
+// Enable delta firmware updates over LoRaWAN, nRF52 flash layout
+#ifdef NRF52_SERIES
+#define ENABLE_FUOTA
+#endif
+
+// Restart into the new image after a delta update (fuota.cpp). Needs a bootloader that
+// copies a valid APP bank 1 at boot, leave off until that is verified on hardware
+//#define FUOTA_ACTIVATE
+
 /** Examples for application events */
 #define ACC_TRIGGER 0b1000000000000000
 #define N_ACC_TRIGGER 0b0111111111111111
+#define LOAD_TRIGGER 0b0100000000000000
+#define N_LOAD_TRIGGER 0b1011111111111111
 
 #ifdef NRF52_SERIES
 #if MY_DEBUG > 0
@@ -80,13 +97,171 @@ void ble_data_handler(void) __attribute__((weak));
 void lora_data_handler(void);
 
 /** Temperature + Humidity stuff */
-int init_shtc3(void);
+bool init_shtc3(void);
 void shtc3_read_data(void);
 
 /** Accelerometer stuff */
 bool init_acc(void);
 void clear_acc_int(void);
 uint16_t *read_acc(void);
+uint8_t acc_check_event(int16_t *peak);
+uint16_t acc_capture(int16_t *xyz, uint16_t samples);
+void acc_apply_config(void);
+
+/** Vibration analysis */
+void init_vibration(void);
+void vibration_read_data(void);
+
+/** Defaults, the values in use are in g_app_config */
+/** Wake on motion threshold, high-pass filtered, in mg */
+#define ACC_WAKE_THRESHOLD_MG 250
+/** Deviation from 1g reported as impact, in mg */
+#define ACC_IMPACT_THRESHOLD_MG 1500
+/** Minimum time between two alert uplinks, in s */
+#define ACC_ALERT_HOLDOFF 60
+
+/** Accelerometer event flags */
+#define ACC_EVENT_MOTION 0x01
+#define ACC_EVENT_IMPACT 0x02
+#define ACC_EVENT_TILT 0x04
+
+/** Energy aware scheduling */
+enum energy_tier_e
+{
+	ENERGY_CRITICAL = 0, // x4 interval, GNSS, BLE and optional sensors off
+	ENERGY_SAVE,		  // x2 interval, GNSS and BLE off
+	ENERGY_NORMAL,		  // configured interval
+	ENERGY_SURPLUS,		  // 1/2 interval, optional sensors on
+};
+extern energy_tier_e g_energy_tier;
+void init_energy(void);
+void energy_update(uint8_t uplinks);
+bool energy_gnss_allowed(void);
+bool energy_ble_allowed(void);
+bool energy_optional_allowed(void);
+void energy_set_interval(uint32_t interval);
+
+/** Remote configuration, changed by downlink commands and kept in flash, see config.cpp */
+#define LORAWAN_CMD_PORT 10
+
+/** Renogy Modbus poll set, app_config_s::renogy_poll */
+#define RENOGY_POLL_DATA 0x01
+#define RENOGY_POLL_ERRORS 0x02
+
+/** Charge controller on Serial1, app_config_s::charger */
+#define CHARGER_AUTO 0	   // VE.Direct if it talks at init, else Renogy
+#define CHARGER_RENOGY 1   // Modbus poll, renogy_rs232.cpp
+#define CHARGER_VEDIRECT 2 // Victron text protocol, vedirect.cpp
+
+struct app_config_s
+{
+	uint32_t send_interval; // ms, 0: keep the WisBlock setting
+	uint16_t sensor_off;	// one bit per sensor uid, see SENSOR_REGISTRY
+	uint16_t acc_wake_mg;	// ACC_WAKE_THRESHOLD_MG
+	uint16_t acc_impact_mg; // ACC_IMPACT_THRESHOLD_MG
+	uint16_t acc_holdoff_s; // ACC_ALERT_HOLDOFF
+	uint8_t renogy_poll;	// RENOGY_POLL_xxx
+	uint8_t charger;		// CHARGER_xxx
+};
+extern app_config_s g_app_config;
+void init_config(void);
+void config_command(const uint8_t *buf, uint8_t len);
+uint8_t config_ack_encode(uint8_t *buf);
+void config_ack_sent(void);
+/** Command acknowledge, 0x0F01 sequence, status */
+#define CMD_ACK_LEN 4
+
+/** Remote load switching and Class C window, see load.cpp */
+#define LOAD_OFF 0
+#define LOAD_ON 1
+#define LOAD_CYCLE 2
+#define LOAD_NONE 0xFF
+/** Longest Class C window, minutes */
+#define LOAD_WINDOW_MAX_MIN 60
+void init_load(void);
+void load_switch(uint8_t action, uint8_t off_s);
+void load_window(uint8_t minutes);
+void load_event(void);
+bool load_report_send(void);
+
+/** Delta firmware updates, see fuota.cpp, patch and fragments in fuota_codec.h */
+/** Flash of the RAK4631: S140 6.x, Adafruit bootloader, InternalFS at 0xED000 */
+#define FUOTA_PAGE_SIZE 4096
+#define FUOTA_BANK0 0x26000 // running application
+#define FUOTA_BANK1 0x89000 // new image, the bootloader copies it to bank 0
+#define FUOTA_SCRATCH 0xDD000 // received patch
+#define FUOTA_SCRATCH_SIZE 0x10000
+#define FUOTA_BANK_SIZE (FUOTA_SCRATCH - FUOTA_BANK1)
+#define FUOTA_BOOT_SETTINGS 0xFF000
+void fuota_command(const uint8_t *buf, uint8_t len);
+bool fuota_send(void);
+void fuota_tx_fin(void);
+
+/** Backlog batching, frame format in batch_codec.h */
+void init_batch(void);
+bool batch_add(uint8_t packet, const uint8_t *buf, uint16_t len);
+bool batch_send(void);
+
+/** Device time, time_sync.cpp: Application Layer Clock Sync (LoRaWAN TS003) and GNSS */
+#define LORAWAN_CLOCK_PORT 202
+/** 0x1285 Unix time of the samples, s, appended to the uplink once the clock is set */
+#define TIME_PAYLOAD_LEN 6
+uint64_t time_uptime_ms(void);
+uint32_t time_uptime_s(void);
+bool time_is_set(void);
+uint32_t time_unix(void);
+uint32_t time_unix_at(uint32_t uptime_s);
+void time_gnss_fix(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second, uint8_t centisecond, uint32_t age_ms);
+uint8_t time_encode(uint8_t *buf);
+void time_command(const uint8_t *buf, uint8_t len);
+bool time_send(void);
+/** Crystal drift estimate, ppb */
+extern int32_t g_time_drift_ppb;
+
+/** Node battery, battery.cpp */
+void batt_rest_read(void);
+uint16_t batt_rest_mv(void);
+void batt_tx_start(void);
+void batt_tx_end(void);
+/** Battery ADC backend, batt_adc.cpp */
+/**
+ * @brief nRF52 14 bit SAADC result to battery mV, Q16 fixed point
+ *        3000 mV full scale / 16384 * 1.73 divider compensation * 65536
+ */
+#define BATT_ADC_MV_Q16 20760
+bool batt_adc_init(void);
+int16_t batt_adc_read(void);
+bool batt_adc_burst_start(int16_t *buf, uint16_t count);
+uint16_t batt_adc_burst_end(void);
+uint16_t batt_adc_mv(int16_t raw);
+
+/** Time budgets of the sensor phases and the hardware watchdog, supervisor.cpp */
+void init_supervisor(void);
+void supervisor_begin(uint8_t id);
+bool supervisor_expired(void);
+bool supervisor_end(void);
+bool supervisor_allowed(uint8_t id);
+void supervisor_feed(void);
+void supervisor_i2c_recover(void);
+/** Overruns per sensor uid, kept in flash */
+extern uint16_t g_supervisor_overruns[];
+/** Watchdog backend, wdt.cpp */
+bool wdt_start(uint32_t timeout_ms);
+void wdt_feed(void);
+bool wdt_caused_reset(void);
+bool wdt_warm_reset(void);
+uint8_t wdt_retained(void);
+void wdt_retain(uint8_t value);
+
+/** WisBlock modules on the I2C bus, i2c_probe.cpp */
+#define I2C_MODULE_SHTC3 0x01	// RAK1901 temperature and humidity
+#define I2C_MODULE_BME680 0x02	// RAK1906 environment
+#define I2C_MODULE_LIS3DH 0x04	// RAK1904 accelerometer
+#define I2C_MODULE_MCP23017 0x08 // RAK13003 IO expander
+void init_i2c_probe(void);
+bool i2c_module_found(uint8_t module);
+/** I2C_MODULE_xxx bits of the modules found */
+extern uint8_t g_i2c_modules;
 
 /** GNSS functions **/
 bool init_gnss(void);
@@ -94,15 +269,56 @@ bool poll_gnss(void);
 
 /** Renogy RS232 functions **/
 void init_renogy_rs232(void);
-void renogyPollRs232Data(void);
+bool renogyPollRs232Data(void);
 void renogyPollRs232Errors(void);
 const char *renogyDecodeErrorStatus(void);
 void renogyPrintStatus(void);
+bool renogyWriteLoad(bool on, bool *state);
+/** Charge controller backend in use, CHARGER_RENOGY or CHARGER_VEDIRECT */
+extern uint8_t g_charger;
+/** The last Modbus data poll succeeded */
+extern bool g_renogy_valid;
+void charger_select(void);
+bool vedirect_detect(void);
+void vedirect_sample(void);
 
 // LoRaWan functions
 /** Include the WisBlock-API */
 #include <WisBlock-API.h> // Click to install library: http://librarymanager/All#WisBlock-API
 
+/** Peripheral trace hooks, ENABLE_TRACE is set by env:wiscore_rak4631_trace */
+#include "trace.h"
+/** The UART of the charge controller and GNSS, recorded with ENABLE_TRACE */
+#ifdef ENABLE_TRACE
+#define APP_UART g_trace_uart
+#else
+#define APP_UART Serial1
+#endif
+
+/** Largest LoRaWAN application payload (US915 DR4) */
+#define LORAWAN_MAX_PAYLOAD 242
+
+/** Static RAM per module, see zero_heap.h */
+struct ram_budget_s;
+extern const ram_budget_s APP_ram_budget;
+extern const ram_budget_s ENERGY_ram_budget;
+extern const ram_budget_s GNSS_ram_budget;
+extern const ram_budget_s ENV_ram_budget;
+extern const ram_budget_s RS232_ram_budget;
+extern const ram_budget_s VEDIRECT_ram_budget;
+extern const ram_budget_s ACC_ram_budget;
+extern const ram_budget_s VIB_ram_budget;
+extern const ram_budget_s BATT_ram_budget;
+extern const ram_budget_s SENSORS_ram_budget;
+extern const ram_budget_s SUPERVISOR_ram_budget;
+extern const ram_budget_s I2C_PROBE_ram_budget;
+extern const ram_budget_s BATCH_ram_budget;
+extern const ram_budget_s TIME_ram_budget;
+extern const ram_budget_s CONFIG_ram_budget;
+extern const ram_budget_s LOAD_ram_budget;
+extern const ram_budget_s FUOTA_ram_budget;
+extern const ram_budget_s TRACE_ram_budget;
+
 /** Battery level uinion */
 typedef union 
 {
@@ -122,44 +338,29 @@ typedef union
 	uint8_t val8[2];
 } renogy_s;
 
-struct tracker_data_s
+#ifdef ENABLE_ACC
+/** Immediate tamper/impact alert */
+struct acc_alert_s
 {
-#ifdef ENABLE_GNSS
-    uint8_t data_flag1 = 0x01;	// 1
-	uint8_t data_flag2 = 0x88;	// 2
-	uint8_t lat_1 = 0;			// 3
-	uint8_t lat_2 = 0;			// 4
-	uint8_t lat_3 = 0;			// 5
-	uint8_t long_1 = 0;			// 6
-	uint8_t long_2 = 0;			// 7
-	uint8_t long_3 = 0;			// 8
-	uint8_t alt_1 = 0;			// 9
-	uint8_t alt_2 = 0;			// 10
-	uint8_t alt_3 = 0;			// 11
-#endif
-	uint8_t data_flag3 = 0x08;	// 12
-	uint8_t data_flag4 = 0x02;	// 13
-	uint8_t batt_1 = 0;			// 14
-	uint8_t batt_2 = 0;			// 15
-#ifdef ENABLE_ENV_MON
- 	uint8_t data_flag7 = 0x07;	// 24
-	uint8_t data_flag8 = 0x68;	// 25
-	uint8_t humid_1 = 0;		// 26
-	uint8_t data_flag9 = 0x02;	// 27
-	uint8_t data_flag10 = 0x67; // 28
-	uint8_t temp_1 = 0;			// 29
-	uint8_t temp_2 = 0;			// 30
-#endif
+	uint8_t data_flag1 = 0x03;	// 1
+	uint8_t data_flag2 = 0x71;	// 2
+	uint8_t x_1 = 0;			// 3
+	uint8_t x_2 = 0;			// 4
+	uint8_t y_1 = 0;			// 5
+	uint8_t y_2 = 0;			// 6
+	uint8_t z_1 = 0;			// 7
+	uint8_t z_2 = 0;			// 8
+	uint8_t data_flag3 = 0x0D;	// 9
+	uint8_t data_flag4 = 0x00;	// 10
+	uint8_t events = 0;			// 11
 };
 
-extern tracker_data_s g_tracker_data;
-#define TRACKER_DATA_LEN sizeof(tracker_data_s)
+extern acc_alert_s g_acc_alert;
+#define ACC_ALERT_LEN sizeof(acc_alert_s)
+#endif // ENABLE_ACC
 
 #ifdef ENABLE_RS232
-const uint8_t dataStartRegister = 0x100;
-const int numDataRegisters = 30;
-const uint8_t infoStartRegister = 0x00A;
-const int numInfomRegisters = 17;
+#include "renogy_regs.h"
 
 //https://github.com/mickwheelz/NodeRenogy/blob/main/renogy.js
 struct renogy_data_s
@@ -189,7 +390,12 @@ struct renogy_data_s
 };
 
 extern renogy_data_s g_renogy_data;
-#define RENOGY_DATA_LEN sizeof(renogy_data_s)
 #endif // ENABLE_RS232
 
+/** LoRaWAN data rate, the payload size limits in sensor_registry.h depend on it */
+#define APP_DATA_RATE DR_3
+
+/** Periodic sensors */
+#include "sensor_registry.h"
+
 #endif
\ No newline at end of file
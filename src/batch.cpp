@@ -0,0 +1,138 @@
+/**
+ * @file batch.cpp
+ * @brief Backlog of samples the radio could not take, sent as compressed batch frames
+ *        A packet that cannot be sent (LoRaMAC busy) goes into the batch
+ *        frame of its packet type instead of being dropped. Pending frames
+ *        are sent on LORAWAN_BATCH_PORT when a TX cycle finishes and the
+ *        frame is due. A sample that does not go into its frame (layout
+ *        changed, frame full) closes the frame, it is sent at the end of the
+ *        next TX cycle and the sample starts a new one. Frame format in
+ *        batch_codec.h.
+ * @version 0.1
+ * @date 2022-11-05
+ */
+#include "app.h"
+#include "batch_codec.h"
+#include "zero_heap.h"
+
+/** Batch frame size, well below the payload limit of APP_DATA_RATE to keep the airtime short */
+#define BATCH_FRAME_LEN (lorawan_max_payload(APP_DATA_RATE) < 128 ? lorawan_max_payload(APP_DATA_RATE) : 128)
+/** A frame is due with this many samples */
+#define BATCH_FLUSH_SAMPLES 8
+/** or when its first sample is this old, s */
+#define BATCH_MAX_AGE 7200
+
+static_assert(BATCH_HEADER_LEN + packet_max_len() <= BATCH_FRAME_LEN, "Batch frame too small for one sample");
+
+/** One open frame per packet type and a spare for the closed frame */
+uint8_t batch_frame[PACKET_COUNT + 1][BATCH_FRAME_LEN];
+uint8_t batch_prev[PACKET_COUNT][packet_max_len()];
+batch_encoder_s batch_enc[PACKET_COUNT];
+/** Time of the first sample in each frame, s */
+uint32_t batch_first[PACKET_COUNT];
+/** Frame closed before it was due, sent first, count 0 when there is none */
+batch_encoder_s batch_closed;
+/** Frame buffer no encoder uses, NULL while a closed frame waits */
+uint8_t *batch_spare;
+
+RAM_BUDGET(BATCH, sizeof(batch_frame) + sizeof(batch_prev) + sizeof(batch_enc) + sizeof(batch_first) + sizeof(batch_closed) + sizeof(batch_spare),
+		   768);
+
+/**
+ * @brief Start empty frames
+ *
+ */
+void init_batch(void)
+{
+	for (uint8_t packet = 0; packet < PACKET_COUNT; packet++)
+	{
+		batch_begin(&batch_enc[packet], batch_frame[packet], BATCH_FRAME_LEN, batch_prev[packet]);
+	}
+	batch_closed.count = 0;
+	batch_spare = batch_frame[PACKET_COUNT];
+}
+
+/**
+ * @brief Keep a sample the radio did not take
+ *
+ * @param packet PACKET_xxx
+ * @param buf payload from sensors_encode()
+ * @param len payload length
+ * @return true sample is in the backlog
+ */
+bool batch_add(uint8_t packet, const uint8_t *buf, uint16_t len)
+{
+	if (packet >= PACKET_COUNT)
+	{
+		return false;
+	}
+	uint32_t now = time_uptime_s();
+	if (batch_enc[packet].count == 0)
+	{
+		batch_first[packet] = now;
+	}
+	if (!batch_append(&batch_enc[packet], now, buf, (uint8_t)len))
+	{
+		// Layout changed or frame full, close the frame and start a new one with this sample
+		if ((batch_enc[packet].count == 0) || (batch_spare == NULL))
+		{
+			MYLOG("BATCH", "Frame %d full, sample dropped", packet);
+			return false;
+		}
+		batch_closed = batch_enc[packet];
+		batch_begin(&batch_enc[packet], batch_spare, BATCH_FRAME_LEN, batch_prev[packet]);
+		batch_spare = NULL;
+		batch_first[packet] = now;
+		MYLOG("BATCH", "Frame %d closed with %d samples", packet, batch_closed.count);
+		if (!batch_append(&batch_enc[packet], now, buf, (uint8_t)len))
+		{
+			MYLOG("BATCH", "Frame %d sample too long, dropped", packet);
+			return false;
+		}
+	}
+	MYLOG("BATCH", "Frame %d: %d samples", packet, batch_enc[packet].count);
+	return true;
+}
+
+/**
+ * @brief Send the next due frame, call when a TX cycle finished
+ *
+ * @return true a frame was enqueued, wait for its TX cycle
+ */
+bool batch_send(void)
+{
+	uint32_t now = time_uptime_s();
+	if (batch_closed.count)
+	{
+		uint16_t len = batch_finish(&batch_closed, now, time_unix_at(batch_closed.last_time));
+		if (TRACE_LORA_TX(batch_closed.frame, (uint8_t)len, LORAWAN_BATCH_PORT) != LMH_SUCCESS)
+		{
+			return false;
+		}
+		MYLOG("BATCH", "Closed frame enqueued, %d samples in %d bytes", batch_closed.count, len);
+		batch_spare = batch_closed.frame;
+		batch_closed.count = 0;
+		return true;
+	}
+	for (uint8_t packet = 0; packet < PACKET_COUNT; packet++)
+	{
+		batch_encoder_s *e = &batch_enc[packet];
+		// Due when full enough, old enough, or the next sample would not fit
+		bool due = (e->count >= BATCH_FLUSH_SAMPLES) || (e->count && (now - batch_first[packet] >= BATCH_MAX_AGE)) ||
+				   (e->count && (e->bits.pos / 8 + e->frame[4] / 2 > BATCH_FRAME_LEN));
+		if (!due)
+		{
+			continue;
+		}
+		uint16_t len = batch_finish(e, now, time_unix_at(e->last_time));
+		if (TRACE_LORA_TX(e->frame, (uint8_t)len, LORAWAN_BATCH_PORT) != LMH_SUCCESS)
+		{
+			return false;
+		}
+		// LoRaMAC has its own copy, start a new frame
+		MYLOG("BATCH", "Frame %d enqueued, %d samples in %d bytes", packet, e->count, len);
+		batch_begin(e, e->frame, BATCH_FRAME_LEN, batch_prev[packet]);
+		return true;
+	}
+	return false;
+}
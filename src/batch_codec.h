@@ -0,0 +1,555 @@
+/**
+ * @file batch_codec.h
+ * @brief Compressed multi-sample uplink frames (fPort LORAWAN_BATCH_PORT)
+ *        Plain C++ without Arduino dependencies, the firmware encodes with
+ *        it (batch.cpp), tools/batch decodes with it on the host.
+ *
+ *        A frame holds consecutive samples of one uplink packet layout:
+ *
+ *        u8  BATCH_VERSION
+ *        u8  sample count
+ *        u16 age of the last sample when sent, s, big endian
+ *        u8  sample length
+ *        u32 Unix time of the last sample, s, big endian, 0 if the node's
+ *            clock was not set (version 2, time_sync.cpp)
+ *        ..  first sample, verbatim, a normal uplink payload
+ *        ..  bit stream, MSB first, for every further sample:
+ *            time   second sample: delta in s as varint
+ *                   then delta-of-delta: 0 | 10 + 7 bit | 110 + 10 bit | 1110 + 14 bit | 1111 + 32 bit
+ *            fields 0 if unchanged, else 1 + varint(zigzag(delta) - 1)
+ *
+ *        Varints in the bit stream are groups of 3 value bits, low group
+ *        first, each followed by a continuation bit. The fields of a sample
+ *        are the values behind the channel headers of the first sample
+ *        (batch_channel_fields()), deltas wrap at the field width.
+ *
+ *        Version 1 frames end the header after the sample length, the
+ *        decoder still reads them.
+ * @version 0.1
+ * @date 2022-11-05
+ */
+
+#ifndef BATCH_CODEC_H
+#define BATCH_CODEC_H
+
+#include <stdint.h>
+#include <string.h>
+
+/** fPort of the batch frames */
+#define LORAWAN_BATCH_PORT 3
+#define BATCH_VERSION 2
+/** Header bytes before the first sample */
+#define BATCH_HEADER_LEN 9
+/** Header of version 1 frames, without the time */
+#define BATCH_V1_HEADER_LEN 5
+
+/**
+ * @brief Value fields of a channel, one character per field
+ *        'b' u8, 'W' u16 big endian, 'w' u16 little endian, 'T' 24 bit big endian
+ *
+ * @param channel 2 byte channel header
+ * @return const char* field list, NULL if the channel is unknown
+ */
+static inline const char *batch_channel_fields(uint16_t channel)
+{
+	switch (channel)
+	{
+	case 0x0188: // GPS
+		return "TTT";
+	case 0x0802: // battery
+	case 0x0267: // temperature
+		return "W";
+	case 0x0768: // humidity
+		return "b";
+	case 0x0E71: // vibration features
+		return "WWbbb";
+	case 0x1102: // battery under TX, internal resistance
+		return "WW";
+	case 0x0C02: // renogy_data_s, little endian, battery/controller temperature bytes
+		return "wwwbbwwwwwwww";
+	default:
+		return NULL;
+	}
+}
+
+static inline uint8_t batch_field_len(char type)
+{
+	return type == 'T' ? 3 : (type == 'b' ? 1 : 2);
+}
+
+static inline uint32_t batch_field_get(const uint8_t *p, char type)
+{
+	switch (type)
+	{
+	case 'W':
+		return (p[0] << 8) | p[1];
+	case 'w':
+		return p[0] | (p[1] << 8);
+	case 'T':
+		return ((uint32_t)p[0] << 16) | (p[1] << 8) | p[2];
+	default:
+		return p[0];
+	}
+}
+
+static inline void batch_field_put(uint8_t *p, char type, uint32_t v)
+{
+	switch (type)
+	{
+	case 'W':
+		p[0] = (uint8_t)(v >> 8);
+		p[1] = (uint8_t)v;
+		break;
+	case 'w':
+		p[0] = (uint8_t)v;
+		p[1] = (uint8_t)(v >> 8);
+		break;
+	case 'T':
+		p[0] = (uint8_t)(v >> 16);
+		p[1] = (uint8_t)(v >> 8);
+		p[2] = (uint8_t)v;
+		break;
+	default:
+		p[0] = (uint8_t)v;
+		break;
+	}
+}
+
+/** Difference of two field values, wrapped to the field width */
+static inline int32_t batch_field_delta(uint32_t now, uint32_t prev, char type)
+{
+	uint8_t bits = 8 * batch_field_len(type);
+	uint32_t d = (now - prev) & ((1UL << bits) - 1);
+	return (d & (1UL << (bits - 1))) ? (int32_t)(d - (1UL << bits)) : (int32_t)d;
+}
+
+static inline uint32_t batch_zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t batch_unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/**
+ * @brief Walk the fields of a sample
+ *        Calls fn(offset, type) for every value field. Bytes after an
+ *        unknown channel are taken as u8 fields.
+ *
+ * @return false if a channel runs past the end of the sample
+ */
+template <typename F>
+static inline bool batch_walk(const uint8_t *sample, uint8_t len, F fn)
+{
+	uint8_t idx = 0;
+	while (idx < len)
+	{
+		const char *fields = len - idx > 2 ? batch_channel_fields((sample[idx] << 8) | sample[idx + 1]) : NULL;
+		if (!fields)
+		{
+			for (; idx < len; idx++)
+			{
+				fn(idx, 'b');
+			}
+			return true;
+		}
+		idx += 2;
+		for (; *fields; fields++)
+		{
+			if (idx + batch_field_len(*fields) > len)
+			{
+				return false;
+			}
+			fn(idx, *fields);
+			idx += batch_field_len(*fields);
+		}
+	}
+	return true;
+}
+
+/** Bit writer on a fixed buffer, sets overflow instead of writing past the end */
+struct batch_bits_s
+{
+	uint8_t *buf;
+	uint32_t cap_bits;
+	uint32_t pos;
+	bool overflow;
+};
+
+static inline void batch_put_bits(batch_bits_s *w, uint32_t v, uint8_t n)
+{
+	if (w->pos + n > w->cap_bits)
+	{
+		w->overflow = true;
+		return;
+	}
+	while (n--)
+	{
+		uint8_t mask = 0x80 >> (w->pos & 7);
+		if ((v >> n) & 1)
+		{
+			w->buf[w->pos >> 3] |= mask;
+		}
+		else
+		{
+			w->buf[w->pos >> 3] &= ~mask;
+		}
+		w->pos++;
+	}
+}
+
+static inline void batch_put_varint(batch_bits_s *w, uint32_t v)
+{
+	do
+	{
+		batch_put_bits(w, v & 7, 3);
+		v >>= 3;
+		batch_put_bits(w, v ? 1 : 0, 1);
+	} while (v);
+}
+
+/** Time delta-of-delta, Gorilla style buckets */
+static inline void batch_put_dod(batch_bits_s *w, int32_t dod)
+{
+	if (dod == 0)
+	{
+		batch_put_bits(w, 0, 1);
+	}
+	else if (dod >= -63 && dod <= 64)
+	{
+		batch_put_bits(w, 0x2, 2);
+		batch_put_bits(w, (uint32_t)(dod + 63), 7);
+	}
+	else if (dod >= -511 && dod <= 512)
+	{
+		batch_put_bits(w, 0x6, 3);
+		batch_put_bits(w, (uint32_t)(dod + 511), 10);
+	}
+	else if (dod >= -8191 && dod <= 8192)
+	{
+		batch_put_bits(w, 0xE, 4);
+		batch_put_bits(w, (uint32_t)(dod + 8191), 14);
+	}
+	else
+	{
+		batch_put_bits(w, 0xF, 4);
+		batch_put_bits(w, (uint32_t)dod, 32);
+	}
+}
+
+/**
+ * @brief Encoder state, all storage is provided by the caller
+ */
+struct batch_encoder_s
+{
+	uint8_t *frame;		// frame buffer
+	uint8_t *prev;		// last sample, at least as long as a sample
+	uint16_t cap;		// frame buffer size
+	batch_bits_s bits;	// bit stream after the first sample
+	uint8_t count;		// samples in the frame
+	uint32_t last_time; // s
+	int32_t last_delta; // s
+};
+
+/**
+ * @brief Start an empty frame
+ *
+ * @param e encoder
+ * @param frame frame buffer
+ * @param cap frame buffer size, at most the payload limit of the data rate
+ * @param prev buffer for the last sample
+ */
+static inline void batch_begin(batch_encoder_s *e, uint8_t *frame, uint16_t cap, uint8_t *prev)
+{
+	e->frame = frame;
+	e->prev = prev;
+	e->cap = cap;
+	e->count = 0;
+	e->bits.buf = frame;
+	e->bits.cap_bits = (uint32_t)cap * 8;
+	e->bits.pos = 0;
+	e->bits.overflow = false;
+}
+
+/**
+ * @brief Add a sample to the frame
+ *        Fails without changing the frame if the sample does not fit, has
+ *        another layout than the first sample, or the frame holds 255 samples.
+ *
+ * @param e encoder
+ * @param time_s sample time in s, any monotonic clock
+ * @param sample uplink payload
+ * @param len payload length
+ * @return true sample added
+ */
+static inline bool batch_append(batch_encoder_s *e, uint32_t time_s, const uint8_t *sample, uint8_t len)
+{
+	if (e->count == 0)
+	{
+		if (BATCH_HEADER_LEN + len > e->cap || !batch_walk(sample, len, [](uint8_t, char) {}))
+		{
+			return false;
+		}
+		e->frame[0] = BATCH_VERSION;
+		e->frame[1] = 1;
+		e->frame[2] = 0;
+		e->frame[3] = 0;
+		e->frame[4] = len;
+		memset(&e->frame[5], 0, 4);
+		memcpy(&e->frame[BATCH_HEADER_LEN], sample, len);
+		memcpy(e->prev, sample, len);
+		e->bits.pos = (BATCH_HEADER_LEN + len) * 8;
+		e->count = 1;
+		e->last_time = time_s;
+		e->last_delta = 0;
+		return true;
+	}
+	if (len != e->frame[4] || e->count == 255)
+	{
+		return false;
+	}
+	// Channel headers must match, only the values may change
+	bool same_layout = true;
+	uint8_t next = 0;
+	batch_walk(e->prev, len, [&](uint8_t offset, char type) {
+		for (; next < offset; next++)
+		{
+			same_layout = same_layout && (sample[next] == e->prev[next]);
+		}
+		next = offset + batch_field_len(type);
+	});
+	if (!same_layout)
+	{
+		return false;
+	}
+
+	uint32_t start = e->bits.pos;
+	int32_t delta = (int32_t)(time_s - e->last_time);
+	if (e->count == 1)
+	{
+		batch_put_varint(&e->bits, batch_zigzag(delta));
+	}
+	else
+	{
+		batch_put_dod(&e->bits, delta - e->last_delta);
+	}
+	batch_walk(e->prev, len, [&](uint8_t offset, char type) {
+		int32_t d = batch_field_delta(batch_field_get(&sample[offset], type), batch_field_get(&e->prev[offset], type), type);
+		if (d == 0)
+		{
+			batch_put_bits(&e->bits, 0, 1);
+		}
+		else
+		{
+			batch_put_bits(&e->bits, 1, 1);
+			batch_put_varint(&e->bits, batch_zigzag(d) - 1);
+		}
+	});
+	if (e->bits.overflow)
+	{
+		e->bits.pos = start;
+		e->bits.overflow = false;
+		return false;
+	}
+	memcpy(e->prev, sample, len);
+	e->count++;
+	e->frame[1] = e->count;
+	e->last_delta = delta;
+	e->last_time = time_s;
+	return true;
+}
+
+/**
+ * @brief Close the frame for sending
+ *
+ * @param e encoder
+ * @param now_s current time, same clock as the samples
+ * @param last_unix Unix time of the last sample, 0 if unknown
+ * @return uint16_t frame length, 0 if the frame is empty
+ */
+static inline uint16_t batch_finish(batch_encoder_s *e, uint32_t now_s, uint32_t last_unix)
+{
+	if (e->count == 0)
+	{
+		return 0;
+	}
+	uint32_t age = now_s - e->last_time;
+	age = age > 0xFFFF ? 0xFFFF : age;
+	e->frame[2] = (uint8_t)(age >> 8);
+	e->frame[3] = (uint8_t)age;
+	e->frame[5] = (uint8_t)(last_unix >> 24);
+	e->frame[6] = (uint8_t)(last_unix >> 16);
+	e->frame[7] = (uint8_t)(last_unix >> 8);
+	e->frame[8] = (uint8_t)last_unix;
+	return (uint16_t)((e->bits.pos + 7) / 8);
+}
+
+/** Decoding result */
+enum batch_status_e
+{
+	BATCH_OK = 0,
+	BATCH_BAD_VERSION,
+	BATCH_TRUNCATED,
+};
+
+/** Bit reader, returns zero bits past the end and sets truncated */
+struct batch_reader_s
+{
+	const uint8_t *buf;
+	uint32_t len_bits;
+	uint32_t pos;
+	bool truncated;
+};
+
+static inline uint32_t batch_get_bits(batch_reader_s *r, uint8_t n)
+{
+	uint32_t v = 0;
+	while (n--)
+	{
+		uint32_t bit = 0;
+		if (r->pos < r->len_bits)
+		{
+			bit = (r->buf[r->pos >> 3] >> (7 - (r->pos & 7))) & 1;
+		}
+		else
+		{
+			r->truncated = true;
+		}
+		v = (v << 1) | bit;
+		r->pos++;
+	}
+	return v;
+}
+
+static inline uint32_t batch_get_varint(batch_reader_s *r)
+{
+	uint32_t v = 0;
+	for (uint8_t shift = 0; shift < 33; shift += 3)
+	{
+		v |= batch_get_bits(r, 3) << shift;
+		if (!batch_get_bits(r, 1))
+		{
+			break;
+		}
+	}
+	return v;
+}
+
+static inline int32_t batch_get_dod(batch_reader_s *r)
+{
+	if (!batch_get_bits(r, 1))
+	{
+		return 0;
+	}
+	if (!batch_get_bits(r, 1))
+	{
+		return (int32_t)batch_get_bits(r, 7) - 63;
+	}
+	if (!batch_get_bits(r, 1))
+	{
+		return (int32_t)batch_get_bits(r, 10) - 511;
+	}
+	if (!batch_get_bits(r, 1))
+	{
+		return (int32_t)batch_get_bits(r, 14) - 8191;
+	}
+	return (int32_t)batch_get_bits(r, 32);
+}
+
+/** Decoder state, sample holds the current sample */
+struct batch_decoder_s
+{
+	batch_reader_s bits;
+	uint8_t count;		// samples in the frame
+	uint8_t index;		// samples returned so far
+	uint16_t age;		// s, last sample to transmission
+	uint32_t last_unix; // Unix time of the last sample, 0 if unknown
+	uint8_t header;		// header length of the frame's version
+	uint8_t len;		// sample length
+	int32_t time;		// s, relative to the first sample
+	int32_t last_delta; // s
+	uint8_t sample[255];
+};
+
+/**
+ * @brief Read the frame header
+ *
+ * @return uint8_t batch_status_e
+ */
+static inline uint8_t batch_decode_begin(batch_decoder_s *d, const uint8_t *frame, uint16_t len)
+{
+	d->count = 0;
+	d->index = 0;
+	if (len < 1)
+	{
+		return BATCH_TRUNCATED;
+	}
+	if (frame[0] != BATCH_VERSION && frame[0] != 1)
+	{
+		return BATCH_BAD_VERSION;
+	}
+	d->header = frame[0] == 1 ? BATCH_V1_HEADER_LEN : BATCH_HEADER_LEN;
+	if (len < d->header)
+	{
+		return BATCH_TRUNCATED;
+	}
+	d->len = frame[4];
+	if (d->header + d->len > len)
+	{
+		return BATCH_TRUNCATED;
+	}
+	d->count = frame[1];
+	d->age = (frame[2] << 8) | frame[3];
+	d->last_unix = 0;
+	if (frame[0] != 1)
+	{
+		d->last_unix = ((uint32_t)frame[5] << 24) | ((uint32_t)frame[6] << 16) | ((uint32_t)frame[7] << 8) | frame[8];
+	}
+	d->bits.buf = frame;
+	d->bits.len_bits = (uint32_t)len * 8;
+	d->bits.pos = (d->header + d->len) * 8;
+	d->bits.truncated = false;
+	return BATCH_OK;
+}
+
+/**
+ * @brief Next sample into d->sample, its time into d->time
+ *
+ * @return false no more samples, or the bit stream ended early (d->bits.truncated)
+ */
+static inline bool batch_decode_next(batch_decoder_s *d)
+{
+	if (d->index >= d->count)
+	{
+		return false;
+	}
+	if (d->index == 0)
+	{
+		memcpy(d->sample, d->bits.buf + d->header, d->len);
+		d->time = 0;
+		d->last_delta = 0;
+	}
+	else
+	{
+		int32_t delta = d->index == 1 ? batch_unzigzag(batch_get_varint(&d->bits)) : d->last_delta + batch_get_dod(&d->bits);
+		d->time += delta;
+		d->last_delta = delta;
+		batch_walk(d->sample, d->len, [&](uint8_t offset, char type) {
+			if (batch_get_bits(&d->bits, 1))
+			{
+				int32_t delta_v = batch_unzigzag(batch_get_varint(&d->bits) + 1);
+				batch_field_put(&d->sample[offset], type, batch_field_get(&d->sample[offset], type) + (uint32_t)delta_v);
+			}
+		});
+		if (d->bits.truncated)
+		{
+			return false;
+		}
+	}
+	d->index++;
+	return true;
+}
+
+#endif
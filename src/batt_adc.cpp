@@ -0,0 +1,237 @@
+/**
+ * @file batt_adc.cpp
+ * @brief Battery ADC backend for battery.cpp
+ *        nRF52: the SAADC with hardware oversampling. One SAMPLE task makes
+ *        the SAADC take and average a burst of conversions on its own
+ *        (CH[0].CONFIG.BURST), EasyDMA writes the averaged result to RAM.
+ *
+ *        - Resting voltage: one sample with 256x oversampling, ~11 ms.
+ *        - TX sag: TIMER4 triggers a 16x sample every BATT_ADC_SAG_PERIOD_US
+ *          through PPI, the SAADC END event stops the timer through a second
+ *          PPI channel. The CPU only arms the burst before the uplink and
+ *          reads the buffer after LORA_TX_FIN.
+ *
+ *        Input is VBAT through the divider on WB_A0 (P0.05, AIN3), 0.6 V
+ *        reference with gain 1/5 like read_batt() of the WisBlock-API. The
+ *        Arduino analogRead() reprograms the SAADC, every start here sets up
+ *        all registers again.
+ *
+ *        RP2040: no burst, a single read_batt() reading.
+ *
+ *        fleet_sim replaces this file with its battery model.
+ * @version 0.1
+ * @date 2022-12-03
+ */
+#include "app.h"
+
+#ifdef NRF52_SERIES
+#include <nrf_sdm.h>
+#include <nrf_soc.h>
+#endif
+#include "zero_heap.h"
+
+#ifdef NRF52_SERIES
+/** SAADC input, WB_A0 */
+#define BATT_ADC_INPUT SAADC_CH_PSELP_PSELP_AnalogInput3
+/** High impedance divider, needs the 40 us acquisition time */
+#define BATT_ADC_CH_CONFIG ((SAADC_CH_CONFIG_GAIN_Gain1_5 << SAADC_CH_CONFIG_GAIN_Pos) |         \
+							(SAADC_CH_CONFIG_REFSEL_Internal << SAADC_CH_CONFIG_REFSEL_Pos) |   \
+							(SAADC_CH_CONFIG_TACQ_40us << SAADC_CH_CONFIG_TACQ_Pos) |           \
+							(SAADC_CH_CONFIG_MODE_SE << SAADC_CH_CONFIG_MODE_Pos) |             \
+							(SAADC_CH_CONFIG_BURST_Enabled << SAADC_CH_CONFIG_BURST_Pos))
+/** Sample spacing during TX, 16 x 42 us conversions each */
+#define BATT_ADC_SAG_PERIOD_US 4000
+/** PPI channels, 17..19 belong to the SoftDevice */
+#define BATT_ADC_PPI_SAMPLE 14
+#define BATT_ADC_PPI_STOP 15
+
+/** PPI is restricted while the SoftDevice runs, go through its API then */
+static void batt_adc_ppi(uint8_t ch, volatile uint32_t *event, volatile uint32_t *task, bool enable)
+{
+	uint8_t sd_enabled = 0;
+	sd_softdevice_is_enabled(&sd_enabled);
+	if (sd_enabled)
+	{
+		if (enable)
+		{
+			sd_ppi_channel_assign(ch, event, task);
+			sd_ppi_channel_enable_set(1UL << ch);
+		}
+		else
+		{
+			sd_ppi_channel_enable_clr(1UL << ch);
+		}
+		return;
+	}
+	if (enable)
+	{
+		NRF_PPI->CH[ch].EEP = (uint32_t)event;
+		NRF_PPI->CH[ch].TEP = (uint32_t)task;
+		NRF_PPI->CHENSET = 1UL << ch;
+	}
+	else
+	{
+		NRF_PPI->CHENCLR = 1UL << ch;
+	}
+}
+
+/** Channel 0 on VBAT, DMA to buf, started */
+static void batt_adc_start(uint32_t oversample, int16_t *buf, uint16_t count)
+{
+	NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled;
+	for (int ch = 0; ch < 8; ch++)
+	{
+		NRF_SAADC->CH[ch].PSELP = SAADC_CH_PSELP_PSELP_NC;
+		NRF_SAADC->CH[ch].PSELN = SAADC_CH_PSELN_PSELN_NC;
+	}
+	NRF_SAADC->CH[0].CONFIG = BATT_ADC_CH_CONFIG;
+	NRF_SAADC->CH[0].PSELP = BATT_ADC_INPUT;
+	NRF_SAADC->RESOLUTION = SAADC_RESOLUTION_VAL_14bit;
+	NRF_SAADC->OVERSAMPLE = oversample;
+	NRF_SAADC->SAMPLERATE = SAADC_SAMPLERATE_MODE_Task << SAADC_SAMPLERATE_MODE_Pos;
+	NRF_SAADC->INTENCLR = 0xFFFFFFFF;
+	NRF_SAADC->RESULT.PTR = (uint32_t)buf;
+	NRF_SAADC->RESULT.MAXCNT = count;
+	NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Enabled;
+
+	NRF_SAADC->EVENTS_STARTED = 0;
+	NRF_SAADC->EVENTS_END = 0;
+	NRF_SAADC->TASKS_START = 1;
+	while (!NRF_SAADC->EVENTS_STARTED)
+	{
+	}
+	NRF_SAADC->EVENTS_STARTED = 0;
+}
+
+static void batt_adc_stop(void)
+{
+	NRF_SAADC->EVENTS_STOPPED = 0;
+	NRF_SAADC->TASKS_STOP = 1;
+	while (!NRF_SAADC->EVENTS_STOPPED)
+	{
+	}
+	NRF_SAADC->EVENTS_STOPPED = 0;
+	NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled;
+}
+
+/**
+ * @brief Offset calibration, once at startup
+ *
+ */
+bool batt_adc_init(void)
+{
+	NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Enabled;
+	NRF_SAADC->EVENTS_CALIBRATEDONE = 0;
+	NRF_SAADC->TASKS_CALIBRATEOFFSET = 1;
+	uint32_t start = millis();
+	while (!NRF_SAADC->EVENTS_CALIBRATEDONE && (millis() - start < 10))
+	{
+	}
+	bool done = NRF_SAADC->EVENTS_CALIBRATEDONE;
+	NRF_SAADC->EVENTS_CALIBRATEDONE = 0;
+	NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled;
+	return done;
+}
+
+/**
+ * @brief One 256x oversampled reading, blocks ~11 ms
+ *        Not while a burst is running.
+ *
+ * @return int16_t raw result, batt_adc_mv() converts it
+ */
+int16_t batt_adc_read(void)
+{
+	volatile int16_t result = 0;
+	batt_adc_start(SAADC_OVERSAMPLE_OVERSAMPLE_Over256x, (int16_t *)&result, 1);
+	NRF_SAADC->TASKS_SAMPLE = 1;
+	while (!NRF_SAADC->EVENTS_END)
+	{
+		delay(1);
+	}
+	batt_adc_stop();
+	return result;
+}
+
+/**
+ * @brief Start a timer triggered burst, no CPU until batt_adc_burst_end()
+ *
+ * @param buf raw results, stays in use until batt_adc_burst_end()
+ * @param count samples, count * BATT_ADC_SAG_PERIOD_US must cover the TX
+ * @return true burst running
+ */
+bool batt_adc_burst_start(int16_t *buf, uint16_t count)
+{
+	batt_adc_start(SAADC_OVERSAMPLE_OVERSAMPLE_Over16x, buf, count);
+
+	NRF_TIMER4->TASKS_STOP = 1;
+	NRF_TIMER4->TASKS_CLEAR = 1;
+	NRF_TIMER4->MODE = TIMER_MODE_MODE_Timer;
+	NRF_TIMER4->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+	NRF_TIMER4->PRESCALER = 4; // 1 MHz
+	NRF_TIMER4->CC[0] = BATT_ADC_SAG_PERIOD_US;
+	NRF_TIMER4->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+	NRF_TIMER4->EVENTS_COMPARE[0] = 0;
+
+	batt_adc_ppi(BATT_ADC_PPI_SAMPLE, &NRF_TIMER4->EVENTS_COMPARE[0], &NRF_SAADC->TASKS_SAMPLE, true);
+	batt_adc_ppi(BATT_ADC_PPI_STOP, &NRF_SAADC->EVENTS_END, &NRF_TIMER4->TASKS_STOP, true);
+
+	// First sample right away, the TX starts within a few ms
+	NRF_SAADC->TASKS_SAMPLE = 1;
+	NRF_TIMER4->TASKS_START = 1;
+	return true;
+}
+
+/**
+ * @brief Stop the burst if it is still running, release SAADC, timer and PPI
+ *        Only after batt_adc_burst_start() returned true.
+ *
+ * @return uint16_t samples in the buffer
+ */
+uint16_t batt_adc_burst_end(void)
+{
+	NRF_TIMER4->TASKS_STOP = 1;
+	batt_adc_ppi(BATT_ADC_PPI_SAMPLE, NULL, NULL, false);
+	batt_adc_ppi(BATT_ADC_PPI_STOP, NULL, NULL, false);
+	NRF_TIMER4->SHORTS = 0;
+	NRF_TIMER4->TASKS_SHUTDOWN = 1;
+	uint16_t count = (uint16_t)NRF_SAADC->RESULT.AMOUNT;
+	batt_adc_stop();
+	return count;
+}
+
+/** Raw result to battery mV */
+uint16_t batt_adc_mv(int16_t raw)
+{
+	return raw <= 0 ? 0 : (uint16_t)(((uint32_t)raw * BATT_ADC_MV_Q16 + 0x8000) >> 16);
+}
+#endif
+
+#ifdef ARDUINO_ARCH_RP2040
+bool batt_adc_init(void)
+{
+	return true;
+}
+
+/** Already in mV */
+int16_t batt_adc_read(void)
+{
+	return (int16_t)read_batt();
+}
+
+bool batt_adc_burst_start(int16_t *buf, uint16_t count)
+{
+	(void)buf;
+	(void)count;
+	return false;
+}
+
+uint16_t batt_adc_burst_end(void)
+{
+	return 0;
+}
+
+uint16_t batt_adc_mv(int16_t raw)
+{
+	return raw <= 0 ? 0 : (uint16_t)raw;
+}
+#endif
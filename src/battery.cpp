@@ -0,0 +1,185 @@
+/**
+ * @file battery.cpp
+ * @brief Node battery: resting voltage, voltage under TX load, internal resistance
+ *        The resting voltage is one hardware oversampled reading per cycle
+ *        (batt_adc.cpp). While the first uplink of a cycle is on air a timer
+ *        triggered ADC burst runs without the CPU, its lowest sample is the
+ *        battery voltage under TX load. The drop over the TX current is the
+ *        internal resistance, smoothed over the uplinks. A rising internal
+ *        resistance is the early warning of a failing battery, long before
+ *        the resting voltage shows it.
+ *
+ *        The sag of an uplink goes out with the next one.
+ * @version 0.1
+ * @date 2022-10-15
+ */
+#include "app.h"
+#include "zero_heap.h"
+
+/** Burst length, 64 x 4 ms covers a DR_3 uplink */
+#define BATT_SAG_SAMPLES 64
+
+/** Battery current while the SX1262 sends with TX_POWER_0, mA */
+#define BATT_TX_MA 110
+
+/** Internal resistance filter, a new value weighs 1 / (1 << BATT_RINT_SHIFT) */
+#define BATT_RINT_SHIFT 2
+
+/** Battery level uinion, resting voltage */
+batt_s batt_level;
+
+/** Resting voltage, mV */
+uint16_t batt_rest = 0;
+/** Resting voltage read in this cycle, see batt_rest_read() */
+bool batt_rest_fresh = false;
+/** Lowest voltage during the last measured uplink, mV */
+uint16_t batt_tx_min = 0;
+/** Internal resistance, mOhm in Q4 fixed point, 0 until the first uplink */
+uint32_t batt_rint_q4 = 0;
+
+/** DMA target of the burst */
+int16_t batt_sag_buf[BATT_SAG_SAMPLES];
+bool batt_sag_running = false;
+
+RAM_BUDGET(BATT, sizeof(batt_level) + sizeof(batt_rest) + sizeof(batt_rest_fresh) + sizeof(batt_tx_min) + sizeof(batt_rint_q4) + sizeof(batt_sag_buf) + sizeof(batt_sag_running), 160);
+
+/**
+ * @brief Calibrate the ADC
+ *
+ */
+static bool batt_init(void)
+{
+	return batt_adc_init();
+}
+
+static void batt_measure(void)
+{
+	int16_t raw = batt_adc_read();
+	(void)TRACE_ADC(&raw, 1);
+	batt_rest = batt_adc_mv(raw);
+	batt_rest_fresh = true;
+}
+
+/**
+ * @brief Read the resting battery voltage, 10 mV steps
+ *
+ */
+void batt_sample(void)
+{
+	// A TX_FIN went missing, the burst must not hold the SAADC
+	batt_tx_end();
+	batt_measure();
+	batt_level.batt16 = batt_rest / 10;
+}
+
+/**
+ * @brief Resting voltage of this cycle, read if the battery sensor did not
+ *        Call after sensors_sample() and before the first uplink, which
+ *        loads the battery and starts the TX burst. A burst left over from a
+ *        missing TX_FIN holds the SAADC, a single reading would reprogram
+ *        and stop it: the last resting voltage is kept then.
+ *
+ */
+void batt_rest_read(void)
+{
+	if (!batt_rest_fresh && !batt_sag_running)
+	{
+		batt_measure();
+	}
+	batt_rest_fresh = false;
+}
+
+/**
+ * @brief Resting voltage for the energy tiers, see batt_rest_read()
+ *
+ * @return uint16_t mV
+ */
+uint16_t batt_rest_mv(void)
+{
+	return batt_rest;
+}
+
+/**
+ * @brief An uplink was enqueued, measure while it is on air
+ *
+ */
+void batt_tx_start(void)
+{
+	if (!batt_sag_running)
+	{
+		batt_sag_running = batt_adc_burst_start(batt_sag_buf, BATT_SAG_SAMPLES);
+	}
+}
+
+/**
+ * @brief The uplink is done, lowest sample and internal resistance
+ *        Called on LORA_TX_FIN, does nothing without a burst.
+ *
+ */
+void batt_tx_end(void)
+{
+	if (!batt_sag_running)
+	{
+		return;
+	}
+	batt_sag_running = false;
+	uint16_t count = TRACE_ADC(batt_sag_buf, batt_adc_burst_end());
+	if (count == 0)
+	{
+		return;
+	}
+	int16_t low = batt_sag_buf[0];
+	for (uint16_t idx = 1; idx < count; idx++)
+	{
+		low = batt_sag_buf[idx] < low ? batt_sag_buf[idx] : low;
+	}
+	batt_tx_min = batt_adc_mv(low);
+	if (batt_tx_min >= batt_rest)
+	{
+		// The TX was not inside the burst
+		MYLOG("BATT", "No sag in %d samples", count);
+		return;
+	}
+	uint32_t rint_q4 = ((uint32_t)(batt_rest - batt_tx_min) * 1000 << 4) / BATT_TX_MA;
+	if (batt_rint_q4 == 0)
+	{
+		batt_rint_q4 = rint_q4;
+	}
+	else
+	{
+		batt_rint_q4 = (uint32_t)((int32_t)batt_rint_q4 + (((int32_t)rint_q4 - (int32_t)batt_rint_q4) >> BATT_RINT_SHIFT));
+	}
+	MYLOG("BATT", "Rest %d mV, TX %d mV, Rint %ld mOhm", batt_rest, batt_tx_min, (long)(batt_rint_q4 >> 4));
+}
+
+/**
+ * @brief Payload: 0x0802 resting battery voltage, 0.01 V
+ *                 0x1102 lowest voltage under TX, 0.01 V, internal resistance, mOhm
+ *
+ * @param buf payload slot
+ * @param len slot length, BATT_PAYLOAD_LEN
+ * @return uint8_t bytes written, 0 if the slot is too short
+ */
+uint8_t batt_encode(uint8_t *buf, uint8_t len)
+{
+	if (len < BATT_PAYLOAD_LEN)
+	{
+		return 0;
+	}
+	uint16_t tx_min = batt_tx_min / 10;
+	uint32_t rint = batt_rint_q4 >> 4;
+	rint = rint > 0xFFFF ? 0xFFFF : rint;
+	buf[0] = 0x08;
+	buf[1] = 0x02;
+	buf[2] = batt_level.batt8[1];
+	buf[3] = batt_level.batt8[0];
+	buf[4] = 0x11;
+	buf[5] = 0x02;
+	buf[6] = (uint8_t)(tx_min >> 8);
+	buf[7] = (uint8_t)tx_min;
+	buf[8] = (uint8_t)(rint >> 8);
+	buf[9] = (uint8_t)rint;
+	return BATT_PAYLOAD_LEN;
+}
+
+const sensor_driver_s batt_sensor = {"Battery", batt_init, batt_sample, batt_encode, SENSOR_ALWAYS, BATT_BUDGET_MS, NULL, 0};
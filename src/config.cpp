@@ -0,0 +1,430 @@
+/**
+ * @file config.cpp
+ * @brief Remote configuration over downlinks (fPort LORAWAN_CMD_PORT)
+ *        Downlink frame: u8 CMD_VERSION, u8 sequence, then commands back to
+ *        back, multi-byte values big endian:
+ *
+ *        0x01 u16   send interval in s (60 .. 65535)
+ *        0x02 u8 u8 sensor uid (SENSOR_REGISTRY), 0 off / 1 on
+ *        0x03       send a full report now
+ *        0x04 u8 u16 threshold: 1 wake mg, 2 impact mg, 3 alert holdoff s
+ *        0x05 u8    Renogy poll set, RENOGY_POLL_xxx
+ *        0x06       back to the defaults
+ *        0x07 u8 u8 Renogy load: 0 off, 1 on, 2 power cycle; off time in s
+ *                   of the power cycle (1 .. 255), see load.cpp
+ *        0x08 u8    Class C window in minutes (0 closes, max LOAD_WINDOW_MAX_MIN)
+ *        0x09 u8    charge controller, CHARGER_xxx
+ *
+ *        All commands of a frame are checked first and applied together,
+ *        or none of them. The new configuration is written to flash before
+ *        it is used. The next tracker uplink carries 0x0F01 sequence, status,
+ *        a load command sends it at once with the load state.
+ * @version 0.1
+ * @date 2022-11-12
+ */
+#include "app.h"
+#ifdef NRF52_SERIES
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+#endif
+#include "zero_heap.h"
+
+#define CMD_VERSION 1
+
+/** Commands */
+#define CMD_SET_INTERVAL 0x01
+#define CMD_SET_SENSOR 0x02
+#define CMD_REPORT_NOW 0x03
+#define CMD_SET_THRESHOLD 0x04
+#define CMD_SET_RENOGY_POLL 0x05
+#define CMD_RESET_CONFIG 0x06
+#define CMD_LOAD 0x07
+#define CMD_CLASS_C 0x08
+#define CMD_SET_CHARGER 0x09
+
+/** Thresholds of CMD_SET_THRESHOLD */
+#define THR_ACC_WAKE_MG 1
+#define THR_ACC_IMPACT_MG 2
+#define THR_ACC_HOLDOFF_S 3
+
+/** Status in the acknowledge */
+enum cmd_status_e
+{
+	CMD_OK = 0,
+	CMD_BAD_VERSION,
+	CMD_UNKNOWN,
+	CMD_BAD_VALUE,
+	CMD_TRUNCATED,
+	CMD_FLASH_ERROR,
+	CMD_REFUSED, // Class C window in ENERGY_CRITICAL, load switch without Modbus
+};
+
+/** Commands of a frame that act instead of changing the configuration */
+struct config_actions_s
+{
+	bool report;
+	uint8_t load;		// LOAD_xxx
+	uint8_t load_off_s; // LOAD_CYCLE
+	int16_t window;		// Class C minutes, -1: no change
+};
+
+/** Flash record */
+#define CONFIG_FILE "/app_cfg"
+#define CONFIG_TMP_FILE "/app_cfg.tmp"
+#define CONFIG_MAGIC 0x43464731 // "CFG1"
+
+struct config_record_s
+{
+	uint32_t magic;
+	app_config_s config;
+	uint16_t crc;
+};
+
+static const app_config_s config_defaults = {0, 0, ACC_WAKE_THRESHOLD_MG, ACC_IMPACT_THRESHOLD_MG, ACC_ALERT_HOLDOFF,
+											 RENOGY_POLL_DATA | RENOGY_POLL_ERRORS, CHARGER_AUTO};
+
+/** Configuration in use */
+app_config_s g_app_config = config_defaults;
+
+/** Acknowledge for the next tracker uplink */
+bool config_ack_pending = false;
+uint8_t config_ack_seq = 0;
+uint8_t config_ack_status = CMD_OK;
+
+/** Send interval of the WisBlock settings, used while send_interval is 0 */
+uint32_t config_wisblock_interval = 0;
+
+RAM_BUDGET(CONFIG, sizeof(g_app_config) + sizeof(config_ack_pending) + sizeof(config_ack_seq) + sizeof(config_ack_status) + sizeof(config_wisblock_interval), 32);
+
+static uint32_t config_interval(void)
+{
+	return g_app_config.send_interval ? g_app_config.send_interval : config_wisblock_interval;
+}
+
+/** CRC-16/CCITT-FALSE */
+static uint16_t config_crc(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	while (len--)
+	{
+		crc ^= (uint16_t)(*buf++) << 8;
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Write the configuration to flash
+ *        Written to a temporary file and renamed, a reset in between leaves
+ *        the previous configuration intact.
+ *
+ * @return true saved
+ */
+static bool config_save(const app_config_s *config)
+{
+#ifdef NRF52_SERIES
+	config_record_s rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = CONFIG_MAGIC;
+	rec.config = *config;
+	rec.crc = config_crc((const uint8_t *)&rec, offsetof(config_record_s, crc));
+
+	File file(InternalFS);
+	InternalFS.remove(CONFIG_TMP_FILE);
+	if (!file.open(CONFIG_TMP_FILE, FILE_O_WRITE))
+	{
+		return false;
+	}
+	bool ok = file.write((const uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+	file.close();
+	return ok && InternalFS.rename(CONFIG_TMP_FILE, CONFIG_FILE);
+#else
+	(void)config;
+	return true;
+#endif
+}
+
+/**
+ * @brief Load the configuration from flash, defaults if there is none
+ *        Call before init_energy(), the send interval overrides the WisBlock setting.
+ *
+ */
+void init_config(void)
+{
+	g_app_config = config_defaults;
+#ifdef NRF52_SERIES
+	InternalFS.begin();
+	File file(InternalFS);
+	if (file.open(CONFIG_FILE, FILE_O_READ))
+	{
+		config_record_s rec;
+		if ((file.read((uint8_t *)&rec, sizeof(rec)) == (int)sizeof(rec)) && (rec.magic == CONFIG_MAGIC) &&
+			(rec.crc == config_crc((const uint8_t *)&rec, offsetof(config_record_s, crc))))
+		{
+			g_app_config = rec.config;
+			MYLOG("CFG", "Configuration loaded");
+		}
+		else
+		{
+			MYLOG("CFG", "Configuration invalid, using defaults");
+		}
+		file.close();
+	}
+#endif
+	// The replay of tools/trace runs with the recorded configuration
+	TRACE_CONFIG(&g_app_config, sizeof(g_app_config));
+	config_wisblock_interval = g_lorawan_settings.send_repeat_time;
+	g_lorawan_settings.send_repeat_time = config_interval();
+}
+
+/**
+ * @brief Apply one command to a configuration copy
+ *
+ * @param config the copy
+ * @param buf command
+ * @param len bytes left in the frame
+ * @param used bytes of the command
+ * @param actions actions requested by the frame
+ * @return uint8_t cmd_status_e
+ */
+static uint8_t config_parse(app_config_s *config, const uint8_t *buf, uint8_t len, uint8_t *used, config_actions_s *actions)
+{
+	static const uint8_t arg_len[] = {0, 2, 2, 0, 3, 1, 0, 2, 1, 1};
+	uint8_t cmd = buf[0];
+	if (cmd == 0 || cmd >= sizeof(arg_len))
+	{
+		return CMD_UNKNOWN;
+	}
+	*used = 1 + arg_len[cmd];
+	if (*used > len)
+	{
+		return CMD_TRUNCATED;
+	}
+	const uint8_t *arg = &buf[1];
+	switch (cmd)
+	{
+	case CMD_SET_INTERVAL:
+	{
+		uint16_t seconds = (arg[0] << 8) | arg[1];
+		if (seconds < 60)
+		{
+			return CMD_BAD_VALUE;
+		}
+		config->send_interval = (uint32_t)seconds * 1000;
+		break;
+	}
+	case CMD_SET_SENSOR:
+		if (arg[0] >= SENSOR_UID_COUNT || arg[1] > 1)
+		{
+			return CMD_BAD_VALUE;
+		}
+		if (arg[1])
+		{
+			config->sensor_off &= ~(1 << arg[0]);
+		}
+		else
+		{
+			config->sensor_off |= 1 << arg[0];
+		}
+		break;
+	case CMD_REPORT_NOW:
+		actions->report = true;
+		break;
+	case CMD_SET_THRESHOLD:
+	{
+		uint16_t value = (arg[1] << 8) | arg[2];
+		switch (arg[0])
+		{
+		case THR_ACC_WAKE_MG:
+			// INT1_THS is 7 bit, 62 mg per LSB
+			if (value < 62 || value > 7800)
+			{
+				return CMD_BAD_VALUE;
+			}
+			config->acc_wake_mg = value;
+			break;
+		case THR_ACC_IMPACT_MG:
+			if (value < 100 || value > 7000)
+			{
+				return CMD_BAD_VALUE;
+			}
+			config->acc_impact_mg = value;
+			break;
+		case THR_ACC_HOLDOFF_S:
+			if (value < 10)
+			{
+				return CMD_BAD_VALUE;
+			}
+			config->acc_holdoff_s = value;
+			break;
+		default:
+			return CMD_BAD_VALUE;
+		}
+		break;
+	}
+	case CMD_SET_RENOGY_POLL:
+		if (arg[0] & ~(RENOGY_POLL_DATA | RENOGY_POLL_ERRORS))
+		{
+			return CMD_BAD_VALUE;
+		}
+		config->renogy_poll = arg[0];
+		break;
+	case CMD_RESET_CONFIG:
+		*config = config_defaults;
+		break;
+	case CMD_LOAD:
+#ifdef ENABLE_RS232
+		if (arg[0] > LOAD_CYCLE || (arg[0] == LOAD_CYCLE && arg[1] == 0))
+		{
+			return CMD_BAD_VALUE;
+		}
+		if (g_charger != CHARGER_RENOGY)
+		{
+			return CMD_REFUSED;
+		}
+		actions->load = arg[0];
+		actions->load_off_s = arg[1];
+		break;
+#else
+		return CMD_UNKNOWN;
+#endif
+	case CMD_CLASS_C:
+		if (arg[0] > LOAD_WINDOW_MAX_MIN)
+		{
+			return CMD_BAD_VALUE;
+		}
+		if (arg[0] && (g_energy_tier == ENERGY_CRITICAL))
+		{
+			return CMD_REFUSED;
+		}
+		actions->window = arg[0];
+		break;
+	case CMD_SET_CHARGER:
+#ifdef ENABLE_RS232
+		if (arg[0] > CHARGER_VEDIRECT)
+		{
+			return CMD_BAD_VALUE;
+		}
+		config->charger = arg[0];
+		break;
+#else
+		return CMD_UNKNOWN;
+#endif
+	}
+	return CMD_OK;
+}
+
+/**
+ * @brief Handle a downlink on LORAWAN_CMD_PORT
+ *
+ * @param buf downlink payload
+ * @param len payload length
+ */
+void config_command(const uint8_t *buf, uint8_t len)
+{
+	if (len < 2)
+	{
+		MYLOG("CFG", "Command frame too short");
+		return;
+	}
+	config_ack_seq = buf[1];
+	config_ack_pending = true;
+	if (buf[0] != CMD_VERSION)
+	{
+		config_ack_status = CMD_BAD_VERSION;
+		MYLOG("CFG", "Command version %d not supported", buf[0]);
+		return;
+	}
+
+	app_config_s next = g_app_config;
+	config_actions_s actions = {false, LOAD_NONE, 0, -1};
+	uint8_t idx = 2;
+	while (idx < len)
+	{
+		uint8_t used = 0;
+		uint8_t status = config_parse(&next, &buf[idx], len - idx, &used, &actions);
+		if (status != CMD_OK)
+		{
+			config_ack_status = status;
+			MYLOG("CFG", "Command 0x%02X at %d rejected: %d, nothing changed", buf[idx], idx, status);
+			return;
+		}
+		idx += used;
+	}
+
+	if (memcmp(&next, &g_app_config, sizeof(next)) != 0)
+	{
+		if (!config_save(&next))
+		{
+			config_ack_status = CMD_FLASH_ERROR;
+			MYLOG("CFG", "Configuration not saved, nothing changed");
+			return;
+		}
+		bool interval_changed = next.send_interval != g_app_config.send_interval;
+		bool charger_changed = next.charger != g_app_config.charger;
+		g_app_config = next;
+		if (interval_changed)
+		{
+			g_lorawan_settings.send_repeat_time = config_interval();
+			energy_set_interval(config_interval());
+		}
+#ifdef ENABLE_ACC
+		if (i2c_module_found(I2C_MODULE_LIS3DH))
+		{
+			acc_apply_config();
+		}
+#endif
+#ifdef ENABLE_RS232
+		if (charger_changed)
+		{
+			charger_select();
+		}
+#endif
+		MYLOG("CFG", "Configuration %d applied", config_ack_seq);
+	}
+	config_ack_status = CMD_OK;
+	if (actions.window >= 0)
+	{
+		load_window((uint8_t)actions.window);
+	}
+	if (actions.load != LOAD_NONE)
+	{
+		load_switch(actions.load, actions.load_off_s);
+	}
+	if (actions.report)
+	{
+		api_wake_loop(STATUS);
+	}
+}
+
+/**
+ * @brief Append the pending acknowledge to an uplink
+ *
+ * @param buf CMD_ACK_LEN bytes
+ * @return uint8_t bytes written, 0 if nothing is pending
+ */
+uint8_t config_ack_encode(uint8_t *buf)
+{
+	if (!config_ack_pending)
+	{
+		return 0;
+	}
+	buf[0] = 0x0F;
+	buf[1] = 0x01;
+	buf[2] = config_ack_seq;
+	buf[3] = config_ack_status;
+	return CMD_ACK_LEN;
+}
+
+/**
+ * @brief The uplink with the acknowledge is enqueued
+ *
+ */
+void config_ack_sent(void)
+{
+	config_ack_pending = false;
+}
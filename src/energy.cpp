@@ -0,0 +1,211 @@
+/**
+ * @file energy.cpp
+ * @brief Solar energy aware scheduling
+ *        Keeps a rolling window of harvested (panel) and consumed (load plus
+ *        this node) energy and the battery state of charge. From that it
+ *        picks an energy tier which sets the send interval and decides
+ *        whether GNSS, BLE advertising and the optional sensors may run.
+ * @version 0.1
+ * @date 2022-10-01
+ */
+#include "app.h"
+#include "zero_heap.h"
+
+/** Rolling window length in send cycles */
+#define ENERGY_WINDOW 8
+
+/** State of charge thresholds in %, tiers are left upwards only ENERGY_HYSTERESIS above them */
+#define ENERGY_SOC_FULL 95
+#define ENERGY_SOC_SAVE 50
+#define ENERGY_SOC_CRITICAL 25
+#define ENERGY_SOC_DEFICIT 70
+#define ENERGY_HYSTERESIS 5
+
+/** Shortest send interval the scheduler will use, ms */
+#define ENERGY_MIN_INTERVAL 60000
+
+/** Node consumption model, 3.3V rail */
+#define ENERGY_SLEEP_UW 100		// sleep with sensors powered
+#define ENERGY_UPLINK_MJ 60		// one uplink incl. RX windows
+#define ENERGY_GNSS_MJ 3000		// GNSS fix attempt
+#define ENERGY_BLE_MJ 50		// 15 s of advertising
+#define ENERGY_OPTIONAL_MJ 20	// vibration capture
+
+/** Current energy tier */
+energy_tier_e g_energy_tier = ENERGY_NORMAL;
+
+/** Send interval configured by the user, the tiers scale it */
+uint32_t energy_base_interval = 0;
+/** Send interval in use */
+uint32_t energy_interval = 0;
+
+/** Rolling window of harvested and consumed energy per cycle, mJ */
+int64_t energy_harvested[ENERGY_WINDOW] = {0};
+int64_t energy_consumed[ENERGY_WINDOW] = {0};
+uint8_t energy_idx = 0;
+
+RAM_BUDGET(ENERGY, sizeof(g_energy_tier) + sizeof(energy_base_interval) + sizeof(energy_interval) + sizeof(energy_harvested) + sizeof(energy_consumed) + sizeof(energy_idx), 192);
+
+/** Interval multiplier per tier in 1/4 steps: x4, x2, x1, /2 */
+static const uint8_t energy_interval_quarter[] = {16, 8, 4, 2};
+
+/** Send interval of a tier, never below ENERGY_MIN_INTERVAL */
+static uint32_t energy_tier_interval(energy_tier_e tier)
+{
+	uint32_t interval = energy_base_interval * energy_interval_quarter[tier] / 4;
+	return interval < ENERGY_MIN_INTERVAL ? ENERGY_MIN_INTERVAL : interval;
+}
+
+/**
+ * @brief Remember the configured send interval
+ *
+ */
+void init_energy(void)
+{
+	energy_base_interval = g_lorawan_settings.send_repeat_time;
+	energy_interval = energy_base_interval;
+}
+
+/**
+ * @brief State of charge in %
+ *        From the Renogy controller once it answered, otherwise estimated
+ *        from the node battery voltage (LiPo, 3.4 V empty, 4.1 V full). Its
+ *        register reads 0 until the first good poll, VE.Direct has none.
+ */
+static uint8_t energy_soc(void)
+{
+#ifdef ENABLE_RS232
+	if ((g_charger == CHARGER_RENOGY) && g_renogy_valid)
+	{
+		return g_renogy_data.batt_capacity.val16 > 100 ? 100 : g_renogy_data.batt_capacity.val16;
+	}
+#endif
+	uint32_t batt_mv = batt_rest_mv();
+	if (batt_mv <= 3400)
+	{
+		return 0;
+	}
+	if (batt_mv >= 4100)
+	{
+		return 100;
+	}
+	return (batt_mv - 3400) / 7;
+}
+
+/**
+ * @brief Account the last cycle and select the energy tier
+ *        Call once per send cycle, after all readings are done.
+ *
+ * @param uplinks number of uplinks sent in this cycle
+ */
+void energy_update(uint8_t uplinks)
+{
+	uint32_t interval = energy_interval;
+	uint8_t soc = energy_soc();
+	uint16_t panel_w = 0;
+	uint16_t load_w = 0;
+#ifdef ENABLE_RS232
+	// Both backends fill the panel and load power
+	panel_w = g_renogy_data.panel_power.val16;
+	load_w = g_renogy_data.load_power.val16;
+#endif
+
+	// W * ms = mJ
+	int64_t consumed = (int64_t)load_w * interval + (int64_t)ENERGY_SLEEP_UW * interval / 1000000 + uplinks * ENERGY_UPLINK_MJ;
+#ifdef ENABLE_GNSS
+	if (energy_gnss_allowed())
+	{
+		consumed += ENERGY_GNSS_MJ;
+	}
+#endif
+	if (energy_ble_allowed())
+	{
+		consumed += ENERGY_BLE_MJ;
+	}
+#ifdef ENABLE_VIBRATION
+	if (energy_optional_allowed())
+	{
+		consumed += ENERGY_OPTIONAL_MJ;
+	}
+#endif
+	energy_harvested[energy_idx] = (int64_t)panel_w * interval;
+	energy_consumed[energy_idx] = consumed;
+	energy_idx = (energy_idx + 1) % ENERGY_WINDOW;
+
+	int64_t net = 0;
+	for (int idx = 0; idx < ENERGY_WINDOW; idx++)
+	{
+		net += energy_harvested[idx] - energy_consumed[idx];
+	}
+
+	energy_tier_e tier;
+	if ((soc >= ENERGY_SOC_FULL) && (panel_w > 0) && (net >= 0))
+	{
+		tier = ENERGY_SURPLUS;
+	}
+	else if (soc < ENERGY_SOC_CRITICAL)
+	{
+		tier = ENERGY_CRITICAL;
+	}
+	else if ((soc < ENERGY_SOC_SAVE) || ((net < 0) && (soc < ENERGY_SOC_DEFICIT)))
+	{
+		tier = ENERGY_SAVE;
+	}
+	else
+	{
+		tier = ENERGY_NORMAL;
+	}
+
+	// Hysteresis on the way up
+	if ((g_energy_tier == ENERGY_CRITICAL) && (tier > ENERGY_CRITICAL) && (soc < ENERGY_SOC_CRITICAL + ENERGY_HYSTERESIS))
+	{
+		tier = ENERGY_CRITICAL;
+	}
+	if ((g_energy_tier == ENERGY_SAVE) && (tier > ENERGY_SAVE) && (soc < ENERGY_SOC_SAVE + ENERGY_HYSTERESIS))
+	{
+		tier = ENERGY_SAVE;
+	}
+
+	MYLOG("ENERGY", "SoC %d%%, panel %dW, load %dW, net %ld J over %d cycles, tier %d", soc, panel_w, load_w,
+		  (long)(net / 1000), ENERGY_WINDOW, tier);
+
+	if ((tier != g_energy_tier) && (energy_base_interval != 0))
+	{
+		uint32_t new_interval = energy_tier_interval(tier);
+		MYLOG("ENERGY", "Tier %d -> %d, send interval %ld ms", g_energy_tier, tier, (long)new_interval);
+		energy_interval = new_interval;
+		api_timer_restart(new_interval);
+	}
+	g_energy_tier = tier;
+}
+
+/**
+ * @brief A new send interval was configured, apply it with the current tier
+ *
+ * @param interval configured send interval in ms
+ */
+void energy_set_interval(uint32_t interval)
+{
+	energy_base_interval = interval;
+	energy_interval = energy_tier_interval(g_energy_tier);
+	MYLOG("ENERGY", "Send interval %ld ms, tier %d: %ld ms", (long)interval, g_energy_tier, (long)energy_interval);
+	api_timer_restart(energy_interval);
+}
+
+/** GNSS costs the most, only when there is energy to spare */
+bool energy_gnss_allowed(void)
+{
+	return g_energy_tier >= ENERGY_NORMAL;
+}
+
+/** BLE advertising only while the battery is not low */
+bool energy_ble_allowed(void)
+{
+	return g_energy_tier >= ENERGY_NORMAL;
+}
+
+/** Optional sensors only with a full battery and a producing panel */
+bool energy_optional_allowed(void)
+{
+	return g_energy_tier == ENERGY_SURPLUS;
+}
@@ -9,11 +9,36 @@
 
 #include "app.h"
 #include "SparkFun_SHTC3.h" 		//Click here to get the library: http://librarymanager/All#SparkFun_SHTC3
+#include "fixed_point.h"
+#include "zero_heap.h"
 
 #ifdef ENABLE_ENV_MON
 
 SHTC3 g_shtc3;						      // Declare an instance of the SHTC3 class
 
+/** Last reading, payload units: 0.1 degC and 0.5 %RH */
+int16_t env_temp = 0;
+uint8_t env_humid = 0;
+
+RAM_BUDGET(ENV, sizeof(g_shtc3) + sizeof(env_temp) + sizeof(env_humid), 64);
+
+/** SHTC3 address, the commands stand for the register in TRACE_I2C_READ */
+#define SHTC3_ADDR 0x70
+#define SHTC3_TRACE_ID 0xEF		 // read ID, 0xEFC8
+#define SHTC3_TRACE_MEASURE 0x78 // measure T first, 0x7866
+
+/** What the driver read, as it is traced: raw ticks, converted by fixed_point.h */
+struct shtc3_reading_s
+{
+	uint16_t t_ticks;
+	uint16_t rh_ticks;
+	uint16_t id;
+	bool pass_id;
+	bool pass_t;
+	bool pass_rh;
+};
+#define SHTC3_READING_LEN (offsetof(shtc3_reading_s, pass_rh) + 1)
+
 // The errorDecoder function prints "SHTC3_Status_TypeDef" resultsin a human-friendly way
 const char *errorDecoder(SHTC3_Status_TypeDef message)   
 {
@@ -36,18 +61,19 @@ const char *errorDecoder(SHTC3_Status_TypeDef message)
 
 void shtc3_read_data(void)
 {
-	float Temperature = 0;
-	float Humidity = 0;
-	
 	g_shtc3.update();
-	if (g_shtc3.lastStatus == SHTC3_Status_Nominal) // You can also assess the status of the last command by checking the ".lastStatus" member of the object
+	shtc3_reading_s reading = {g_shtc3.T, g_shtc3.RH, 0, false, g_shtc3.passTcrc, g_shtc3.passRHcrc};
+	uint8_t status = TRACE_I2C_READ(SHTC3_ADDR, SHTC3_TRACE_MEASURE, g_shtc3.lastStatus, (uint8_t *)&reading, SHTC3_READING_LEN);
+	if (status == SHTC3_Status_Nominal) // You can also assess the status of the last command by checking the ".lastStatus" member of the object
 	{
+		// Ticks straight to payload units, no float on the sample path
+		env_temp = fx_shtc3_temp::convert(reading.t_ticks);
+		env_humid = fx_shtc3_humid::convert(reading.rh_ticks);
+		char num[FX_STR_LEN];
+		(void)num; // only the logs use it
 
-		Temperature = g_shtc3.toDegC();			          // Packing LoRa data
-		Humidity = g_shtc3.toPercent();
-		
-		MYLOG("ENV","RH = %f %\n", g_shtc3.toPercent()); // "toPercent" returns the percent humidity as a floating point number		
-		if (g_shtc3.passRHcrc)  // Like "passIDcrc" this is true when the RH value is valid from the sensor (but not necessarily up-to-date in terms of time)
+		MYLOG("ENV","RH = %s %%\n", fx_str(num, env_humid * 5, 1));
+		if (reading.pass_rh)  // Like "passIDcrc" this is true when the RH value is valid from the sensor (but not necessarily up-to-date in terms of time)
 		{
 			MYLOG("ENV","Checksum: pass\n");
 		}
@@ -56,8 +82,8 @@ void shtc3_read_data(void)
 			MYLOG("ENV","Checksum: fail\n");
 		}
 		
-        MYLOG("ENV","T = %f C\n", g_shtc3.toDegC()); // "toDegF" and "toDegC" return the temperature as a flaoting point number in deg F and deg C respectively	
-		if (g_shtc3.passTcrc) // Like "passIDcrc" this is true when the T value is valid from the sensor (but not necessarily up-to-date in terms of time)
+        MYLOG("ENV","T = %s C\n", fx_str(num, env_temp, 1));
+		if (reading.pass_t) // Like "passIDcrc" this is true when the T value is valid from the sensor (but not necessarily up-to-date in terms of time)
 		{
 			MYLOG("ENV","Checksum: pass\n");
 		}
@@ -65,35 +91,66 @@ void shtc3_read_data(void)
 		{
 			MYLOG("ENV","Checksum: fail\n");
 		}
-
-        int16_t temp_int = (int16_t)(Temperature * 10.0);
-	    uint16_t humid_int = (uint16_t)(Humidity * 2);
-
-        g_tracker_data.humid_1 = (uint8_t)(humid_int);
-	    g_tracker_data.temp_1 = (uint8_t)(temp_int >> 8);
-	    g_tracker_data.temp_2 = (uint8_t)(temp_int);
 	}
 	else
 	{
-        MYLOG("ENV","Update failed, error: %s\n", errorDecoder(g_shtc3.lastStatus));
+        MYLOG("ENV","Update failed, error: %s\n", errorDecoder((SHTC3_Status_TypeDef)status));
 	}
 }
 
-int init_shtc3(void)
+bool init_shtc3(void)
 {
-	MYLOG("ENV", "Beginning shtc3 sensor. Result = %s", errorDecoder(g_shtc3.begin())); // Most SHTC3 functions return a variable of the type "SHTC3_Status_TypeDef" to indicate the status of their execution
+	g_shtc3.begin();
+	shtc3_reading_s reading = {0, 0, g_shtc3.ID, g_shtc3.passIDcrc, false, false};
+	uint8_t status = TRACE_I2C_READ(SHTC3_ADDR, SHTC3_TRACE_ID, g_shtc3.lastStatus, (uint8_t *)&reading, SHTC3_READING_LEN);
+	MYLOG("ENV", "Beginning shtc3 sensor. Result = %s", errorDecoder((SHTC3_Status_TypeDef)status)); // Most SHTC3 functions return a variable of the type "SHTC3_Status_TypeDef" to indicate the status of their execution
 
-	if (g_shtc3.passIDcrc)                      // Whenever data is received the associated checksum is calculated and verified so you can be sure the data is true
+	if (reading.pass_id)                      // Whenever data is received the associated checksum is calculated and verified so you can be sure the data is true
 	{					   						                    // The checksum pass indicators are: passIDcrc, passRHcrc, and passTcrc for the ID, RH, and T readings respectively
 		MYLOG("ENV", "ID Passed Checksum. ");
-		MYLOG("ENV", "Device ID: 0b%0b", g_shtc3.ID); // The 16-bit device ID can be accessed as a member variable of the object
+		MYLOG("ENV", "Device ID: 0b%0b", reading.id); // The 16-bit device ID can be accessed as a member variable of the object
 	}
 	else
 	{
 		Serial.println("ID Checksum Failed. ");
 	}
 
-    return !!g_shtc3.passIDcrc;
+    return (status == SHTC3_Status_Nominal) && reading.pass_id;
 }
 
+/**
+ * @brief Payload: 0x0768 humidity, 0x0267 temperature
+ *
+ * @param buf payload slot
+ * @param len slot length, ENV_PAYLOAD_LEN
+ * @return uint8_t bytes written, 0 if the slot is too short
+ */
+uint8_t shtc3_encode(uint8_t *buf, uint8_t len)
+{
+	if (len < ENV_PAYLOAD_LEN)
+	{
+		return 0;
+	}
+	buf[0] = 0x07;
+	buf[1] = 0x68;
+	buf[2] = env_humid;
+	buf[3] = 0x02;
+	buf[4] = 0x67;
+	buf[5] = (uint8_t)(env_temp >> 8);
+	buf[6] = (uint8_t)(env_temp);
+	return ENV_PAYLOAD_LEN;
+}
+
+/**
+ * @brief Supervisor recovery: free the bus, wake the sensor again
+ *
+ */
+static void shtc3_recover(void)
+{
+	supervisor_i2c_recover();
+	g_shtc3.begin();
+}
+
+const sensor_driver_s env_sensor = {"SHTC3", init_shtc3, shtc3_read_data, shtc3_encode, SENSOR_ALWAYS, ENV_BUDGET_MS, shtc3_recover, I2C_MODULE_SHTC3};
+
 #endif // ENABLE_ENV_MON
\ No newline at end of file
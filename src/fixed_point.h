@@ -0,0 +1,135 @@
+/**
+ * @file fixed_point.h
+ * @brief Integer conversions from sensor ticks to payload units
+ *        Plain C++ without Arduino dependencies, the firmware converts with
+ *        it, tools/fixed checks it against the float expressions it replaced
+ *        and times both.
+ *
+ *        Every scale is a type, factor, offset and divisor are template
+ *        arguments: the compiler folds them, the division by a constant
+ *        becomes a multiply, and the tick range is checked at compile time
+ *        against 32 bit overflow and the payload type. The Cortex-M4F has
+ *        single precision only, the double expressions (x * 10.0, lat() *
+ *        1e7) went through the soft-float library.
+ * @version 0.1
+ * @date 2022-12-31
+ */
+
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+#include <limits>
+
+/** Room for fx_str(): sign, 10 digits, point, terminator */
+#define FX_STR_LEN 13
+
+constexpr bool fx_fits(int64_t v, int64_t min, int64_t max)
+{
+	return v >= min && v <= max;
+}
+
+/**
+ * @brief Linear scale: out = (raw * MUL + ADD) / DIV
+ *        Truncated toward zero, like the cast of the float expression it
+ *        replaces.
+ *
+ * @tparam OUT payload type
+ * @tparam RAW_MIN smallest tick value
+ * @tparam RAW_MAX largest tick value
+ */
+template <typename OUT, int32_t RAW_MIN, int32_t RAW_MAX, int32_t MUL, int32_t ADD, int32_t DIV>
+struct fx_scale_s
+{
+	static_assert(DIV > 0, "divisor must be positive");
+	static_assert(RAW_MIN <= RAW_MAX, "empty tick range");
+	static_assert(fx_fits((int64_t)RAW_MIN * MUL + ADD, INT32_MIN, INT32_MAX) && fx_fits((int64_t)RAW_MAX * MUL + ADD, INT32_MIN, INT32_MAX),
+				  "raw * MUL + ADD overflows 32 bit");
+	static_assert(fx_fits(((int64_t)RAW_MIN * MUL + ADD) / DIV, std::numeric_limits<OUT>::min(), std::numeric_limits<OUT>::max()) &&
+					  fx_fits(((int64_t)RAW_MAX * MUL + ADD) / DIV, std::numeric_limits<OUT>::min(), std::numeric_limits<OUT>::max()),
+				  "result does not fit the payload type");
+
+	static inline OUT convert(int32_t raw)
+	{
+		return (OUT)((raw * MUL + ADD) / DIV);
+	}
+};
+
+/** SHTC3 temperature, 0.1 degC: -45 + 175 * ticks / 65535 degC, the SparkFun library's formula */
+typedef fx_scale_s<int16_t, 0, 65535, 1750, -450 * 65535, 65535> fx_shtc3_temp;
+/** SHTC3 humidity, 0.5 %RH: 100 * ticks / 65535 %RH */
+typedef fx_scale_s<uint8_t, 0, 65535, 200, 0, 65535> fx_shtc3_humid;
+
+/**
+ * @brief GNSS latitude or longitude, 0.0001 deg
+ *        From the parts TinyGPS++ keeps (RawDegrees), truncated toward zero
+ *        like (int64_t)(lat() * 10000000) / 1000.
+ */
+static inline int32_t fx_gnss_deg(uint16_t deg, uint32_t billionths, bool negative)
+{
+	int32_t v = (int32_t)deg * 10000 + (int32_t)(billionths / 100000);
+	return negative ? -v : v;
+}
+
+/**
+ * @brief The float expressions the conversions replaced, reference for tools/fixed and the benchmark
+ */
+static inline int16_t fx_float_shtc3_temp(uint16_t ticks)
+{
+	float t = -45 + 175 * ((float)ticks / 65535);
+	return (int16_t)(t * 10.0);
+}
+
+static inline uint8_t fx_float_shtc3_humid(uint16_t ticks)
+{
+	float h = 100 * ((float)ticks / 65535);
+	return (uint8_t)(uint16_t)(h * 2);
+}
+
+static inline int32_t fx_float_gnss_deg(uint16_t deg, uint32_t billionths, bool negative)
+{
+	double d = deg + billionths / 1000000000.0;
+	int64_t v = (int64_t)((negative ? -d : d) * 10000000);
+	return (int32_t)(v / 1000);
+}
+
+/**
+ * @brief Fixed point value as decimal text, for the logs instead of %f
+ *
+ * @param buf FX_STR_LEN bytes
+ * @param v value in 10^-decimals
+ * @param decimals 0 .. 9
+ * @return const char* buf
+ */
+static inline const char *fx_str(char *buf, int32_t v, uint8_t decimals)
+{
+	char tmp[FX_STR_LEN];
+	uint8_t n = 0;
+	uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+	do
+	{
+		tmp[n++] = (char)('0' + u % 10);
+		u /= 10;
+		if (n == decimals)
+		{
+			tmp[n++] = '.';
+		}
+	} while (u || n <= decimals);
+	if (tmp[n - 1] == '.')
+	{
+		tmp[n++] = '0';
+	}
+	uint8_t len = 0;
+	if (v < 0)
+	{
+		buf[len++] = '-';
+	}
+	while (n)
+	{
+		buf[len++] = tmp[--n];
+	}
+	buf[len] = 0;
+	return buf;
+}
+
+#endif
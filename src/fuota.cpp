@@ -0,0 +1,579 @@
+/**
+ * @file fuota.cpp
+ * @brief Delta firmware updates over LoRaWAN (fPort LORAWAN_FUOTA_PORT)
+ *        A full image takes too much airtime, the network server sends a
+ *        binary patch against the running image instead (fuota_codec.h,
+ *        made by tools/fuota/fuota_patch). The patch travels in a LoRaWAN
+ *        TS004 fragmentation session, unicast, best inside a Class C window
+ *        (downlink command 0x08).
+ *
+ *        - Fragments go straight to the scratch area in flash, only the
+ *          received bitmap is in RAM.
+ *        - Coded fragments are reduced by the fragments already in flash and
+ *          kept in RAM, up to FUOTA_MAX_LOST lost fragments can be
+ *          recovered by Gaussian elimination over GF(2).
+ *        - The complete patch is checked against the session descriptor
+ *          (CRC-32 of the patch) and applied into bank 1, the old image is
+ *          checked before and the new image after.
+ *        - The result goes out as FRAG_PATCH_RESULT. With FUOTA_ACTIVATE the
+ *          bootloader settings then mark bank 1 valid and the node
+ *          restarts, the bootloader has to copy bank 1 over bank 0.
+ *
+ *        FUOTA_ACTIVATE is off: the SDK11 legacy DFU the Adafruit bootloader
+ *        is built on resumes only SoftDevice and bootloader bank swaps at
+ *        boot, an APP bank is copied while a DFU transfer runs. Settings
+ *        that describe an image bank 0 does not hold fail its check and the
+ *        node stays in DFU mode. Without it the new image is kept and
+ *        reported, the node goes on running the old one.
+ *
+ *        Flash layout in app.h (FUOTA_BANK0 ...), bank 1 must be where the
+ *        bootloader expects it.
+ * @version 0.1
+ * @date 2022-12-10
+ */
+#include "app.h"
+
+#ifdef ENABLE_FUOTA
+#include <flash/flash_nrf5x.h>
+#include "fuota_codec.h"
+#include "zero_heap.h"
+
+/** Largest fragment and patch the decoder takes */
+#define FUOTA_FRAG_MAX 128
+#define FUOTA_MAX_FRAGS 2048
+/** Lost fragments the coded fragments can recover */
+#define FUOTA_MAX_LOST 32
+
+/** FragSessionSetupAns status bits */
+#define FRAG_SETUP_ENCODING 0x01
+#define FRAG_SETUP_MEMORY 0x02
+#define FRAG_SETUP_INDEX 0x04
+/** FragSessionStatusAns status bit */
+#define FRAG_STATUS_MEMORY 0x01
+/** FragSessionDeleteAns status bit */
+#define FRAG_DELETE_NO_SESSION 0x04
+
+/** Legacy banked DFU of the bootloader */
+#define BANK_VALID_APP 0x01
+
+/** Answer to a downlink, longest: FRAG_PATCH_RESULT */
+#define FUOTA_ANSWER_MAX 16
+
+/** Fragmentation session */
+struct fuota_session_s
+{
+	bool active;
+	bool coded;		// coded fragments arrived, the lost list is fixed
+	bool overflow;	// more than FUOTA_MAX_LOST lost
+	bool done;		// patch handled
+	uint16_t nb_frag;
+	uint8_t frag_size;
+	uint8_t padding;
+	uint32_t descriptor;
+	uint16_t received;
+	uint8_t lost;
+	uint8_t rows;
+};
+
+/** One reduced coded fragment, bit k of mask is lost fragment fuota_lost[k] */
+struct fuota_row_s
+{
+	uint32_t mask;
+	uint8_t data[FUOTA_FRAG_MAX];
+};
+
+fuota_session_s fuota_session;
+/** Received fragments, one bit each */
+uint8_t fuota_got[FUOTA_MAX_FRAGS / 8];
+/** Fragments still missing when the first coded fragment arrived */
+uint16_t fuota_lost[FUOTA_MAX_LOST];
+/** Row k has pivot k */
+fuota_row_s fuota_rows[FUOTA_MAX_LOST];
+uint32_t fuota_row_valid = 0;
+/** Matrix line of a coded fragment, the fragment being reduced, a fragment read back */
+uint8_t fuota_line[FUOTA_MAX_FRAGS / 8];
+fuota_row_s fuota_work;
+uint8_t fuota_known[FUOTA_FRAG_MAX];
+
+/** Answer waiting for the radio */
+uint8_t fuota_answer[FUOTA_ANSWER_MAX];
+uint8_t fuota_answer_len = 0;
+/** New image in bank 1 is good, restart after the result uplink */
+bool fuota_activate_pending = false;
+bool fuota_activate_armed = false;
+uint32_t fuota_new_size = 0;
+
+RAM_BUDGET(FUOTA, sizeof(fuota_session) + sizeof(fuota_got) + sizeof(fuota_lost) + sizeof(fuota_rows) + sizeof(fuota_row_valid) + sizeof(fuota_line) + sizeof(fuota_work) + sizeof(fuota_known) + sizeof(fuota_answer) + sizeof(fuota_answer_len) + sizeof(fuota_activate_pending) + sizeof(fuota_activate_armed) + sizeof(fuota_new_size), 5120);
+
+static bool fuota_flash_read(uint32_t addr, uint8_t *buf, uint16_t len)
+{
+	return flash_nrf5x_read(buf, addr, len) == len;
+}
+
+static bool fuota_flash_write(uint32_t addr, const uint8_t *buf, uint16_t len)
+{
+	return flash_nrf5x_write(addr, buf, len) == len;
+}
+
+static bool fuota_read_old(void *ctx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	(void)ctx;
+	return fuota_flash_read(FUOTA_BANK0 + offset, buf, len);
+}
+
+static bool fuota_read_patch(void *ctx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	(void)ctx;
+	return fuota_flash_read(FUOTA_SCRATCH + offset, buf, len);
+}
+
+static bool fuota_write_new(void *ctx, uint32_t offset, const uint8_t *buf, uint16_t len)
+{
+	(void)ctx;
+	return fuota_flash_write(FUOTA_BANK1 + offset, buf, len);
+}
+
+static void fuota_answer_add(const uint8_t *buf, uint8_t len)
+{
+	if (fuota_answer_len + len <= FUOTA_ANSWER_MAX)
+	{
+		memcpy(&fuota_answer[fuota_answer_len], buf, len);
+		fuota_answer_len += len;
+	}
+}
+
+static bool fuota_has(uint16_t idx)
+{
+	return (fuota_got[idx / 8] >> (idx & 7)) & 1;
+}
+
+static void fuota_mark(uint16_t idx)
+{
+	fuota_got[idx / 8] |= 1 << (idx & 7);
+	fuota_session.received++;
+}
+
+static void fuota_xor(uint8_t *dst, const uint8_t *src, uint8_t len)
+{
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		dst[idx] ^= src[idx];
+	}
+}
+
+/** FragSessionStatusAns: received and index, missing, status */
+static void fuota_status_answer(void)
+{
+	uint16_t missing = fuota_session.nb_frag - fuota_session.received;
+	uint8_t ans[5] = {FRAG_SESSION_STATUS, (uint8_t)fuota_session.received, (uint8_t)((fuota_session.received >> 8) & 0x3F),
+					  (uint8_t)(missing > 255 ? 255 : missing), (uint8_t)(fuota_session.overflow ? FRAG_STATUS_MEMORY : 0)};
+	fuota_answer_add(ans, sizeof(ans));
+}
+
+/**
+ * @brief Session setup: check, erase the scratch area
+ *
+ * @return uint8_t FragSessionSetupAns status bits
+ */
+static uint8_t fuota_setup(const uint8_t *p)
+{
+	uint8_t frag_index = (p[0] >> 4) & 0x03;
+	uint16_t nb_frag = p[1] | (p[2] << 8);
+	uint8_t frag_size = p[3];
+	uint8_t matrix = (p[4] >> 3) & 0x07;
+	uint8_t padding = p[5];
+	uint8_t status = 0;
+	if (frag_index != 0)
+	{
+		status |= FRAG_SETUP_INDEX;
+	}
+	if (matrix != 0)
+	{
+		status |= FRAG_SETUP_ENCODING;
+	}
+	if ((nb_frag == 0) || (nb_frag > FUOTA_MAX_FRAGS) || (frag_size == 0) || (frag_size > FUOTA_FRAG_MAX) ||
+		((uint32_t)nb_frag * frag_size > FUOTA_SCRATCH_SIZE) || (padding >= frag_size))
+	{
+		status |= FRAG_SETUP_MEMORY;
+	}
+	if (status)
+	{
+		return status;
+	}
+
+	memset(&fuota_session, 0, sizeof(fuota_session));
+	memset(fuota_got, 0, sizeof(fuota_got));
+	fuota_row_valid = 0;
+	fuota_session.nb_frag = nb_frag;
+	fuota_session.frag_size = frag_size;
+	fuota_session.padding = padding;
+	fuota_session.descriptor = fuota_get32(p + 6);
+
+	uint32_t bytes = (uint32_t)nb_frag * frag_size;
+	for (uint32_t addr = FUOTA_SCRATCH; addr < FUOTA_SCRATCH + bytes; addr += FUOTA_PAGE_SIZE)
+	{
+		flash_nrf5x_erase(addr);
+	}
+	fuota_session.active = true;
+	MYLOG("FUOTA", "Session: %d fragments of %d bytes", nb_frag, frag_size);
+	return 0;
+}
+
+/**
+ * @brief Patch complete in the scratch area: check and apply it
+ *
+ */
+static void fuota_complete(void)
+{
+	fuota_session.done = true;
+	flash_nrf5x_flush();
+	uint32_t patch_len = (uint32_t)fuota_session.nb_frag * fuota_session.frag_size - fuota_session.padding;
+
+	uint8_t result = FUOTA_OK;
+	uint32_t crc = 0;
+	uint8_t buf[FUOTA_CHUNK];
+	for (uint32_t pos = 0; pos < patch_len; pos += FUOTA_CHUNK)
+	{
+		uint16_t len = patch_len - pos < FUOTA_CHUNK ? (uint16_t)(patch_len - pos) : FUOTA_CHUNK;
+		fuota_flash_read(FUOTA_SCRATCH + pos, buf, len);
+		crc = fuota_crc32(crc, buf, len);
+	}
+	fuota_header_s h = {0, 0, 0, 0};
+	if (crc != fuota_session.descriptor)
+	{
+		result = FUOTA_BAD_DESCRIPTOR;
+	}
+	else
+	{
+		MYLOG("FUOTA", "Patch complete, %ld bytes, applying", (long)patch_len);
+		fuota_io_s io = {NULL, fuota_read_old, fuota_read_patch, fuota_write_new};
+		result = fuota_patch_apply(&io, patch_len, FUOTA_BANK_SIZE, &h);
+		flash_nrf5x_flush();
+	}
+	MYLOG("FUOTA", "Patch result %d, new image %ld bytes", result, (long)h.new_size);
+
+	uint8_t ans[6] = {FRAG_PATCH_RESULT, result};
+	fuota_put32(&ans[2], h.new_crc);
+	fuota_answer_add(ans, sizeof(ans));
+	if (result == FUOTA_OK)
+	{
+		fuota_new_size = h.new_size;
+		fuota_activate_pending = true;
+	}
+}
+
+/**
+ * @brief Solve the stored rows, write the recovered fragments
+ *        Row k has bit k and maybe higher ones, from the top down every row
+ *        is left with its own bit only.
+ */
+static void fuota_solve(void)
+{
+	uint8_t size = fuota_session.frag_size;
+	for (int8_t k = fuota_session.lost - 1; k >= 0; k--)
+	{
+		fuota_row_s *row = &fuota_rows[k];
+		for (uint8_t j = k + 1; j < fuota_session.lost; j++)
+		{
+			if (row->mask & (1UL << j))
+			{
+				fuota_xor(row->data, fuota_rows[j].data, size);
+			}
+		}
+		row->mask = 1UL << k;
+		fuota_flash_write(FUOTA_SCRATCH + (uint32_t)fuota_lost[k] * size, row->data, size);
+		fuota_mark(fuota_lost[k]);
+	}
+	MYLOG("FUOTA", "Recovered %d fragments", fuota_session.lost);
+}
+
+/**
+ * @brief Eliminate a reduced row against the stored ones, keep it if independent
+ *
+ * @param row mask and data, modified
+ */
+static void fuota_add_row(fuota_row_s *row)
+{
+	uint8_t size = fuota_session.frag_size;
+	while (row->mask)
+	{
+		uint8_t k = 0;
+		while (!(row->mask & (1UL << k)))
+		{
+			k++;
+		}
+		if (!(fuota_row_valid & (1UL << k)))
+		{
+			fuota_rows[k] = *row;
+			fuota_row_valid |= 1UL << k;
+			fuota_session.rows++;
+			return;
+		}
+		row->mask ^= fuota_rows[k].mask;
+		fuota_xor(row->data, fuota_rows[k].data, size);
+	}
+}
+
+/** Position of a fragment in the lost list, -1 if it is not lost */
+static int8_t fuota_lost_pos(uint16_t idx)
+{
+	for (uint8_t k = 0; k < fuota_session.lost; k++)
+	{
+		if (fuota_lost[k] == idx)
+		{
+			return k;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief The first coded fragment ends the uncoded ones, fix the lost list
+ *
+ */
+static void fuota_start_coded(void)
+{
+	fuota_session.coded = true;
+	for (uint16_t idx = 0; idx < fuota_session.nb_frag; idx++)
+	{
+		if (fuota_has(idx))
+		{
+			continue;
+		}
+		if (fuota_session.lost == FUOTA_MAX_LOST)
+		{
+			fuota_session.overflow = true;
+			MYLOG("FUOTA", "More than %d fragments lost", FUOTA_MAX_LOST);
+			return;
+		}
+		fuota_lost[fuota_session.lost++] = idx;
+	}
+	MYLOG("FUOTA", "%d fragments lost", fuota_session.lost);
+}
+
+/**
+ * @brief DataFragment
+ *
+ * @param n fragment number, 1 based
+ * @param data frag_size bytes
+ */
+static void fuota_fragment(uint16_t n, const uint8_t *data)
+{
+	uint16_t m = fuota_session.nb_frag;
+	uint8_t size = fuota_session.frag_size;
+	if (n == 0 || fuota_session.done)
+	{
+		return;
+	}
+	if (n <= m && !fuota_has(n - 1))
+	{
+		int8_t k = fuota_session.coded ? fuota_lost_pos(n - 1) : -1;
+		if (k < 0)
+		{
+			fuota_flash_write(FUOTA_SCRATCH + (uint32_t)(n - 1) * size, data, size);
+			fuota_mark(n - 1);
+		}
+		else
+		{
+			// Late uncoded fragment of the lost list, a row with one bit
+			fuota_work.mask = 1UL << k;
+			memcpy(fuota_work.data, data, size);
+			fuota_add_row(&fuota_work);
+		}
+	}
+	else if (n > m)
+	{
+		if (!fuota_session.coded)
+		{
+			fuota_start_coded();
+		}
+		if (fuota_session.overflow || fuota_session.received == m)
+		{
+			return;
+		}
+		fuota_work.mask = 0;
+		memcpy(fuota_work.data, data, size);
+		fuota_matrix_line(n, m, fuota_line);
+		for (uint16_t idx = 0; idx < m; idx++)
+		{
+			if (!((fuota_line[idx / 8] >> (idx & 7)) & 1))
+			{
+				continue;
+			}
+			if (fuota_has(idx))
+			{
+				fuota_flash_read(FUOTA_SCRATCH + (uint32_t)idx * size, fuota_known, size);
+				fuota_xor(fuota_work.data, fuota_known, size);
+			}
+			else
+			{
+				fuota_work.mask |= 1UL << fuota_lost_pos(idx);
+			}
+		}
+		fuota_add_row(&fuota_work);
+	}
+	if (fuota_session.coded && !fuota_session.overflow && fuota_session.lost && fuota_session.rows == fuota_session.lost &&
+		fuota_session.received < m)
+	{
+		fuota_solve();
+	}
+	if (fuota_session.received == m)
+	{
+		fuota_complete();
+	}
+}
+
+/**
+ * @brief Handle a downlink on LORAWAN_FUOTA_PORT, several commands back to back
+ *        Call fuota_send() afterwards.
+ *
+ */
+void fuota_command(const uint8_t *buf, uint8_t len)
+{
+	uint8_t idx = 0;
+	while (idx < len)
+	{
+		uint8_t cid = buf[idx++];
+		uint8_t left = len - idx;
+		const uint8_t *p = &buf[idx];
+		switch (cid)
+		{
+		case FRAG_PACKAGE_VERSION:
+		{
+			uint8_t ans[3] = {FRAG_PACKAGE_VERSION, FRAG_PACKAGE_ID, FRAG_PACKAGE_VER};
+			fuota_answer_add(ans, sizeof(ans));
+			break;
+		}
+		case FRAG_SESSION_STATUS:
+			if (left < 1)
+			{
+				return;
+			}
+			idx += 1;
+			if (fuota_session.active && (((p[0] >> 1) & 0x03) == 0))
+			{
+				fuota_status_answer();
+			}
+			break;
+		case FRAG_SESSION_SETUP:
+		{
+			if (left < 10)
+			{
+				return;
+			}
+			idx += 10;
+			uint8_t ans[2] = {FRAG_SESSION_SETUP, (uint8_t)(fuota_setup(p) | (((p[0] >> 4) & 0x03) << 6))};
+			fuota_answer_add(ans, sizeof(ans));
+			break;
+		}
+		case FRAG_SESSION_DELETE:
+		{
+			if (left < 1)
+			{
+				return;
+			}
+			idx += 1;
+			uint8_t ans[2] = {FRAG_SESSION_DELETE, (uint8_t)(fuota_session.active ? 0 : FRAG_DELETE_NO_SESSION)};
+			fuota_session.active = false;
+			fuota_answer_add(ans, sizeof(ans));
+			break;
+		}
+		case FRAG_DATA_FRAGMENT:
+			// Takes the rest of the frame
+			if (fuota_session.active && (left >= 2 + fuota_session.frag_size) && ((p[1] >> 6) == 0))
+			{
+				fuota_fragment(p[0] | ((p[1] & 0x3F) << 8), &p[2]);
+			}
+			return;
+		default:
+			MYLOG("FUOTA", "Unknown command 0x%02X", cid);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Send the pending answer, keep it if the radio is busy
+ *        Called again on LORA_TX_FIN until it is out.
+ *
+ * @return true answer enqueued, a TX cycle is running
+ */
+bool fuota_send(void)
+{
+	if (fuota_answer_len == 0)
+	{
+		return false;
+	}
+	switch (TRACE_LORA_TX(fuota_answer, fuota_answer_len, LORAWAN_FUOTA_PORT))
+	{
+	case LMH_SUCCESS:
+		fuota_answer_len = 0;
+		fuota_activate_armed = fuota_activate_pending;
+		return true;
+	case LMH_BUSY:
+		return false;
+	default:
+		fuota_answer_len = 0;
+		return false;
+	}
+}
+
+#ifdef FUOTA_ACTIVATE
+/** CRC-16/CCITT-FALSE, the bootloader's check of bank 0 */
+static uint16_t fuota_crc16(uint32_t addr, uint32_t size)
+{
+	uint16_t crc = 0xFFFF;
+	uint8_t buf[FUOTA_CHUNK];
+	for (uint32_t pos = 0; pos < size; pos += FUOTA_CHUNK)
+	{
+		uint16_t len = size - pos < FUOTA_CHUNK ? (uint16_t)(size - pos) : FUOTA_CHUNK;
+		fuota_flash_read(addr + pos, buf, len);
+		for (uint16_t idx = 0; idx < len; idx++)
+		{
+			crc ^= (uint16_t)buf[idx] << 8;
+			for (uint8_t bit = 0; bit < 8; bit++)
+			{
+				crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+			}
+		}
+	}
+	return crc;
+}
+#endif
+
+/**
+ * @brief After LORA_TX_FIN: the patch result is out, hand bank 1 to the bootloader
+ *        Only with FUOTA_ACTIVATE, see the top of this file.
+ *
+ */
+void fuota_tx_fin(void)
+{
+	if (!fuota_activate_armed)
+	{
+		return;
+	}
+	fuota_activate_armed = false;
+	fuota_activate_pending = false;
+
+#ifdef FUOTA_ACTIVATE
+	// bootloader_settings_t of the legacy banked DFU, every field the APP check reads
+	// describes the image after the copy, the SoftDevice and bootloader fields keep their values
+	uint32_t settings[8];
+	fuota_flash_read(FUOTA_BOOT_SETTINGS, (uint8_t *)settings, sizeof(settings));
+	uint16_t crc = fuota_crc16(FUOTA_BANK1, fuota_new_size);
+	settings[0] = BANK_VALID_APP; // bank_0
+	settings[1] = crc;			  // bank_0_crc
+	settings[2] = BANK_VALID_APP; // bank_1, copy it over bank 0
+	settings[3] = fuota_new_size; // bank_0_size, length of the CRC check
+	settings[6] = fuota_new_size; // app_image_size
+	fuota_flash_write(FUOTA_BOOT_SETTINGS, (const uint8_t *)settings, sizeof(settings));
+	flash_nrf5x_flush();
+	MYLOG("FUOTA", "Bank 1 valid, restart");
+	delay(100);
+	api_reset();
+#else
+	MYLOG("FUOTA", "New image in bank 1, %ld bytes, not activated", (long)fuota_new_size);
+#endif
+}
+
+#endif // ENABLE_FUOTA
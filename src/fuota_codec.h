@@ -0,0 +1,418 @@
+/**
+ * @file fuota_codec.h
+ * @brief Delta patch format and fragmentation coding for firmware updates (fPort LORAWAN_FUOTA_PORT)
+ *        Plain C++ without Arduino dependencies, shared by the firmware
+ *        (fuota.cpp) and the host tools (tools/fuota).
+ *
+ *        Patch, little endian:
+ *
+ *        0  'F' 'D' magic, u8 version, u8 0
+ *        4  u32 old image size, u32 old image CRC-32
+ *        12 u32 new image size, u32 new image CRC-32
+ *        20 operations until FUOTA_OP_END:
+ *
+ *        FUOTA_OP_DIFF  zigzag varint seek in the old image, varint length,
+ *                       then runs up to the length: varint unchanged bytes,
+ *                       varint changed bytes, the changed bytes as
+ *                       (new - old) mod 256. Moved code with shifted
+ *                       addresses is a long run of small differences.
+ *        FUOTA_OP_ADD   varint length, new bytes
+ *
+ *        The old position continues after each DIFF. Varints are LEB128.
+ *
+ *        Fragmentation follows LoRaWAN TS004 (Fragmented Data Block
+ *        Transport): fragments 1..M carry the patch, fragments above M are
+ *        the XOR of a pseudo random half of the M fragments
+ *        (fuota_matrix_line()). Any M independent fragments rebuild the
+ *        patch.
+ * @version 0.1
+ * @date 2022-12-10
+ */
+
+#ifndef FUOTA_CODEC_H
+#define FUOTA_CODEC_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LORAWAN_FUOTA_PORT 201
+
+/** TS004 commands */
+#define FRAG_PACKAGE_VERSION 0x00
+#define FRAG_SESSION_STATUS 0x01
+#define FRAG_SESSION_SETUP 0x02
+#define FRAG_SESSION_DELETE 0x03
+#define FRAG_DATA_FRAGMENT 0x08
+/** Patch result, not in TS004: u8 fuota_result_e, u32 CRC-32 of the new image */
+#define FRAG_PATCH_RESULT 0x80
+
+/** TS004 package identifier and version */
+#define FRAG_PACKAGE_ID 3
+#define FRAG_PACKAGE_VER 1
+
+#define FUOTA_PATCH_VERSION 1
+#define FUOTA_HEADER_LEN 20
+
+#define FUOTA_OP_END 0x00
+#define FUOTA_OP_DIFF 0x01
+#define FUOTA_OP_ADD 0x02
+
+/** Result of applying a patch */
+enum fuota_result_e
+{
+	FUOTA_OK = 0,
+	FUOTA_BAD_HEADER,	  // magic, version or sizes
+	FUOTA_WRONG_IMAGE,	  // the running image is not the one the patch was made for
+	FUOTA_BAD_PATCH,	  // operations run past the patch or an image
+	FUOTA_BAD_RESULT,	  // new image CRC differs
+	FUOTA_FLASH_ERROR,	  // read or write failed
+	FUOTA_BAD_DESCRIPTOR, // reassembled patch does not match the session descriptor
+	FUOTA_LOST_TOO_MANY,  // more fragments lost than the decoder can recover
+};
+
+struct fuota_header_s
+{
+	uint32_t old_size;
+	uint32_t old_crc;
+	uint32_t new_size;
+	uint32_t new_crc;
+};
+
+static inline uint32_t fuota_get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void fuota_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+/** CRC-32 (IEEE), start with 0, bitwise to keep the table out of flash */
+static inline uint32_t fuota_crc32(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+	crc = ~crc;
+	while (len--)
+	{
+		crc ^= *buf++;
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+/** TS004 pseudo random generator */
+static inline uint32_t fuota_prbs23(uint32_t x)
+{
+	uint32_t b0 = x & 1;
+	uint32_t b1 = (x & 32) >> 5;
+	return (x >> 1) + ((b0 ^ b1) << 22);
+}
+
+/**
+ * @brief Fragments XORed into coded fragment n, TS004 matrix line
+ *
+ * @param n fragment number, above m
+ * @param m fragments of the patch
+ * @param line one bit per fragment, bit (i & 7) of byte i / 8 for fragment i + 1
+ */
+static inline void fuota_matrix_line(uint16_t n, uint16_t m, uint8_t *line)
+{
+	memset(line, 0, (m + 7) / 8);
+	if (n <= m)
+	{
+		line[(n - 1) / 8] |= 1 << ((n - 1) & 7);
+		return;
+	}
+	// Like the reference decoder: modulo m, m + 1 if m is a power of two
+	uint32_t mod = (m & (m - 1)) ? m : m + 1;
+	uint32_t x = 1 + 1001 * (uint32_t)(n - m);
+	for (uint16_t coeff = 0; coeff < m / 2; coeff++)
+	{
+		uint32_t r = m;
+		while (r >= m)
+		{
+			x = fuota_prbs23(x);
+			r = x % mod;
+		}
+		line[r / 8] |= 1 << (r & 7);
+	}
+}
+
+/** Flash or memory access of fuota_patch_apply(), false on error */
+struct fuota_io_s
+{
+	void *ctx;
+	bool (*read_old)(void *ctx, uint32_t offset, uint8_t *buf, uint16_t len);
+	bool (*read_patch)(void *ctx, uint32_t offset, uint8_t *buf, uint16_t len);
+	bool (*write_new)(void *ctx, uint32_t offset, const uint8_t *buf, uint16_t len);
+};
+
+#define FUOTA_CHUNK 64
+
+/** Sequential buffered reader over one of the fuota_io_s read functions */
+struct fuota_reader_s
+{
+	const fuota_io_s *io;
+	bool (*read)(void *ctx, uint32_t offset, uint8_t *buf, uint16_t len);
+	uint32_t pos;  // offset of buf[0]
+	uint32_t size; // readable bytes
+	uint8_t fill;
+	uint8_t idx;
+	bool error;
+	uint8_t buf[FUOTA_CHUNK];
+};
+
+static inline void fuota_reader_seek(fuota_reader_s *r, uint32_t pos)
+{
+	r->pos = pos;
+	r->fill = 0;
+	r->idx = 0;
+}
+
+/** Next byte, sets error at the end */
+static inline uint8_t fuota_reader_get(fuota_reader_s *r)
+{
+	if (r->idx == r->fill)
+	{
+		r->pos += r->fill;
+		uint32_t left = r->pos < r->size ? r->size - r->pos : 0;
+		r->fill = left < FUOTA_CHUNK ? (uint8_t)left : FUOTA_CHUNK;
+		r->idx = 0;
+		if (r->fill == 0 || !r->read(r->io->ctx, r->pos, r->buf, r->fill))
+		{
+			r->fill = 0;
+			r->error = true;
+			return 0;
+		}
+	}
+	return r->buf[r->idx++];
+}
+
+static inline uint32_t fuota_reader_offset(const fuota_reader_s *r)
+{
+	return r->pos + r->idx;
+}
+
+static inline uint32_t fuota_varint(fuota_reader_s *r)
+{
+	uint32_t v = 0;
+	for (uint8_t shift = 0; shift < 35 && !r->error; shift += 7)
+	{
+		uint8_t b = fuota_reader_get(r);
+		v |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+		{
+			return v;
+		}
+	}
+	r->error = true;
+	return 0;
+}
+
+/** Buffered writer of the new image, keeps its CRC */
+struct fuota_writer_s
+{
+	const fuota_io_s *io;
+	uint32_t pos;
+	uint32_t crc;
+	uint8_t fill;
+	bool error;
+	uint8_t buf[FUOTA_CHUNK];
+};
+
+static inline void fuota_writer_flush(fuota_writer_s *w)
+{
+	if (w->fill && !w->error)
+	{
+		w->error = !w->io->write_new(w->io->ctx, w->pos, w->buf, w->fill);
+		w->crc = fuota_crc32(w->crc, w->buf, w->fill);
+		w->pos += w->fill;
+	}
+	w->fill = 0;
+}
+
+static inline void fuota_writer_put(fuota_writer_s *w, uint8_t b)
+{
+	w->buf[w->fill++] = b;
+	if (w->fill == FUOTA_CHUNK)
+	{
+		fuota_writer_flush(w);
+	}
+}
+
+/**
+ * @brief Read and check the patch header
+ *
+ * @return uint8_t FUOTA_OK or FUOTA_BAD_HEADER
+ */
+static inline uint8_t fuota_patch_header(const uint8_t *p, uint32_t patch_len, fuota_header_s *h)
+{
+	if (patch_len < FUOTA_HEADER_LEN + 1 || p[0] != 'F' || p[1] != 'D' || p[2] != FUOTA_PATCH_VERSION)
+	{
+		return FUOTA_BAD_HEADER;
+	}
+	h->old_size = fuota_get32(p + 4);
+	h->old_crc = fuota_get32(p + 8);
+	h->new_size = fuota_get32(p + 12);
+	h->new_crc = fuota_get32(p + 16);
+	return FUOTA_OK;
+}
+
+/**
+ * @brief CRC-32 of the first size bytes of the old image
+ *
+ * @return false read error
+ */
+static inline bool fuota_old_crc(const fuota_io_s *io, uint32_t size, uint32_t *crc)
+{
+	uint8_t buf[FUOTA_CHUNK];
+	*crc = 0;
+	for (uint32_t pos = 0; pos < size; pos += FUOTA_CHUNK)
+	{
+		uint16_t len = size - pos < FUOTA_CHUNK ? (uint16_t)(size - pos) : FUOTA_CHUNK;
+		if (!io->read_old(io->ctx, pos, buf, len))
+		{
+			return false;
+		}
+		*crc = fuota_crc32(*crc, buf, len);
+	}
+	return true;
+}
+
+/**
+ * @brief Build the new image from the old image and a patch
+ *        Checks the old image before and the new image after, the new
+ *        image is written front to back in FUOTA_CHUNK pieces.
+ *
+ * @param io access to the images and the patch
+ * @param patch_len patch bytes
+ * @param max_new room for the new image
+ * @param h the patch header
+ * @return uint8_t fuota_result_e
+ */
+static inline uint8_t fuota_patch_apply(const fuota_io_s *io, uint32_t patch_len, uint32_t max_new, fuota_header_s *h)
+{
+	fuota_reader_s patch;
+	patch.io = io;
+	patch.read = io->read_patch;
+	patch.size = patch_len;
+	patch.error = false;
+	fuota_reader_seek(&patch, 0);
+	uint8_t raw[FUOTA_HEADER_LEN];
+	for (uint8_t idx = 0; idx < FUOTA_HEADER_LEN; idx++)
+	{
+		raw[idx] = fuota_reader_get(&patch);
+	}
+	if (patch.error || fuota_patch_header(raw, patch_len, h) != FUOTA_OK || h->new_size > max_new)
+	{
+		return FUOTA_BAD_HEADER;
+	}
+	uint32_t crc;
+	if (!fuota_old_crc(io, h->old_size, &crc))
+	{
+		return FUOTA_FLASH_ERROR;
+	}
+	if (crc != h->old_crc)
+	{
+		return FUOTA_WRONG_IMAGE;
+	}
+
+	fuota_reader_s old;
+	old.io = io;
+	old.read = io->read_old;
+	old.size = h->old_size;
+	old.error = false;
+	fuota_reader_seek(&old, 0);
+
+	fuota_writer_s out;
+	out.io = io;
+	out.pos = 0;
+	out.crc = 0;
+	out.fill = 0;
+	out.error = false;
+
+	uint32_t written = 0;
+	for (;;)
+	{
+		uint8_t op = fuota_reader_get(&patch);
+		if (patch.error || op == FUOTA_OP_END)
+		{
+			break;
+		}
+		if (op == FUOTA_OP_DIFF)
+		{
+			uint32_t zz = fuota_varint(&patch);
+			int32_t seek = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+			uint32_t len = fuota_varint(&patch);
+			int64_t from = (int64_t)fuota_reader_offset(&old) + seek;
+			if (from < 0 || from + len > h->old_size || written + len > h->new_size)
+			{
+				return FUOTA_BAD_PATCH;
+			}
+			fuota_reader_seek(&old, (uint32_t)from);
+			uint32_t left = len;
+			while (left && !patch.error)
+			{
+				uint32_t same = fuota_varint(&patch);
+				uint32_t changed = fuota_varint(&patch);
+				if (same + changed > left || same + changed == 0)
+				{
+					return FUOTA_BAD_PATCH;
+				}
+				for (uint32_t idx = 0; idx < same; idx++)
+				{
+					fuota_writer_put(&out, fuota_reader_get(&old));
+				}
+				for (uint32_t idx = 0; idx < changed; idx++)
+				{
+					fuota_writer_put(&out, fuota_reader_get(&old) + fuota_reader_get(&patch));
+				}
+				left -= same + changed;
+			}
+			written += len;
+		}
+		else if (op == FUOTA_OP_ADD)
+		{
+			uint32_t len = fuota_varint(&patch);
+			if (written + len > h->new_size)
+			{
+				return FUOTA_BAD_PATCH;
+			}
+			for (uint32_t idx = 0; idx < len; idx++)
+			{
+				fuota_writer_put(&out, fuota_reader_get(&patch));
+			}
+			written += len;
+		}
+		else
+		{
+			return FUOTA_BAD_PATCH;
+		}
+		if (old.error)
+		{
+			return FUOTA_BAD_PATCH;
+		}
+	}
+	fuota_writer_flush(&out);
+	if (patch.error)
+	{
+		return FUOTA_BAD_PATCH;
+	}
+	if (out.error)
+	{
+		return FUOTA_FLASH_ERROR;
+	}
+	if (written != h->new_size || out.crc != h->new_crc)
+	{
+		return FUOTA_BAD_RESULT;
+	}
+	return FUOTA_OK;
+}
+
+#endif
@@ -9,6 +9,8 @@
  * 
  */
 #include "app.h"
+#include "fixed_point.h"
+#include "zero_heap.h"
 
 #ifdef ENABLE_GNSS
 
@@ -27,6 +29,13 @@ bool last_read_ok = false;
 /** Flag if GNSS is serial or I2C */
 bool i2c_gnss = false;
 
+/** Last position, payload units: 0.0001 deg and 0.01 m */
+int32_t gnss_lat = 0;
+int32_t gnss_long = 0;
+int32_t gnss_alt = 0;
+
+RAM_BUDGET(GNSS, sizeof(my_gnss) + sizeof(pos_union) + sizeof(last_read_ok) + sizeof(i2c_gnss) + 3 * sizeof(int32_t), 512);
+
 /**
  * @brief Initialize the GNSS
  * 
@@ -64,7 +73,7 @@ bool poll_gnss(void)
 	delay(500);
 
 	// Start connection
-	Serial1.begin(9600);
+	APP_UART.begin(9600);
 	delay(500);
 
 	// delay(100);
@@ -72,17 +81,24 @@ bool poll_gnss(void)
 	bool has_pos = false;
 	bool has_alt = false;
 	// bool has_hdop = false;
-	int64_t latitude = 0;
-	int64_t longitude = 0;
+	// Payload units: 0.0001 deg, cm
+	int32_t latitude = 0;
+	int32_t longitude = 0;
 	int32_t altitude = 0;
 	uint8_t hdop = 0;
+	char lat_str[FX_STR_LEN];
+	char lng_str[FX_STR_LEN];
+	(void)lat_str; // only the logs use them
+	(void)lng_str;
 
 	Serial.println("=============================================");
-	while ((millis() - time_out) < 60000)
+	// The search timeout ends a search without a fix inside the phase budget, the budget is only a
+	// backstop for a search that does not return: its overrun powers the module down
+	while (((millis() - time_out) < 60000) && !supervisor_expired())
 	{
-		while (Serial1.available() > 0)
+		while (APP_UART.available() > 0)
 		{
-			char c = Serial1.read();
+			char c = APP_UART.read();
 			// Serial.print(c);
 			if (my_gnss.encode(c))
 			{
@@ -90,9 +106,16 @@ bool poll_gnss(void)
 				if (my_gnss.location.isUpdated() && my_gnss.location.isValid())
 				{
 					has_pos = true;
-					latitude = my_gnss.location.lat() * 10000000;
-					longitude = my_gnss.location.lng() * 10000000;
-					MYLOG("GNSS", "Lat: %.4f Lon: %.4f\n", latitude / 10000000.0, longitude / 10000000.0);
+					// Payload units from the parsed digits, lat() and lng() would go through double
+					latitude = fx_gnss_deg(my_gnss.location.rawLat().deg, my_gnss.location.rawLat().billionths, my_gnss.location.rawLat().negative);
+					longitude = fx_gnss_deg(my_gnss.location.rawLng().deg, my_gnss.location.rawLng().billionths, my_gnss.location.rawLng().negative);
+					MYLOG("GNSS", "Lat: %s Lon: %s\n", fx_str(lat_str, latitude, 4), fx_str(lng_str, longitude, 4));
+				}
+				if (my_gnss.time.isUpdated() && my_gnss.time.isValid() && my_gnss.date.isValid())
+				{
+					// UTC of the sentence for the device clock
+					time_gnss_fix(my_gnss.date.year(), my_gnss.date.month(), my_gnss.date.day(), my_gnss.time.hour(), my_gnss.time.minute(),
+								  my_gnss.time.second(), my_gnss.time.centisecond(), my_gnss.time.age());
 				}
 
 				// if (my_gnss.hdop.isUpdated() && my_gnss.hdop.isValid())
@@ -118,9 +141,9 @@ bool poll_gnss(void)
 				else if (my_gnss.altitude.isUpdated() && my_gnss.altitude.isValid())
 				{
 					has_alt = true;
-					altitude = my_gnss.altitude.meters() * 1000;
-					MYLOG("GNSS", "Alt: %.2f\n", altitude / 1000.0);
-					MYLOG("GNSS", "Alt: %.2f\n", my_gnss.altitude.meters());
+					// cm, what meters() divides by 100.0
+					altitude = my_gnss.altitude.value();
+					MYLOG("GNSS", "Alt: %s\n", fx_str(lat_str, altitude, 2));
 				}
 			}
 			// if (has_pos && has_alt && has_hdop)
@@ -139,7 +162,7 @@ bool poll_gnss(void)
 	Serial.println("\n=============================================");
 
 	// Shut down Serial 1 to save power
-	Serial1.end();
+	APP_UART.end();
 
 	// if (my_gnss.getGnssFixOk())
 	if (has_pos && has_alt)
@@ -153,23 +176,12 @@ bool poll_gnss(void)
 		// altitude = 156024;
 
 		MYLOG("GNSS", "Fixtype: %d\n", hdop);
-		MYLOG("GNSS", "Lat: %.4f Lon: %.4f\n", latitude / 10000000.0, longitude / 10000000.0);
-		MYLOG("GNSS", "Alt: %.2f\n", altitude / 1000.0);
-
-		pos_union.val32 = latitude / 1000;
-		g_tracker_data.lat_1 = pos_union.val8[2];
-		g_tracker_data.lat_2 = pos_union.val8[1];
-		g_tracker_data.lat_3 = pos_union.val8[0];
-
-		pos_union.val32 = longitude / 1000;
-		g_tracker_data.long_1 = pos_union.val8[2];
-		g_tracker_data.long_2 = pos_union.val8[1];
-		g_tracker_data.long_3 = pos_union.val8[0];
-
-		pos_union.val32 = altitude / 10;
-		g_tracker_data.alt_1 = pos_union.val8[2];
-		g_tracker_data.alt_2 = pos_union.val8[1];
-		g_tracker_data.alt_3 = pos_union.val8[0];
+		MYLOG("GNSS", "Lat: %s Lon: %s\n", fx_str(lat_str, latitude, 4), fx_str(lng_str, longitude, 4));
+		MYLOG("GNSS", "Alt: %s\n", fx_str(lat_str, altitude, 2));
+
+		gnss_lat = latitude;
+		gnss_long = longitude;
+		gnss_alt = altitude;
 	}
 	else
 	{
@@ -192,4 +204,64 @@ bool poll_gnss(void)
 	return false;
 }
 
+/**
+ * @brief Sensor registry sample function
+ *
+ */
+void gnss_sample(void)
+{
+	// Check location and populate payload
+	if (poll_gnss())
+	{
+		MYLOG("APP", "Valid GNSS position");
+	}
+	else
+	{
+		MYLOG("APP", "No valid GNSS position");
+	}
+}
+
+/**
+ * @brief Payload: 0x0188 latitude, longitude, altitude, 24 bit each
+ *
+ * @param buf payload slot
+ * @param len slot length, GNSS_PAYLOAD_LEN
+ * @return uint8_t bytes written, 0 if the slot is too short
+ */
+uint8_t gnss_encode(uint8_t *buf, uint8_t len)
+{
+	if (len < GNSS_PAYLOAD_LEN)
+	{
+		return 0;
+	}
+	buf[0] = 0x01;
+	buf[1] = 0x88;
+	pos_union.val32 = gnss_lat;
+	buf[2] = pos_union.val8[2];
+	buf[3] = pos_union.val8[1];
+	buf[4] = pos_union.val8[0];
+	pos_union.val32 = gnss_long;
+	buf[5] = pos_union.val8[2];
+	buf[6] = pos_union.val8[1];
+	buf[7] = pos_union.val8[0];
+	pos_union.val32 = gnss_alt;
+	buf[8] = pos_union.val8[2];
+	buf[9] = pos_union.val8[1];
+	buf[10] = pos_union.val8[0];
+	return GNSS_PAYLOAD_LEN;
+}
+
+/**
+ * @brief Supervisor recovery: close the UART and power the module down, the next poll powers it up
+ *
+ */
+static void gnss_recover(void)
+{
+	APP_UART.end();
+	pinMode(WB_IO2, OUTPUT);
+	digitalWrite(WB_IO2, LOW);
+}
+
+const sensor_driver_s gnss_sensor = {"GNSS", init_gnss, gnss_sample, gnss_encode, SENSOR_COSTLY, GNSS_BUDGET_MS, gnss_recover, 0};
+
 #endif // ENABLE_GNSS
\ No newline at end of file
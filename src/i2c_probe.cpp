@@ -0,0 +1,153 @@
+/**
+ * @file i2c_probe.cpp
+ * @brief WisBlock modules found on the I2C bus at boot
+ *        Every known module address is probed with an empty write, a module
+ *        that ACKs is fitted. Drivers of modules that are not fitted are not
+ *        initialized, not sampled and leave their bytes out of the payload
+ *        (sensor_driver_s::module), so one image serves every hardware mix.
+ *
+ *        The result is kept in flash. After a reset that kept the power
+ *        (watchdog, soft reset, lockup) no module can have been plugged in
+ *        or out, the stored result is used and the bus is not touched. After
+ *        power on or the reset pin the bus is probed again.
+ *
+ *        RAK1906 (BME680) and RAK13003 (MCP23017) are found and logged, this
+ *        build has no driver for them.
+ * @version 0.1
+ * @date 2022-12-31
+ */
+#include "app.h"
+#include <Wire.h>
+#ifdef NRF52_SERIES
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+#endif
+#include "zero_heap.h"
+
+/** Register of the trace record of an address probe, there is no register */
+#define I2C_PROBE_REG 0xFF
+
+/** Flash record of the modules found */
+#define I2C_PROBE_FILE "/i2c_hw"
+#define I2C_PROBE_MAGIC 0x49324331 // "I2C1"
+
+struct i2c_probe_record_s
+{
+	uint32_t magic;
+	uint8_t modules;
+};
+
+struct i2c_module_s
+{
+	uint8_t module;
+	uint8_t addr;
+	const char *name;
+};
+
+/** Known modules, the addresses of the WisBlock defaults */
+static const i2c_module_s i2c_known[] = {
+	{I2C_MODULE_SHTC3, 0x70, "RAK1901 SHTC3"},
+	{I2C_MODULE_BME680, 0x76, "RAK1906 BME680"},
+	{I2C_MODULE_LIS3DH, 0x18, "RAK1904 LIS3DH"},
+	{I2C_MODULE_MCP23017, 0x20, "RAK13003 MCP23017"},
+};
+
+/** I2C_MODULE_xxx bits of the modules found */
+uint8_t g_i2c_modules = 0;
+
+RAM_BUDGET(I2C_PROBE, sizeof(g_i2c_modules), 8);
+
+/**
+ * @brief Modules stored by an earlier boot
+ *
+ * @return true record found, g_i2c_modules set
+ */
+static bool i2c_probe_load(void)
+{
+#ifdef NRF52_SERIES
+	File file(InternalFS);
+	if (file.open(I2C_PROBE_FILE, FILE_O_READ))
+	{
+		i2c_probe_record_s rec;
+		bool ok = (file.read((uint8_t *)&rec, sizeof(rec)) == (int)sizeof(rec)) && (rec.magic == I2C_PROBE_MAGIC);
+		file.close();
+		if (ok)
+		{
+			g_i2c_modules = rec.modules;
+			return true;
+		}
+	}
+#endif
+	return false;
+}
+
+/**
+ * @brief Keep the modules found, only written when they changed
+ *
+ */
+static void i2c_probe_save(void)
+{
+#ifdef NRF52_SERIES
+	File file(InternalFS);
+	if (file.open(I2C_PROBE_FILE, FILE_O_READ))
+	{
+		i2c_probe_record_s rec;
+		bool same = (file.read((uint8_t *)&rec, sizeof(rec)) == (int)sizeof(rec)) && (rec.magic == I2C_PROBE_MAGIC) &&
+					(rec.modules == g_i2c_modules);
+		file.close();
+		if (same)
+		{
+			return;
+		}
+	}
+	i2c_probe_record_s rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = I2C_PROBE_MAGIC;
+	rec.modules = g_i2c_modules;
+	InternalFS.remove(I2C_PROBE_FILE);
+	if (file.open(I2C_PROBE_FILE, FILE_O_WRITE))
+	{
+		file.write((const uint8_t *)&rec, sizeof(rec));
+		file.close();
+	}
+#endif
+}
+
+/**
+ * @brief Find the fitted modules, from flash after a warm reset, else on the bus
+ *        Call after Wire.begin() and init_config() (the flash is mounted),
+ *        before the drivers are initialized.
+ *
+ */
+void init_i2c_probe(void)
+{
+	if (wdt_warm_reset() && i2c_probe_load())
+	{
+		MYLOG("I2C", "Warm reset, modules 0x%02X from flash", g_i2c_modules);
+		return;
+	}
+
+	g_i2c_modules = 0;
+	for (size_t idx = 0; idx < sizeof(i2c_known) / sizeof(i2c_known[0]); idx++)
+	{
+		Wire.beginTransmission(i2c_known[idx].addr);
+		if (TRACE_I2C_READ(i2c_known[idx].addr, I2C_PROBE_REG, Wire.endTransmission(), NULL, 0) == 0)
+		{
+			g_i2c_modules |= i2c_known[idx].module;
+			MYLOG("I2C", "%s at 0x%02X", i2c_known[idx].name, i2c_known[idx].addr);
+		}
+	}
+	MYLOG("I2C", "Modules 0x%02X", g_i2c_modules);
+	i2c_probe_save();
+}
+
+/**
+ * @brief Module found at boot
+ *
+ * @param module I2C_MODULE_xxx
+ */
+bool i2c_module_found(uint8_t module)
+{
+	return (g_i2c_modules & module) != 0;
+}
@@ -0,0 +1,270 @@
+/**
+ * @file load.cpp
+ * @brief Remote switching of the Renogy load output
+ *        A downlink command (config.cpp) switches the load with a Modbus
+ *        write, reads the state back and sends it right away on channel
+ *        0x1001 (state, result) together with the command acknowledge. A
+ *        power cycle switches off, waits and switches on again, with a
+ *        report after each step.
+ *
+ *        In Class A a downlink waits for the next uplink, up to a full send
+ *        interval. A command can open a Class C window instead: the receiver
+ *        stays on for the given minutes, commands arrive within seconds, then
+ *        the node goes back to Class A. The receiver draws about 5 mA, the
+ *        window is refused in ENERGY_CRITICAL. LoRaWAN 1.0 has no class
+ *        switch MAC command, the device profile on the network server must
+ *        allow Class C; outside the window its downlinks still reach the
+ *        node in the Class A RX windows.
+ * @version 0.1
+ * @date 2022-11-19
+ */
+#include "app.h"
+#include "zero_heap.h"
+
+/** Report: 0x0F01 acknowledge, 0x1001 load state, result */
+#define LOAD_REPORT_LEN (CMD_ACK_LEN + 4)
+
+/** Modbus attempts, writing the switch twice does no harm */
+#define LOAD_TRIES 2
+
+/** Load state in the report when the controller did not answer */
+#define LOAD_STATE_UNKNOWN 0xFF
+
+/** Result in the report */
+enum load_result_e
+{
+	LOAD_OK = 0,
+	LOAD_MODBUS_ERROR, // no or bad answer from the controller
+	LOAD_MISMATCH,	   // state read back differs, controller not in manual load mode
+};
+
+#ifdef NRF52_SERIES
+/** End of the off time of a power cycle */
+SoftwareTimer load_cycle_timer;
+/** End of the Class C window */
+SoftwareTimer load_window_timer;
+#endif
+#ifdef ARDUINO_ARCH_RP2040
+TimerEvent_t load_cycle_timer;
+TimerEvent_t load_window_timer;
+#endif
+
+/** Set by the timers, handled by load_event() in the app task */
+volatile bool load_cycle_due = false;
+volatile bool load_window_due = false;
+
+/** Class C window open */
+bool load_class_c = false;
+
+/** Report waiting for the radio */
+bool load_report_pending = false;
+uint8_t load_state = LOAD_STATE_UNKNOWN;
+uint8_t load_result = LOAD_OK;
+uint8_t load_report[LOAD_REPORT_LEN];
+
+RAM_BUDGET(LOAD, sizeof(load_cycle_timer) + sizeof(load_window_timer) + sizeof(load_cycle_due) + sizeof(load_window_due) + sizeof(load_class_c) + sizeof(load_report_pending) + sizeof(load_state) + sizeof(load_result) + sizeof(load_report), 96);
+
+#ifdef NRF52_SERIES
+static void load_cycle_cb(TimerHandle_t)
+#else
+static void load_cycle_cb(void)
+#endif
+{
+	load_cycle_due = true;
+	api_wake_loop(LOAD_TRIGGER);
+}
+
+#ifdef NRF52_SERIES
+static void load_window_cb(TimerHandle_t)
+#else
+static void load_window_cb(void)
+#endif
+{
+	load_window_due = true;
+	api_wake_loop(LOAD_TRIGGER);
+}
+
+/**
+ * @brief Prepare the one shot timers
+ *
+ */
+void init_load(void)
+{
+#ifdef NRF52_SERIES
+	load_cycle_timer.begin(1000, load_cycle_cb, NULL, false);
+	load_window_timer.begin(60000, load_window_cb, NULL, false);
+#endif
+#ifdef ARDUINO_ARCH_RP2040
+	load_cycle_timer.oneShot = true;
+	TimerInit(&load_cycle_timer, load_cycle_cb);
+	load_window_timer.oneShot = true;
+	TimerInit(&load_window_timer, load_window_cb);
+#endif
+}
+
+#ifdef NRF52_SERIES
+static void load_timer_stop(SoftwareTimer *timer)
+{
+	timer->stop();
+}
+
+static void load_timer_start(SoftwareTimer *timer, uint32_t ms)
+{
+	timer->stop();
+	timer->setPeriod(ms);
+	timer->start();
+}
+#endif
+#ifdef ARDUINO_ARCH_RP2040
+static void load_timer_stop(TimerEvent_t *timer)
+{
+	TimerStop(timer);
+}
+
+static void load_timer_start(TimerEvent_t *timer, uint32_t ms)
+{
+	TimerStop(timer);
+	TimerSetValue(timer, ms);
+	TimerStart(timer);
+}
+#endif
+
+/**
+ * @brief Write the load switch, read it back, queue the report
+ *
+ * @return true the controller confirmed the new state
+ */
+static bool load_write(bool on)
+{
+#ifdef ENABLE_RS232
+	bool state = false;
+	bool answered = false;
+	for (uint8_t attempt = 0; (attempt < LOAD_TRIES) && !answered; attempt++)
+	{
+		answered = renogyWriteLoad(on, &state);
+	}
+	if (!answered)
+	{
+		load_state = LOAD_STATE_UNKNOWN;
+		load_result = LOAD_MODBUS_ERROR;
+	}
+	else
+	{
+		load_state = state ? 1 : 0;
+		load_result = state == on ? LOAD_OK : LOAD_MISMATCH;
+	}
+#else
+	(void)on;
+	load_state = LOAD_STATE_UNKNOWN;
+	load_result = LOAD_MODBUS_ERROR;
+#endif
+	MYLOG("LOAD", "Load %s: state %d result %d", on ? "on" : "off", load_state, load_result);
+	load_report_pending = true;
+	return load_result == LOAD_OK;
+}
+
+/**
+ * @brief Switch the load, command CMD_LOAD
+ *        Call load_report_send() afterwards.
+ *
+ * @param action LOAD_OFF, LOAD_ON or LOAD_CYCLE
+ * @param off_s off time of LOAD_CYCLE
+ */
+void load_switch(uint8_t action, uint8_t off_s)
+{
+	load_timer_stop(&load_cycle_timer);
+	load_cycle_due = false;
+	if (load_write(action == LOAD_ON) && (action == LOAD_CYCLE))
+	{
+		load_timer_start(&load_cycle_timer, (uint32_t)off_s * 1000);
+	}
+}
+
+/**
+ * @brief Open, extend or close the Class C window, command CMD_CLASS_C
+ *
+ * @param minutes window length, 0 closes it
+ */
+void load_window(uint8_t minutes)
+{
+	if (minutes == 0)
+	{
+		load_timer_stop(&load_window_timer);
+		load_window_due = true;
+		load_event();
+		return;
+	}
+	if (!load_class_c)
+	{
+		if (TRACE_LORA_CLASS(CLASS_C) != LMH_SUCCESS)
+		{
+			MYLOG("LOAD", "Class C request failed");
+			return;
+		}
+		load_class_c = true;
+	}
+	MYLOG("LOAD", "Class C for %d min", minutes);
+	load_timer_start(&load_window_timer, (uint32_t)minutes * 60000);
+}
+
+/**
+ * @brief Handle LOAD_TRIGGER: end of a power cycle or of the Class C window
+ *        Call load_report_send() afterwards.
+ *
+ */
+void load_event(void)
+{
+	if (load_cycle_due)
+	{
+		load_cycle_due = false;
+		load_write(true);
+	}
+	if (load_window_due)
+	{
+		load_window_due = false;
+		if (load_class_c)
+		{
+			// Back to the Class A RX windows, the receiver sleeps again
+			TRACE_LORA_CLASS(CLASS_A);
+			load_class_c = false;
+			MYLOG("LOAD", "Back to Class A");
+		}
+	}
+}
+
+/**
+ * @brief Send the pending report, keep it if the radio is busy
+ *        Called again on LORA_TX_FIN until it is out.
+ *
+ * @return true report enqueued, a TX cycle is running
+ */
+bool load_report_send(void)
+{
+	if (!load_report_pending)
+	{
+		return false;
+	}
+	uint8_t ack_size = config_ack_encode(load_report);
+	load_report[ack_size] = 0x10;
+	load_report[ack_size + 1] = 0x01;
+	load_report[ack_size + 2] = load_state;
+	load_report[ack_size + 3] = load_result;
+
+	switch (TRACE_LORA_TX(load_report, ack_size + 4, 0))
+	{
+	case LMH_SUCCESS:
+		MYLOG("LOAD", "Load report enqueued");
+		load_report_pending = false;
+		if (ack_size)
+		{
+			config_ack_sent();
+		}
+		return true;
+	case LMH_BUSY:
+		MYLOG("LOAD", "LoRa transceiver is busy, load report later");
+		return false;
+	default:
+		load_report_pending = false;
+		return false;
+	}
+}
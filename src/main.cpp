@@ -25,6 +25,11 @@ TimerEvent_t delayed_sending;
 
 /** Include the WisBlock-API */
 #include <WisBlock-API.h> // Click to install library: http://librarymanager/All#WisBlock-API
+#ifdef ENABLE_FUOTA
+#include "fuota_codec.h"
+#endif
+#include "fixed_point.h"
+#include "zero_heap.h"
 
 /** Define the version of your SW */
 #define SW_VERSION_1 1 // major version increase on API change / not backwards compatible
@@ -43,8 +48,10 @@ void lora_data_handler(void);
 /** Set the device name, max length is 10 characters */
 char g_ble_dev_name[10] = "IoTA-MON";
 
-/** Location data as byte array */
-tracker_data_s g_tracker_data;
+/** Uplink payload, one packet at a time: samples, their time, command acknowledge */
+uint8_t g_payload[packet_max_len() + TIME_PAYLOAD_LEN + CMD_ACK_LEN];
+static_assert(packet_len(PACKET_TRACKER) + TIME_PAYLOAD_LEN + CMD_ACK_LEN <= lorawan_max_payload(APP_DATA_RATE), "No room for the command acknowledge");
+static_assert(packet_len(PACKET_RENOGY) + TIME_PAYLOAD_LEN <= lorawan_max_payload(APP_DATA_RATE), "No room for the sample time");
 
 /** Flag showing if TX cycle is ongoing */
 bool lora_busy = false;
@@ -52,19 +59,142 @@ bool lora_busy = false;
 /** Send Fail counter **/
 uint8_t send_fail = 0;
 
-/** Timer since last position message was sent */
-time_t last_pos_send = 0;
+/** Timer since last position message was sent, millis(), compared by unsigned difference across the wrap */
+uint32_t last_pos_send = 0;
 /** Timer for delayed sending to keep duty cycle */
 
-/** Battery level uinion */
-batt_s batt_level;
-
 /** Flag if delayed sending is already activated */
 bool delayed_active = false;
 
 /** Minimum delay between sending new locations, set to 45 seconds */
 time_t min_delay = 45000;
 
+#ifdef ENABLE_ACC
+/** Tamper/impact alert as byte array */
+acc_alert_s g_acc_alert;
+
+/** Timer since last alert was sent, millis() */
+uint32_t last_alert_send = 0;
+#endif
+
+/** Hex dump of a received downlink, 3 characters per byte */
+char log_buff[LORAWAN_MAX_PAYLOAD * 3 + 1];
+
+#ifdef ENABLE_ACC
+#define APP_ACC_RAM sizeof(g_acc_alert)
+#else
+#define APP_ACC_RAM 0
+#endif
+RAM_BUDGET(APP, sizeof(g_payload) + sizeof(log_buff) + sizeof(g_ble_dev_name) + APP_ACC_RAM, 1024);
+
+#if MY_DEBUG > 0
+/**
+ * @brief Log the static RAM of every module
+ *
+ */
+void print_ram_budget(void)
+{
+	const ram_budget_s *budgets[] = {
+		&APP_ram_budget,
+		&ENERGY_ram_budget,
+		&SENSORS_ram_budget,
+		&SUPERVISOR_ram_budget,
+		&I2C_PROBE_ram_budget,
+		&BATCH_ram_budget,
+		&TIME_ram_budget,
+		&CONFIG_ram_budget,
+		&LOAD_ram_budget,
+		&BATT_ram_budget,
+#ifdef ENABLE_GNSS
+		&GNSS_ram_budget,
+#endif
+#ifdef ENABLE_ENV_MON
+		&ENV_ram_budget,
+#endif
+#ifdef ENABLE_RS232
+		&RS232_ram_budget,
+		&VEDIRECT_ram_budget,
+#endif
+#ifdef ENABLE_ACC
+		&ACC_ram_budget,
+#endif
+#ifdef ENABLE_VIBRATION
+		&VIB_ram_budget,
+#endif
+#ifdef ENABLE_FUOTA
+		&FUOTA_ram_budget,
+#endif
+#ifdef ENABLE_TRACE
+		&TRACE_ram_budget,
+#endif
+	};
+	uint32_t total = 0;
+	for (size_t idx = 0; idx < sizeof(budgets) / sizeof(budgets[0]); idx++)
+	{
+		MYLOG("RAM", "%-8s %5lu of %5lu bytes", budgets[idx]->module, budgets[idx]->bytes, budgets[idx]->limit);
+		total += budgets[idx]->bytes;
+	}
+	MYLOG("RAM", "Total    %5lu bytes static, no heap", total);
+}
+#endif
+
+#if MY_DEBUG > 0 && defined(DWT)
+/**
+ * @brief Cycles per conversion of fixed_point.h against the float path it replaced
+ *        Runs once at boot in debug builds, outside any supervisor phase.
+ *
+ */
+static void fx_benchmark(void)
+{
+	static const uint16_t count = 256;
+	volatile int32_t sink = 0;
+	uint32_t cycles[6];
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	uint32_t start = DWT->CYCCNT;
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		sink = sink + fx_float_shtc3_temp(idx * 251);
+	}
+	cycles[0] = DWT->CYCCNT - start;
+	start = DWT->CYCCNT;
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		sink = sink + fx_shtc3_temp::convert(idx * 251);
+	}
+	cycles[1] = DWT->CYCCNT - start;
+	start = DWT->CYCCNT;
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		sink = sink + fx_float_shtc3_humid(idx * 251);
+	}
+	cycles[2] = DWT->CYCCNT - start;
+	start = DWT->CYCCNT;
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		sink = sink + fx_shtc3_humid::convert(idx * 251);
+	}
+	cycles[3] = DWT->CYCCNT - start;
+	start = DWT->CYCCNT;
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		sink = sink + fx_float_gnss_deg(idx % 90, idx * 3906249UL, idx & 1);
+	}
+	cycles[4] = DWT->CYCCNT - start;
+	start = DWT->CYCCNT;
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		sink = sink + fx_gnss_deg(idx % 90, idx * 3906249UL, idx & 1);
+	}
+	cycles[5] = DWT->CYCCNT - start;
+
+	MYLOG("FX", "Cycles per conversion, float / fixed: SHTC3 T %lu / %lu, RH %lu / %lu, GNSS deg %lu / %lu",
+		  cycles[0] / count, cycles[1] / count, cycles[2] / count, cycles[3] / count, cycles[4] / count, cycles[5] / count);
+}
+#endif
+
 #ifdef NRF52_SERIES
 /**
  * @brief Timer function used to avoid sending packages too often.
@@ -156,7 +286,7 @@ void setup_app(void)
 	g_lorawan_settings.duty_cycle_enabled = false;					// Flag to enable duty cycle (validity depends on Region)
 	g_lorawan_settings.join_trials = 10;							// Number of join retries
 	g_lorawan_settings.tx_power = TX_POWER_0;						// TX power 0 .. 15 (validity depends on Region)
-	g_lorawan_settings.data_rate = DR_3;							// Data rate 0 .. 15 (validity depends on Region)
+	g_lorawan_settings.data_rate = APP_DATA_RATE;						// Data rate 0 .. 15 (validity depends on Region)
 	g_lorawan_settings.lora_class = CLASS_A;						// LoRaWAN class 0: A, 2: C, 1: B is not supported
 	g_lorawan_settings.subband_channels = 2;						// Subband channel selection 1 .. 9
 	g_lorawan_settings.app_port = LORAWAN_APP_PORT;					// Data port to send data
@@ -182,28 +312,50 @@ bool init_app(void)
 	pinMode(WB_IO2, OUTPUT);
 	digitalWrite(WB_IO2, HIGH);
 
+	// Peripheral trace, only with ENABLE_TRACE
+	TRACE_INIT();
+	TRACE_PHASE_BEGIN(TRACE_PHASE_INIT);
+
 	// Start the I2C bus
 	Wire.begin();
 	Wire.setClock(400000);
 
-#ifdef ENABLE_GNSS
-	// Initialize GNSS module
-	MYLOG("APP", "Initialize uBlox GNSS");
-	init_result = init_gnss();
-	MYLOG("APP", "Result %s", init_result ? "success" : "failed");
+	// Configuration from flash, the drivers below use it
+	init_config();
+
+	// Phase budgets and the watchdog, before the drivers can hang
+	init_supervisor();
+
+	// Modules on the bus, the drivers of the others are left out
+	init_i2c_probe();
+
+#ifdef ENABLE_ACC
+	// Initialize accelerometer, it watches for motion while we sleep
+	MYLOG("APP", "Initialize RAK1904 accelerometer");
+	if (!i2c_module_found(I2C_MODULE_LIS3DH))
+	{
+		MYLOG("APP", "Accelerometer not fitted");
+	}
+	else if (!init_acc())
+	{
+		MYLOG("APP", "Accelerometer init failed");
+		init_result = false;
+	}
 #endif
-#ifdef ENABLE_ENV_MON
-	// Initialize Temp & Humi sensor
-	MYLOG("APP", "Initialize shtc3 Temp & Humi");
-	init_result |= init_shtc3();
-	MYLOG("APP", "Result %s", init_result ? "success" : "failed");
+	// Initialize all sensors in the registry, vibration needs the accelerometer
+	if (!sensors_init())
+	{
+		MYLOG("APP", "A fitted sensor failed its init");
+		init_result = false;
+	}
+	init_energy();
+	init_batch();
+	init_load();
+#if MY_DEBUG > 0
+	print_ram_budget();
 #endif
-#ifdef ENABLE_RS232
-	// Initialize Serial (for RS232 to Renogy)
-	MYLOG("APP", "Initialize Serial1 for RS232 to Renogy");
-	init_renogy_rs232();
-	MYLOG("APP", "Result %s", Serial1 ? "success" : "failed");
-	//Serial1.write("Hello to renogy!");
+#if MY_DEBUG > 0 && defined(DWT)
+	fx_benchmark();
 #endif
 	if (g_lorawan_settings.send_repeat_time != 0)
 	{
@@ -217,10 +369,10 @@ bool init_app(void)
 	}
 	// Set to 1/2 of programmed send interval or 30 seconds
 #ifdef NRF52_SERIES
-	delayed_sending.begin(g_lorawan_settings.send_repeat_time, send_delayed);
+	delayed_sending.begin(g_lorawan_settings.send_repeat_time, send_delayed, NULL, false);
 #endif
 #ifdef ARDUINO_ARCH_RP2040
-	delayed_sending.oneShot = false;
+	delayed_sending.oneShot = true;
 	delayed_sending.ReloadValue = g_lorawan_settings.send_repeat_time;
 	TimerInit(&delayed_sending, send_delayed);
 	TimerSetValue(&delayed_sending, g_lorawan_settings.send_repeat_time);
@@ -229,6 +381,11 @@ bool init_app(void)
 	// Power down GNSS module
 	// pinMode(WB_IO2, OUTPUT);
 	// digitalWrite(WB_IO2, LOW);
+
+	// The sensor inits returned
+	supervisor_feed();
+	TRACE_PHASE_END(TRACE_PHASE_INIT);
+	TRACE_FLUSH();
 	return init_result;
 }
 
@@ -239,6 +396,8 @@ bool init_app(void)
 */
 void app_event_handler(void)
 {
+	TRACE_WAKE(TRACE_WAKE_APP);
+
 	// Timer triggered event
 	if ((g_task_event_type & STATUS) == STATUS)
 	{
@@ -246,8 +405,8 @@ void app_event_handler(void)
 		MYLOG("APP", "Timer wakeup");
 
 #ifdef NRF52_SERIES
-		// If BLE is enabled, restart Advertising
-		if (g_enable_ble)
+		// If BLE is enabled, restart Advertising, unless energy is low
+		if (g_enable_ble && energy_ble_allowed())
 		{
 			restart_advertising(15);
 		}
@@ -258,105 +417,171 @@ void app_event_handler(void)
 		}
 		else
 		{
-#ifdef ENABLE_GNSS
-			// Check location and populate payload
-			if (poll_gnss())
-			{
-				MYLOG("APP", "Valid GNSS position");
-			}
-			else
-			{
-				MYLOG("APP", "No valid GNSS position");
-			}
-#endif
-#ifdef ENABLE_ENV_MON
-			// Read temp & humi data and populate payload
-			shtc3_read_data();
-#endif
-			// Get battery level
-			// g_tracker_data.batt = mv_to_percent(read_batt());
-			batt_level.batt16 = read_batt() / 10;
-			g_tracker_data.batt_1 = batt_level.batt8[1];
-			g_tracker_data.batt_2 = batt_level.batt8[0];	
+			// Uplinks enqueued in this cycle, for the energy budget
+			uint8_t uplinks = 0;
+
+			// Read all sensors the energy budget allows
+			sensors_sample();
+			// Resting battery voltage for energy_update(), before the uplinks load the battery
+			batt_rest_read();
 
 			// Remember last time sending
 			last_pos_send = millis();
 
 			// Just in case
-			delayed_active = false;	
+			delayed_active = false;
 
-			uint8_t *packet = (uint8_t *)&g_tracker_data;
-#if MY_DEBUG == 1
-			Serial.println("Packet 1 prepared for uplink:");
-			for (int idx = 0; idx < (int)TRACKER_DATA_LEN; idx++)
-			{
-				Serial.printf("%02X", packet[idx]);
-			}
-			Serial.println("");
-#endif
-
-			//Sending first uplink data: Battery, GNSS, ENV data
-			lmh_error_status result = send_lora_packet((uint8_t *)&g_tracker_data, TRACKER_DATA_LEN);
-			switch (result)
+			TRACE_PHASE_BEGIN(TRACE_PHASE_UPLINK);
+			for (uint8_t packet = 0; packet < PACKET_COUNT; packet++)
 			{
-			case LMH_SUCCESS:
-				MYLOG("APP", "Packet 1 enqueued");
-				// Set a flag that TX cycle is running
-				lora_busy = true;
-				break;
-			case LMH_BUSY:
-				MYLOG("APP", "LoRa transceiver is busy");
-				break;
-			case LMH_ERROR:
-				MYLOG("APP", "Packet 1 error, too big to send with current DR");
-				break;
-			}
-
-#ifdef ENABLE_RS232
-			if (Serial1)
-			{
-				// Read Renogy Solar Controller and populate payload
-				renogyPollRs232Data();
-				renogyPollRs232Errors();
-#if MY_DEBUG == 1
-				renogyPrintStatus();
-#endif
-				packet = (uint8_t *)&g_renogy_data;
+				uint16_t sample_size = sensors_encode(packet, g_payload);
+				uint16_t packet_size = sample_size;
+				if (sample_size)
+				{
+					// Time of the samples, once the clock is set
+					packet_size += time_encode(&g_payload[packet_size]);
+				}
+				uint8_t ack_size = 0;
+				if (packet == PACKET_TRACKER)
+				{
+					// Acknowledge of the last downlink command
+					ack_size = config_ack_encode(&g_payload[packet_size]);
+					packet_size += ack_size;
+				}
+				if (packet_size == 0)
+				{
+					continue;
+				}
 #if MY_DEBUG == 1
-                Serial.println("Packet 2 prepared for uplink:");
-				for (int idx = 0; idx < (int)RENOGY_DATA_LEN; idx++)
+				Serial.printf("Packet %d prepared for uplink:\n", packet + 1);
+				for (int idx = 0; idx < (int)packet_size; idx++)
 				{
-					Serial.printf("%02X", packet[idx]);
+					Serial.printf("%02X", g_payload[idx]);
 				}
 				Serial.println("");
 #endif
-				//MYLOG("RS232", "Renogy Error Status: %s", renogyDecodeErrorStatus());
+				if (uplinks != 0)
+				{
+					delay(1); // Give lorawan time to send the previous packet
+				}
 
-				// Sending second uplink data: Renogy Solar Charge Controller readings
-				delay(1); // Wait for a second to allow lorawan to send the first packet
-				result = send_lora_packet((uint8_t *)&g_renogy_data, RENOGY_DATA_LEN);
+				lmh_error_status result = TRACE_LORA_TX(g_payload, packet_size, 0);
 				switch (result)
 				{
 				case LMH_SUCCESS:
-					MYLOG("APP", "Packet 2 enqueued");
+					MYLOG("APP", "Packet %d enqueued", packet + 1);
+					if (uplinks == 0)
+					{
+						// Battery voltage under TX load
+						batt_tx_start();
+					}
 					// Set a flag that TX cycle is running
 					lora_busy = true;
+					uplinks++;
+					if (ack_size)
+					{
+						config_ack_sent();
+					}
 					break;
 				case LMH_BUSY:
-					MYLOG("APP", "LoRa transceiver is busy");
+					MYLOG("APP", "LoRa transceiver is busy, packet %d to backlog", packet + 1);
+					batch_add(packet, g_payload, sample_size);
 					break;
 				case LMH_ERROR:
-					MYLOG("APP", "Packet 2 error, too big to send with current DR");
+					MYLOG("APP", "Packet %d error, too big to send with current DR", packet + 1);
 					break;
 				}
 			}
+			TRACE_PHASE_END(TRACE_PHASE_UPLINK);
+
+			// Adapt interval and optional consumers to the available energy
+			energy_update(uplinks);
+		}
+
+		// Every sensor phase returned
+		supervisor_feed();
+	}
+
+	// Power cycle step or end of the Class C window
+	if ((g_task_event_type & LOAD_TRIGGER) == LOAD_TRIGGER)
+	{
+		g_task_event_type &= N_LOAD_TRIGGER;
+		MYLOG("APP", "Load wakeup");
+		load_event();
+		if (load_report_send())
+		{
+			lora_busy = true;
+		}
+	}
+
+#ifdef ENABLE_ACC
+	// Accelerometer triggered event
+	if ((g_task_event_type & ACC_TRIGGER) == ACC_TRIGGER)
+	{
+		g_task_event_type &= N_ACC_TRIGGER;
+		MYLOG("APP", "ACC wakeup");
+		TRACE_PHASE_BEGIN(TRACE_PHASE_ACC);
+
+		int16_t peak[3] = {0};
+		uint8_t events = acc_check_event(peak);
+
+		// Impact or tamper, send an alert right away, but not more often than the alert holdoff
+		if ((events & (ACC_EVENT_IMPACT | ACC_EVENT_TILT)) && ((last_alert_send == 0) || ((millis() - last_alert_send) > (uint32_t)g_app_config.acc_holdoff_s * 1000)))
+		{
+			g_acc_alert.x_1 = (uint8_t)(peak[0] >> 8);
+			g_acc_alert.x_2 = (uint8_t)(peak[0]);
+			g_acc_alert.y_1 = (uint8_t)(peak[1] >> 8);
+			g_acc_alert.y_2 = (uint8_t)(peak[1]);
+			g_acc_alert.z_1 = (uint8_t)(peak[2] >> 8);
+			g_acc_alert.z_2 = (uint8_t)(peak[2]);
+			g_acc_alert.events = events;
+
+			lmh_error_status result = TRACE_LORA_TX((uint8_t *)&g_acc_alert, ACC_ALERT_LEN, 0);
+			switch (result)
+			{
+			case LMH_SUCCESS:
+				MYLOG("APP", "Alert packet enqueued");
+				last_alert_send = millis();
+				// Set a flag that TX cycle is running
+				lora_busy = true;
+				break;
+			case LMH_BUSY:
+				MYLOG("APP", "LoRa transceiver is busy");
+				break;
+			case LMH_ERROR:
+				MYLOG("APP", "Alert packet error, too big to send with current DR");
+				break;
+			}
+		}
+
+#ifdef ENABLE_GNSS
+		// Moved, get a new position but keep min_delay between two position uplinks
+		if ((events & ACC_EVENT_MOTION) && !delayed_active)
+		{
+			if ((millis() - last_pos_send) > (uint32_t)min_delay)
+			{
+				api_wake_loop(STATUS);
+			}
 			else
 			{
-				MYLOG("RS232", "RS232 interface not initialized, skipping Renogy Poll Cycle");
+				delayed_active = true;
+				uint32_t wait_time = (uint32_t)min_delay - (millis() - last_pos_send);
+				MYLOG("APP", "Position update in %ld ms", (long)wait_time);
+#ifdef NRF52_SERIES
+				delayed_sending.setPeriod(wait_time);
+				delayed_sending.start();
+#endif
+#ifdef ARDUINO_ARCH_RP2040
+				TimerSetValue(&delayed_sending, wait_time);
+				TimerStart(&delayed_sending);
+#endif
 			}
-#endif // RS232_ENABLED
 		}
+#endif // ENABLE_GNSS
+		TRACE_PHASE_END(TRACE_PHASE_ACC);
 	}
+#endif // ENABLE_ACC
+	TRACE_FLUSH();
 }
 
 #ifdef NRF52_SERIES
@@ -399,6 +624,8 @@ void ble_data_handler(void)
 */
 void lora_data_handler(void)
 {
+	TRACE_WAKE(TRACE_WAKE_LORA);
+
 	// LoRa Join finished handling
 	if ((g_task_event_type & LORA_JOIN_FIN) == LORA_JOIN_FIN)
 	{
@@ -418,31 +645,49 @@ void lora_data_handler(void)
 	// LoRa data handling
 	if ((g_task_event_type & LORA_DATA) == LORA_DATA)
 	{
-		/**************************************************************/
-		/**************************************************************/
-		/// \todo LoRa data arrived
-		/// \todo parse them here
-		/**************************************************************/
-		/**************************************************************/
 		g_task_event_type &= N_LORA_DATA;
-		MYLOG("APP", "Received package over LoRa");
-		char log_buff[g_rx_data_len * 3] = {0};
-		uint8_t log_idx = 0;
-		for (int idx = 0; idx < g_rx_data_len; idx++)
+		TRACE_PHASE_BEGIN(TRACE_PHASE_DOWNLINK);
+		MYLOG("APP", "Received package over LoRa on fPort %d", g_last_fport);
+#if MY_DEBUG > 0
+		uint16_t log_idx = 0;
+		log_buff[0] = 0;
+		for (int idx = 0; (idx < g_rx_data_len) && (idx < LORAWAN_MAX_PAYLOAD); idx++)
 		{
 			sprintf(&log_buff[log_idx], "%02X ", g_rx_lora_data[idx]);
 			log_idx += 3;
 		}
-		lora_busy = false;
 		MYLOG("APP", "%s", log_buff);
+#endif
+		lora_busy = false;
+		if (g_last_fport == LORAWAN_CMD_PORT)
+		{
+			config_command(g_rx_lora_data, g_rx_data_len);
+			// Load switched, confirm right away if the radio is free
+			lora_busy = load_report_send();
+		}
+#ifdef ENABLE_FUOTA
+		else if (g_last_fport == LORAWAN_FUOTA_PORT)
+		{
+			fuota_command(g_rx_lora_data, g_rx_data_len);
+			lora_busy = fuota_send();
+		}
+#endif
+		else if (g_last_fport == LORAWAN_CLOCK_PORT)
+		{
+			time_command(g_rx_lora_data, g_rx_data_len);
+			lora_busy = time_send();
+		}
+		TRACE_PHASE_END(TRACE_PHASE_DOWNLINK);
 	}
 
 	// LoRa TX finished handling
 	if ((g_task_event_type & LORA_TX_FIN) == LORA_TX_FIN)
 	{
 		g_task_event_type &= N_LORA_TX_FIN;
+		TRACE_PHASE_BEGIN(TRACE_PHASE_TX_FIN);
 
 		MYLOG("APP", "LPWAN TX cycle %s", g_rx_fin_result ? "finished ACK" : "failed NAK");
+		batt_tx_end();
 
 		if (!g_rx_fin_result)
 		{
@@ -457,7 +702,16 @@ void lora_data_handler(void)
 			}
 		}
 
-		// Clear the LoRa TX flag
-		lora_busy = false;
+#ifdef ENABLE_FUOTA
+		// Patch result is out, restart into the new image
+		fuota_tx_fin();
+		// Clear the LoRa TX flag, unless a load report, an update answer, a clock request or a backlog frame goes out now
+		lora_busy = load_report_send() || fuota_send() || time_send() || batch_send();
+#else
+		// Clear the LoRa TX flag, unless a load report, a clock request or a backlog frame goes out now
+		lora_busy = load_report_send() || time_send() || batch_send();
+#endif
+		TRACE_PHASE_END(TRACE_PHASE_TX_FIN);
 	}
+	TRACE_FLUSH();
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+/**
+ * @file renogy_regs.h
+ * @brief Renogy Wanderer Modbus register layout
+ *        Plain C/C++ with no Arduino dependencies, so the firmware and the
+ *        host-side controller emulator (tools/renogy_emu) share one map.
+ * @version 0.1
+ * @date 2022-09-10
+ *
+ * Reference: https://github.com/mickwheelz/NodeRenogy/blob/main/renogy.js
+ */
+
+#ifndef RENOGY_REGS_H
+#define RENOGY_REGS_H
+
+#include <stdint.h>
+
+/** Modbus slave address of the controller */
+#define RENOGY_SLAVE_ID 1
+/** Baudrate of the RJ12 RS232 port */
+#define RENOGY_BAUDRATE 9600
+
+/** Controller info block (model, versions, serial number) */
+const uint16_t infoStartRegister = 0x00A;
+const int numInfomRegisters = 17;
+
+/** Live data block, read every cycle */
+const uint16_t dataStartRegister = 0x100;
+const int numDataRegisters = 10;
+
+/** Offsets inside the live data block, in the order renogySetData() expects */
+enum renogy_data_reg_e
+{
+	RENOGY_REG_BATT_CAPACITY = 0x100,  // %
+	RENOGY_REG_BATT_VOLTAGE = 0x101,   // 0.1 V
+	RENOGY_REG_CHARGE_CURRENT = 0x102, // 0.01 A
+	RENOGY_REG_TEMPERATURE = 0x103,	   // high byte controller, low byte battery, degC
+	RENOGY_REG_LOAD_VOLTAGE = 0x104,   // 0.1 V
+	RENOGY_REG_LOAD_CURRENT = 0x105,   // 0.01 A
+	RENOGY_REG_LOAD_POWER = 0x106,	   // W
+	RENOGY_REG_PANEL_VOLTAGE = 0x107,  // 0.1 V
+	RENOGY_REG_PANEL_CURRENT = 0x108,  // 0.01 A
+	RENOGY_REG_PANEL_POWER = 0x109,	   // W
+};
+
+/** Load output switch, write 1 (on) or 0 (off) with function 0x06 */
+const uint16_t loadSwitchRegister = 0x10A;
+/** Load and charging state, high byte bit 7 is the load state */
+const uint16_t loadStatusRegister = 0x120;
+#define RENOGY_LOAD_STATUS_ON 0x8000
+
+/** Fault bits, two registers */
+const uint16_t errorStartRegister = 0x121;
+const int numErrorRegisters = 2;
+
+#endif
@@ -16,31 +16,28 @@
 
 #ifdef ENABLE_RS232
 #include <ModbusMaster.h>
+#include "fixed_point.h"
+#include "zero_heap.h"
 
 // instantiate ModbusMaster object
 ModbusMaster node;
 
 renogy_data_s g_renogy_data;
 uint8_t recvd_renogy_downlink = 0;
+uint8_t g_charger = CHARGER_RENOGY;
+/** The last data poll succeeded, batt_capacity is the controller's */
+bool g_renogy_valid = false;
 
-static byte* func_out;
 //static byte bitmask_chargestatus = 0b01111111;
-String temp_str;
-char temp[50];
+
+RAM_BUDGET(RS232, sizeof(node) + sizeof(g_renogy_data) + sizeof(recvd_renogy_downlink) + sizeof(g_charger) + sizeof(g_renogy_valid), 384);
 
 void init_renogy_rs232(void)
 {
-	Serial1.begin(9600);
-  node.begin(1, Serial1);
+	APP_UART.begin(RENOGY_BAUDRATE);
+  node.begin(RENOGY_SLAVE_ID, APP_UART);
 }
 
-const uint16_t dataStartRegister = 0x100;
-const int numDataRegisters = 10;//30;
-const uint16_t infoStartRegister = 0x00A;
-const int numInfomRegisters = 17;
-const uint16_t errorStartRegister = 0x121;
-const int numErrorRegisters = 2;
-
 void renogySetData(uint16_t *data)
 {
   int i = 0;
@@ -95,7 +92,12 @@ void renogyPollRs232Errors(void)
   
 }
 
-void renogyPollRs232Data(void)
+/**
+ * @brief Read the live data registers
+ *
+ * @return true the controller answered
+ */
+bool renogyPollRs232Data(void)
 {
   static uint32_t i;
   uint8_t j, result;
@@ -125,26 +127,146 @@ void renogyPollRs232Data(void)
   {
     MYLOG("RS232","Modbus error %d", result);
   }
-  
+  g_renogy_valid = result == node.ku8MBSuccess;
+  return g_renogy_valid;
+}
+
+/**
+ * @brief Switch the load output and read its state back
+ *        The controller only follows the switch register in manual load
+ *        mode, in the other modes the read back state differs.
+ *
+ * @param on true: load on
+ * @param state load state read back
+ * @return true both transactions succeeded
+ */
+bool renogyWriteLoad(bool on, bool *state)
+{
+  uint8_t result = node.writeSingleRegister(loadSwitchRegister, on ? 1 : 0);
+  if (result != node.ku8MBSuccess)
+  {
+    MYLOG("RS232","Load switch error %d", result);
+    return false;
+  }
+  result = node.readHoldingRegisters(loadStatusRegister, 1);
+  if (result != node.ku8MBSuccess)
+  {
+    MYLOG("RS232","Load status error %d", result);
+    return false;
+  }
+  *state = (node.getResponseBuffer(0) & RENOGY_LOAD_STATUS_ON) != 0;
+  return true;
 }
 
 void renogyPrintStatus(void)
 {
+  // The registers are in 0.1 V and 0.01 A already, only the decimal point is placed
+  char num[FX_STR_LEN];
+  (void)num; // only the logs use it
   MYLOG("RS232","Battery Capacity: %d", g_renogy_data.batt_capacity.val16);
-  MYLOG("RS232","Battery Voltage: %f", ((float)g_renogy_data.batt_voltage.val16 * 0.1));
-  MYLOG("RS232","Battery Charge Current: %f", ((float)g_renogy_data.batt_charge_current.val16 * 0.01));
+  MYLOG("RS232","Battery Voltage: %s", fx_str(num, g_renogy_data.batt_voltage.val16, 1));
+  MYLOG("RS232","Battery Charge Current: %s", fx_str(num, g_renogy_data.batt_charge_current.val16, 2));
   MYLOG("RS232","Battery Temperature: %d", (g_renogy_data.temp.val8[0]));
   MYLOG("RS232","Control Temperature: %d", (g_renogy_data.temp.val8[1]));
-  MYLOG("RS232","Load Voltage: %f", ((float)g_renogy_data.load_voltage.val16 * 0.1));
-  MYLOG("RS232","Load Current: %f", ((float)g_renogy_data.load_current.val16 * 0.01));
+  MYLOG("RS232","Load Voltage: %s", fx_str(num, g_renogy_data.load_voltage.val16, 1));
+  MYLOG("RS232","Load Current: %s", fx_str(num, g_renogy_data.load_current.val16, 2));
   MYLOG("RS232","Load Power: %d", g_renogy_data.load_power.val16);
-  MYLOG("RS232","Panel Voltage: %f", ((float)g_renogy_data.panel_voltage.val16 * 0.1));
-  MYLOG("RS232","Panel Current: %f", ((float)g_renogy_data.panel_current.val16 * 0.01));
+  MYLOG("RS232","Panel Voltage: %s", fx_str(num, g_renogy_data.panel_voltage.val16, 1));
+  MYLOG("RS232","Panel Current: %s", fx_str(num, g_renogy_data.panel_current.val16, 2));
   MYLOG("RS232","Panel Power: %d", g_renogy_data.panel_power.val16);
   MYLOG("RS232","Error Status 1: 0x%02X", g_renogy_data.error_status_1.val16);
   MYLOG("RS232","Error Status 2: 0x%02X", g_renogy_data.error_status_2.val16);
 }
 
+static_assert(sizeof(renogy_data_s) == RENOGY_PAYLOAD_LEN, "renogy_data_s does not match RENOGY_PAYLOAD_LEN");
+
+/**
+ * @brief Pick the charge controller backend from g_app_config.charger
+ *        CHARGER_AUTO listens for a VE.Direct block first, the Renogy
+ *        controller only talks when asked.
+ *
+ */
+void charger_select(void)
+{
+  APP_UART.end();
+  g_charger = g_app_config.charger;
+  if (g_charger == CHARGER_AUTO)
+  {
+    g_charger = vedirect_detect() ? CHARGER_VEDIRECT : CHARGER_RENOGY;
+  }
+  if (g_charger == CHARGER_RENOGY)
+  {
+    init_renogy_rs232();
+  }
+  MYLOG("RS232", "Charge controller %s", g_charger == CHARGER_VEDIRECT ? "VE.Direct" : "Renogy");
+}
+
+/**
+ * @brief Sensor registry init function
+ *
+ */
+static bool renogy_init(void)
+{
+  charger_select();
+  return (g_charger == CHARGER_VEDIRECT) || APP_UART;
+}
+
+/**
+ * @brief Read the charge controller: the Renogy registers in the configured
+ *        poll set, or one VE.Direct block
+ *
+ */
+void renogy_sample(void)
+{
+  if (g_charger == CHARGER_VEDIRECT)
+  {
+    vedirect_sample();
+    return;
+  }
+  bool answered = true;
+  if (g_app_config.renogy_poll & RENOGY_POLL_DATA)
+  {
+    answered = renogyPollRs232Data();
+  }
+  // No second timeout on a silent line, no second poll after a slow one used up the budget
+  if ((g_app_config.renogy_poll & RENOGY_POLL_ERRORS) && answered && !supervisor_expired())
+  {
+    renogyPollRs232Errors();
+  }
+#if MY_DEBUG == 1
+  renogyPrintStatus();
+#endif
+  //MYLOG("RS232", "Renogy Error Status: %s", renogyDecodeErrorStatus());
+}
+
+/**
+ * @brief Payload: renogy_data_s, starts with 0x0C02
+ *
+ * @param buf payload slot
+ * @param len slot length, RENOGY_PAYLOAD_LEN
+ * @return uint8_t bytes written, 0 if the slot is too short
+ */
+uint8_t renogy_encode(uint8_t *buf, uint8_t len)
+{
+  if (len < sizeof(renogy_data_s))
+  {
+    return 0;
+  }
+  memcpy(buf, &g_renogy_data, sizeof(renogy_data_s));
+  return sizeof(renogy_data_s);
+}
+
+/**
+ * @brief Supervisor recovery: close the UART, select and open the backend again
+ *
+ */
+static void renogy_recover(void)
+{
+  charger_select();
+}
+
+const sensor_driver_s renogy_sensor = {"Renogy", renogy_init, renogy_sample, renogy_encode, SENSOR_ALWAYS, RENOGY_BUDGET_MS, renogy_recover, 0};
+
 /* 
 Renogy Wanderer Error Codes
 
@@ -164,7 +286,7 @@ Read more: https://manuals.plus/renogy/solar-charge-controller-manual#ixzz7baexK
 */
 
 #define RENOGY_MAX_ERROR_CODE 14
-const char *renogyErrorCodes[] = {
+static const char *const renogyErrorCodes[] = {
     "No error detected",
     "Battery over-discharged",
     "Battery over-voltage",
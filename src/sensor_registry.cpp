@@ -0,0 +1,116 @@
+/**
+ * @file sensor_registry.cpp
+ * @brief Driver table and dispatch for the sensors in SENSOR_REGISTRY
+ * @version 0.1
+ * @date 2022-10-15
+ */
+#include "app.h"
+#include "zero_heap.h"
+
+#define SENSOR_X_DRIVER(name, packet, len, uid) &name##_sensor,
+
+/** The driver table, in payload order */
+const sensor_driver_s *const g_sensors[] = {SENSOR_REGISTRY(SENSOR_X_DRIVER) NULL};
+static_assert(SENSOR_UID_COUNT <= 8 * sizeof(g_app_config.sensor_off), "app_config_s::sensor_off has one bit per uid");
+
+/** Result of each driver's init */
+bool g_sensor_ok[SENSOR_COUNT + 1];
+/** The boot probe found the driver's module, or it needs none */
+bool g_sensor_fitted[SENSOR_COUNT + 1];
+
+RAM_BUDGET(SENSORS, sizeof(g_sensors) + sizeof(g_sensor_ok) + sizeof(g_sensor_fitted), 64);
+
+/**
+ * @brief Initialize all registered sensors
+ *        Call after init_i2c_probe(), sensors of modules not found are left out.
+ *
+ * @return true every fitted sensor is working
+ */
+bool sensors_init(void)
+{
+	bool all_ok = true;
+	for (uint8_t id = 0; id < SENSOR_COUNT; id++)
+	{
+		const sensor_driver_s *sensor = g_sensors[id];
+		g_sensor_fitted[id] = (sensor->module == 0) || i2c_module_found(sensor->module);
+		if (!supervisor_allowed(id))
+		{
+			g_sensor_ok[id] = false;
+			all_ok = all_ok && !g_sensor_fitted[id];
+			MYLOG("APP", "%s left out, hung twice", sensor->name);
+			continue;
+		}
+		if (!g_sensor_fitted[id])
+		{
+			g_sensor_ok[id] = false;
+			MYLOG("APP", "%s not fitted", sensor->name);
+			continue;
+		}
+		supervisor_begin(id);
+		g_sensor_ok[id] = sensor->init ? sensor->init() : true;
+		supervisor_end();
+		MYLOG("APP", "Initialize %s: %s", sensor->name, g_sensor_ok[id] ? "success" : "failed");
+		all_ok = all_ok && g_sensor_ok[id];
+	}
+	return all_ok;
+}
+
+bool sensor_disabled(uint8_t id)
+{
+	return (g_app_config.sensor_off >> sensor_uid[id]) & 1;
+}
+
+/**
+ * @brief Sample all working sensors the energy budget allows
+ *
+ */
+void sensors_sample(void)
+{
+	for (uint8_t id = 0; id < SENSOR_COUNT; id++)
+	{
+		const sensor_driver_s *sensor = g_sensors[id];
+		if (!g_sensor_ok[id] || sensor_disabled(id))
+		{
+			continue;
+		}
+		if (((sensor->policy == SENSOR_COSTLY) && !energy_gnss_allowed()) ||
+			((sensor->policy == SENSOR_OPTIONAL) && !energy_optional_allowed()))
+		{
+			MYLOG("APP", "%s skipped, energy low", sensor->name);
+			continue;
+		}
+		TRACE_PHASE_BEGIN(TRACE_PHASE_SENSOR + id);
+		supervisor_begin(id);
+		sensor->sample();
+		supervisor_end();
+		TRACE_PHASE_END(TRACE_PHASE_SENSOR + id);
+	}
+}
+
+/**
+ * @brief Build one uplink packet from the last samples
+ *        Sensors switched off by a downlink command or not fitted are left out.
+ *
+ * @param packet PACKET_xxx
+ * @param buf at least packet_max_len() bytes
+ * @return uint16_t packet length, 0 if no sensor contributes to it
+ */
+uint16_t sensors_encode(uint8_t packet, uint8_t *buf)
+{
+	uint16_t len = 0;
+	for (uint8_t id = 0; id < SENSOR_COUNT; id++)
+	{
+		if (sensor_packet[id] != packet || sensor_disabled(id) || !g_sensor_fitted[id])
+		{
+			continue;
+		}
+		// The driver gets its slot only, a short or refused write leaves no gap
+		uint8_t written = g_sensors[id]->encode(&buf[len], sensor_len[id]);
+		if (written != sensor_len[id])
+		{
+			MYLOG("APP", "%s encoded %d bytes, registry says %d", g_sensors[id]->name, written, sensor_len[id]);
+		}
+		len += written;
+	}
+	return len;
+}
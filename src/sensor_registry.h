@@ -0,0 +1,170 @@
+/**
+ * @file sensor_registry.h
+ * @brief Compile time sensor registry
+ *        Every periodic sensor is one entry in SENSOR_REGISTRY. The entry
+ *        order is the payload order, the packet sizes of a fully fitted node
+ *        are computed at compile time and checked against the payload limit of
+ *        APP_DATA_RATE. The app event handler only walks the driver table.
+ *
+ *        To add a sensor: write a driver (init/sample/encode, see env.cpp),
+ *        define its payload length and ENABLE_ flag, add a SENSOR_ENTRY_ line
+ *        with the next free uid. A driver of a WisBlock I2C module names the
+ *        module, it is left out when the boot probe does not find it
+ *        (i2c_probe.cpp). The uid identifies the sensor in downlink commands
+ *        (config.cpp), it must not change between builds.
+ * @version 0.1
+ * @date 2022-10-15
+ */
+
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+#include <stdint.h>
+
+/** Energy policy of a sensor, see energy.cpp */
+enum sensor_policy_e
+{
+	SENSOR_ALWAYS = 0, // sampled every cycle
+	SENSOR_COSTLY,	   // skipped when energy_gnss_allowed() says no
+	SENSOR_OPTIONAL,   // only when energy_optional_allowed()
+};
+
+/** Uplink packets, sent in this order */
+enum sensor_packet_e
+{
+	PACKET_TRACKER = 0, // GNSS, battery, environment, vibration
+	PACKET_RENOGY,		// charge controller
+	PACKET_COUNT
+};
+
+/** One sensor driver */
+struct sensor_driver_s
+{
+	const char *name;
+	/** Initialize the hardware, NULL if there is nothing to do */
+	bool (*init)(void);
+	/** Read the sensor into the driver's own storage */
+	void (*sample)(void);
+	/** Write channel, type and value to buf, at most len bytes, returns the bytes written, 0 if they do not fit */
+	uint8_t (*encode)(uint8_t *buf, uint8_t len);
+	sensor_policy_e policy;
+	/** Longest init or sample, the supervisor counts an overrun beyond it (supervisor.cpp) */
+	uint32_t budget_ms;
+	/** Bring a stuck peripheral back after an overrun, NULL if there is nothing to reset */
+	void (*recover)(void);
+	/** I2C_MODULE_xxx the driver needs (i2c_probe.cpp), 0 if it is always fitted */
+	uint8_t module;
+};
+
+/** Payload footprint of each driver, including the 2 byte channel/type header */
+#define GNSS_PAYLOAD_LEN 11	  // 0x0188 lat, long, alt, 3 bytes each
+#define BATT_PAYLOAD_LEN 10	  // 0x0802 battery voltage, 0x1102 voltage under TX, internal resistance
+#define ENV_PAYLOAD_LEN 7	  // 0x0768 humidity, 0x0267 temperature
+#define VIB_PAYLOAD_LEN 9	  // 0x0E71 vibration features
+#define RENOGY_PAYLOAD_LEN 26 // 0x0C02 renogy_data_s
+
+/** Time budget of each driver, the watchdog timeout in supervisor.cpp covers all of them in one cycle */
+#define GNSS_BUDGET_MS 65000  // 1 s power up, 60 s search, 1 s after a failed search, power down
+#define BATT_BUDGET_MS 100	  // one 256x oversampled SAADC reading, ~11 ms
+#define ENV_BUDGET_MS 200	  // SHTC3 wake, measure, sleep, ~15 ms
+#define VIB_BUDGET_MS 1500	  // 128 samples at 400 Hz, at most 1 s of FIFO reads
+#define RENOGY_BUDGET_MS 3000 // two Modbus reads, or one VE.Direct capture of 2.5 s
+
+/** X(name, packet, payload length, uid), name##_sensor is the driver */
+#ifdef ENABLE_GNSS
+#define SENSOR_ENTRY_GNSS(X) X(gnss, PACKET_TRACKER, GNSS_PAYLOAD_LEN, 0)
+#else
+#define SENSOR_ENTRY_GNSS(X)
+#endif
+#define SENSOR_ENTRY_BATT(X) X(batt, PACKET_TRACKER, BATT_PAYLOAD_LEN, 1)
+#ifdef ENABLE_ENV_MON
+#define SENSOR_ENTRY_ENV(X) X(env, PACKET_TRACKER, ENV_PAYLOAD_LEN, 2)
+#else
+#define SENSOR_ENTRY_ENV(X)
+#endif
+#ifdef ENABLE_VIBRATION
+#define SENSOR_ENTRY_VIB(X) X(vib, PACKET_TRACKER, VIB_PAYLOAD_LEN, 3)
+#else
+#define SENSOR_ENTRY_VIB(X)
+#endif
+#ifdef ENABLE_RS232
+#define SENSOR_ENTRY_RENOGY(X) X(renogy, PACKET_RENOGY, RENOGY_PAYLOAD_LEN, 4)
+#else
+#define SENSOR_ENTRY_RENOGY(X)
+#endif
+
+#define SENSOR_REGISTRY(X) \
+	SENSOR_ENTRY_GNSS(X)   \
+	SENSOR_ENTRY_BATT(X)   \
+	SENSOR_ENTRY_ENV(X)    \
+	SENSOR_ENTRY_VIB(X)    \
+	SENSOR_ENTRY_RENOGY(X)
+
+#define SENSOR_X_ID(name, packet, len, uid) SENSOR_##name,
+#define SENSOR_X_PACKET(name, packet, len, uid) packet,
+#define SENSOR_X_LEN(name, packet, len, uid) len,
+#define SENSOR_X_UID(name, packet, len, uid) uid,
+#define SENSOR_X_EXTERN(name, packet, len, uid) extern const sensor_driver_s name##_sensor;
+
+/** Highest uid + 1 */
+#define SENSOR_UID_COUNT 5
+
+/** Sensor index in the driver table */
+enum sensor_id_e
+{
+	SENSOR_REGISTRY(SENSOR_X_ID)
+		SENSOR_COUNT
+};
+
+SENSOR_REGISTRY(SENSOR_X_EXTERN)
+
+/** Packet and payload length per sensor, one dummy entry so the arrays are never empty */
+constexpr uint8_t sensor_packet[] = {SENSOR_REGISTRY(SENSOR_X_PACKET) PACKET_COUNT};
+constexpr uint8_t sensor_len[] = {SENSOR_REGISTRY(SENSOR_X_LEN) 0};
+constexpr uint8_t sensor_uid[] = {SENSOR_REGISTRY(SENSOR_X_UID) SENSOR_UID_COUNT};
+
+/** Bytes of packet pkt taken by the sensors before id */
+constexpr uint16_t packet_bytes_before(uint8_t pkt, uint8_t id)
+{
+	return id == 0 ? 0 : packet_bytes_before(pkt, id - 1) + (sensor_packet[id - 1] == pkt ? sensor_len[id - 1] : 0);
+}
+
+/** Total length of a packet */
+constexpr uint16_t packet_len(uint8_t pkt)
+{
+	return packet_bytes_before(pkt, SENSOR_COUNT);
+}
+
+/** Length of the largest packet */
+constexpr uint16_t packet_max_len(uint8_t pkt = 0)
+{
+	return pkt >= PACKET_COUNT ? 0 : (packet_len(pkt) > packet_max_len(pkt + 1) ? packet_len(pkt) : packet_max_len(pkt + 1));
+}
+
+/** US915 maximum application payload per data rate, DR0 .. DR4 */
+constexpr uint16_t lorawan_max_payload(uint8_t dr)
+{
+	return dr == 0 ? 11 : dr == 1 ? 53 : dr == 2 ? 125 : 242;
+}
+
+static_assert(packet_len(PACKET_TRACKER) <= lorawan_max_payload(APP_DATA_RATE), "Tracker packet too big for APP_DATA_RATE");
+static_assert(packet_len(PACKET_RENOGY) <= lorawan_max_payload(APP_DATA_RATE), "Renogy packet too big for APP_DATA_RATE");
+
+#define TRACKER_DATA_LEN packet_len(PACKET_TRACKER)
+#define RENOGY_DATA_LEN packet_len(PACKET_RENOGY)
+
+/** The driver table */
+extern const sensor_driver_s *const g_sensors[];
+/** Result of each driver's init */
+extern bool g_sensor_ok[];
+/** The boot probe found the driver's module, or it needs none */
+extern bool g_sensor_fitted[];
+
+/** true if a downlink command switched the sensor off */
+bool sensor_disabled(uint8_t id);
+
+bool sensors_init(void);
+void sensors_sample(void);
+uint16_t sensors_encode(uint8_t packet, uint8_t *buf);
+
+#endif
@@ -0,0 +1,279 @@
+/**
+ * @file supervisor.cpp
+ * @brief Time budgets of the sensor phases and the hardware watchdog
+ *        Every init and sample of a registry driver is a phase with the
+ *        driver's budget_ms. Loops that wait on a peripheral can ask
+ *        supervisor_expired() and give up early. A phase that returns beyond
+ *        its budget is counted as an overrun and the driver's recover()
+ *        resets the peripheral: the sample of that cycle is lost, the next
+ *        one starts clean.
+ *
+ *        A phase that never returns (an I2C slave holding SDA, the TWIM
+ *        waiting for a STOP that never comes) cannot be stopped from the app
+ *        task. The watchdog is fed only at the end of a wake in which every
+ *        phase returned, and the phase in progress is kept in a register that
+ *        survives the watchdog reset. At the next boot the overrun is counted
+ *        for that phase and its recover() runs before the drivers are
+ *        initialized. A second watchdog reset in the same phase in a row
+ *        leaves that sensor out until the next reset.
+ *
+ *        The watchdog pauses while the CPU sleeps, so its timeout is awake
+ *        time: longer than all budgets of one cycle together, and
+ *        independent of the send interval.
+ * @version 0.1
+ * @date 2022-12-31
+ */
+#include "app.h"
+#include <Wire.h>
+#ifdef NRF52_SERIES
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+#endif
+#include "zero_heap.h"
+
+/** Awake time without a completed cycle until the watchdog resets the node */
+#define SUPERVISOR_WDT_MS 120000
+static_assert(SUPERVISOR_WDT_MS > GNSS_BUDGET_MS + BATT_BUDGET_MS + ENV_BUDGET_MS + VIB_BUDGET_MS + RENOGY_BUDGET_MS + 10000,
+			  "Watchdog timeout shorter than the sensor budgets of one cycle");
+
+/** Retained byte: low nibble uid + 1 of the phase in progress, high nibble uid + 1 of the last watchdog reset */
+#define SUPERVISOR_PHASE(v) ((v)&0x0F)
+#define SUPERVISOR_SUSPECT(v) ((v) >> 4)
+static_assert(SENSOR_UID_COUNT < 0x0F, "uid + 1 has to fit a nibble");
+
+/** Flash record of the overrun counters */
+#define SUPERVISOR_FILE "/sup_cnt"
+#define SUPERVISOR_MAGIC 0x53555031 // "SUP1"
+
+struct supervisor_record_s
+{
+	uint32_t magic;
+	uint16_t overruns[SENSOR_UID_COUNT];
+};
+
+/** Overruns per sensor uid, budget exceeded or watchdog reset */
+uint16_t g_supervisor_overruns[SENSOR_UID_COUNT];
+
+/** Phase in progress, SENSOR_COUNT if none */
+uint8_t supervisor_id = SENSOR_COUNT;
+uint32_t supervisor_start = 0;
+/** uid + 1 of the sensor behind the last watchdog reset, 0 if none */
+uint8_t supervisor_suspect = 0;
+/** Sensor left out after two watchdog resets in a row, SENSOR_COUNT if none */
+uint8_t supervisor_skip = SENSOR_COUNT;
+/** Watchdog running */
+bool supervisor_wdt = false;
+
+RAM_BUDGET(SUPERVISOR, sizeof(g_supervisor_overruns) + sizeof(supervisor_id) + sizeof(supervisor_start) + sizeof(supervisor_suspect) + sizeof(supervisor_skip) + sizeof(supervisor_wdt), 32);
+
+/**
+ * @brief Keep the counters, only written after an overrun
+ *
+ */
+static void supervisor_save(void)
+{
+#ifdef NRF52_SERIES
+	supervisor_record_s rec;
+	rec.magic = SUPERVISOR_MAGIC;
+	memcpy(rec.overruns, g_supervisor_overruns, sizeof(rec.overruns));
+
+	File file(InternalFS);
+	InternalFS.remove(SUPERVISOR_FILE);
+	if (file.open(SUPERVISOR_FILE, FILE_O_WRITE))
+	{
+		file.write((const uint8_t *)&rec, sizeof(rec));
+		file.close();
+	}
+#endif
+}
+
+static void supervisor_load(void)
+{
+	memset(g_supervisor_overruns, 0, sizeof(g_supervisor_overruns));
+#ifdef NRF52_SERIES
+	File file(InternalFS);
+	if (file.open(SUPERVISOR_FILE, FILE_O_READ))
+	{
+		supervisor_record_s rec;
+		if ((file.read((uint8_t *)&rec, sizeof(rec)) == (int)sizeof(rec)) && (rec.magic == SUPERVISOR_MAGIC))
+		{
+			memcpy(g_supervisor_overruns, rec.overruns, sizeof(g_supervisor_overruns));
+		}
+		file.close();
+	}
+#endif
+}
+
+/** Registry index of a uid, SENSOR_COUNT if this build does not have it */
+static uint8_t supervisor_sensor(uint8_t uid)
+{
+	for (uint8_t id = 0; id < SENSOR_COUNT; id++)
+	{
+		if (sensor_uid[id] == uid)
+		{
+			return id;
+		}
+	}
+	return SENSOR_COUNT;
+}
+
+/**
+ * @brief Count the overrun of a sensor and bring its peripheral back
+ *
+ */
+static void supervisor_overrun(uint8_t id)
+{
+	uint8_t uid = sensor_uid[id];
+	if (g_supervisor_overruns[uid] != 0xFFFF)
+	{
+		g_supervisor_overruns[uid]++;
+	}
+	supervisor_save();
+	if (g_sensors[id]->recover)
+	{
+		g_sensors[id]->recover();
+	}
+}
+
+/**
+ * @brief Count a phase the watchdog cut short, start the watchdog
+ *        Call after init_config() (the flash is mounted) and before sensors_init().
+ *
+ */
+void init_supervisor(void)
+{
+	supervisor_load();
+	uint8_t retained = wdt_retained();
+	supervisor_id = SENSOR_COUNT;
+	supervisor_suspect = 0;
+	supervisor_skip = SENSOR_COUNT;
+	if (wdt_caused_reset() && SUPERVISOR_PHASE(retained))
+	{
+		uint8_t id = supervisor_sensor(SUPERVISOR_PHASE(retained) - 1);
+		if (id < SENSOR_COUNT)
+		{
+			if (SUPERVISOR_SUSPECT(retained) == SUPERVISOR_PHASE(retained))
+			{
+				// Hung again after its recovery, leave it out until the next reset
+				supervisor_skip = id;
+			}
+			supervisor_suspect = SUPERVISOR_PHASE(retained);
+			MYLOG("SUP", "Watchdog reset in %s", g_sensors[id]->name);
+			supervisor_overrun(id);
+		}
+	}
+	wdt_retain(supervisor_suspect << 4);
+
+	for (uint8_t id = 0; id < SENSOR_COUNT; id++)
+	{
+		if (g_supervisor_overruns[sensor_uid[id]])
+		{
+			MYLOG("SUP", "%s: %d overruns", g_sensors[id]->name, g_supervisor_overruns[sensor_uid[id]]);
+		}
+	}
+	supervisor_wdt = wdt_start(SUPERVISOR_WDT_MS);
+	MYLOG("SUP", "Watchdog %s", supervisor_wdt ? "started" : "not available");
+}
+
+/**
+ * @brief A sensor phase starts, the watchdog reset knows it from here on
+ *
+ * @param id registry index
+ */
+void supervisor_begin(uint8_t id)
+{
+	supervisor_id = id;
+	supervisor_start = millis();
+	wdt_retain((supervisor_suspect << 4) | (sensor_uid[id] + 1));
+}
+
+/**
+ * @brief The phase in progress used up its budget, wait loops give up
+ *
+ * @return true stop waiting for the peripheral
+ */
+bool supervisor_expired(void)
+{
+	return (supervisor_id < SENSOR_COUNT) && (millis() - supervisor_start > g_sensors[supervisor_id]->budget_ms);
+}
+
+/**
+ * @brief The phase in progress returned, recover its peripheral if it took too long
+ *
+ * @return true within its budget
+ */
+bool supervisor_end(void)
+{
+	uint8_t id = supervisor_id;
+	if (id >= SENSOR_COUNT)
+	{
+		return true;
+	}
+	uint32_t took = millis() - supervisor_start;
+	supervisor_id = SENSOR_COUNT;
+	if (supervisor_suspect == sensor_uid[id] + 1)
+	{
+		// It returned, the last watchdog reset is history
+		supervisor_suspect = 0;
+	}
+	wdt_retain(supervisor_suspect << 4);
+	if (took <= g_sensors[id]->budget_ms)
+	{
+		return true;
+	}
+	MYLOG("SUP", "%s took %ld ms, budget %ld ms", g_sensors[id]->name, (long)took, (long)g_sensors[id]->budget_ms);
+	supervisor_overrun(id);
+	return false;
+}
+
+/**
+ * @brief Sensor not left out after repeated watchdog resets
+ *
+ * @param id registry index
+ */
+bool supervisor_allowed(uint8_t id)
+{
+	return id != supervisor_skip;
+}
+
+/**
+ * @brief End of a wake, feed the watchdog unless a phase is still open
+ *
+ */
+void supervisor_feed(void)
+{
+	if (supervisor_wdt && (supervisor_id >= SENSOR_COUNT))
+	{
+		wdt_feed();
+	}
+}
+
+/**
+ * @brief Recovery of the I2C sensors: clock a stuck slave free, STOP, restart the bus
+ *        A slave that was reset in the middle of a read holds SDA low
+ *        until it has shifted out the rest of its byte.
+ *
+ */
+void supervisor_i2c_recover(void)
+{
+	Wire.end();
+	pinMode(PIN_WIRE_SDA, INPUT_PULLUP);
+	pinMode(PIN_WIRE_SCL, OUTPUT);
+	digitalWrite(PIN_WIRE_SCL, HIGH);
+	for (uint8_t pulse = 0; (pulse < 9) && !digitalRead(PIN_WIRE_SDA); pulse++)
+	{
+		digitalWrite(PIN_WIRE_SCL, LOW);
+		delayMicroseconds(5);
+		digitalWrite(PIN_WIRE_SCL, HIGH);
+		delayMicroseconds(5);
+	}
+	// STOP: SDA rises while SCL is high
+	pinMode(PIN_WIRE_SDA, OUTPUT);
+	digitalWrite(PIN_WIRE_SDA, LOW);
+	delayMicroseconds(5);
+	digitalWrite(PIN_WIRE_SDA, HIGH);
+	delayMicroseconds(5);
+	Wire.begin();
+	Wire.setClock(400000);
+}
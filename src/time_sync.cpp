@@ -0,0 +1,382 @@
+/**
+ * @file time_sync.cpp
+ * @brief Device time: Unix time from the network or the GNSS, sample time stamps
+ *        The node counts its uptime in ms across the millis() wrap and keeps
+ *        one reference: the Unix time at an uptime. In between the time
+ *        runs on the uptime, corrected by the measured drift of the LFCLK
+ *        crystal.
+ *
+ *        Sources:
+ *        - LoRaWAN Application Layer Clock Synchronization (TS003) on
+ *          LORAWAN_CLOCK_PORT: AppTimeReq after the first TX cycle, hourly
+ *          until answered, then every 128 * 2^period s. The network server
+ *          answers with the correction in whole seconds. The DeviceTimeReq
+ *          MAC command would do the same, but the LoRaMAC helper of the
+ *          WisBlock-API does not expose it.
+ *        - GNSS: UTC date and time of a fix, to 10 ms (gnss.cpp). A fix
+ *          restarts the TS003 period.
+ *
+ *        Drift: the error of the prediction at a sync, over at least
+ *        TIME_DRIFT_MIN_S, corrects the drift estimate by a quarter. The one
+ *        second resolution of TS003 is 23 ppm over 12 h.
+ *
+ *        Every uplink ends with the time of its samples (0x1285, Cayenne LPP
+ *        Unix time, u32 big endian) once the clock is set. Backlog frames
+ *        carry the time of their last sample (batch_codec.h).
+ * @version 0.1
+ * @date 2022-12-31
+ */
+#include "app.h"
+#include "zero_heap.h"
+
+/** TS003 commands */
+#define CLOCK_PACKAGE_VERSION 0x00
+#define CLOCK_APP_TIME 0x01
+#define CLOCK_PERIODICITY 0x02
+#define CLOCK_FORCE_RESYNC 0x03
+#define CLOCK_PACKAGE_ID 1
+#define CLOCK_PACKAGE_VER 1
+/** AppTimeReq Param: the server answers even without a correction */
+#define CLOCK_ANS_REQUIRED 0x10
+#define CLOCK_REQ_LEN 6
+/** Default request period, 128 * 2^9 s = 18.2 h */
+#define TIME_PERIOD_DEFAULT 9
+/** Unanswered request, next try after, s */
+#define TIME_RETRY_S 3600
+/** GPS epoch 1980-01-06 as Unix time, GPS - UTC leap seconds since 2017 */
+#define TIME_GPS_EPOCH 315964800
+#define TIME_GPS_LEAP_S 18
+/** Shortest interval between two syncs that updates the drift, s */
+#define TIME_DRIFT_MIN_S 43200
+/** Larger errors are steps, not drift, and the estimate stays within, ppm */
+#define TIME_DRIFT_MAX_PPM 200
+/** Answers of one downlink */
+#define TIME_ANSWER_MAX 16
+
+/** Crystal drift estimate, ppb, positive: the uptime runs slow */
+int32_t g_time_drift_ppb = 0;
+
+/** Uptime across the millis() wrap */
+uint64_t time_clock_ms = 0;
+uint32_t time_clock_last = 0;
+/** Unix time in ms at uptime time_ref_up */
+int64_t time_ref_unix = 0;
+uint64_t time_ref_up = 0;
+bool time_valid = false;
+
+/** TS003 state */
+uint8_t time_token = 0;
+uint8_t time_period = TIME_PERIOD_DEFAULT;
+/** Forced requests left */
+uint8_t time_resync = 0;
+/** Request out, no answer yet */
+bool time_requested = false;
+/** Uptime and DeviceTime of the last request */
+uint64_t time_req_up = 0;
+uint32_t time_req_gps = 0;
+uint16_t time_req_frac = 0;
+/** Answers to the last downlink */
+uint8_t time_answer[TIME_ANSWER_MAX];
+uint8_t time_answer_len = 0;
+
+RAM_BUDGET(TIME, sizeof(g_time_drift_ppb) + sizeof(time_clock_ms) + sizeof(time_clock_last) + sizeof(time_ref_unix) + sizeof(time_ref_up) + sizeof(time_valid) + sizeof(time_token) + sizeof(time_period) + sizeof(time_resync) + sizeof(time_requested) + sizeof(time_req_up) + sizeof(time_req_gps) + sizeof(time_req_frac) + sizeof(time_answer) + sizeof(time_answer_len), 96);
+
+/**
+ * @brief ms since boot, call at least once per millis() wrap (49 days)
+ *
+ */
+uint64_t time_uptime_ms(void)
+{
+	uint32_t now = millis();
+	time_clock_ms += now - time_clock_last;
+	time_clock_last = now;
+	return time_clock_ms;
+}
+
+uint32_t time_uptime_s(void)
+{
+	return (uint32_t)(time_uptime_ms() / 1000);
+}
+
+bool time_is_set(void)
+{
+	return time_valid;
+}
+
+/** Unix time in ms at an uptime, drift corrected */
+static int64_t time_unix_ms(uint64_t up)
+{
+	int64_t elapsed = (int64_t)(up - time_ref_up);
+	return time_ref_unix + elapsed + elapsed * g_time_drift_ppb / 1000000000;
+}
+
+/**
+ * @brief Unix time of an earlier time_uptime_s()
+ *
+ * @return uint32_t s, 0 if the clock is not set
+ */
+uint32_t time_unix_at(uint32_t uptime_s)
+{
+	if (!time_valid)
+	{
+		return 0;
+	}
+	return (uint32_t)(time_unix_ms((uint64_t)uptime_s * 1000) / 1000);
+}
+
+uint32_t time_unix(void)
+{
+	if (!time_valid)
+	{
+		return 0;
+	}
+	return (uint32_t)(time_unix_ms(time_uptime_ms()) / 1000);
+}
+
+/**
+ * @brief Take a time from a source, learn the drift from the error of the prediction
+ *
+ * @param up uptime the time belongs to, ms
+ * @param unix_ms Unix time at that uptime, ms
+ */
+static void time_sync(uint64_t up, int64_t unix_ms, const char *source)
+{
+	if (time_valid)
+	{
+		int64_t error = unix_ms - time_unix_ms(up);
+		int64_t interval = (int64_t)(up - time_ref_up);
+		if ((interval >= (int64_t)TIME_DRIFT_MIN_S * 1000) && ((error < 0 ? -error : error) * 1000000 <= interval * TIME_DRIFT_MAX_PPM))
+		{
+			int64_t drift = g_time_drift_ppb + error * 1000000000 / interval / 4;
+			drift = drift > TIME_DRIFT_MAX_PPM * 1000 ? TIME_DRIFT_MAX_PPM * 1000 : drift;
+			drift = drift < -TIME_DRIFT_MAX_PPM * 1000 ? -TIME_DRIFT_MAX_PPM * 1000 : drift;
+			g_time_drift_ppb = (int32_t)drift;
+		}
+		MYLOG("TIME", "%s: off by %ld ms, drift %ld ppb", source, (long)error, (long)g_time_drift_ppb);
+	}
+	else
+	{
+		MYLOG("TIME", "%s: clock set", source);
+	}
+	(void)source;
+	time_ref_unix = unix_ms;
+	time_ref_up = up;
+	time_valid = true;
+}
+
+/** Days since 1970-01-01 of a Gregorian date */
+static int32_t time_days(uint16_t year, uint8_t month, uint8_t day)
+{
+	int32_t y = (int32_t)year - (month <= 2 ? 1 : 0);
+	int32_t era = y / 400;
+	int32_t yoe = y - era * 400;
+	int32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+/**
+ * @brief UTC of a GNSS fix
+ *
+ * @param age_ms time since the receiver sent it
+ */
+void time_gnss_fix(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second, uint8_t centisecond, uint32_t age_ms)
+{
+	// Before its first fix the receiver counts from a default date
+	if ((year < 2022) || (month < 1) || (month > 12) || (day < 1) || (day > 31))
+	{
+		return;
+	}
+	int64_t unix_s = (int64_t)time_days(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+	time_sync(time_uptime_ms() - age_ms, unix_s * 1000 + centisecond * 10, "GNSS");
+	// Synced, the next AppTimeReq after a full period
+	time_req_up = time_ref_up;
+	time_requested = false;
+}
+
+/**
+ * @brief Samples time, channel 0x1285
+ *
+ * @param buf TIME_PAYLOAD_LEN bytes
+ * @return uint8_t bytes written, 0 if the clock is not set
+ */
+uint8_t time_encode(uint8_t *buf)
+{
+	if (!time_valid)
+	{
+		return 0;
+	}
+	uint32_t now = time_unix();
+	buf[0] = 0x12;
+	buf[1] = 0x85;
+	buf[2] = (uint8_t)(now >> 24);
+	buf[3] = (uint8_t)(now >> 16);
+	buf[4] = (uint8_t)(now >> 8);
+	buf[5] = (uint8_t)now;
+	return TIME_PAYLOAD_LEN;
+}
+
+/** DeviceTime of TS003: GPS s, from the uptime while the clock is not set */
+static uint32_t time_gps(uint64_t up, uint16_t *frac_ms)
+{
+	int64_t ms = time_valid ? time_unix_ms(up) - ((int64_t)TIME_GPS_EPOCH - TIME_GPS_LEAP_S) * 1000 : (int64_t)up;
+	*frac_ms = (uint16_t)(ms % 1000);
+	return (uint32_t)(ms / 1000);
+}
+
+static void time_put_u32(uint8_t *buf, uint32_t v)
+{
+	buf[0] = (uint8_t)v;
+	buf[1] = (uint8_t)(v >> 8);
+	buf[2] = (uint8_t)(v >> 16);
+	buf[3] = (uint8_t)(v >> 24);
+}
+
+static void time_answer_add(const uint8_t *buf, uint8_t len)
+{
+	if (time_answer_len + len <= TIME_ANSWER_MAX)
+	{
+		memcpy(&time_answer[time_answer_len], buf, len);
+		time_answer_len += len;
+	}
+}
+
+/**
+ * @brief Handle a downlink on LORAWAN_CLOCK_PORT, answers go out with time_send()
+ *
+ */
+void time_command(const uint8_t *buf, uint8_t len)
+{
+	time_answer_len = 0;
+	uint8_t idx = 0;
+	while (idx < len)
+	{
+		switch (buf[idx])
+		{
+		case CLOCK_PACKAGE_VERSION:
+		{
+			uint8_t ans[3] = {CLOCK_PACKAGE_VERSION, CLOCK_PACKAGE_ID, CLOCK_PACKAGE_VER};
+			time_answer_add(ans, sizeof(ans));
+			idx += 1;
+			break;
+		}
+		case CLOCK_APP_TIME:
+		{
+			if (idx + 6 > len)
+			{
+				return;
+			}
+			int32_t correction = (int32_t)(buf[idx + 1] | (buf[idx + 2] << 8) | (buf[idx + 3] << 16) | ((uint32_t)buf[idx + 4] << 24));
+			uint8_t token = buf[idx + 5] & 0x0F;
+			if (time_requested && (token == time_token))
+			{
+				int64_t gps = (int64_t)time_req_gps + correction;
+				time_sync(time_req_up, (gps + TIME_GPS_EPOCH - TIME_GPS_LEAP_S) * 1000 + time_req_frac, "Network");
+				time_token = (time_token + 1) & 0x0F;
+				time_requested = false;
+			}
+			else
+			{
+				MYLOG("TIME", "AppTimeAns token %d, expected %d", token, time_token);
+			}
+			idx += 6;
+			break;
+		}
+		case CLOCK_PERIODICITY:
+		{
+			if (idx + 2 > len)
+			{
+				return;
+			}
+			time_period = buf[idx + 1] & 0x0F;
+			uint16_t frac;
+			uint8_t ans[6] = {CLOCK_PERIODICITY, 0};
+			time_put_u32(&ans[2], time_gps(time_uptime_ms(), &frac));
+			time_answer_add(ans, sizeof(ans));
+			MYLOG("TIME", "Request period %ld s", (long)(128L << time_period));
+			idx += 2;
+			break;
+		}
+		case CLOCK_FORCE_RESYNC:
+		{
+			if (idx + 2 > len)
+			{
+				return;
+			}
+			time_resync = buf[idx + 1] & 0x07;
+			idx += 2;
+			break;
+		}
+		default:
+			// Unknown command, its length is unknown too
+			return;
+		}
+	}
+}
+
+/** AppTimeReq due: forced, unset clock or period over, not while one waits for its answer */
+static bool time_request_due(uint64_t up)
+{
+	uint64_t since = up - time_req_up;
+	if (time_requested && (since < (uint64_t)TIME_RETRY_S * 1000))
+	{
+		return false;
+	}
+	if (time_resync || !time_valid || time_requested)
+	{
+		return true;
+	}
+	return since >= ((uint64_t)128 << time_period) * 1000;
+}
+
+/**
+ * @brief Send pending answers and a due AppTimeReq, call when a TX cycle finished
+ *
+ * @return true a frame was enqueued, wait for its TX cycle
+ */
+bool time_send(void)
+{
+	uint8_t frame[TIME_ANSWER_MAX + CLOCK_REQ_LEN];
+	uint8_t len = time_answer_len;
+	memcpy(frame, time_answer, len);
+
+	uint64_t up = time_uptime_ms();
+	bool request = time_request_due(up);
+	uint16_t frac = 0;
+	uint32_t device_time = 0;
+	if (request)
+	{
+		device_time = time_gps(up, &frac);
+		frame[len] = CLOCK_APP_TIME;
+		time_put_u32(&frame[len + 1], device_time);
+		frame[len + 5] = CLOCK_ANS_REQUIRED | time_token;
+		len += CLOCK_REQ_LEN;
+	}
+	if (len == 0)
+	{
+		return false;
+	}
+	switch (TRACE_LORA_TX(frame, len, LORAWAN_CLOCK_PORT))
+	{
+	case LMH_SUCCESS:
+		time_answer_len = 0;
+		if (request)
+		{
+			time_requested = true;
+			time_req_up = up;
+			time_req_gps = device_time;
+			time_req_frac = frac;
+			if (time_resync)
+			{
+				time_resync--;
+			}
+			MYLOG("TIME", "AppTimeReq %ld, token %d", (long)device_time, time_token);
+		}
+		return true;
+	case LMH_BUSY:
+		return false;
+	default:
+		time_answer_len = 0;
+		return false;
+	}
+}
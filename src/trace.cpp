@@ -0,0 +1,433 @@
+/**
+ * @file trace.cpp
+ * @brief Peripheral trace recording, the hooks of trace.h
+ *        Records collect in trace_buf and are written out by TRACE_FLUSH()
+ *        at the end of every handler, or earlier when the buffer is full.
+ *        By default they go out over USB as TRACE_LINE_TAG lines between the
+ *        log output. With -DTRACE_TO_FLASH they are appended to TRACE_FILE
+ *        in the internal flash instead, up to TRACE_FILE_MAX bytes; the file
+ *        is dumped over USB and removed on the next boot.
+ *
+ *        Bytes read or written on the UART in a row are added to one record
+ *        as they come, so a Modbus reply costs a single record header.
+ * @version 0.1
+ * @date 2022-12-17
+ */
+#include "app.h"
+
+#ifdef ENABLE_TRACE
+#ifdef TRACE_TO_FLASH
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+#endif
+#include "zero_heap.h"
+
+/** Record buffer, the largest record is a wake with a full downlink */
+#define TRACE_BUF_SIZE 1024
+static_assert(TRACE_HEADER_MAX + TRACE_WAKE_HEADER + 256 <= TRACE_BUF_SIZE, "A downlink does not fit the trace buffer");
+
+/** Trace file of TRACE_TO_FLASH */
+#define TRACE_FILE "/trace"
+#define TRACE_FILE_MAX 16384
+
+/** Wake up reasons lora_data_handler() takes care of, app_event_handler() gets the rest */
+#define TRACE_LORA_EVENTS (LORA_DATA | LORA_TX_FIN | LORA_JOIN_FIN)
+#define TRACE_API_EVENTS (BLE_CONFIG | BLE_DATA | AT_CMD)
+
+/** Largest UART record, its length is always written as two varint bytes */
+#define TRACE_UART_RECORD_MAX 255
+
+/** Records not written out yet */
+uint8_t trace_buf[TRACE_BUF_SIZE];
+uint16_t trace_len = 0;
+/** Stream offset of trace_buf[0] */
+uint32_t trace_offset = 0;
+/** Time of the last record, the next one stores the difference */
+uint32_t trace_last_ms = 0;
+
+/** UART record that bytes are added to: type (0 none), position of its length, length */
+uint8_t trace_open_type = 0;
+uint16_t trace_open_pos = 0;
+uint8_t trace_open_len = 0;
+
+/** Last recorded TRACE_REC_UART_STATE */
+bool trace_uart_open = false;
+/** TRACE_TO_FLASH: the file is full, recording stopped */
+bool trace_stopped = false;
+
+/** micros() at TRACE_PHASE_BEGIN() */
+uint32_t trace_phase_start[TRACE_PHASE_MAX];
+
+/** Tee in front of Serial1, used through APP_UART */
+TraceUart g_trace_uart(Serial1);
+
+RAM_BUDGET(TRACE, sizeof(trace_buf) + sizeof(trace_len) + sizeof(trace_offset) + sizeof(trace_last_ms) + sizeof(trace_open_type) + sizeof(trace_open_pos) + sizeof(trace_open_len) + sizeof(trace_uart_open) + sizeof(trace_stopped) + sizeof(trace_phase_start) + sizeof(g_trace_uart), 1536);
+
+/**
+ * @brief Write trace bytes as TRACE_LINE_TAG lines to the USB serial
+ *
+ * @param offset stream offset of data[0]
+ */
+static void trace_usb_lines(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char line[TRACE_LINE_BYTES * 2 + 1];
+	for (uint32_t pos = 0; pos < len; pos += TRACE_LINE_BYTES)
+	{
+		uint32_t count = (len - pos) < TRACE_LINE_BYTES ? (len - pos) : TRACE_LINE_BYTES;
+		for (uint32_t idx = 0; idx < count; idx++)
+		{
+			line[2 * idx] = hex[data[pos + idx] >> 4];
+			line[2 * idx + 1] = hex[data[pos + idx] & 0x0F];
+		}
+		line[2 * count] = 0;
+		Serial.printf(TRACE_LINE_TAG "%lX %s\r\n", (unsigned long)(offset + pos), line);
+	}
+}
+
+/**
+ * @brief Write the buffered records out
+ *        Called at the end of every handler, the UART record in progress is closed.
+ *
+ */
+void trace_flush(void)
+{
+	trace_open_type = 0;
+	if (trace_len == 0)
+	{
+		return;
+	}
+#ifdef TRACE_TO_FLASH
+	File file(InternalFS);
+	if (!trace_stopped && file.open(TRACE_FILE, FILE_O_WRITE))
+	{
+		if (file.size() + trace_len > TRACE_FILE_MAX)
+		{
+			trace_stopped = true;
+			MYLOG("TRACE", "Trace file full, recording stopped");
+		}
+		else
+		{
+			file.write(trace_buf, trace_len);
+		}
+		file.close();
+	}
+#else
+	trace_usb_lines(trace_offset, trace_buf, trace_len);
+#endif
+	trace_offset += trace_len;
+	trace_len = 0;
+}
+
+/**
+ * @brief Room for a record of len bytes, written out first if needed
+ *
+ * @return bool false recording stopped
+ */
+static bool trace_reserve(uint16_t len)
+{
+	if (trace_stopped)
+	{
+		return false;
+	}
+	if (trace_len + TRACE_HEADER_MAX + len > TRACE_BUF_SIZE)
+	{
+		trace_flush();
+	}
+	return !trace_stopped;
+}
+
+/** Type and time of a record */
+static void trace_header(uint8_t type)
+{
+	uint32_t now = millis();
+	trace_buf[trace_len++] = type;
+	trace_len += trace_put_varint(&trace_buf[trace_len], now - trace_last_ms);
+	trace_last_ms = now;
+}
+
+/**
+ * @brief Start a record
+ *
+ * @param len data bytes, at most TRACE_BUF_SIZE - TRACE_HEADER_MAX
+ * @return uint8_t* where the data goes, NULL if recording stopped
+ */
+static uint8_t *trace_record(uint8_t type, uint16_t len)
+{
+	trace_open_type = 0;
+	if (!trace_reserve(len))
+	{
+		return NULL;
+	}
+	trace_header(type);
+	trace_len += trace_put_varint(&trace_buf[trace_len], len);
+	uint8_t *data = &trace_buf[trace_len];
+	trace_len += len;
+	return data;
+}
+
+/**
+ * @brief Add a byte to the UART record of this type, or start one
+ *
+ */
+static void trace_uart_byte(uint8_t type, uint8_t c)
+{
+	if ((trace_open_type != type) || (trace_open_len == TRACE_UART_RECORD_MAX) || (trace_len == TRACE_BUF_SIZE))
+	{
+		trace_open_type = 0;
+		if (!trace_reserve(1))
+		{
+			return;
+		}
+		trace_header(type);
+		trace_open_type = type;
+		trace_open_pos = trace_len;
+		trace_open_len = 0;
+		trace_len += 2;
+	}
+	trace_buf[trace_len++] = c;
+	trace_open_len++;
+	trace_buf[trace_open_pos] = (uint8_t)(trace_open_len | 0x80);
+	trace_buf[trace_open_pos + 1] = (uint8_t)(trace_open_len >> 7);
+}
+
+/**
+ * @brief Start recording, call first in init_app()
+ *        TRACE_TO_FLASH dumps the trace of the previous run first.
+ *
+ */
+void trace_init(void)
+{
+#ifdef TRACE_TO_FLASH
+	InternalFS.begin();
+	File file(InternalFS);
+	if (file.open(TRACE_FILE, FILE_O_READ))
+	{
+		MYLOG("TRACE", "Trace of the previous run");
+		uint32_t offset = 0;
+		int got;
+		while ((got = file.read(trace_buf, TRACE_BUF_SIZE)) > 0)
+		{
+			trace_usb_lines(offset, trace_buf, (uint32_t)got);
+			offset += (uint32_t)got;
+		}
+		file.close();
+		InternalFS.remove(TRACE_FILE);
+	}
+#endif
+	uint8_t *data = trace_record(TRACE_REC_BOOT, 3);
+	data[0] = 'T';
+	data[1] = 'R';
+	data[2] = TRACE_VERSION;
+}
+
+/**
+ * @brief The configuration loaded from flash, the replay starts with it
+ *
+ */
+void trace_config(void *config, uint8_t len)
+{
+	uint8_t *data = trace_record(TRACE_REC_CONFIG, len);
+	if (data)
+	{
+		memcpy(data, config, len);
+	}
+}
+
+/**
+ * @brief Entry of app_event_handler() or lora_data_handler()
+ *        Recorded only if there is something for the handler to do.
+ *
+ * @param handler TRACE_WAKE_APP or TRACE_WAKE_LORA
+ */
+void trace_wake(uint8_t handler)
+{
+	uint16_t events = g_task_event_type;
+	uint16_t mine = handler == TRACE_WAKE_LORA ? (events & TRACE_LORA_EVENTS) : (events & ~(TRACE_LORA_EVENTS | TRACE_API_EVENTS));
+	if (!mine)
+	{
+		return;
+	}
+	uint8_t rx_len = (handler == TRACE_WAKE_LORA) && (events & LORA_DATA) ? g_rx_data_len : 0;
+	uint8_t *data = trace_record(TRACE_REC_WAKE, TRACE_WAKE_HEADER + rx_len);
+	if (!data)
+	{
+		return;
+	}
+	data[0] = handler;
+	data[1] = (uint8_t)events;
+	data[2] = (uint8_t)(events >> 8);
+	data[3] = g_last_fport;
+	data[4] = (uint8_t)g_last_rssi;
+	data[5] = (uint8_t)(g_last_rssi >> 8);
+	data[6] = (uint8_t)g_last_snr;
+	data[7] = (g_rx_fin_result ? TRACE_WAKE_RX_FIN : 0) | (g_join_result ? TRACE_WAKE_JOIN : 0);
+	memcpy(&data[TRACE_WAKE_HEADER], g_rx_lora_data, rx_len);
+}
+
+void trace_phase_begin(uint8_t phase)
+{
+	if (phase < TRACE_PHASE_MAX)
+	{
+		trace_phase_start[phase] = micros();
+	}
+}
+
+void trace_phase_end(uint8_t phase)
+{
+	if (phase >= TRACE_PHASE_MAX)
+	{
+		return;
+	}
+	uint8_t us[5];
+	uint8_t us_len = trace_put_varint(us, micros() - trace_phase_start[phase]);
+	uint8_t *data = trace_record(TRACE_REC_PHASE, 1 + us_len);
+	if (data)
+	{
+		data[0] = phase;
+		memcpy(&data[1], us, us_len);
+	}
+}
+
+/**
+ * @brief Result of a sensor read over I2C
+ *
+ * @param addr 7 bit address
+ * @param reg register or command
+ * @param status driver result
+ * @param data what was read
+ * @return uint8_t status
+ */
+uint8_t trace_i2c_read(uint8_t addr, uint8_t reg, uint8_t status, uint8_t *data, uint8_t len)
+{
+	uint8_t *rec = trace_record(TRACE_REC_I2C_READ, 3 + len);
+	if (rec)
+	{
+		rec[0] = addr;
+		rec[1] = reg;
+		rec[2] = status;
+		if (len)
+		{
+			memcpy(&rec[3], data, len);
+		}
+	}
+	return status;
+}
+
+/**
+ * @brief Raw SAADC results
+ *
+ * @return uint16_t count
+ */
+uint16_t trace_adc(int16_t *raw, uint16_t count)
+{
+	uint8_t *data = trace_record(TRACE_REC_ADC, 2 * count);
+	if (data)
+	{
+		for (uint16_t idx = 0; idx < count; idx++)
+		{
+			data[2 * idx] = (uint8_t)raw[idx];
+			data[2 * idx + 1] = (uint8_t)(raw[idx] >> 8);
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief send_lora_packet() with its payload and result
+ *
+ */
+lmh_error_status trace_lora_tx(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	lmh_error_status result = send_lora_packet(data, size, fport);
+	uint8_t *rec = trace_record(TRACE_REC_LORA_TX, 2 + size);
+	if (rec)
+	{
+		rec[0] = fport;
+		rec[1] = (uint8_t)result;
+		memcpy(&rec[2], data, size);
+	}
+	return result;
+}
+
+/**
+ * @brief lmh_class_request() and its result
+ *
+ */
+lmh_error_status trace_lora_class(DeviceClass_t new_class)
+{
+	lmh_error_status result = lmh_class_request(new_class);
+	uint8_t *rec = trace_record(TRACE_REC_LORA_CLASS, 2);
+	if (rec)
+	{
+		rec[0] = new_class;
+		rec[1] = (uint8_t)result;
+	}
+	return result;
+}
+
+void trace_uart_begin(uint32_t baud)
+{
+	uint8_t *data = trace_record(TRACE_REC_UART_BEGIN, 4);
+	if (data)
+	{
+		data[0] = (uint8_t)baud;
+		data[1] = (uint8_t)(baud >> 8);
+		data[2] = (uint8_t)(baud >> 16);
+		data[3] = (uint8_t)(baud >> 24);
+	}
+}
+
+void trace_uart_end(void)
+{
+	trace_record(TRACE_REC_UART_END, 0);
+}
+
+/**
+ * @brief Port state as the core reports it, recorded when it changes
+ *
+ */
+bool trace_uart_state(bool open)
+{
+	if (open != trace_uart_open)
+	{
+		uint8_t *data = trace_record(TRACE_REC_UART_STATE, 1);
+		if (data)
+		{
+			data[0] = open;
+			trace_uart_open = open;
+		}
+	}
+	return open;
+}
+
+/** Polls are not recorded, only the bytes that were read */
+int trace_uart_available(int count)
+{
+	return count;
+}
+
+int trace_uart_read(int c)
+{
+	if (c >= 0)
+	{
+		trace_uart_byte(TRACE_REC_UART_RX, (uint8_t)c);
+	}
+	return c;
+}
+
+int trace_uart_peek(int c)
+{
+	return c;
+}
+
+void trace_uart_write(const uint8_t *buffer, size_t size)
+{
+	for (size_t idx = 0; idx < size; idx++)
+	{
+		trace_uart_byte(TRACE_REC_UART_TX, buffer[idx]);
+	}
+}
+
+#endif // ENABLE_TRACE
@@ -0,0 +1,117 @@
+/**
+ * @file trace.h
+ * @brief Peripheral trace hooks, recording in trace.cpp
+ *        The hooks sit where data comes from the hardware: the UART tee
+ *        (APP_UART), the I2C sensor reads, the battery ADC, the radio calls
+ *        (TRACE_LORA_TX, TRACE_LORA_CLASS) and the entry of the event
+ *        handlers. On the node they record, in the
+ *        replay of tools/trace they are implemented by the replay runner and
+ *        hand the recorded data to the application instead. Hooks that take
+ *        a buffer or return a value may change them for that reason.
+ *
+ *        Without ENABLE_TRACE all of it compiles to nothing.
+ * @version 0.1
+ * @date 2022-12-17
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <WisBlock-API.h>
+#include "trace_codec.h"
+
+/** Timed phases, a sensor sample is TRACE_PHASE_SENSOR + its registry index */
+enum trace_phase_e
+{
+	TRACE_PHASE_INIT = 0,
+	TRACE_PHASE_UPLINK,	  // payload build and enqueue
+	TRACE_PHASE_DOWNLINK, // LORA_DATA handling
+	TRACE_PHASE_TX_FIN,	  // LORA_TX_FIN handling
+	TRACE_PHASE_ACC,	  // accelerometer event
+	TRACE_PHASE_SENSOR,
+};
+#define TRACE_PHASE_MAX (TRACE_PHASE_SENSOR + 16)
+
+#ifdef ENABLE_TRACE
+void trace_init(void);
+void trace_config(void *config, uint8_t len);
+void trace_wake(uint8_t handler);
+void trace_phase_begin(uint8_t phase);
+void trace_phase_end(uint8_t phase);
+void trace_flush(void);
+uint8_t trace_i2c_read(uint8_t addr, uint8_t reg, uint8_t status, uint8_t *data, uint8_t len);
+uint16_t trace_adc(int16_t *raw, uint16_t count);
+lmh_error_status trace_lora_tx(uint8_t *data, uint8_t size, uint8_t fport);
+lmh_error_status trace_lora_class(DeviceClass_t new_class);
+
+void trace_uart_begin(uint32_t baud);
+void trace_uart_end(void);
+bool trace_uart_state(bool open);
+int trace_uart_available(int count);
+int trace_uart_read(int c);
+int trace_uart_peek(int c);
+void trace_uart_write(const uint8_t *buffer, size_t size);
+
+/**
+ * @brief Tee in front of Serial1, every byte the application reads or writes is recorded
+ *
+ */
+class TraceUart : public Stream
+{
+public:
+	TraceUart(HardwareSerial &port) : _port(port) {}
+	void begin(uint32_t baud)
+	{
+		trace_uart_begin(baud);
+		_port.begin(baud);
+	}
+	void end(void)
+	{
+		trace_uart_end();
+		_port.end();
+	}
+	operator bool() { return trace_uart_state((bool)_port); }
+
+	int available(void) override { return trace_uart_available(_port.available()); }
+	int read(void) override { return trace_uart_read(_port.read()); }
+	int peek(void) override { return trace_uart_peek(_port.peek()); }
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t *buffer, size_t size) override
+	{
+		trace_uart_write(buffer, size);
+		return _port.write(buffer, size);
+	}
+	using Print::write;
+	void flush(void) override { _port.flush(); }
+
+private:
+	HardwareSerial &_port;
+};
+
+extern TraceUart g_trace_uart;
+
+#define TRACE_INIT() trace_init()
+#define TRACE_CONFIG(config, len) trace_config(config, len)
+#define TRACE_WAKE(handler) trace_wake(handler)
+#define TRACE_PHASE_BEGIN(phase) trace_phase_begin(phase)
+#define TRACE_PHASE_END(phase) trace_phase_end(phase)
+#define TRACE_FLUSH() trace_flush()
+#define TRACE_I2C_READ(addr, reg, status, data, len) trace_i2c_read(addr, reg, status, data, len)
+#define TRACE_ADC(raw, count) trace_adc(raw, count)
+#define TRACE_LORA_TX(data, size, fport) trace_lora_tx(data, size, fport)
+#define TRACE_LORA_CLASS(new_class) trace_lora_class(new_class)
+#else
+#define TRACE_INIT()
+#define TRACE_CONFIG(config, len)
+#define TRACE_WAKE(handler)
+#define TRACE_PHASE_BEGIN(phase)
+#define TRACE_PHASE_END(phase)
+#define TRACE_FLUSH()
+#define TRACE_I2C_READ(addr, reg, status, data, len) (status)
+#define TRACE_ADC(raw, count) (count)
+#define TRACE_LORA_TX(data, size, fport) send_lora_packet(data, size, fport)
+#define TRACE_LORA_CLASS(new_class) lmh_class_request(new_class)
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * @file trace_codec.h
+ * @brief Peripheral trace format, recorded by trace.cpp, replayed by tools/trace
+ *        Plain C++ without Arduino dependencies, shared by the firmware and
+ *        the host tools.
+ *
+ *        A trace is a sequence of records:
+ *
+ *        u8 type, varint ms since the previous record, varint data length, data
+ *
+ *        Varints are LEB128, multi-byte values little endian. A trace starts
+ *        with TRACE_REC_BOOT. Over USB the records go out as text lines between
+ *        the log output: TRACE_LINE_TAG, the stream offset of the first byte
+ *        (hex), a blank and up to TRACE_LINE_BYTES bytes in hex.
+ * @version 0.1
+ * @date 2022-12-17
+ */
+
+#ifndef TRACE_CODEC_H
+#define TRACE_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** 2: SHTC3 readings as raw ticks */
+#define TRACE_VERSION 2
+#define TRACE_LINE_TAG "@T "
+#define TRACE_LINE_BYTES 32
+
+/** Record types */
+enum trace_type_e
+{
+	TRACE_REC_BOOT = 0x01,		 // 'T' 'R' TRACE_VERSION
+	TRACE_REC_CONFIG = 0x02,	 // app_config_s as loaded from flash
+	TRACE_REC_WAKE = 0x03,		 // u8 handler, u16 events, u8 fport, i16 rssi, i8 snr, u8 flags, downlink
+	TRACE_REC_PHASE = 0x04,		 // u8 phase, varint duration in us
+	TRACE_REC_UART_BEGIN = 0x10, // u32 baud
+	TRACE_REC_UART_END = 0x11,	 //
+	TRACE_REC_UART_RX = 0x12,	 // bytes the application read
+	TRACE_REC_UART_TX = 0x13,	 // bytes the application wrote
+	TRACE_REC_UART_STATE = 0x14, // u8 port open, as the core reports it, on change
+	TRACE_REC_I2C_READ = 0x20,	 // u8 address, u8 register, u8 status, data
+	TRACE_REC_ADC = 0x30,		 // raw samples, i16 each
+	TRACE_REC_LORA_TX = 0x40,	 // u8 fport, i8 lmh_error_status, payload
+	TRACE_REC_LORA_CLASS = 0x41, // u8 class, i8 lmh_error_status
+};
+
+/** TRACE_REC_WAKE handler */
+#define TRACE_WAKE_APP 0
+#define TRACE_WAKE_LORA 1
+/** TRACE_REC_WAKE flags */
+#define TRACE_WAKE_RX_FIN 0x01
+#define TRACE_WAKE_JOIN 0x02
+#define TRACE_WAKE_HEADER 8
+
+/** Header: type, two 5 byte varints */
+#define TRACE_HEADER_MAX 11
+
+static inline uint8_t trace_put_varint(uint8_t *p, uint32_t v)
+{
+	uint8_t n = 0;
+	while (v >= 0x80)
+	{
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static inline bool trace_get_varint(const uint8_t *buf, size_t len, size_t *pos, uint32_t *v)
+{
+	*v = 0;
+	for (uint8_t shift = 0; shift < 35; shift += 7)
+	{
+		if (*pos >= len)
+		{
+			return false;
+		}
+		uint8_t b = buf[(*pos)++];
+		*v |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/** One record, data points into the trace */
+struct trace_record_s
+{
+	uint8_t type;
+	uint32_t dt_ms;
+	uint32_t len;
+	const uint8_t *data;
+};
+
+/**
+ * @brief Next record of a trace
+ *
+ * @param pos read position, advanced past the record
+ * @return false end of the trace or a truncated record
+ */
+static inline bool trace_next(const uint8_t *buf, size_t len, size_t *pos, trace_record_s *r)
+{
+	if (*pos >= len)
+	{
+		return false;
+	}
+	r->type = buf[(*pos)++];
+	if (!trace_get_varint(buf, len, pos, &r->dt_ms) || !trace_get_varint(buf, len, pos, &r->len) || (len - *pos < r->len))
+	{
+		return false;
+	}
+	r->data = &buf[*pos];
+	*pos += r->len;
+	return true;
+}
+
+#endif
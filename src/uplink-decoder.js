@@ -34,6 +34,17 @@ function parseTriple(str, base) {
   return (n << 8) >> 8;
 }
 
+// convert little endian 4 character hex string to unsigned short
+function parseShortLE(str) {
+  return parseInt(str.substring(2, 4) + str.substring(0, 2), 16);
+}
+
+// convert Renogy temperature byte, bit 7 is the sign
+function parseRenogyTemp(str) {
+  var n = parseInt(str, 16);
+  return (n & 0x80) ? -(n & 0x7f) : n;
+}
+
 // decode Hex sensor string data to object
 function rakSensorDataDecode(hexStr) {
   var str = hexStr;
@@ -67,6 +78,30 @@ function rakSensorDataDecode(hexStr) {
         myObj.acceleration_z = parseFloat((parseShort(str.substring(12, 16), 16) * 0.001).toFixed(3));//unit:g
         str = str.substring(16);
         break;
+      case 0x0d00:// Accelerometer events
+        myObj.motion = (parseInt(str.substring(4, 6), 16) & 0x01) != 0;
+        myObj.impact = (parseInt(str.substring(4, 6), 16) & 0x02) != 0;
+        myObj.tilt = (parseInt(str.substring(4, 6), 16) & 0x04) != 0;
+        str = str.substring(6);
+        break;
+      case 0x0e71:// Vibration features
+        myObj.vibration_rms = parseFloat((parseInt(str.substring(4, 8), 16) * 0.001).toFixed(3));//unit:g
+        myObj.vibration_peak = parseFloat((parseInt(str.substring(8, 12), 16) * 0.001).toFixed(3));//unit:g
+        myObj.vibration_crest = parseFloat((parseInt(str.substring(12, 14), 16) * 0.1).toFixed(1));
+        myObj.vibration_freq_1 = parseInt(str.substring(14, 16), 16);//unit:Hz
+        myObj.vibration_freq_2 = parseInt(str.substring(16, 18), 16);//unit:Hz
+        str = str.substring(18);
+        break;
+      case 0x0f01:// command acknowledge, sequence and status of the last downlink on fPort 10
+        myObj.commandSeq = parseInt(str.substring(4, 6), 16);
+        myObj.commandStatus = parseInt(str.substring(6, 8), 16);
+        str = str.substring(8);
+        break;
+      case 0x1001:// renogy load switched, state read back (0 off, 1 on, 255 unknown) and result
+        myObj.loadState = parseInt(str.substring(4, 6), 16);
+        myObj.loadResult = parseInt(str.substring(6, 8), 16);
+        str = str.substring(8);
+        break;
       case 0x0402:// air resistance
         myObj.gasResistance = parseFloat((parseShort(str.substring(4, 8), 16) * 0.01).toFixed(2));//unit:KΩ
         str = str.substring(8);
@@ -75,6 +110,15 @@ function rakSensorDataDecode(hexStr) {
         myObj.battery = parseFloat((parseShort(str.substring(4, 8), 16) * 0.01).toFixed(2));//unit:V
         str = str.substring(8);
         break;
+      case 0x1102:// Battery under TX load: lowest voltage and internal resistance
+        myObj.batteryTxMin = parseFloat((parseInt(str.substring(4, 8), 16) * 0.01).toFixed(2));//unit:V
+        myObj.batteryRint = parseInt(str.substring(8, 12), 16);//unit:mOhm
+        str = str.substring(12);
+        break;
+      case 0x1285:// Unix time of the samples, s
+        myObj.sampleTime = parseInt(str.substring(4, 12), 16);//unit:s
+        str = str.substring(12);
+        break;
       case 0x0586:// gyroscope
         myObj.gyroscope_x = parseFloat((parseShort(str.substring(4, 8), 16) * 0.01).toFixed(2));//unit:°/s
         myObj.gyroscope_y = parseFloat((parseShort(str.substring(8, 12), 16) * 0.01).toFixed(2));//unit:°/s
@@ -93,15 +137,25 @@ function rakSensorDataDecode(hexStr) {
         myObj.magnetometer_z = parseFloat((parseShort(str.substring(4, 8), 16) * 0.01).toFixed(2));//unit:μT
         str = str.substring(8);
         break;
-      case 0x0c02:// renogy solar controller
-        myObj.panelVoltage = parseFloat((parseShort(str.substring(4, 8), 16) * 0.01).toFixed(2));//unit:V
-        str = str.substring(4);
-        myObj.panelCurrent = parseFloat((parseShort(str.substring(4, 8), 16) * 0.01).toFixed(2));//unit:A
-        str = str.substring(4);
-        //TO DO here! 
+      case 0x0c02:// renogy solar controller, registers 0x100..0x109 and 0x121..0x122, little endian
+        myObj.battCapacity = parseShortLE(str.substring(4, 8));//unit:%
+        myObj.battVoltage = parseFloat((parseShortLE(str.substring(8, 12)) * 0.1).toFixed(1));//unit:V
+        myObj.battChargeCurrent = parseFloat((parseShortLE(str.substring(12, 16)) * 0.01).toFixed(2));//unit:A
+        myObj.battTemperature = parseRenogyTemp(str.substring(16, 18));//unit: °C
+        myObj.controllerTemperature = parseRenogyTemp(str.substring(18, 20));//unit: °C
+        myObj.loadVoltage = parseFloat((parseShortLE(str.substring(20, 24)) * 0.1).toFixed(1));//unit:V
+        myObj.loadCurrent = parseFloat((parseShortLE(str.substring(24, 28)) * 0.01).toFixed(2));//unit:A
+        myObj.loadPower = parseShortLE(str.substring(28, 32));//unit:W
+        myObj.panelVoltage = parseFloat((parseShortLE(str.substring(32, 36)) * 0.1).toFixed(1));//unit:V
+        myObj.panelCurrent = parseFloat((parseShortLE(str.substring(36, 40)) * 0.01).toFixed(2));//unit:A
+        myObj.panelPower = parseShortLE(str.substring(40, 44));//unit:W
+        myObj.errorStatus1 = parseShortLE(str.substring(44, 48));
+        myObj.errorStatus2 = parseShortLE(str.substring(48, 52));
+        str = str.substring(52);
         break;
-      default:
-        str = str.substring(7);
+      default:// unknown channel, its length is unknown too, stop here instead of decoding garbage
+        myObj.unknownChannel = flag;
+        str = "";
         break;
     }
   }
@@ -0,0 +1,113 @@
+/**
+ * @file vedirect.cpp
+ * @brief Victron MPPT charge controller over VE.Direct, alternative to the Renogy Modbus poll
+ *        The controller pushes a text block every second (vedirect.h), there
+ *        is nothing to request. Once per cycle the UART is opened, one block
+ *        with a good checksum is captured and the UART is closed again, so it
+ *        sleeps between cycles. Connected via Victron's VE.Direct to RS232
+ *        cable to the same RS232 click as the Renogy controller.
+ *
+ *        The values go into g_renogy_data, the uplink keeps its 0x0C02 layout:
+ *        battery, panel and load values as the Renogy registers, no state of
+ *        charge and no temperatures (0), error_status_1 the off reason (OR),
+ *        error_status_2 the Victron error code (ERR).
+ * @version 0.1
+ * @date 2022-11-26
+ */
+#include "app.h"
+
+#ifdef ENABLE_RS232
+#include "vedirect.h"
+#include "zero_heap.h"
+
+/** Capture window, the first checksum only synchronizes: up to two blocks */
+#define VEDIRECT_CAPTURE_MS 2500
+
+/** Parser, the last good block stays in vedirect.frame */
+vedirect_parser_s vedirect;
+
+RAM_BUDGET(VEDIRECT, sizeof(vedirect), 160);
+
+/**
+ * @brief Listen for one complete MPPT block
+ *
+ * @return true vedirect.frame holds a block with the battery voltage
+ */
+static bool vedirect_capture(void)
+{
+	APP_UART.begin(VEDIRECT_BAUDRATE);
+	vedirect_begin(&vedirect);
+	bool got = false;
+	uint32_t start = millis();
+	while (!got && (millis() - start < VEDIRECT_CAPTURE_MS))
+	{
+		while (!got && APP_UART.available())
+		{
+			got = vedirect_feed(&vedirect, (uint8_t)APP_UART.read()) && (vedirect.frame.present & VE_V);
+		}
+		if (!got)
+		{
+			// A block takes ~80 ms at 19200 Bd, the 64 byte RX FIFO holds 30 ms
+			delay(10);
+		}
+	}
+	APP_UART.end();
+	if (vedirect.checksum_errors)
+	{
+		MYLOG("VE", "%ld checksum errors", (long)vedirect.checksum_errors);
+	}
+	return got;
+}
+
+/**
+ * @brief Check for a VE.Direct controller on Serial1
+ *
+ * @return true a valid block arrived
+ */
+bool vedirect_detect(void)
+{
+	return vedirect_capture();
+}
+
+/**
+ * @brief Values of the last block into g_renogy_data, same units as the Renogy registers
+ *
+ */
+static void vedirectSetData(const vedirect_frame_s *f)
+{
+	int32_t batt_ma = f->i_ma > 0 ? f->i_ma : 0;
+	int32_t load_ma = (f->present & VE_IL) ? f->il_ma : 0;
+	bool load_on = (f->present & VE_LOAD) ? f->load_on : load_ma > 0;
+
+	g_renogy_data.batt_capacity.val16 = 0;
+	g_renogy_data.batt_voltage.val16 = (uint16_t)(f->v_mv / 100);
+	g_renogy_data.batt_charge_current.val16 = (uint16_t)(batt_ma / 10);
+	g_renogy_data.temp.val16 = 0;
+	g_renogy_data.load_voltage.val16 = load_on ? (uint16_t)(f->v_mv / 100) : 0;
+	g_renogy_data.load_current.val16 = (uint16_t)(load_ma / 10);
+	g_renogy_data.load_power.val16 = (uint16_t)((int64_t)f->v_mv * load_ma / 1000000);
+	g_renogy_data.panel_voltage.val16 = (uint16_t)(f->vpv_mv / 100);
+	g_renogy_data.panel_current.val16 = f->vpv_mv > 0 ? (uint16_t)((int64_t)f->ppv_w * 100000 / f->vpv_mv) : 0;
+	g_renogy_data.panel_power.val16 = (uint16_t)f->ppv_w;
+	g_renogy_data.error_status_1.val16 = (uint16_t)f->off_reason;
+	g_renogy_data.error_status_2.val16 = f->err;
+}
+
+/**
+ * @brief Capture one block and update g_renogy_data
+ *
+ */
+void vedirect_sample(void)
+{
+	if (!vedirect_capture())
+	{
+		MYLOG("VE", "No VE.Direct block");
+		return;
+	}
+	vedirectSetData(&vedirect.frame);
+#if MY_DEBUG == 1
+	renogyPrintStatus();
+#endif
+}
+
+#endif // ENABLE_RS232
@@ -0,0 +1,253 @@
+/**
+ * @file vedirect.h
+ * @brief Victron VE.Direct text protocol parser
+ *        Plain C++ without Arduino dependencies, the firmware parses with it
+ *        (vedirect.cpp), the host tools can check their frames with it.
+ *
+ *        The controller pushes one block per second at 19200 Bd:
+ *
+ *        \r\nV\t12800\r\nI\t-350 ... \r\nChecksum\t<byte>
+ *
+ *        All bytes of a block, from the \r\n after the previous checksum
+ *        byte up to and including its own checksum byte, add up to 0 mod 256.
+ *        HEX protocol messages (':' up to '\n') may be interleaved anywhere,
+ *        they do not count. The parser takes one byte at a time, keeps no
+ *        more than one label and one value, and hands out the fields of a
+ *        block only after its checksum matched.
+ *
+ *        Reference: Victron "VE.Direct Protocol" 3.33, text mode.
+ * @version 0.1
+ * @date 2022-11-26
+ */
+
+#ifndef VEDIRECT_H
+#define VEDIRECT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define VEDIRECT_BAUDRATE 19200
+/** Longest label and value the spec allows */
+#define VEDIRECT_LABEL_MAX 9
+#define VEDIRECT_VALUE_MAX 33
+
+/** Fields of an MPPT block this parser keeps, vedirect_frame_s::present */
+#define VE_V 0x0001	   // battery voltage, mV
+#define VE_I 0x0002	   // battery current, mA
+#define VE_VPV 0x0004  // panel voltage, mV
+#define VE_PPV 0x0008  // panel power, W
+#define VE_CS 0x0010   // state of operation
+#define VE_ERR 0x0020  // error code
+#define VE_LOAD 0x0040 // load output ON / OFF
+#define VE_IL 0x0080   // load current, mA
+#define VE_OR 0x0100   // off reason, bit field
+
+/** Values of one block */
+struct vedirect_frame_s
+{
+	uint16_t present;
+	int32_t v_mv;
+	int32_t i_ma;
+	int32_t vpv_mv;
+	int32_t ppv_w;
+	int32_t il_ma;
+	uint32_t off_reason;
+	uint8_t cs;
+	uint8_t err;
+	bool load_on;
+};
+
+enum vedirect_state_e
+{
+	VE_LABEL = 0, // after \n
+	VE_VALUE,	  // after \t
+	VE_CHECKSUM,  // the next byte is the checksum
+	VE_HEX,		  // inside a HEX protocol message
+};
+
+struct vedirect_parser_s
+{
+	uint8_t state;
+	uint8_t hex_return; // state after the HEX message
+	bool synced;		// a checksum was seen, the block before it started before the first byte
+	uint8_t sum;
+	uint8_t label_len;
+	uint8_t value_len;
+	char label[VEDIRECT_LABEL_MAX + 1];
+	char value[VEDIRECT_VALUE_MAX + 1];
+	/** Fields of the block being received */
+	vedirect_frame_s pending;
+	/** Fields of the last block with a good checksum */
+	vedirect_frame_s frame;
+	uint32_t blocks;
+	uint32_t checksum_errors;
+};
+
+static inline void vedirect_begin(vedirect_parser_s *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->state = VE_LABEL;
+}
+
+/** Decimal value, optional sign */
+static inline int32_t vedirect_int(const char *s)
+{
+	bool neg = *s == '-';
+	s += neg ? 1 : 0;
+	int32_t v = 0;
+	while (*s >= '0' && *s <= '9')
+	{
+		v = v * 10 + (*s++ - '0');
+	}
+	return neg ? -v : v;
+}
+
+/** Hexadecimal value with 0x prefix */
+static inline uint32_t vedirect_hex(const char *s)
+{
+	uint32_t v = 0;
+	s += (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) ? 2 : 0;
+	for (; *s; s++)
+	{
+		char c = *s;
+		uint8_t d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0xFF;
+		if (d == 0xFF)
+		{
+			break;
+		}
+		v = (v << 4) | d;
+	}
+	return v;
+}
+
+/** Store one label/value pair in the pending block */
+static inline void vedirect_field(vedirect_parser_s *p)
+{
+	vedirect_frame_s *f = &p->pending;
+	const char *l = p->label;
+	const char *v = p->value;
+	if (strcmp(l, "V") == 0)
+	{
+		f->v_mv = vedirect_int(v);
+		f->present |= VE_V;
+	}
+	else if (strcmp(l, "I") == 0)
+	{
+		f->i_ma = vedirect_int(v);
+		f->present |= VE_I;
+	}
+	else if (strcmp(l, "VPV") == 0)
+	{
+		f->vpv_mv = vedirect_int(v);
+		f->present |= VE_VPV;
+	}
+	else if (strcmp(l, "PPV") == 0)
+	{
+		f->ppv_w = vedirect_int(v);
+		f->present |= VE_PPV;
+	}
+	else if (strcmp(l, "CS") == 0)
+	{
+		f->cs = (uint8_t)vedirect_int(v);
+		f->present |= VE_CS;
+	}
+	else if (strcmp(l, "ERR") == 0)
+	{
+		f->err = (uint8_t)vedirect_int(v);
+		f->present |= VE_ERR;
+	}
+	else if (strcmp(l, "LOAD") == 0)
+	{
+		f->load_on = strcmp(v, "ON") == 0;
+		f->present |= VE_LOAD;
+	}
+	else if (strcmp(l, "IL") == 0)
+	{
+		f->il_ma = vedirect_int(v);
+		f->present |= VE_IL;
+	}
+	else if (strcmp(l, "OR") == 0)
+	{
+		f->off_reason = vedirect_hex(v);
+		f->present |= VE_OR;
+	}
+}
+
+/**
+ * @brief Feed one received byte
+ *
+ * @return true a block with a good checksum ended, its fields are in p->frame
+ */
+static inline bool vedirect_feed(vedirect_parser_s *p, uint8_t c)
+{
+	if (p->state == VE_HEX)
+	{
+		if (c == '\n')
+		{
+			p->state = p->hex_return;
+		}
+		return false;
+	}
+	if (c == ':' && p->state != VE_CHECKSUM)
+	{
+		p->hex_return = p->state;
+		p->state = VE_HEX;
+		return false;
+	}
+	p->sum += c;
+
+	switch (p->state)
+	{
+	case VE_LABEL:
+		if (c == '\t')
+		{
+			p->label[p->label_len < VEDIRECT_LABEL_MAX ? p->label_len : VEDIRECT_LABEL_MAX] = 0;
+			p->value_len = 0;
+			p->state = strcmp(p->label, "Checksum") == 0 ? VE_CHECKSUM : VE_VALUE;
+		}
+		else if (c == '\n')
+		{
+			p->label_len = 0;
+		}
+		else if (c != '\r' && p->label_len < VEDIRECT_LABEL_MAX)
+		{
+			p->label[p->label_len++] = (char)c;
+		}
+		return false;
+	case VE_VALUE:
+		if (c == '\n')
+		{
+			p->value[p->value_len] = 0;
+			vedirect_field(p);
+			p->label_len = 0;
+			p->state = VE_LABEL;
+		}
+		else if (c != '\r' && p->value_len < VEDIRECT_VALUE_MAX)
+		{
+			p->value[p->value_len++] = (char)c;
+		}
+		return false;
+	case VE_CHECKSUM:
+	default:
+	{
+		bool good = p->synced && (p->sum == 0);
+		if (p->synced && !good)
+		{
+			p->checksum_errors++;
+		}
+		else if (good)
+		{
+			p->blocks++;
+			p->frame = p->pending;
+		}
+		p->synced = true;
+		p->sum = 0;
+		p->label_len = 0;
+		p->state = VE_LABEL;
+		memset(&p->pending, 0, sizeof(p->pending));
+		return good;
+	}
+	}
+}
+
+#endif
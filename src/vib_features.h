@@ -0,0 +1,185 @@
+/**
+ * @file vib_features.h
+ * @brief Vibration feature extraction, scalar reference kernels
+ *        Plain C++ without Arduino or CMSIS dependencies. The firmware uses
+ *        these as fallback and as baseline for the CMSIS-DSP kernels in
+ *        vibration.cpp, tools/vibration builds them on the host.
+ * @version 0.1
+ * @date 2022-09-24
+ */
+
+#ifndef VIB_FEATURES_H
+#define VIB_FEATURES_H
+
+#include <stdint.h>
+#include <math.h>
+
+/** Samples per capture, power of 2 for the FFT */
+#define VIB_SAMPLES 128
+/** Accelerometer output data rate during a capture */
+#define VIB_ODR_HZ 400
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/** Features sent in the uplink */
+struct vib_features_s
+{
+	uint16_t rms_mg;  // RMS of the dynamic acceleration
+	uint16_t peak_mg; // Largest absolute dynamic acceleration
+	uint8_t crest_10; // Crest factor peak/RMS * 10
+	uint8_t freq_1;	  // Strongest frequency in Hz
+	uint8_t freq_2;	  // Second strongest frequency in Hz
+};
+
+/**
+ * @brief Pick the axis with the largest variance and remove its mean
+ *
+ * @param xyz interleaved x, y, z samples in mg
+ * @param count number of samples (x, y, z triples)
+ * @param out dynamic acceleration of the chosen axis in mg
+ */
+static inline void vib_select_axis(const int16_t *xyz, uint16_t count, float *out)
+{
+	int64_t sum[3] = {0};
+	int64_t sum2[3] = {0};
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int32_t v = xyz[3 * idx + axis];
+			sum[axis] += v;
+			sum2[axis] += v * v;
+		}
+	}
+	int best = 0;
+	int64_t best_var = -1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		// count^2 * variance, same scale for all axes
+		int64_t var = count * sum2[axis] - sum[axis] * sum[axis];
+		if (var > best_var)
+		{
+			best_var = var;
+			best = axis;
+		}
+	}
+	float mean = count ? (float)sum[best] / count : 0.0f;
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		out[idx] = xyz[3 * idx + best] - mean;
+	}
+}
+
+/**
+ * @brief Convert the two strongest FFT bins into the feature record
+ *
+ * @param mag magnitude spectrum, VIB_SAMPLES / 2 bins, bin 0 is ignored
+ * @param f feature record, freq_1 and freq_2 are set
+ */
+static inline void vib_pick_peaks(const float *mag, vib_features_s *f)
+{
+	uint16_t first = 1;
+	for (uint16_t bin = 2; bin < VIB_SAMPLES / 2; bin++)
+	{
+		if (mag[bin] > mag[first])
+		{
+			first = bin;
+		}
+	}
+	// Second peak must not be a neighbour of the first one (leakage)
+	uint16_t second = 0;
+	for (uint16_t bin = 1; bin < VIB_SAMPLES / 2; bin++)
+	{
+		if (bin + 1 >= first && bin <= first + 1)
+		{
+			continue;
+		}
+		if (second == 0 || mag[bin] > mag[second])
+		{
+			second = bin;
+		}
+	}
+	f->freq_1 = (uint8_t)((first * VIB_ODR_HZ + VIB_SAMPLES / 2) / VIB_SAMPLES);
+	f->freq_2 = (uint8_t)((second * VIB_ODR_HZ + VIB_SAMPLES / 2) / VIB_SAMPLES);
+}
+
+/**
+ * @brief RMS, peak and crest factor into the feature record
+ */
+static inline void vib_set_levels(float rms, float peak, vib_features_s *f)
+{
+	f->rms_mg = rms > 65535.0f ? 65535 : (uint16_t)(rms + 0.5f);
+	f->peak_mg = peak > 65535.0f ? 65535 : (uint16_t)(peak + 0.5f);
+	float crest = rms > 0.0f ? peak / rms * 10.0f : 0.0f;
+	f->crest_10 = crest > 255.0f ? 255 : (uint8_t)(crest + 0.5f);
+}
+
+/**
+ * @brief Scalar baseline, plain loops and an iterative radix-2 FFT
+ *
+ * @param x dynamic acceleration, VIB_SAMPLES values, overwritten
+ * @param f computed features
+ */
+static inline void vib_features_scalar(float *x, vib_features_s *f)
+{
+	static float re[VIB_SAMPLES];
+	static float im[VIB_SAMPLES];
+
+	float sum2 = 0.0f;
+	float peak = 0.0f;
+	for (uint16_t idx = 0; idx < VIB_SAMPLES; idx++)
+	{
+		sum2 += x[idx] * x[idx];
+		float a = fabsf(x[idx]);
+		if (a > peak)
+		{
+			peak = a;
+		}
+	}
+	vib_set_levels(sqrtf(sum2 / VIB_SAMPLES), peak, f);
+
+	// Hann window, bit reversed copy
+	for (uint16_t idx = 0, rev = 0; idx < VIB_SAMPLES; idx++)
+	{
+		float w = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * idx / VIB_SAMPLES);
+		re[rev] = x[idx] * w;
+		im[rev] = 0.0f;
+		uint16_t bit = VIB_SAMPLES >> 1;
+		while (rev & bit)
+		{
+			rev ^= bit;
+			bit >>= 1;
+		}
+		rev |= bit;
+	}
+	for (uint16_t len = 2; len <= VIB_SAMPLES; len <<= 1)
+	{
+		float ang = -2.0f * (float)M_PI / len;
+		for (uint16_t start = 0; start < VIB_SAMPLES; start += len)
+		{
+			for (uint16_t k = 0; k < len / 2; k++)
+			{
+				float wr = cosf(ang * k);
+				float wi = sinf(ang * k);
+				uint16_t a = start + k;
+				uint16_t b = a + len / 2;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+	// Magnitudes reuse the input buffer
+	for (uint16_t bin = 0; bin < VIB_SAMPLES / 2; bin++)
+	{
+		x[bin] = sqrtf(re[bin] * re[bin] + im[bin] * im[bin]);
+	}
+	vib_pick_peaks(x, f);
+}
+
+#endif
@@ -0,0 +1,188 @@
+/**
+ * @file vibration.cpp
+ * @brief Vibration features from the RAK1904 for enclosures next to
+ *        generators and pumps
+ *        A short 400 Hz capture is drained from the accelerometer FIFO into
+ *        a fixed buffer and reduced to RMS, peak, crest factor and the two
+ *        dominant frequencies. On the nRF52840 the Cortex-M4F CMSIS-DSP
+ *        kernels are used, vib_features.h holds the scalar baseline.
+ * @version 0.1
+ * @date 2022-09-24
+ */
+#include "app.h"
+
+#ifdef ENABLE_VIBRATION
+#include "vib_features.h"
+
+#if defined(NRF52_SERIES) && __has_include(<arm_math.h>)
+#define VIB_USE_CMSIS
+#include <arm_math.h>
+
+/** Real FFT instance */
+arm_rfft_fast_instance_f32 vib_fft;
+/** Hann window */
+float vib_window[VIB_SAMPLES];
+/** FFT output, packed complex */
+float vib_spectrum[VIB_SAMPLES];
+#endif
+
+#include "zero_heap.h"
+
+/** Raw capture, x, y, z interleaved in mg */
+int16_t vib_raw[VIB_SAMPLES * 3];
+/** Dynamic acceleration of the strongest axis */
+float vib_signal[VIB_SAMPLES];
+/** Features of the last complete capture */
+static vib_features_s vib_last = {0};
+
+#ifdef VIB_USE_CMSIS
+RAM_BUDGET(VIB, sizeof(vib_raw) + sizeof(vib_signal) + sizeof(vib_last) + sizeof(vib_fft) + sizeof(vib_window) + sizeof(vib_spectrum), 3072);
+#else
+// vib_features_scalar() keeps two VIB_SAMPLES float work arrays
+RAM_BUDGET(VIB, sizeof(vib_raw) + sizeof(vib_signal) + sizeof(vib_last) + 2 * VIB_SAMPLES * sizeof(float), 3072);
+#endif
+
+#ifdef VIB_USE_CMSIS
+/**
+ * @brief CMSIS-DSP kernels
+ *
+ * @param x dynamic acceleration, VIB_SAMPLES values, overwritten
+ * @param f computed features
+ */
+static void vib_features_cmsis(float *x, vib_features_s *f)
+{
+	float rms;
+	float peak;
+	uint32_t peak_idx;
+
+	arm_rms_f32(x, VIB_SAMPLES, &rms);
+	arm_mult_f32(x, vib_window, vib_spectrum, VIB_SAMPLES);
+	arm_abs_f32(x, x, VIB_SAMPLES);
+	arm_max_f32(x, VIB_SAMPLES, &peak, &peak_idx);
+	vib_set_levels(rms, peak, f);
+
+	arm_rfft_fast_f32(&vib_fft, vib_spectrum, x, 0);
+	// Bin 0 packs DC and Nyquist as two reals, it is ignored anyway
+	arm_cmplx_mag_f32(x, vib_spectrum, VIB_SAMPLES / 2);
+	vib_pick_peaks(vib_spectrum, f);
+}
+
+/**
+ * @brief Compare CMSIS-DSP and scalar kernel timing with the DWT cycle counter
+ *
+ */
+static void vib_benchmark(void)
+{
+	vib_features_s f_cmsis;
+	vib_features_s f_scalar;
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// 50 Hz plus some 120 Hz, 300 mg
+	for (uint16_t idx = 0; idx < VIB_SAMPLES; idx++)
+	{
+		vib_signal[idx] = 300.0f * arm_sin_f32(2.0f * PI * 50.0f * idx / VIB_ODR_HZ) + 80.0f * arm_sin_f32(2.0f * PI * 120.0f * idx / VIB_ODR_HZ);
+	}
+	float copy[VIB_SAMPLES];
+	memcpy(copy, vib_signal, sizeof(copy));
+
+	uint32_t start = DWT->CYCCNT;
+	vib_features_cmsis(vib_signal, &f_cmsis);
+	uint32_t cmsis_cycles = DWT->CYCCNT - start;
+
+	start = DWT->CYCCNT;
+	vib_features_scalar(copy, &f_scalar);
+	uint32_t scalar_cycles = DWT->CYCCNT - start;
+
+	MYLOG("VIB", "CMSIS %lu cycles: rms %d peak %d crest %d f %d/%d Hz", cmsis_cycles,
+		  f_cmsis.rms_mg, f_cmsis.peak_mg, f_cmsis.crest_10, f_cmsis.freq_1, f_cmsis.freq_2);
+	MYLOG("VIB", "Scalar %lu cycles: rms %d peak %d crest %d f %d/%d Hz", scalar_cycles,
+		  f_scalar.rms_mg, f_scalar.peak_mg, f_scalar.crest_10, f_scalar.freq_1, f_scalar.freq_2);
+}
+#endif
+
+/**
+ * @brief Prepare the DSP kernels
+ *
+ */
+void init_vibration(void)
+{
+#ifdef VIB_USE_CMSIS
+	arm_rfft_fast_init_f32(&vib_fft, VIB_SAMPLES);
+	for (uint16_t idx = 0; idx < VIB_SAMPLES; idx++)
+	{
+		vib_window[idx] = 0.5f - 0.5f * arm_cos_f32(2.0f * PI * idx / VIB_SAMPLES);
+	}
+#if MY_DEBUG > 0
+	vib_benchmark();
+#endif
+#else
+	MYLOG("VIB", "CMSIS-DSP not available, using scalar kernels");
+#endif
+}
+
+/**
+ * @brief Capture vibration and keep the features for the payload
+ *
+ */
+void vibration_read_data(void)
+{
+	uint16_t samples = acc_capture(vib_raw, VIB_SAMPLES);
+	if (samples < VIB_SAMPLES)
+	{
+		MYLOG("VIB", "Capture incomplete, %d samples", samples);
+		return;
+	}
+
+	vib_features_s features;
+	vib_select_axis(vib_raw, VIB_SAMPLES, vib_signal);
+#ifdef VIB_USE_CMSIS
+	vib_features_cmsis(vib_signal, &features);
+#else
+	vib_features_scalar(vib_signal, &features);
+#endif
+	MYLOG("VIB", "RMS %d mg, peak %d mg, crest %d.%d, %d Hz / %d Hz", features.rms_mg, features.peak_mg,
+		  features.crest_10 / 10, features.crest_10 % 10, features.freq_1, features.freq_2);
+
+	vib_last = features;
+}
+
+/**
+ * @brief Sensor registry init function
+ *        Needs the accelerometer, init_acc() runs before the registry
+ */
+static bool vib_init(void)
+{
+	init_vibration();
+	return true;
+}
+
+/**
+ * @brief Payload: 0x0E71 RMS, peak (mg, 16 bit), crest factor x10, two dominant frequencies (Hz)
+ *
+ * @param buf payload slot
+ * @param len slot length, VIB_PAYLOAD_LEN
+ * @return uint8_t bytes written, 0 if the slot is too short
+ */
+uint8_t vib_encode(uint8_t *buf, uint8_t len)
+{
+	if (len < VIB_PAYLOAD_LEN)
+	{
+		return 0;
+	}
+	buf[0] = 0x0E;
+	buf[1] = 0x71;
+	buf[2] = (uint8_t)(vib_last.rms_mg >> 8);
+	buf[3] = (uint8_t)(vib_last.rms_mg);
+	buf[4] = (uint8_t)(vib_last.peak_mg >> 8);
+	buf[5] = (uint8_t)(vib_last.peak_mg);
+	buf[6] = vib_last.crest_10;
+	buf[7] = vib_last.freq_1;
+	buf[8] = vib_last.freq_2;
+	return VIB_PAYLOAD_LEN;
+}
+
+const sensor_driver_s vib_sensor = {"VIB", vib_init, vibration_read_data, vib_encode, SENSOR_OPTIONAL, VIB_BUDGET_MS, supervisor_i2c_recover, I2C_MODULE_LIS3DH};
+
+#endif // ENABLE_VIBRATION
@@ -0,0 +1,141 @@
+/**
+ * @file wdt.cpp
+ * @brief Watchdog backend for supervisor.cpp
+ *        nRF52: the WDT, paused while the CPU sleeps and while the debugger
+ *        halts it, one reload register. Once started it runs until the next
+ *        reset and its configuration is locked, after a soft reset it is
+ *        still running. GPREGRET2 keeps one byte through the watchdog reset,
+ *        GPREGRET belongs to the bootloader. While the SoftDevice runs the
+ *        POWER registers go through its API.
+ *
+ *        RP2040: no watchdog, its longest timeout (8.3 s) is shorter than the
+ *        GNSS search. The phase budgets are still checked.
+ *
+ *        The host tools replace this file.
+ * @version 0.1
+ * @date 2022-12-31
+ */
+#include "app.h"
+
+#ifdef NRF52_SERIES
+#include <nrf_sdm.h>
+#include <nrf_soc.h>
+#endif
+#include "zero_heap.h"
+
+#ifdef NRF52_SERIES
+/** The WDT counts the 32.768 kHz LFCLK */
+#define WDT_TICKS_PER_S 32768
+
+/**
+ * @brief Start the watchdog
+ *
+ * @param timeout_ms awake time until the reset
+ * @return true running
+ */
+bool wdt_start(uint32_t timeout_ms)
+{
+	if (NRF_WDT->RUNSTATUS)
+	{
+		// Still running from before a soft reset, with the timeout set then
+		wdt_feed();
+		return true;
+	}
+	NRF_WDT->CONFIG = (WDT_CONFIG_SLEEP_Pause << WDT_CONFIG_SLEEP_Pos) | (WDT_CONFIG_HALT_Pause << WDT_CONFIG_HALT_Pos);
+	NRF_WDT->CRV = (uint32_t)((uint64_t)timeout_ms * WDT_TICKS_PER_S / 1000);
+	NRF_WDT->RREN = WDT_RREN_RR0_Msk;
+	NRF_WDT->TASKS_START = 1;
+	return true;
+}
+
+void wdt_feed(void)
+{
+	NRF_WDT->RR[0] = WDT_RR_RR_Reload;
+}
+
+/**
+ * @brief The last reset came from the watchdog
+ *        The core reads and clears RESETREAS at startup.
+ *
+ */
+bool wdt_caused_reset(void)
+{
+	return (readResetReason() & POWER_RESETREAS_DOG_Msk) != 0;
+}
+
+/**
+ * @brief The last reset kept the power: watchdog, soft reset or CPU lockup
+ *        Modules cannot have been plugged in or out since the last boot.
+ *        The reset pin counts as cold, it is how a new module gets probed.
+ *
+ */
+bool wdt_warm_reset(void)
+{
+	return (readResetReason() & (POWER_RESETREAS_DOG_Msk | POWER_RESETREAS_SREQ_Msk | POWER_RESETREAS_LOCKUP_Msk)) != 0;
+}
+
+static bool wdt_sd_enabled(void)
+{
+	uint8_t sd_enabled = 0;
+	sd_softdevice_is_enabled(&sd_enabled);
+	return sd_enabled != 0;
+}
+
+/**
+ * @brief The byte kept through the watchdog reset, 0 after power on
+ *
+ */
+uint8_t wdt_retained(void)
+{
+	if (wdt_sd_enabled())
+	{
+		uint32_t value = 0;
+		sd_power_gpregret_get(1, &value);
+		return (uint8_t)value;
+	}
+	return (uint8_t)NRF_POWER->GPREGRET2;
+}
+
+void wdt_retain(uint8_t value)
+{
+	if (wdt_sd_enabled())
+	{
+		sd_power_gpregret_clr(1, 0xFF);
+		sd_power_gpregret_set(1, value);
+		return;
+	}
+	NRF_POWER->GPREGRET2 = value;
+}
+#endif
+
+#ifdef ARDUINO_ARCH_RP2040
+bool wdt_start(uint32_t timeout_ms)
+{
+	(void)timeout_ms;
+	return false;
+}
+
+void wdt_feed(void)
+{
+}
+
+bool wdt_caused_reset(void)
+{
+	return false;
+}
+
+bool wdt_warm_reset(void)
+{
+	return false;
+}
+
+uint8_t wdt_retained(void)
+{
+	return 0;
+}
+
+void wdt_retain(uint8_t value)
+{
+	(void)value;
+}
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file zero_heap.h
+ * @brief Static memory rules for the application sources
+ *        Include as the LAST header of every application .cpp file.
+ *        RAM_BUDGET() records the static RAM of a module and checks it
+ *        against the module limit at compile time. With -DAPP_ZERO_HEAP
+ *        (env:wiscore_rak4631_zero_heap) heap functions, Arduino String and
+ *        variable length arrays become compile errors in the code that
+ *        follows, the libraries included before are not affected.
+ *
+ *        The bytes of RAM_BUDGET() are a hand written sizeof() sum for the
+ *        boot log. The same env checks the real .bss and .data of every
+ *        object file against the limits after linking
+ *        (tools/ram_budget/ram_budget.py), a global missing from the sum
+ *        still counts there.
+ * @version 0.1
+ * @date 2022-10-08
+ */
+
+#ifndef ZERO_HEAP_H
+#define ZERO_HEAP_H
+
+#include <stdint.h>
+
+/** Static RAM of one module */
+struct ram_budget_s
+{
+	const char *module;
+	uint32_t bytes;
+	uint32_t limit;
+};
+
+/**
+ * @brief Declare the static RAM of a module, fails to compile above the limit
+ *
+ * @param name module name, defines name##_ram_budget
+ * @param bytes sum of sizeof() of the module buffers and objects, logged at boot
+ * @param limit budget in bytes, also the limit of the object file's .bss and .data
+ */
+#define RAM_BUDGET(name, bytes, limit)                                               \
+	static_assert((bytes) <= (limit), #name " static RAM exceeds its budget");       \
+	extern const ram_budget_s name##_ram_budget;                                     \
+	const ram_budget_s name##_ram_budget = {#name, (uint32_t)(bytes), (uint32_t)(limit)}
+
+#ifdef APP_ZERO_HEAP
+#pragma GCC diagnostic error "-Wvla"
+#pragma GCC poison malloc calloc realloc free strdup String
+#endif
+
+#endif
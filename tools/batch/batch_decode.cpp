@@ -0,0 +1,281 @@
+/**
+ * @file batch_decode.cpp
+ * @brief Host decoder and compression benchmark for batch frames
+ *        Expands the batch frames (fPort LORAWAN_BATCH_PORT, src/batch_codec.h)
+ *        of an uplink archive into one record per sample, with the sample
+ *        time as rx_time, so tools/decoder/uplink_decode can decode them.
+ *        Other records are copied.
+ *
+ *        The benchmark takes the samples of an archive from one node,
+ *        encodes them with the firmware's encoder at several frame sizes,
+ *        checks that every sample and time decodes unchanged and reports
+ *        the bytes per sample against single sample uplinks.
+ *
+ *        g++ -std=c++17 -O2 -Isrc tools/batch/batch_decode.cpp -o batch_decode
+ *
+ *        batch_decode archive out_archive
+ *        batch_decode -b archive
+ * @version 0.1
+ * @date 2022-11-05
+ */
+
+#include "batch_codec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/** Archive record header, see tools/decoder/uplink_decoder.h */
+#define RECORD_HEADER 6
+/** LoRaWAN MHDR, FHDR, FPort and MIC around every application payload */
+#define LORAWAN_OVERHEAD 13
+/** fPort of single sample uplinks, LORAWAN_APP_PORT of the firmware */
+#define SAMPLE_PORT 2
+
+/** One archive record */
+struct record_s
+{
+	uint32_t rx_time;
+	uint8_t port;
+	std::vector<uint8_t> payload;
+};
+
+static bool read_archive(const char *path, std::vector<record_s> &records)
+{
+	FILE *in = fopen(path, "rb");
+	if (!in)
+	{
+		perror(path);
+		return false;
+	}
+	uint8_t hdr[RECORD_HEADER];
+	while (fread(hdr, 1, RECORD_HEADER, in) == RECORD_HEADER)
+	{
+		record_s r;
+		r.rx_time = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+		r.port = hdr[4];
+		r.payload.resize(hdr[5]);
+		if (fread(r.payload.data(), 1, r.payload.size(), in) != r.payload.size())
+		{
+			break;
+		}
+		records.push_back(std::move(r));
+	}
+	fclose(in);
+	return true;
+}
+
+static void write_record(FILE *out, uint32_t rx_time, uint8_t port, const uint8_t *payload, uint8_t len)
+{
+	uint8_t hdr[RECORD_HEADER] = {(uint8_t)rx_time, (uint8_t)(rx_time >> 8), (uint8_t)(rx_time >> 16), (uint8_t)(rx_time >> 24), port, len};
+	fwrite(hdr, 1, RECORD_HEADER, out);
+	fwrite(payload, 1, len, out);
+}
+
+/**
+ * @brief Samples of an archive, batch frames expanded
+ *
+ * @param bad_frames frames that did not decode completely
+ */
+static std::vector<record_s> expand(const std::vector<record_s> &records, size_t *bad_frames)
+{
+	std::vector<record_s> samples;
+	static batch_decoder_s d;
+	*bad_frames = 0;
+	for (const record_s &r : records)
+	{
+		if (r.port != LORAWAN_BATCH_PORT)
+		{
+			samples.push_back(r);
+			continue;
+		}
+		if (batch_decode_begin(&d, r.payload.data(), (uint16_t)r.payload.size()) != BATCH_OK)
+		{
+			(*bad_frames)++;
+			continue;
+		}
+		size_t first = samples.size();
+		while (batch_decode_next(&d))
+		{
+			record_s s;
+			s.rx_time = (uint32_t)d.time;
+			s.port = SAMPLE_PORT;
+			s.payload.assign(d.sample, d.sample + d.len);
+			samples.push_back(std::move(s));
+		}
+		if (d.index != d.count)
+		{
+			(*bad_frames)++;
+		}
+		// Times are relative to the first sample, the last one is at the frame's time,
+		// or age s before the uplink from a node without a set clock
+		int32_t last = d.index ? d.time : 0;
+		uint32_t last_time = d.last_unix ? d.last_unix : r.rx_time - d.age;
+		for (size_t idx = first; idx < samples.size(); idx++)
+		{
+			samples[idx].rx_time = last_time - (uint32_t)(last - (int32_t)samples[idx].rx_time);
+		}
+	}
+	return samples;
+}
+
+/** Result of one layout and frame size */
+struct bench_result_s
+{
+	size_t samples = 0;
+	size_t frames = 0;
+	size_t bytes = 0;
+	size_t mismatches = 0;
+	double encode_ns = 0.0;
+};
+
+/**
+ * @brief Encode a series with the firmware encoder, decode and compare
+ */
+static bench_result_s bench_series(const std::vector<const record_s *> &series, uint16_t cap)
+{
+	bench_result_s res;
+	static uint8_t frame[256];
+	static uint8_t prev[256];
+	static batch_decoder_s d;
+	batch_encoder_s e;
+	size_t next = 0;
+	while (next < series.size())
+	{
+		size_t first = next;
+		batch_begin(&e, frame, cap, prev);
+		auto t0 = std::chrono::steady_clock::now();
+		while (next < series.size() &&
+			   batch_append(&e, series[next]->rx_time, series[next]->payload.data(), (uint8_t)series[next]->payload.size()))
+		{
+			next++;
+		}
+		uint16_t len = batch_finish(&e, series[next - 1]->rx_time, series[next - 1]->rx_time);
+		auto t1 = std::chrono::steady_clock::now();
+		res.encode_ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+		if (next == first)
+		{
+			// Sample longer than the frame
+			next++;
+			res.mismatches++;
+			continue;
+		}
+		res.frames++;
+		res.bytes += len;
+
+		if (batch_decode_begin(&d, frame, len) != BATCH_OK || d.last_unix != series[next - 1]->rx_time)
+		{
+			res.mismatches++;
+		}
+		for (size_t idx = first; idx < next; idx++)
+		{
+			const record_s *r = series[idx];
+			if (!batch_decode_next(&d) || d.len != r->payload.size() ||
+				memcmp(d.sample, r->payload.data(), d.len) != 0 ||
+				(uint32_t)d.time != r->rx_time - series[first]->rx_time)
+			{
+				res.mismatches++;
+			}
+		}
+		res.samples += next - first;
+	}
+	return res;
+}
+
+static int benchmark(const char *path)
+{
+	std::vector<record_s> records;
+	if (!read_archive(path, records))
+	{
+		return 1;
+	}
+	size_t bad_frames = 0;
+	std::vector<record_s> samples = expand(records, &bad_frames);
+
+	// One series per payload layout: first channel and length
+	std::map<std::pair<uint16_t, uint8_t>, std::vector<const record_s *>> series;
+	for (const record_s &s : samples)
+	{
+		if (s.payload.size() < 2 || s.port == LORAWAN_BATCH_PORT)
+		{
+			continue;
+		}
+		series[{(uint16_t)((s.payload[0] << 8) | s.payload[1]), (uint8_t)s.payload.size()}].push_back(&s);
+	}
+	// Backlog samples arrive late, encode in sample time order
+	for (auto &s : series)
+	{
+		std::stable_sort(s.second.begin(), s.second.end(), [](const record_s *a, const record_s *b) { return a->rx_time < b->rx_time; });
+	}
+	printf("%zu records, %zu samples, %zu batch frames not decodable\n", records.size(), samples.size(), bad_frames);
+	printf("channel  len  frame  samples  frames  smp/frame  bytes/smp  ratio  on air/smp  ratio  encode ns/smp  errors\n");
+
+	size_t errors = bad_frames;
+	const uint16_t caps[] = {53, 128, 242};
+	for (auto &s : series)
+	{
+		uint8_t len = s.first.second;
+		double single_air = len + LORAWAN_OVERHEAD;
+		for (uint16_t cap : caps)
+		{
+			bench_result_s res = bench_series(s.second, cap);
+			errors += res.mismatches;
+			if (!res.samples)
+			{
+				continue;
+			}
+			double per_sample = (double)res.bytes / res.samples;
+			double air = (double)(res.bytes + res.frames * LORAWAN_OVERHEAD) / res.samples;
+			printf("0x%04X %5u %6u %8zu %7zu %10.1f %10.2f %5.1fx %11.2f %5.1fx %14.0f %7zu\n",
+				   s.first.first, len, cap, res.samples, res.frames, (double)res.samples / res.frames,
+				   per_sample, len / per_sample, air, single_air / air, res.encode_ns / res.samples, res.mismatches);
+		}
+	}
+	return errors ? 1 : 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s archive out_archive   expand batch frames into single samples\n"
+			"       %s -b archive            compression benchmark, archive of one node\n",
+			name, name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 3 && std::string(argv[1]) == "-b")
+	{
+		return benchmark(argv[2]);
+	}
+	if (argc != 3 || argv[1][0] == '-')
+	{
+		usage(argv[0]);
+	}
+
+	std::vector<record_s> records;
+	if (!read_archive(argv[1], records))
+	{
+		return 1;
+	}
+	FILE *out = fopen(argv[2], "wb");
+	if (!out)
+	{
+		perror(argv[2]);
+		return 1;
+	}
+	size_t bad_frames = 0;
+	std::vector<record_s> samples = expand(records, &bad_frames);
+	for (const record_s &s : samples)
+	{
+		write_record(out, s.rx_time, s.port, s.payload.data(), (uint8_t)s.payload.size());
+	}
+	fclose(out);
+	printf("%zu records, %zu samples, %zu batch frames not decodable\n", records.size(), samples.size(), bad_frames);
+	return bad_frames ? 1 : 0;
+}
@@ -0,0 +1,1059 @@
+/**
+ * @file app_bench.cpp
+ * @brief Host checks and benchmarks of the payload, Modbus and uplink code
+ *        The unmodified src/ sources run natively on a virtual clock, with a
+ *        Renogy controller of fixed registers behind Serial1 and a radio
+ *        that can be told to answer busy.
+ *
+ *        Checks, any failure makes the exit code 1:
+ *        - renogySetData()/renogySetError() put every register in its field
+ *        - a wake polls the controller and reads the SHTC3, the uplinks
+ *          decode (tools/decoder) to the values the peripherals returned
+ *        - a busy radio sends the samples to the backlog, the next TX cycle
+ *          end sends the batch frame, a layout change closes the frame
+ *          and keeps the sample
+ *        - no new cycle while one is running, a NAK counts, the 10th resets
+ *          the node, a downlink ends the cycle
+ *        - a silent controller costs one Modbus timeout, a slow one is an
+ *          overrun of its time budget and the next wake polls it normally;
+ *          every wake feeds the watchdog; a watchdog reset in a sensor phase counts an overrun,
+ *          a second one in a row leaves the sensor out
+ *        - the first cycle end asks for the time (AppTimeReq), the answer
+ *          sets the clock, uplinks and backlog frames then carry the sample
+ *          time, a later sync learns the drift of the node's crystal
+ *        - the boot probe finds the SHTC3 and no accelerometer, a module
+ *          that is not fitted leaves its bytes out of the payload, a warm
+ *          reset takes the modules from flash, a cold one probes again
+ *
+ *        Benchmarks: host ns and user space instructions (perf_event_open,
+ *        left out if the kernel does not allow it) per sensors_encode(),
+ *        register decode, uplink_decode() and complete send cycle, the
+ *        payload sizes and the virtual time a cycle keeps the node awake.
+ *        Instruction counts, sizes and awake time move with the code, not
+ *        with the machine: they are the ones to compare against
+ *        tools/bench/baseline.txt before flashing. Host ns are shown for
+ *        information, -t gates them too.
+ *
+ *        Build with tools/bench/build.sh, run from the repository root.
+ *
+ *        app_bench [-b baseline] [-u baseline] [-t ns_tolerance_%]
+ * @version 0.1
+ * @date 2022-12-31
+ */
+
+#include "app.h"
+#include <SparkFun_SHTC3.h>
+#include <ModbusMaster.h>
+#include "batch_codec.h"
+#include "uplink_decoder.h"
+
+#include <chrono>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+/** The application entry points, see src/main.cpp */
+void setup_app(void);
+bool init_app(void);
+void app_event_handler(void);
+void lora_data_handler(void);
+
+/** Application state the checks look at, src/main.cpp, src/renogy_rs232.cpp and src/batch.cpp */
+extern bool lora_busy;
+extern uint8_t send_fail;
+extern uint8_t supervisor_skip;
+extern batch_encoder_s batch_enc[];
+void renogySetData(uint16_t *data);
+void renogySetError(uint16_t *data);
+
+/** Network server time at the first sync, 2023-01-01 00:00 UTC, it runs this much faster than the node's uptime */
+#define BENCH_UNIX 1672531200
+#define BENCH_CLOCK_PPM 100.0
+/** GPS time = Unix time - BENCH_GPS_OFFSET */
+#define BENCH_GPS_OFFSET (315964800 - 18)
+
+/** Send interval of the bench node */
+#define BENCH_INTERVAL_MS 900000
+/** Node LiPo, what the ADC reads */
+#define BENCH_LIPO_MV 3900
+/** Renogy RS232 line */
+#define BENCH_RENOGY_CHAR_US 1042 // 10 bits at 9600 Bd
+#define BENCH_RENOGY_LATENCY_US 20000
+/** Samples until a backlog frame is due, BATCH_FLUSH_SAMPLES in src/batch.cpp */
+#define BENCH_BATCH_SAMPLES 8
+/** NAKs until the node resets, src/main.cpp */
+#define BENCH_NAK_RESET 10
+
+/** Repetitions of every measurement, the fastest counts */
+#define BENCH_REPEAT 5
+
+/** Tolerance of the instruction counts against the baseline, % */
+#define BENCH_INSTR_TOLERANCE 2.0
+
+/** Live data and fault registers of the controller, dataStartRegister and errorStartRegister */
+static const uint16_t renogy_data[numDataRegisters] = {87, 131, 245, (30 << 8) | 22, 131, 120, 15, 189, 270, 51};
+static const uint16_t renogy_error[numErrorRegisters] = {0x0000, 0x0012};
+
+/**
+ * @brief Renogy controller on Serial1
+ *        Answers function 0x03 from fixed registers and 0x06 on the load
+ *        switch, with RS232 timing on the virtual clock.
+ */
+class BenchRenogy : public HostUartPeer
+{
+public:
+	uint16_t load_on = 1;
+	/** Cable pulled: requests go out, nothing comes back */
+	bool silent = false;
+	/** Request to first response byte */
+	uint64_t latency_us = BENCH_RENOGY_LATENCY_US;
+
+	void receive(const uint8_t *buffer, size_t size) override
+	{
+		// Blocking write, the UART sends at 9600 Bd
+		host_virtual_us += size * BENCH_RENOGY_CHAR_US;
+		_req.insert(_req.end(), buffer, buffer + size);
+		if (silent)
+		{
+			_req.clear();
+			return;
+		}
+		if (_req.size() < 8)
+		{
+			return;
+		}
+		std::vector<uint8_t> req(_req.begin(), _req.begin() + 8);
+		_req.clear();
+		if (crc16(req.data(), 8) != 0)
+		{
+			return;
+		}
+		_rsp.clear();
+		_rsp_read = 0;
+		uint16_t addr = (req[2] << 8) | req[3];
+		uint16_t qty = (req[4] << 8) | req[5];
+		_rsp.push_back(req[0]);
+		if (req[1] == 0x03)
+		{
+			_rsp.push_back(0x03);
+			_rsp.push_back((uint8_t)(2 * qty));
+			for (uint16_t idx = 0; idx < qty; idx++)
+			{
+				uint16_t val = reg(addr + idx);
+				_rsp.push_back((uint8_t)(val >> 8));
+				_rsp.push_back((uint8_t)val);
+			}
+		}
+		else if (req[1] == 0x06 && addr == loadSwitchRegister)
+		{
+			load_on = qty ? 1 : 0;
+			_rsp.insert(_rsp.end(), req.begin() + 1, req.begin() + 6);
+		}
+		else
+		{
+			_rsp.push_back(req[1] | 0x80);
+			_rsp.push_back(0x01);
+		}
+		uint16_t crc = crc16(_rsp.data(), _rsp.size());
+		_rsp.push_back((uint8_t)crc);
+		_rsp.push_back((uint8_t)(crc >> 8));
+		_rsp_start = host_virtual_us + latency_us;
+	}
+
+	int available(void) override
+	{
+		if (_rsp_read >= _rsp.size() || host_virtual_us < _rsp_start)
+		{
+			return 0;
+		}
+		size_t arrived = (host_virtual_us - _rsp_start) / BENCH_RENOGY_CHAR_US;
+		arrived = arrived > _rsp.size() ? _rsp.size() : arrived;
+		return arrived > _rsp_read ? (int)(arrived - _rsp_read) : 0;
+	}
+
+	int read(void) override
+	{
+		return available() ? _rsp[_rsp_read++] : -1;
+	}
+
+private:
+	std::vector<uint8_t> _req;
+	std::vector<uint8_t> _rsp;
+	size_t _rsp_read = 0;
+	uint64_t _rsp_start = 0;
+
+	static uint16_t crc16(const uint8_t *buf, size_t len)
+	{
+		uint16_t crc = 0xFFFF;
+		for (size_t i = 0; i < len; i++)
+		{
+			crc ^= buf[i];
+			for (int b = 0; b < 8; b++)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+			}
+		}
+		return crc;
+	}
+
+	uint16_t reg(uint16_t addr) const
+	{
+		if (addr >= dataStartRegister && addr < dataStartRegister + numDataRegisters)
+		{
+			return renogy_data[addr - dataStartRegister];
+		}
+		if (addr >= errorStartRegister && addr < errorStartRegister + numErrorRegisters)
+		{
+			return renogy_error[addr - errorStartRegister];
+		}
+		if (addr == loadStatusRegister)
+		{
+			return load_on ? RENOGY_LOAD_STATUS_ON : 0;
+		}
+		return 0;
+	}
+};
+
+/** One uplink the application enqueued */
+struct bench_uplink_s
+{
+	uint8_t port;
+	std::vector<uint8_t> payload;
+};
+
+/** Radio stand-in: takes every uplink unless busy */
+struct bench_radio_s
+{
+	bool busy = false;
+	uint32_t busy_answers = 0;
+	std::vector<bench_uplink_s> sent;
+};
+
+/** Watchdog stand-in: counts the feeds, the checks set the reset cause */
+struct bench_wdt_s
+{
+	bool running = false;
+	uint32_t feeds = 0;
+	bool caused_reset = false;
+	bool warm_reset = false;
+	uint8_t retained = 0;
+};
+
+/** Bench state */
+static BenchRenogy renogy;
+static bench_radio_s radio;
+static bench_wdt_s wdt;
+static uint32_t resets = 0;
+/** Virtual time of BENCH_UNIX */
+static uint64_t clock_epoch_us = 0;
+static int perf_fd = -1;
+static uint32_t failed_checks = 0;
+/** Results in the order measured, compared with and written to the baseline */
+static std::vector<std::pair<std::string, double>> metrics;
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: app_bench [-b baseline] [-u baseline] [-t ns_tolerance_%%]\n");
+	fprintf(stderr, "  -b  compare with a baseline file, exit code 1 on a regression\n");
+	fprintf(stderr, "  -u  write the results as the new baseline\n");
+	fprintf(stderr, "  -t  fail on host ns beyond this tolerance too, default not gated\n");
+	exit(1);
+}
+
+/** WisBlock-API calls */
+
+void api_wake_loop(uint16_t reason)
+{
+	g_task_event_type |= reason;
+}
+
+void api_timer_restart(uint32_t new_time)
+{
+	(void)new_time;
+}
+
+void host_timer_start(SoftwareTimer *timer)
+{
+	(void)timer;
+}
+
+void host_timer_stop(SoftwareTimer *timer)
+{
+	(void)timer;
+}
+
+void api_set_version(uint16_t sw_1, uint16_t sw_2, uint16_t sw_3)
+{
+	(void)sw_1;
+	(void)sw_2;
+	(void)sw_3;
+}
+
+void api_read_credentials(void) {}
+void api_set_credentials(void) {}
+void at_serial_input(uint8_t cmd) { (void)cmd; }
+void restart_advertising(uint16_t timeout) { (void)timeout; }
+
+void api_reset(void)
+{
+	resets++;
+}
+
+float read_batt(void)
+{
+	return (float)BENCH_LIPO_MV;
+}
+
+/** The SAADC backend, results are already mV */
+bool batt_adc_init(void)
+{
+	return true;
+}
+
+int16_t batt_adc_read(void)
+{
+	return BENCH_LIPO_MV;
+}
+
+bool batt_adc_burst_start(int16_t *buf, uint16_t count)
+{
+	for (uint16_t idx = 0; idx < count; idx++)
+	{
+		buf[idx] = BENCH_LIPO_MV;
+	}
+	return true;
+}
+
+uint16_t batt_adc_burst_end(void)
+{
+	return 0;
+}
+
+uint16_t batt_adc_mv(int16_t raw)
+{
+	return raw <= 0 ? 0 : (uint16_t)raw;
+}
+
+/** The watchdog backend of src/wdt.cpp */
+bool wdt_start(uint32_t timeout_ms)
+{
+	(void)timeout_ms;
+	wdt.running = true;
+	return true;
+}
+
+void wdt_feed(void)
+{
+	wdt.feeds++;
+}
+
+bool wdt_caused_reset(void)
+{
+	return wdt.caused_reset;
+}
+
+bool wdt_warm_reset(void)
+{
+	return wdt.warm_reset;
+}
+
+uint8_t wdt_retained(void)
+{
+	return wdt.retained;
+}
+
+void wdt_retain(uint8_t value)
+{
+	wdt.retained = value;
+}
+
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	if (radio.busy)
+	{
+		radio.busy_answers++;
+		return LMH_BUSY;
+	}
+	radio.sent.push_back({fport ? fport : g_lorawan_settings.app_port, std::vector<uint8_t>(data, data + size)});
+	return LMH_SUCCESS;
+}
+
+lmh_error_status lmh_class_request(DeviceClass_t new_class)
+{
+	(void)new_class;
+	return LMH_SUCCESS;
+}
+
+/** The WisBlock-API loop: handle events until the app task would sleep again */
+static void wake(void)
+{
+	for (int pass = 0; g_task_event_type && pass < 4; pass++)
+	{
+		app_event_handler();
+		lora_data_handler();
+	}
+	g_task_event_type = 0;
+}
+
+/** Timer wakeup at the next send interval */
+static void wake_status(void)
+{
+	host_virtual_us += (uint64_t)BENCH_INTERVAL_MS * 1000;
+	api_wake_loop(STATUS);
+	wake();
+}
+
+/** End of the TX cycle, ACK or NAK */
+static void wake_tx_fin(bool ack)
+{
+	g_rx_fin_result = ack;
+	api_wake_loop(LORA_TX_FIN);
+	wake();
+}
+
+/** A downlink in the RX window of the running cycle */
+static void downlink(uint8_t port, const uint8_t *buf, uint8_t len)
+{
+	memcpy(g_rx_lora_data, buf, len);
+	g_rx_data_len = len;
+	g_last_fport = port;
+	api_wake_loop(LORA_DATA);
+	wake();
+}
+
+/** Network server clock, Unix s */
+static double server_unix(void)
+{
+	return BENCH_UNIX + (double)(host_virtual_us - clock_epoch_us) / 1e6 * (1.0 + BENCH_CLOCK_PPM / 1e6);
+}
+
+/**
+ * @brief Network server: AppTimeAns to the AppTimeReq of the last uplink, received right away
+ *
+ * @return false the last uplink has no request
+ */
+static bool clock_answer(void)
+{
+	if (radio.sent.empty() || radio.sent.back().port != LORAWAN_CLOCK_PORT || radio.sent.back().payload.size() < 6)
+	{
+		return false;
+	}
+	// The request is the last command of the frame
+	const uint8_t *req = &radio.sent.back().payload[radio.sent.back().payload.size() - 6];
+	if (req[0] != 0x01)
+	{
+		return false;
+	}
+	uint32_t device = req[1] | (req[2] << 8) | (req[3] << 16) | ((uint32_t)req[4] << 24);
+	uint32_t corr = (uint32_t)(server_unix() - BENCH_GPS_OFFSET) - device;
+	uint8_t ans[6] = {0x01, (uint8_t)corr, (uint8_t)(corr >> 8), (uint8_t)(corr >> 16), (uint8_t)(corr >> 24), (uint8_t)(req[5] & 0x0F)};
+	downlink(LORAWAN_CLOCK_PORT, ans, sizeof(ans));
+	return true;
+}
+
+/**
+ * @brief Report one check
+ *
+ * @param fmt detail after the result, NULL for none
+ */
+static void check(bool ok, const char *name, const char *fmt = NULL, ...) __attribute__((format(printf, 3, 4)));
+static void check(bool ok, const char *name, const char *fmt, ...)
+{
+	char detail[256] = "";
+	if (fmt)
+	{
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(detail, sizeof(detail), fmt, args);
+		va_end(args);
+	}
+	printf("%-44s %s%s%s\n", name, ok ? "ok" : "FAILED", detail[0] ? "  " : "", detail);
+	failed_checks += ok ? 0 : 1;
+}
+
+/** Decoded value of a field, NAN if the frame does not have it */
+static double field(const uplink_frame_s &f, uplink_field_e id)
+{
+	return (f.present & (1ULL << id)) ? f.value[id] : NAN;
+}
+
+static bool near(double v, double want, double tolerance)
+{
+	return fabs(v - want) <= tolerance;
+}
+
+/**
+ * @brief Every register in its field of renogy_data_s
+ */
+static void check_modbus(void)
+{
+	renogy_data_s before = g_renogy_data;
+	uint16_t data[numDataRegisters];
+	uint16_t error[numErrorRegisters];
+	memcpy(data, renogy_data, sizeof(data));
+	memcpy(error, renogy_error, sizeof(error));
+	renogySetData(data);
+	renogySetError(error);
+
+	const renogy_s *got[numDataRegisters] = {&g_renogy_data.batt_capacity, &g_renogy_data.batt_voltage, &g_renogy_data.batt_charge_current,
+											 &g_renogy_data.temp, &g_renogy_data.load_voltage, &g_renogy_data.load_current,
+											 &g_renogy_data.load_power, &g_renogy_data.panel_voltage, &g_renogy_data.panel_current,
+											 &g_renogy_data.panel_power};
+	int wrong = -1;
+	for (int idx = 0; idx < numDataRegisters && wrong < 0; idx++)
+	{
+		wrong = got[idx]->val16 == renogy_data[idx] ? -1 : idx;
+	}
+	check(wrong < 0, "renogySetData() register to field", wrong < 0 ? NULL : "register 0x%03X", dataStartRegister + wrong);
+	check(g_renogy_data.error_status_1.val16 == renogy_error[0] && g_renogy_data.error_status_2.val16 == renogy_error[1],
+		  "renogySetError() register to field");
+	check(g_renogy_data.data_flag1 == 0x0C && g_renogy_data.data_flag2 == 0x02, "renogy_data_s channel header kept");
+	g_renogy_data = before;
+}
+
+/**
+ * @brief One wake, the uplinks decode to what the peripherals returned
+ */
+static void check_encode(void)
+{
+	radio.sent.clear();
+	uint32_t modbus_before = host_modbus_stats.transactions;
+	uint32_t modbus_ok_before = host_modbus_stats.result[ModbusMaster::ku8MBSuccess];
+	wake_status();
+	uint32_t polls = host_modbus_stats.transactions - modbus_before;
+	check(polls > 0 && host_modbus_stats.result[ModbusMaster::ku8MBSuccess] - modbus_ok_before == polls, "wake polls the controller",
+		  "%u transactions", polls);
+	check(radio.sent.size() == PACKET_COUNT, "wake sends one uplink per packet", "%zu uplinks", radio.sent.size());
+
+	bool tracker = false;
+	bool charger = false;
+	for (const bench_uplink_s &up : radio.sent)
+	{
+		uplink_frame_s f;
+		uint8_t status = uplink_decode(up.payload.data(), (uint8_t)up.payload.size(), &f);
+		check(status == UPLINK_OK && up.port == g_lorawan_settings.app_port, "uplink decodes", "status %d port %d", status, up.port);
+		if (f.present & (1ULL << UF_battery))
+		{
+			tracker = true;
+			check(near(field(f, UF_battery), BENCH_LIPO_MV / 1000.0, 0.011), "tracker battery", "%.2f V", field(f, UF_battery));
+			check(near(field(f, UF_temperature), host_shtc3.temp_c, 0.11), "tracker temperature", "%.1f degC", field(f, UF_temperature));
+			check(near(field(f, UF_humidity), host_shtc3.humidity, 0.51), "tracker humidity", "%.1f %%RH", field(f, UF_humidity));
+		}
+		if (f.present & (1ULL << UF_battCapacity))
+		{
+			charger = true;
+			bool ok = field(f, UF_battCapacity) == renogy_data[0] && near(field(f, UF_battVoltage), renogy_data[1] * 0.1, 0.001) &&
+					  near(field(f, UF_battChargeCurrent), renogy_data[2] * 0.01, 0.0001) && field(f, UF_battTemperature) == (renogy_data[3] & 0xFF) &&
+					  field(f, UF_controllerTemperature) == (renogy_data[3] >> 8) && near(field(f, UF_loadVoltage), renogy_data[4] * 0.1, 0.001) &&
+					  near(field(f, UF_loadCurrent), renogy_data[5] * 0.01, 0.0001) && field(f, UF_loadPower) == renogy_data[6] &&
+					  near(field(f, UF_panelVoltage), renogy_data[7] * 0.1, 0.001) && near(field(f, UF_panelCurrent), renogy_data[8] * 0.01, 0.0001) &&
+					  field(f, UF_panelPower) == renogy_data[9];
+			check(ok, "charger registers", "%.0f %% %.1f V, panel %.0f W", field(f, UF_battCapacity), field(f, UF_battVoltage), field(f, UF_panelPower));
+			check(field(f, UF_errorStatus1) == renogy_error[0] && field(f, UF_errorStatus2) == renogy_error[1], "charger fault registers");
+		}
+	}
+	check(tracker && charger, "tracker and charger packet sent");
+	wake_tx_fin(true);
+}
+
+/**
+ * @brief Device time: request after the first cycle, clock set by the answer, sample times, drift
+ */
+static void check_time(void)
+{
+	// check_encode() left its uplinks and the request of the first cycle end
+	bool no_time = radio.sent.size() > PACKET_COUNT;
+	for (size_t idx = 0; idx < PACKET_COUNT && idx < radio.sent.size(); idx++)
+	{
+		uplink_frame_s f;
+		uplink_decode(radio.sent[idx].payload.data(), (uint8_t)radio.sent[idx].payload.size(), &f);
+		no_time = no_time && !(f.present & (1ULL << UF_sampleTime));
+	}
+	check(no_time && !time_is_set(), "no sample time before the clock is set");
+	const std::vector<uint8_t> &req = radio.sent.back().payload;
+	check(radio.sent.back().port == LORAWAN_CLOCK_PORT && req.size() == 6 && req[0] == 0x01 && req[5] == 0x10 && lora_busy,
+		  "AppTimeReq at the end of the first cycle", "%zu bytes", req.size());
+
+	clock_epoch_us = host_virtual_us;
+	clock_answer();
+	check(time_is_set() && near(time_unix(), server_unix(), 1.0) && !lora_busy, "AppTimeAns sets the clock", "%u", time_unix());
+
+	radio.sent.clear();
+	wake_status();
+	bool stamped = radio.sent.size() == PACKET_COUNT;
+	for (const bench_uplink_s &up : radio.sent)
+	{
+		uplink_frame_s f;
+		uplink_decode(up.payload.data(), (uint8_t)up.payload.size(), &f);
+		stamped = stamped && near(field(f, UF_sampleTime), server_unix(), 1.0);
+	}
+	check(stamped, "uplinks carry the sample time");
+	wake_tx_fin(true);
+	check(radio.sent.size() == PACKET_COUNT && !lora_busy, "no clock request before its period", "%zu uplinks", radio.sent.size());
+
+	// 13 h later the server forces a sync, the node's clock is BENCH_CLOCK_PPM behind
+	host_virtual_us += 13ULL * 3600 * 1000000;
+	uint8_t force[2] = {0x03, 0x01};
+	downlink(LORAWAN_CLOCK_PORT, force, sizeof(force));
+	bool asked = clock_answer();
+	check(asked && near(g_time_drift_ppb, BENCH_CLOCK_PPM * 1000 / 4, 10000) && near(time_unix(), server_unix(), 1.0),
+		  "drift learned from the next sync", "%d ppb", g_time_drift_ppb);
+}
+
+/**
+ * @brief The TX cycle state machine: busy radio, running cycle, NAK, downlink
+ */
+static void check_cycle(void)
+{
+	// Radio busy: every sample to the backlog, the next TX cycle end sends the frame
+	radio.sent.clear();
+	radio.busy = true;
+	radio.busy_answers = 0;
+	for (int idx = 0; idx < BENCH_BATCH_SAMPLES; idx++)
+	{
+		wake_status();
+	}
+	radio.busy = false;
+	check(radio.sent.empty() && !lora_busy, "busy radio, no cycle running", "%u busy answers", radio.busy_answers);
+	wake_tx_fin(true);
+	check(radio.sent.size() == 1 && radio.sent[0].port == LORAWAN_BATCH_PORT && lora_busy, "backlog frame at the end of the next cycle",
+		  "%zu uplinks", radio.sent.size());
+	batch_decoder_s d;
+	bool timed = !radio.sent.empty() && batch_decode_begin(&d, radio.sent[0].payload.data(), (uint16_t)radio.sent[0].payload.size()) == BATCH_OK &&
+				 near(d.last_unix + d.age, time_unix(), 1.0);
+	check(timed, "backlog frame carries the sample time", "%u", timed ? d.last_unix : 0);
+	// One frame per packet, each waits for the end of the cycle before it
+	for (int idx = 0; idx < PACKET_COUNT && lora_busy; idx++)
+	{
+		wake_tx_fin(true);
+	}
+	size_t batch_frames = 0;
+	for (const bench_uplink_s &up : radio.sent)
+	{
+		batch_frames += up.port == LORAWAN_BATCH_PORT ? 1 : 0;
+	}
+	check(!lora_busy && batch_frames == PACKET_COUNT, "cycle ends with the backlog sent", "%zu backlog frames", batch_frames);
+
+	// The SHTC3 switched off by configuration changes the tracker layout, the frame is closed and the sample kept
+	radio.sent.clear();
+	radio.busy = true;
+	wake_status();
+	g_app_config.sensor_off |= 1 << sensor_uid[SENSOR_env];
+	wake_status();
+	g_app_config.sensor_off &= ~(1 << sensor_uid[SENSOR_env]);
+	radio.busy = false;
+	wake_tx_fin(true);
+	bool closed = radio.sent.size() == 1 && radio.sent[0].port == LORAWAN_BATCH_PORT &&
+				  batch_decode_begin(&d, radio.sent[0].payload.data(), (uint16_t)radio.sent[0].payload.size()) == BATCH_OK && d.count == 1;
+	check(closed && batch_enc[PACKET_TRACKER].count == 1 && batch_enc[PACKET_RENOGY].count == 2, "layout change closes the backlog frame",
+		  "%zu uplinks, %u tracker samples open", radio.sent.size(), batch_enc[PACKET_TRACKER].count);
+	wake_tx_fin(true);
+	init_batch();
+
+	// A running cycle blocks the next wake
+	radio.sent.clear();
+	wake_status();
+	size_t first = radio.sent.size();
+	wake_status();
+	check(first == PACKET_COUNT && radio.sent.size() == first && lora_busy, "no new uplinks while a cycle runs", "%zu uplinks", radio.sent.size());
+
+	// NAKs count up, the 10th resets the node
+	uint8_t fails = send_fail;
+	resets = 0;
+	wake_tx_fin(false);
+	check(send_fail == fails + 1 && !lora_busy, "NAK counted, cycle ends");
+	while (send_fail < BENCH_NAK_RESET - 1)
+	{
+		wake_status();
+		wake_tx_fin(false);
+	}
+	check(resets == 0, "no reset before the 10th NAK", "%u resets", resets);
+	wake_status();
+	wake_tx_fin(false);
+	check(resets == 1, "10th NAK resets the node", "%u resets", resets);
+
+	// A downlink ends the cycle
+	wake_status();
+	check(lora_busy, "uplink starts a cycle");
+	g_last_fport = g_lorawan_settings.app_port;
+	g_rx_data_len = 0;
+	api_wake_loop(LORA_DATA);
+	wake();
+	check(!lora_busy, "downlink ends the cycle");
+}
+
+/**
+ * @brief Phase budgets and the watchdog: overrun, recovery, feeding, reset in a phase
+ */
+static void check_supervisor(void)
+{
+	const uint8_t renogy_uid = sensor_uid[SENSOR_renogy];
+	const uint8_t env_uid = sensor_uid[SENSOR_env];
+
+	// Every wake that returns feeds the watchdog
+	uint32_t feeds = wdt.feeds;
+	wake_status();
+	wake_tx_fin(true);
+	check(wdt.running && wdt.feeds > feeds && wdt.retained == 0, "watchdog fed per wake, no phase open", "%u feeds", wdt.feeds - feeds);
+
+	// Silent controller: one timeout, the error poll does not wait a second time
+	uint16_t overruns = g_supervisor_overruns[renogy_uid];
+	uint32_t timeouts = host_modbus_stats.result[ModbusMaster::ku8MBResponseTimedOut];
+	renogy.silent = true;
+	wake_status();
+	wake_tx_fin(true);
+	renogy.silent = false;
+	timeouts = host_modbus_stats.result[ModbusMaster::ku8MBResponseTimedOut] - timeouts;
+	check(timeouts == 1 && g_supervisor_overruns[renogy_uid] == overruns, "silent controller, one timeout, no overrun", "%u timeouts",
+		  timeouts);
+
+	// Slow controller: both polls answer, together beyond the budget, one overrun, recovered
+	renogy.latency_us = (uint64_t)RENOGY_BUDGET_MS * 600;
+	wake_status();
+	wake_tx_fin(true);
+	renogy.latency_us = BENCH_RENOGY_LATENCY_US;
+	check(g_supervisor_overruns[renogy_uid] == overruns + 1, "slow controller, one overrun", "%u overruns",
+		  g_supervisor_overruns[renogy_uid] - overruns);
+
+	uint32_t modbus_before = host_modbus_stats.transactions;
+	uint32_t modbus_ok_before = host_modbus_stats.result[ModbusMaster::ku8MBSuccess];
+	wake_status();
+	wake_tx_fin(true);
+	uint32_t polls = host_modbus_stats.transactions - modbus_before;
+	check(g_supervisor_overruns[renogy_uid] == overruns + 1 && polls > 0 &&
+			  host_modbus_stats.result[ModbusMaster::ku8MBSuccess] - modbus_ok_before == polls,
+		  "controller back, next wake normal", "%u transactions", polls);
+
+	// Watchdog reset while the SHTC3 phase runs: counted at boot, the sensor stays in
+	overruns = g_supervisor_overruns[env_uid];
+	supervisor_begin(SENSOR_env);
+	wdt.caused_reset = true;
+	init_supervisor();
+	check(g_supervisor_overruns[env_uid] == overruns + 1 && supervisor_allowed(SENSOR_env), "watchdog reset in a phase, overrun counted",
+		  "%u overruns", g_supervisor_overruns[env_uid] - overruns);
+
+	// Hangs again in the same phase: left out until the next reset
+	supervisor_begin(SENSOR_env);
+	init_supervisor();
+	check(g_supervisor_overruns[env_uid] == overruns + 2 && !supervisor_allowed(SENSOR_env) && supervisor_allowed(SENSOR_renogy),
+		  "2nd watchdog reset in a row, sensor left out", "skip %u", supervisor_skip);
+
+	// Power on reset: everything back in
+	wdt.caused_reset = false;
+	wdt.retained = 0;
+	init_supervisor();
+	check(supervisor_allowed(SENSOR_env), "next reset, sensor back in");
+}
+
+/**
+ * @brief Boot probe of the I2C modules, the payload follows the modules found
+ */
+static void check_i2c_probe(void)
+{
+	uint8_t buf[LORAWAN_MAX_PAYLOAD];
+	uplink_frame_s f;
+	check(g_i2c_modules == I2C_MODULE_SHTC3 && g_sensor_ok[SENSOR_env], "boot probe finds the SHTC3, no accelerometer", "modules 0x%02X",
+		  g_i2c_modules);
+
+	// SHTC3 unplugged, power on: left out of init and payload
+	host_shtc3.present = false;
+	wdt.warm_reset = false;
+	init_i2c_probe();
+	bool started = sensors_init();
+	uint16_t len = sensors_encode(PACKET_TRACKER, buf);
+	bool decoded = uplink_decode(buf, (uint8_t)len, &f) == UPLINK_OK;
+	check(g_i2c_modules == 0 && started && !g_sensor_ok[SENSOR_env] && len == TRACKER_DATA_LEN - ENV_PAYLOAD_LEN && decoded &&
+			  !(f.present & (1ULL << UF_temperature)),
+		  "module not fitted, left out of the payload", "%u bytes", len);
+
+	// Plugged back without a power cycle is impossible, a warm reset does not probe
+	host_shtc3.present = true;
+	wdt.warm_reset = true;
+	init_i2c_probe();
+	check(g_i2c_modules == 0, "warm reset, modules from flash", "modules 0x%02X", g_i2c_modules);
+
+	// Power on: probed again, back in the payload
+	wdt.warm_reset = false;
+	init_i2c_probe();
+	sensors_init();
+	len = sensors_encode(PACKET_TRACKER, buf);
+	decoded = uplink_decode(buf, (uint8_t)len, &f) == UPLINK_OK;
+	check(g_i2c_modules == I2C_MODULE_SHTC3 && g_sensor_ok[SENSOR_env] && len == TRACKER_DATA_LEN && decoded &&
+			  (f.present & (1ULL << UF_temperature)),
+		  "cold reset probes, module back in payload", "%u bytes", len);
+}
+
+/** User space instructions retired, 0 without perf_event_open */
+static uint64_t instructions(void)
+{
+	uint64_t count = 0;
+	if (perf_fd < 0 || read(perf_fd, &count, sizeof(count)) != sizeof(count))
+	{
+		return 0;
+	}
+	return count;
+}
+
+static void perf_open(void)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (perf_fd >= 0)
+	{
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+static void metric(const std::string &name, double value)
+{
+	metrics.push_back({name, value});
+}
+
+/** Keeps the results alive */
+static volatile uint32_t g_sink;
+
+/**
+ * @brief ns and instructions per call of fn, the fastest of BENCH_REPEAT runs
+ */
+template <typename F>
+static void measure(const char *name, uint32_t rounds, F fn)
+{
+	double best_ns = 0.0;
+	double best_instr = 0.0;
+	for (int rep = 0; rep < BENCH_REPEAT; rep++)
+	{
+		uint32_t sink = 0;
+		uint64_t i0 = instructions();
+		auto t0 = std::chrono::steady_clock::now();
+		for (uint32_t r = 0; r < rounds; r++)
+		{
+			sink += fn(r);
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		uint64_t i1 = instructions();
+		g_sink = sink;
+		double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+		double instr = (double)(i1 - i0) / rounds;
+		best_ns = (rep == 0 || ns < best_ns) ? ns : best_ns;
+		best_instr = (rep == 0 || instr < best_instr) ? instr : best_instr;
+	}
+	metric(std::string(name) + "_ns", best_ns);
+	if (perf_fd >= 0)
+	{
+		metric(std::string(name) + "_instr", best_instr);
+	}
+}
+
+static void benchmarks(void)
+{
+	uint8_t buf[LORAWAN_MAX_PAYLOAD];
+	uint16_t size[PACKET_COUNT];
+	for (uint8_t packet = 0; packet < PACKET_COUNT; packet++)
+	{
+		size[packet] = sensors_encode(packet, buf);
+	}
+	metric("payload_tracker_bytes", size[PACKET_TRACKER]);
+	metric("payload_renogy_bytes", size[PACKET_RENOGY]);
+
+	measure("encode_tracker", 100000, [&](uint32_t r) { return (uint32_t)sensors_encode(PACKET_TRACKER, buf) + r; });
+	measure("encode_renogy", 100000, [&](uint32_t r) { return (uint32_t)sensors_encode(PACKET_RENOGY, buf) + r; });
+
+	renogy_data_s before = g_renogy_data;
+	uint16_t data[numDataRegisters];
+	uint16_t error[numErrorRegisters];
+	measure("modbus_decode", 100000, [&](uint32_t r) {
+		memcpy(data, renogy_data, sizeof(data));
+		memcpy(error, renogy_error, sizeof(error));
+		data[r % numDataRegisters] ^= (uint16_t)r;
+		renogySetData(data);
+		renogySetError(error);
+		return (uint32_t)g_renogy_data.panel_power.val16;
+	});
+	g_renogy_data = before;
+
+	uint8_t payload[PACKET_COUNT][LORAWAN_MAX_PAYLOAD];
+	for (uint8_t packet = 0; packet < PACKET_COUNT; packet++)
+	{
+		sensors_encode(packet, payload[packet]);
+	}
+	uplink_frame_s f;
+	measure("decode_tracker", 100000, [&](uint32_t r) { return (uint32_t)uplink_decode(payload[PACKET_TRACKER], (uint8_t)size[PACKET_TRACKER], &f) + r; });
+	measure("decode_renogy", 100000, [&](uint32_t r) { return (uint32_t)uplink_decode(payload[PACKET_RENOGY], (uint8_t)size[PACKET_RENOGY], &f) + r; });
+
+	// Wake, sensors, Modbus poll, encode, send, end of the TX cycle
+	uint64_t awake_us = 0;
+	uint32_t cycles = 0;
+	measure("cycle", 2000, [&](uint32_t r) {
+		radio.sent.clear();
+		host_virtual_us += (uint64_t)BENCH_INTERVAL_MS * 1000;
+		uint64_t start = host_virtual_us;
+		api_wake_loop(STATUS);
+		wake();
+		wake_tx_fin(true);
+		// The periodic clock request goes out at the end of the cycle, its answer ends the next one
+		clock_answer();
+		awake_us += host_virtual_us - start;
+		cycles++;
+		return (uint32_t)radio.sent.size() + r;
+	});
+	metric("cycle_awake_us", (double)awake_us / cycles);
+}
+
+/**
+ * @brief Compare with the baseline, every metric that is larger beyond its tolerance is a regression
+ *        Instructions within BENCH_INSTR_TOLERANCE, sizes and awake time
+ *        exact. Host ns move with the machine's load, within ns_tolerance
+ *        only if it is not negative, else they are only shown.
+ *
+ * @return true no regression
+ */
+static bool compare(const char *path, double ns_tolerance)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+	{
+		fprintf(stderr, "can't open %s\n", path);
+		exit(1);
+	}
+	std::vector<std::pair<std::string, double>> base;
+	char line[256];
+	bool same_compiler = true;
+	while (fgets(line, sizeof(line), fp))
+	{
+		char name[128];
+		double value;
+		if (strncmp(line, "# compiler ", 11) == 0)
+		{
+			line[strcspn(line, "\r\n")] = 0;
+			same_compiler = strcmp(line + 11, __VERSION__) == 0;
+		}
+		else if (line[0] != '#' && sscanf(line, "%127s %lf", name, &value) == 2)
+		{
+			base.push_back({name, value});
+		}
+	}
+	fclose(fp);
+
+	printf("\n%-24s %14s %14s %8s\n", "metric", "baseline", "now", "change");
+	if (!same_compiler)
+	{
+		printf("baseline from another compiler, instruction counts are not comparable\n");
+	}
+	bool ok = true;
+	for (const auto &m : metrics)
+	{
+		const std::pair<std::string, double> *b = NULL;
+		for (const auto &e : base)
+		{
+			b = e.first == m.first ? &e : b;
+		}
+		if (!b)
+		{
+			printf("%-24s %14s %14.1f %8s  new\n", m.first.c_str(), "-", m.second, "");
+			continue;
+		}
+		bool is_ns = m.first.size() > 3 && m.first.compare(m.first.size() - 3, 3, "_ns") == 0;
+		bool is_instr = m.first.size() > 6 && m.first.compare(m.first.size() - 6, 6, "_instr") == 0;
+		double tolerance = is_ns ? ns_tolerance : is_instr ? BENCH_INSTR_TOLERANCE : 0.0;
+		double change = b->second != 0.0 ? 100.0 * (m.second - b->second) / b->second : 0.0;
+		bool regression = m.second > b->second * (1.0 + tolerance / 100.0) + 0.05 && (same_compiler || !is_instr) && (!is_ns || ns_tolerance >= 0.0);
+		ok = ok && !regression;
+		printf("%-24s %14.1f %14.1f %+7.1f%%%s\n", m.first.c_str(), b->second, m.second, change, regression ? "  REGRESSION" : "");
+	}
+	return ok;
+}
+
+static void write_baseline(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+	{
+		fprintf(stderr, "can't create %s\n", path);
+		exit(1);
+	}
+	fprintf(fp, "# app_bench baseline, sh tools/bench/build.sh && ./app_bench -u tools/bench/baseline.txt\n");
+	fprintf(fp, "# compiler %s\n", __VERSION__);
+	for (const auto &m : metrics)
+	{
+		fprintf(fp, "%s %.1f\n", m.first.c_str(), m.second);
+	}
+	fclose(fp);
+	printf("\nbaseline written to %s\n", path);
+}
+
+int main(int argc, char **argv)
+{
+	const char *baseline = NULL;
+	const char *update = NULL;
+	double ns_tolerance = -1.0;
+	for (int idx = 1; idx < argc; idx++)
+	{
+		if (!strcmp(argv[idx], "-b") && idx + 1 < argc)
+		{
+			baseline = argv[++idx];
+		}
+		else if (!strcmp(argv[idx], "-u") && idx + 1 < argc)
+		{
+			update = argv[++idx];
+		}
+		else if (!strcmp(argv[idx], "-t") && idx + 1 < argc)
+		{
+			ns_tolerance = atof(argv[++idx]);
+		}
+		else
+		{
+			usage();
+		}
+	}
+
+	host_virtual_time = true;
+	host_shtc3 = {true, 21.5f, 55.0f};
+	Serial1.attach(&renogy);
+	setup_app();
+	g_lorawan_settings.send_repeat_time = BENCH_INTERVAL_MS;
+	init_app();
+	g_join_result = true;
+	api_wake_loop(LORA_JOIN_FIN);
+	wake();
+
+	check_modbus();
+	check_encode();
+	check_time();
+	check_cycle();
+	check_supervisor();
+	check_i2c_probe();
+
+	perf_open();
+	benchmarks();
+	printf("\n%-24s %14s%s\n", "metric", "value", perf_fd < 0 ? "  (no instruction counter)" : "");
+	for (const auto &m : metrics)
+	{
+		printf("%-24s %14.1f\n", m.first.c_str(), m.second);
+	}
+
+	bool ok = failed_checks == 0;
+	if (baseline)
+	{
+		ok = compare(baseline, ns_tolerance) && ok;
+	}
+	if (update)
+	{
+		write_baseline(update);
+	}
+	if (failed_checks)
+	{
+		printf("\n%u checks failed\n", failed_checks);
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Build the host checks and benchmarks, run from the repository root:
+#   sh tools/bench/build.sh [output]
+#   ./app_bench -b tools/bench/baseline.txt
+#
+# The application sources are built like the firmware (-O2, same ENABLE_
+# flags from src/app.h), so the instruction counts follow the code.
+set -e
+
+OUT=${1:-app_bench}
+
+# src/batt_adc.cpp (SAADC registers) and src/wdt.cpp (WDT registers) are replaced by app_bench.cpp
+CXXFLAGS="-std=gnu++17 -O2 -DNRF52_SERIES -DMY_DEBUG=0 -Itools/host/shim -Isrc -Itools/decoder"
+APP="src/main.cpp src/sensor_registry.cpp src/battery.cpp src/env.cpp src/acc.cpp src/energy.cpp \
+	src/renogy_rs232.cpp src/gnss.cpp src/vibration.cpp src/supervisor.cpp src/i2c_probe.cpp src/batch.cpp src/time_sync.cpp src/config.cpp src/load.cpp src/vedirect.cpp src/fuota.cpp tools/fleet_sim/wisblock_state.cpp"
+
+g++ $CXXFLAGS tools/bench/app_bench.cpp tools/host/host_port.cpp $APP -o "$OUT"
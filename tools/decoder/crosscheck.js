@@ -0,0 +1,94 @@
+// Cross-check of uplink_decode against src/uplink-decoder.js
+// Decodes every frame of an archive with both decoders and compares the
+// fields. Also reports the frames/s of the JS decoder for comparison with
+// `uplink_decode -b`.
+//
+//   node tools/decoder/crosscheck.js archive [path/to/uplink_decode]
+
+var fs = require("fs");
+var os = require("os");
+var path = require("path");
+var vm = require("vm");
+var childProcess = require("child_process");
+
+if (process.argv.length < 3) {
+  console.error("usage: node crosscheck.js archive [uplink_decode]");
+  process.exit(1);
+}
+var archivePath = process.argv[2];
+var nativeDecoder = process.argv[3] || "./uplink_decode";
+
+// The JS decoder is a plain script for the network server, run it in its own context
+var sandbox = {};
+vm.createContext(sandbox);
+vm.runInContext(fs.readFileSync(path.join(__dirname, "../../src/uplink-decoder.js"), "utf8"), sandbox);
+
+// Archive records: u32 rx_time LE, u8 fPort, u8 length, payload
+var archive = fs.readFileSync(archivePath);
+var frames = [];
+var pos = 0;
+while (pos + 6 <= archive.length) {
+  var len = archive[pos + 5];
+  if (pos + 6 + len > archive.length) {
+    break;
+  }
+  frames.push({
+    port: archive[pos + 4],
+    bytes: Array.prototype.slice.call(archive, pos + 6, pos + 6 + len),
+  });
+  pos += 6 + len;
+}
+
+var t0 = process.hrtime.bigint();
+var jsDecoded = frames.map(function (f) {
+  return sandbox.Decoder(f.bytes, f.port);
+});
+var t1 = process.hrtime.bigint();
+var jsRate = frames.length / (Number(t1 - t0) / 1e9);
+
+var tmp = path.join(os.tmpdir(), "crosscheck-" + process.pid + ".jsonl");
+childProcess.execFileSync(nativeDecoder, ["-o", tmp, archivePath], { stdio: "inherit" });
+var native = fs.readFileSync(tmp, "utf8").split("\n").filter(function (l) {
+  return l.length > 0;
+}).map(function (l) {
+  return JSON.parse(l);
+});
+fs.unlinkSync(tmp);
+
+// Fields only one side has: the JS location string, the native frame header
+var jsOnly = { location: true };
+var nativeOnly = { rx_time: true, port: true, status: true };
+
+var mismatches = 0;
+function report(idx, text) {
+  if (mismatches++ < 10) {
+    console.log("frame " + idx + ": " + text + " bytes " + Buffer.from(frames[idx].bytes).toString("hex"));
+  }
+}
+
+if (native.length != frames.length) {
+  report(0, "native decoded " + native.length + " frames, archive has " + frames.length);
+}
+for (var idx = 0; idx < frames.length && idx < native.length; idx++) {
+  var js = jsDecoded[idx];
+  var cpp = native[idx];
+  for (var key in js) {
+    if (jsOnly[key]) {
+      continue;
+    }
+    if (!(key in cpp)) {
+      report(idx, key + " missing in native output");
+    } else if (js[key] !== cpp[key]) {
+      report(idx, key + " js " + js[key] + " native " + cpp[key]);
+    }
+  }
+  for (var key in cpp) {
+    if (!nativeOnly[key] && !(key in js)) {
+      report(idx, key + " missing in JS output");
+    }
+  }
+}
+
+console.log(frames.length + " frames, " + mismatches + " mismatches");
+console.log("JS decoder " + Math.round(jsRate) + " frames/s");
+process.exit(mismatches ? 1 : 0);
@@ -0,0 +1,661 @@
+/**
+ * @file uplink_decode.cpp
+ * @brief Batch decoder for archived uplinks
+ *        Streams an archive (see uplink_decoder.h) in chunks, decodes the
+ *        chunks on a pool of threads and writes the frames in archive order,
+ *        as JSON lines or as one column file per field. Also generates
+ *        synthetic archives and benchmarks the decoder in frames/s.
+ *
+ *        g++ -std=c++17 -O2 -pthread tools/decoder/uplink_decode.cpp -o uplink_decode
+ *
+ *        uplink_decode [-t threads] [-f jsonl|columns|none] [-o out] archive
+ *        uplink_decode -g frames archive    write a synthetic archive
+ *        uplink_decode -b [-t threads] archive
+ * @version 0.1
+ * @date 2022-10-22
+ */
+
+#include "uplink_decoder.h"
+
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+/** Archive bytes per chunk, one chunk per thread and round */
+#define CHUNK_SIZE (256 * 1024)
+
+enum out_format_e
+{
+	OUT_JSONL,
+	OUT_COLUMNS,
+	OUT_NONE,
+};
+
+/** One chunk of the archive and what the decoder made of it */
+struct chunk_s
+{
+	std::vector<uint8_t> raw;
+	size_t used = 0;
+	std::vector<uplink_frame_s> frames;
+	size_t count = 0;
+	std::string text;
+};
+
+/** 10^decimals */
+static const double pow10_tab[] = {1.0, 10.0, 100.0, 1000.0, 10000.0};
+
+/**
+ * @brief Round to 10^-decimals units like Number.prototype.toFixed()
+ *        toFixed() rounds the exact binary value, ties away from zero. Only
+ *        values within rounding error of a tie need the exact expansion.
+ */
+static long long js_round(double v, int decimals)
+{
+	double scaled = fabs(v * pow10_tab[decimals]);
+	if (fabs(scaled - floor(scaled) - 0.5) > 1e-6)
+	{
+		return llround(v * pow10_tab[decimals]);
+	}
+	// glibc prints the exact expansion, a double below 2^53 has at most 52 fraction digits
+	char exact[128];
+	snprintf(exact, sizeof(exact), "%.60f", fabs(v));
+	const char *dot = strchr(exact, '.');
+	long long q = strtoll(exact, NULL, 10);
+	for (int idx = 1; idx <= decimals; idx++)
+	{
+		q = q * 10 + (dot[idx] - '0');
+	}
+	if (dot[decimals + 1] >= '5')
+	{
+		q++;
+	}
+	return v < 0 ? -q : q;
+}
+
+/**
+ * @brief Append a value the way the JS decoder prints it: rounded, no trailing zeros
+ *        All values are fixed point on the wire, so the value is rounded to an
+ *        integer of 10^-decimals units and printed without snprintf("%f").
+ */
+static void append_value(std::string &out, const uplink_field_s &field, double v)
+{
+	if (field.kind == UF_BOOL)
+	{
+		out += v != 0.0 ? "true" : "false";
+		return;
+	}
+	int decimals = field.decimals;
+	long long q = js_round(v, decimals);
+	// Drop trailing zero decimals
+	while (decimals > 0 && q % 10 == 0)
+	{
+		q /= 10;
+		decimals--;
+	}
+	char num[24];
+	char *p = &num[sizeof(num)];
+	bool neg = q < 0;
+	unsigned long long u = neg ? -q : q;
+	int digits = 0;
+	do
+	{
+		*--p = (char)('0' + u % 10);
+		u /= 10;
+		if (++digits == decimals)
+		{
+			*--p = '.';
+		}
+	} while (u != 0 || digits <= decimals);
+	if (*p == '.')
+	{
+		*--p = '0';
+	}
+	if (neg)
+	{
+		*--p = '-';
+	}
+	out.append(p, &num[sizeof(num)] - p);
+}
+
+/**
+ * @brief JSON lines: rx_time, port, status and the fields present
+ */
+static void format_jsonl(chunk_s &c)
+{
+	c.text.clear();
+	c.text.reserve(c.count * 160);
+	char head[64];
+	for (size_t idx = 0; idx < c.count; idx++)
+	{
+		const uplink_frame_s &f = c.frames[idx];
+		snprintf(head, sizeof(head), "{\"rx_time\":%u,\"port\":%u,\"status\":%u", f.rx_time, f.port, f.status);
+		c.text += head;
+		for (int field = 0; field < UF_COUNT; field++)
+		{
+			if (f.present & (1ULL << field))
+			{
+				c.text += ",\"";
+				c.text += uplink_fields[field].name;
+				c.text += "\":";
+				append_value(c.text, uplink_fields[field], f.value[field]);
+			}
+		}
+		c.text += "}\n";
+	}
+}
+
+/** Column output: one file per field, NaN where a frame has no value */
+struct columns_s
+{
+	std::string dir;
+	FILE *rx_time = NULL;
+	FILE *port = NULL;
+	FILE *status = NULL;
+	FILE *field[UF_COUNT] = {NULL};
+	size_t rows = 0;
+};
+
+static FILE *open_column(const std::string &dir, const char *name, const char *ext)
+{
+	std::string path = dir + "/" + name + "." + ext;
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+	{
+		perror(path.c_str());
+		exit(1);
+	}
+	return f;
+}
+
+static void columns_open(columns_s &cols, const std::string &dir)
+{
+	mkdir(dir.c_str(), 0755);
+	cols.dir = dir;
+	cols.rx_time = open_column(dir, "rx_time", "u32");
+	cols.port = open_column(dir, "port", "u8");
+	cols.status = open_column(dir, "status", "u8");
+	for (int field = 0; field < UF_COUNT; field++)
+	{
+		cols.field[field] = open_column(dir, uplink_fields[field].name, "f64");
+	}
+}
+
+static void columns_write(columns_s &cols, const chunk_s &c)
+{
+	std::vector<uint32_t> u32(c.count);
+	std::vector<uint8_t> u8(c.count);
+	std::vector<double> f64(c.count);
+	for (size_t idx = 0; idx < c.count; idx++)
+	{
+		u32[idx] = c.frames[idx].rx_time;
+	}
+	fwrite(u32.data(), sizeof(uint32_t), c.count, cols.rx_time);
+	for (size_t idx = 0; idx < c.count; idx++)
+	{
+		u8[idx] = c.frames[idx].port;
+	}
+	fwrite(u8.data(), 1, c.count, cols.port);
+	for (size_t idx = 0; idx < c.count; idx++)
+	{
+		u8[idx] = c.frames[idx].status;
+	}
+	fwrite(u8.data(), 1, c.count, cols.status);
+	for (int field = 0; field < UF_COUNT; field++)
+	{
+		uint64_t bit = 1ULL << field;
+		for (size_t idx = 0; idx < c.count; idx++)
+		{
+			f64[idx] = (c.frames[idx].present & bit) ? c.frames[idx].value[field] : NAN;
+		}
+		fwrite(f64.data(), sizeof(double), c.count, cols.field[field]);
+	}
+	cols.rows += c.count;
+}
+
+static void columns_close(columns_s &cols)
+{
+	fclose(cols.rx_time);
+	fclose(cols.port);
+	fclose(cols.status);
+	for (int field = 0; field < UF_COUNT; field++)
+	{
+		fclose(cols.field[field]);
+	}
+	// Schema: file, type, unit, rows
+	FILE *schema = open_column(cols.dir, "columns", "txt");
+	fprintf(schema, "rx_time.u32 u32 s %zu\nport.u8 u8 - %zu\nstatus.u8 u8 - %zu\n", cols.rows, cols.rows, cols.rows);
+	for (int field = 0; field < UF_COUNT; field++)
+	{
+		fprintf(schema, "%s.f64 f64 %s %zu\n", uplink_fields[field].name,
+				uplink_fields[field].unit[0] ? uplink_fields[field].unit : "-", cols.rows);
+	}
+	fclose(schema);
+}
+
+/**
+ * @brief Decode one chunk, and format it if the output is text
+ */
+static void decode_chunk(chunk_s &c, out_format_e format)
+{
+	size_t records = 0;
+	uplink_archive_split(c.raw.data(), c.used, &records);
+	if (c.frames.size() < records)
+	{
+		c.frames.resize(records);
+	}
+	c.count = uplink_decode_records(c.raw.data(), c.used, c.frames.data());
+	if (format == OUT_JSONL)
+	{
+		format_jsonl(c);
+	}
+}
+
+/**
+ * @brief Stream the archive through the thread pool
+ *
+ * @return size_t frames decoded
+ */
+static size_t run_decode(FILE *in, int threads, out_format_e format, FILE *out, columns_s *cols)
+{
+	std::vector<chunk_s> chunks(threads);
+	std::vector<uint8_t> carry;
+	size_t frames = 0;
+	bool eof = false;
+	while (!eof)
+	{
+		// Fill one chunk per thread, each ends at a record boundary
+		int filled = 0;
+		for (; filled < threads && !eof; filled++)
+		{
+			chunk_s &c = chunks[filled];
+			c.raw.resize(carry.size() + CHUNK_SIZE);
+			memcpy(c.raw.data(), carry.data(), carry.size());
+			size_t got = fread(c.raw.data() + carry.size(), 1, CHUNK_SIZE, in);
+			size_t size = carry.size() + got;
+			eof = got < CHUNK_SIZE;
+			c.used = uplink_archive_split(c.raw.data(), size, NULL);
+			carry.assign(c.raw.begin() + c.used, c.raw.begin() + size);
+		}
+		if (eof && !carry.empty())
+		{
+			fprintf(stderr, "archive ends with %zu bytes of an incomplete record\n", carry.size());
+		}
+
+		std::vector<std::thread> pool;
+		for (int idx = 1; idx < filled; idx++)
+		{
+			pool.emplace_back(decode_chunk, std::ref(chunks[idx]), format);
+		}
+		if (filled > 0)
+		{
+			decode_chunk(chunks[0], format);
+		}
+		for (auto &t : pool)
+		{
+			t.join();
+		}
+
+		// Write in archive order
+		for (int idx = 0; idx < filled; idx++)
+		{
+			frames += chunks[idx].count;
+			if (format == OUT_JSONL)
+			{
+				fwrite(chunks[idx].text.data(), 1, chunks[idx].text.size(), out);
+			}
+			else if (format == OUT_COLUMNS)
+			{
+				columns_write(*cols, chunks[idx]);
+			}
+		}
+	}
+	return frames;
+}
+
+/**
+ * @brief 0x1285 a few s before reception, left out as by a node without a set clock
+ *
+ * @return uint8_t bytes written
+ */
+static uint8_t sample_time(uint8_t *p, uint32_t rx_time, std::mt19937 &rng)
+{
+	if (rng() % 8 == 0)
+	{
+		return 0;
+	}
+	uint32_t t = rx_time - 1 - rng() % 5;
+	uint8_t ch[] = {0x12, 0x85, (uint8_t)(t >> 24), (uint8_t)(t >> 16), (uint8_t)(t >> 8), (uint8_t)t};
+	memcpy(p, ch, sizeof(ch));
+	return sizeof(ch);
+}
+
+/**
+ * @brief Synthetic archive: the packets this firmware sends, with plausible values
+ *        Tracker packets (battery, environment, sometimes GNSS and vibration),
+ *        Renogy packets and accelerometer alerts, 1% with an unknown channel.
+ *        Most sensor packets end with their sample time.
+ */
+static void generate(FILE *out, size_t count)
+{
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> byte(0, 255);
+	uint32_t rx_time = 1640995200;
+	uint8_t rec[6 + 255];
+	for (size_t n = 0; n < count; n++)
+	{
+		uint8_t *p = &rec[6];
+		uint8_t len = 0;
+		int kind = rng() % 10;
+		rx_time += 60 + rng() % 900;
+		if (kind < 6)
+		{
+			// Tracker packet
+			if (rng() % 2)
+			{
+				int32_t lat = (int32_t)(rng() % 1800000) - 900000;
+				int32_t lng = (int32_t)(rng() % 3600000) - 1800000;
+				int32_t alt = (int32_t)(rng() % 400000) - 10000;
+				uint8_t gps[] = {0x01, 0x88,
+								 (uint8_t)(lat >> 16), (uint8_t)(lat >> 8), (uint8_t)lat,
+								 (uint8_t)(lng >> 16), (uint8_t)(lng >> 8), (uint8_t)lng,
+								 (uint8_t)(alt >> 16), (uint8_t)(alt >> 8), (uint8_t)alt};
+				memcpy(p + len, gps, sizeof(gps));
+				len += sizeof(gps);
+			}
+			uint16_t batt = 340 + rng() % 80;
+			uint8_t bat[] = {0x08, 0x02, (uint8_t)(batt >> 8), (uint8_t)batt};
+			memcpy(p + len, bat, sizeof(bat));
+			len += sizeof(bat);
+			uint16_t tx_min = batt - rng() % 40;
+			uint16_t rint = 60 + rng() % 600;
+			uint8_t sag[] = {0x11, 0x02, (uint8_t)(tx_min >> 8), (uint8_t)tx_min, (uint8_t)(rint >> 8), (uint8_t)rint};
+			memcpy(p + len, sag, sizeof(sag));
+			len += sizeof(sag);
+			int16_t temp = (int16_t)(rng() % 700) - 200;
+			uint8_t env[] = {0x07, 0x68, (uint8_t)(rng() % 201), 0x02, 0x67, (uint8_t)(temp >> 8), (uint8_t)temp};
+			memcpy(p + len, env, sizeof(env));
+			len += sizeof(env);
+			if (rng() % 4 == 0)
+			{
+				uint8_t vib[] = {0x0E, 0x71, (uint8_t)(rng() % 4), (uint8_t)byte(rng), (uint8_t)(rng() % 16),
+								 (uint8_t)byte(rng), (uint8_t)(10 + rng() % 60), (uint8_t)(rng() % 200), (uint8_t)(rng() % 200)};
+				memcpy(p + len, vib, sizeof(vib));
+				len += sizeof(vib);
+			}
+			len += sample_time(p + len, rx_time, rng);
+			if (rng() % 100 == 0)
+			{
+				uint8_t unknown[] = {0x1F, 0x05, (uint8_t)byte(rng), (uint8_t)byte(rng)};
+				memcpy(p + len, unknown, sizeof(unknown));
+				len += sizeof(unknown);
+			}
+		}
+		else if (kind < 9)
+		{
+			// renogy_data_s, little endian registers
+			uint16_t regs[12] = {(uint16_t)(rng() % 101), (uint16_t)(110 + rng() % 40), (uint16_t)(rng() % 2000),
+								 (uint16_t)((rng() % 60) | ((rng() % 2) << 7) | ((rng() % 70) << 8)),
+								 (uint16_t)(110 + rng() % 40), (uint16_t)(rng() % 1000), (uint16_t)(rng() % 200),
+								 (uint16_t)(rng() % 250), (uint16_t)(rng() % 1500), (uint16_t)(rng() % 300),
+								 (uint16_t)(rng() % 50 == 0 ? byte(rng) : 0), (uint16_t)(rng() % 50 == 0 ? byte(rng) : 0)};
+			p[len++] = 0x0C;
+			p[len++] = 0x02;
+			for (int idx = 0; idx < 12; idx++)
+			{
+				p[len++] = (uint8_t)regs[idx];
+				p[len++] = (uint8_t)(regs[idx] >> 8);
+			}
+			len += sample_time(p + len, rx_time, rng);
+		}
+		else
+		{
+			// acc_alert_s
+			int16_t xyz[3] = {(int16_t)(rng() % 16000 - 8000), (int16_t)(rng() % 16000 - 8000), (int16_t)(rng() % 16000 - 8000)};
+			p[len++] = 0x03;
+			p[len++] = 0x71;
+			for (int idx = 0; idx < 3; idx++)
+			{
+				p[len++] = (uint8_t)(xyz[idx] >> 8);
+				p[len++] = (uint8_t)xyz[idx];
+			}
+			p[len++] = 0x0D;
+			p[len++] = 0x00;
+			p[len++] = (uint8_t)(1 + rng() % 7);
+		}
+		rec[0] = (uint8_t)rx_time;
+		rec[1] = (uint8_t)(rx_time >> 8);
+		rec[2] = (uint8_t)(rx_time >> 16);
+		rec[3] = (uint8_t)(rx_time >> 24);
+		rec[4] = 2;
+		rec[5] = len;
+		fwrite(rec, 1, 6 + len, out);
+	}
+}
+
+/** Benchmark worker, every t-th chunk starting at w */
+static void bench_worker(std::vector<chunk_s> &chunks, int w, int t, out_format_e format)
+{
+	for (size_t idx = w; idx < chunks.size(); idx += t)
+	{
+		decode_chunk(chunks[idx], format);
+	}
+}
+
+/**
+ * @brief Decode the archive from memory with 1 .. threads threads, decode only and decode + JSON
+ */
+static void benchmark(const char *path, int threads)
+{
+	FILE *in = fopen(path, "rb");
+	if (!in)
+	{
+		perror(path);
+		exit(1);
+	}
+	std::vector<uint8_t> archive;
+	uint8_t buf[65536];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), in)) > 0)
+	{
+		archive.insert(archive.end(), buf, buf + got);
+	}
+	fclose(in);
+
+	// Split into chunks up front, the benchmark times the decoder, not the disk
+	std::vector<chunk_s> chunks;
+	size_t pos = 0;
+	size_t total = 0;
+	while (pos < archive.size())
+	{
+		chunk_s c;
+		size_t size = archive.size() - pos < CHUNK_SIZE ? archive.size() - pos : CHUNK_SIZE;
+		size_t used = uplink_archive_split(&archive[pos], size, NULL);
+		if (used == 0)
+		{
+			break;
+		}
+		c.raw.assign(archive.begin() + pos, archive.begin() + pos + used);
+		c.used = used;
+		pos += used;
+		chunks.push_back(std::move(c));
+	}
+
+	// Warm up: frame buffers allocated and touched once
+	bench_worker(chunks, 0, 1, OUT_NONE);
+
+	printf("%zu bytes, %zu chunks\n", archive.size(), chunks.size());
+	printf("threads  decode frames/s  decode+json frames/s\n");
+	for (int t = 1;; t *= 2)
+	{
+		t = t > threads ? threads : t;
+		double rate[2];
+		for (int mode = 0; mode < 2; mode++)
+		{
+			out_format_e format = mode ? OUT_JSONL : OUT_NONE;
+			auto t0 = std::chrono::steady_clock::now();
+			std::vector<std::thread> pool;
+			for (int w = 0; w < t; w++)
+			{
+				pool.emplace_back(bench_worker, std::ref(chunks), w, t, format);
+			}
+			for (auto &th : pool)
+			{
+				th.join();
+			}
+			auto t1 = std::chrono::steady_clock::now();
+			total = 0;
+			for (auto &c : chunks)
+			{
+				total += c.count;
+			}
+			rate[mode] = total / std::chrono::duration<double>(t1 - t0).count();
+		}
+		printf("%7d  %15.0f  %20.0f\n", t, rate[0], rate[1]);
+		if (t == threads)
+		{
+			break;
+		}
+	}
+	printf("%zu frames\n", total);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s [-t threads] [-f jsonl|columns|none] [-o out] archive\n"
+			"       %s -g frames archive\n"
+			"       %s -b [-t threads] archive\n"
+			"  -t  decoder threads, default: all cores\n"
+			"  -f  jsonl (default, to stdout or -o file), columns (one file per field in directory -o), none\n"
+			"  -g  write a synthetic archive with this many frames\n"
+			"  -b  benchmark frames/s from 1 to -t threads\n",
+			name, name, name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int threads = (int)std::thread::hardware_concurrency();
+	out_format_e format = OUT_JSONL;
+	const char *out_path = NULL;
+	long gen_frames = 0;
+	bool bench = false;
+	const char *archive = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-t" && i + 1 < argc)
+		{
+			threads = atoi(argv[++i]);
+		}
+		else if (arg == "-f" && i + 1 < argc)
+		{
+			std::string f = argv[++i];
+			if (f == "jsonl")
+			{
+				format = OUT_JSONL;
+			}
+			else if (f == "columns")
+			{
+				format = OUT_COLUMNS;
+			}
+			else if (f == "none")
+			{
+				format = OUT_NONE;
+			}
+			else
+			{
+				usage(argv[0]);
+			}
+		}
+		else if (arg == "-o" && i + 1 < argc)
+		{
+			out_path = argv[++i];
+		}
+		else if (arg == "-g" && i + 1 < argc)
+		{
+			gen_frames = atol(argv[++i]);
+		}
+		else if (arg == "-b")
+		{
+			bench = true;
+		}
+		else if (arg[0] != '-' && !archive)
+		{
+			archive = argv[i];
+		}
+		else
+		{
+			usage(argv[0]);
+		}
+	}
+	if (!archive || threads < 1)
+	{
+		usage(argv[0]);
+	}
+
+	if (gen_frames > 0)
+	{
+		FILE *out = fopen(archive, "wb");
+		if (!out)
+		{
+			perror(archive);
+			return 1;
+		}
+		generate(out, gen_frames);
+		fclose(out);
+		return 0;
+	}
+	if (bench)
+	{
+		benchmark(archive, threads);
+		return 0;
+	}
+
+	FILE *in = fopen(archive, "rb");
+	if (!in)
+	{
+		perror(archive);
+		return 1;
+	}
+	FILE *out = stdout;
+	columns_s cols;
+	if (format == OUT_COLUMNS)
+	{
+		if (!out_path)
+		{
+			usage(argv[0]);
+		}
+		columns_open(cols, out_path);
+	}
+	else if (out_path)
+	{
+		out = fopen(out_path, "w");
+		if (!out)
+		{
+			perror(out_path);
+			return 1;
+		}
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	size_t frames = run_decode(in, threads, format, out, &cols);
+	auto t1 = std::chrono::steady_clock::now();
+	fclose(in);
+	if (format == OUT_COLUMNS)
+	{
+		columns_close(cols);
+	}
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	fprintf(stderr, "%zu frames in %.3f s\n", frames, std::chrono::duration<double>(t1 - t0).count());
+	return 0;
+}
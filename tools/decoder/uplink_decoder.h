@@ -0,0 +1,362 @@
+/**
+ * @file uplink_decoder.h
+ * @brief Binary decoder for the uplink payloads of this firmware
+ *        Same channels, scaling and field names as src/uplink-decoder.js,
+ *        but it works on the raw bytes, no hex string in between. One
+ *        decoded frame is a fixed size record with a bit mask of the fields
+ *        present, so batches can be turned into columns without lookups.
+ *
+ *        Archive format, little endian, records back to back:
+ *        u32 rx_time (s), u8 fPort, u8 length, length bytes of payload
+ * @version 0.1
+ * @date 2022-10-22
+ */
+
+#ifndef UPLINK_DECODER_H
+#define UPLINK_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/** Field kinds, how a value is printed */
+#define UF_NUM 0
+#define UF_BOOL 1
+
+/** X(name, unit, decimals, kind), name and rounding as in the JS decoder */
+#define UPLINK_FIELDS(X)                        \
+	X(latitude, "deg", 4, UF_NUM)               \
+	X(longitude, "deg", 4, UF_NUM)              \
+	X(altitude, "m", 1, UF_NUM)                 \
+	X(battery, "V", 2, UF_NUM)                  \
+	X(batteryTxMin, "V", 2, UF_NUM)             \
+	X(batteryRint, "mOhm", 0, UF_NUM)           \
+	X(humidity, "%RH", 1, UF_NUM)               \
+	X(temperature, "degC", 2, UF_NUM)           \
+	X(barometer, "hPa", 2, UF_NUM)              \
+	X(gasResistance, "kOhm", 2, UF_NUM)         \
+	X(acceleration_x, "g", 3, UF_NUM)           \
+	X(acceleration_y, "g", 3, UF_NUM)           \
+	X(acceleration_z, "g", 3, UF_NUM)           \
+	X(gyroscope_x, "deg/s", 2, UF_NUM)          \
+	X(gyroscope_y, "deg/s", 2, UF_NUM)          \
+	X(gyroscope_z, "deg/s", 2, UF_NUM)          \
+	X(magnetometer_x, "uT", 2, UF_NUM)          \
+	X(magnetometer_y, "uT", 2, UF_NUM)          \
+	X(magnetometer_z, "uT", 2, UF_NUM)          \
+	X(motion, "", 0, UF_BOOL)                   \
+	X(impact, "", 0, UF_BOOL)                   \
+	X(tilt, "", 0, UF_BOOL)                     \
+	X(vibration_rms, "g", 3, UF_NUM)            \
+	X(vibration_peak, "g", 3, UF_NUM)           \
+	X(vibration_crest, "", 1, UF_NUM)           \
+	X(vibration_freq_1, "Hz", 0, UF_NUM)        \
+	X(vibration_freq_2, "Hz", 0, UF_NUM)        \
+	X(battCapacity, "%", 0, UF_NUM)             \
+	X(battVoltage, "V", 1, UF_NUM)              \
+	X(battChargeCurrent, "A", 2, UF_NUM)        \
+	X(battTemperature, "degC", 0, UF_NUM)       \
+	X(controllerTemperature, "degC", 0, UF_NUM) \
+	X(loadVoltage, "V", 1, UF_NUM)              \
+	X(loadCurrent, "A", 2, UF_NUM)              \
+	X(loadPower, "W", 0, UF_NUM)                \
+	X(panelVoltage, "V", 1, UF_NUM)             \
+	X(panelCurrent, "A", 2, UF_NUM)             \
+	X(panelPower, "W", 0, UF_NUM)               \
+	X(errorStatus1, "", 0, UF_NUM)              \
+	X(errorStatus2, "", 0, UF_NUM)              \
+	X(commandSeq, "", 0, UF_NUM)                \
+	X(commandStatus, "", 0, UF_NUM)             \
+	X(loadState, "", 0, UF_NUM)                 \
+	X(loadResult, "", 0, UF_NUM)                \
+	X(sampleTime, "s", 0, UF_NUM)               \
+	X(unknownChannel, "", 0, UF_NUM)
+
+#define UF_X_ID(name, unit, decimals, kind) UF_##name,
+enum uplink_field_e
+{
+	UPLINK_FIELDS(UF_X_ID)
+		UF_COUNT
+};
+static_assert(UF_COUNT <= 64, "uplink_frame_s::present has one bit per field");
+
+/** Static description of a field */
+struct uplink_field_s
+{
+	const char *name;
+	const char *unit;
+	uint8_t decimals;
+	uint8_t kind;
+};
+
+#define UF_X_DESC(name, unit, decimals, kind) {#name, unit, decimals, kind},
+static const uplink_field_s uplink_fields[UF_COUNT] = {UPLINK_FIELDS(UF_X_DESC)};
+
+/** Frame status */
+enum uplink_status_e
+{
+	UPLINK_OK = 0,
+	UPLINK_UNKNOWN_CHANNEL, // decoding stopped at a channel this decoder does not know
+	UPLINK_TRUNCATED,		// a channel is longer than the rest of the frame
+};
+
+/** One decoded uplink */
+struct uplink_frame_s
+{
+	uint32_t rx_time;
+	uint8_t port;
+	uint8_t status;
+	uint64_t present;
+	double value[UF_COUNT];
+};
+
+/** Archive record header length */
+#define UPLINK_RECORD_HEADER 6
+
+static inline int16_t uplink_s16(const uint8_t *p)
+{
+	return (int16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint16_t uplink_u16(const uint8_t *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint16_t uplink_u16le(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline int32_t uplink_s24(const uint8_t *p)
+{
+	int32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+	return (v & 0x800000) ? v - 0x1000000 : v;
+}
+
+/** Renogy temperature byte, bit 7 is the sign */
+static inline int uplink_renogy_temp(uint8_t b)
+{
+	return (b & 0x80) ? -(b & 0x7f) : b;
+}
+
+static inline void uplink_set(uplink_frame_s *f, uplink_field_e field, double v)
+{
+	f->value[field] = v;
+	f->present |= 1ULL << field;
+}
+
+/**
+ * @brief Payload length of a channel, without the 2 byte header
+ *
+ * @return int length, -1 if the channel is unknown
+ */
+static inline int uplink_channel_len(uint16_t channel)
+{
+	switch (channel)
+	{
+	case 0x0768: // humidity
+		return 1;
+	case 0x0d00: // accelerometer events
+		return 1;
+	case 0x0673: // barometer
+	case 0x0267: // temperature
+	case 0x0402: // gas resistance
+	case 0x0802: // battery
+	case 0x0902: // magnetometer x
+	case 0x0a02: // magnetometer y
+	case 0x0b02: // magnetometer z
+	case 0x0f01: // command acknowledge
+	case 0x1001: // load switch report
+		return 2;
+	case 0x1102: // battery under TX
+	case 0x1285: // sample time
+		return 4;
+	case 0x0371: // acceleration
+	case 0x0586: // gyroscope
+		return 6;
+	case 0x0e71: // vibration features
+		return 7;
+	case 0x0188: // GPS
+		return 9;
+	case 0x0c02: // renogy_data_s
+		return 24;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * @brief Decode one payload
+ *
+ * @param buf payload
+ * @param len payload length
+ * @param f decoded frame, rx_time and port are left alone
+ * @return uint8_t uplink_status_e
+ */
+static inline uint8_t uplink_decode(const uint8_t *buf, uint8_t len, uplink_frame_s *f)
+{
+	f->present = 0;
+	f->status = UPLINK_OK;
+	uint16_t idx = 0;
+	// Same loop condition as the JS decoder: a trailing header without value is ignored
+	while (len - idx > 2)
+	{
+		uint16_t channel = uplink_u16(&buf[idx]);
+		int clen = uplink_channel_len(channel);
+		if (clen < 0)
+		{
+			uplink_set(f, UF_unknownChannel, channel);
+			f->status = UPLINK_UNKNOWN_CHANNEL;
+			break;
+		}
+		if (idx + 2 + clen > len)
+		{
+			f->status = UPLINK_TRUNCATED;
+			break;
+		}
+		const uint8_t *p = &buf[idx + 2];
+		switch (channel)
+		{
+		case 0x0768:
+			uplink_set(f, UF_humidity, p[0] * 0.5);
+			break;
+		case 0x0673:
+			uplink_set(f, UF_barometer, uplink_s16(p) * 0.1);
+			break;
+		case 0x0267:
+			uplink_set(f, UF_temperature, uplink_s16(p) * 0.1);
+			break;
+		case 0x0188:
+			uplink_set(f, UF_latitude, uplink_s24(p) * 0.0001);
+			uplink_set(f, UF_longitude, uplink_s24(p + 3) * 0.0001);
+			uplink_set(f, UF_altitude, uplink_s24(p + 6) * 0.01);
+			break;
+		case 0x0371:
+			uplink_set(f, UF_acceleration_x, uplink_s16(p) * 0.001);
+			uplink_set(f, UF_acceleration_y, uplink_s16(p + 2) * 0.001);
+			uplink_set(f, UF_acceleration_z, uplink_s16(p + 4) * 0.001);
+			break;
+		case 0x0d00:
+			uplink_set(f, UF_motion, (p[0] & 0x01) != 0);
+			uplink_set(f, UF_impact, (p[0] & 0x02) != 0);
+			uplink_set(f, UF_tilt, (p[0] & 0x04) != 0);
+			break;
+		case 0x0f01:
+			uplink_set(f, UF_commandSeq, p[0]);
+			uplink_set(f, UF_commandStatus, p[1]);
+			break;
+		case 0x1001:
+			uplink_set(f, UF_loadState, p[0]);
+			uplink_set(f, UF_loadResult, p[1]);
+			break;
+		case 0x0e71:
+			uplink_set(f, UF_vibration_rms, uplink_u16(p) * 0.001);
+			uplink_set(f, UF_vibration_peak, uplink_u16(p + 2) * 0.001);
+			uplink_set(f, UF_vibration_crest, p[4] * 0.1);
+			uplink_set(f, UF_vibration_freq_1, p[5]);
+			uplink_set(f, UF_vibration_freq_2, p[6]);
+			break;
+		case 0x0402:
+			uplink_set(f, UF_gasResistance, uplink_s16(p) * 0.01);
+			break;
+		case 0x0802:
+			uplink_set(f, UF_battery, uplink_s16(p) * 0.01);
+			break;
+		case 0x1102:
+			uplink_set(f, UF_batteryTxMin, uplink_u16(p) * 0.01);
+			uplink_set(f, UF_batteryRint, uplink_u16(p + 2));
+			break;
+		case 0x1285:
+			uplink_set(f, UF_sampleTime, ((uint32_t)uplink_u16(p) << 16) | uplink_u16(p + 2));
+			break;
+		case 0x0586:
+			uplink_set(f, UF_gyroscope_x, uplink_s16(p) * 0.01);
+			uplink_set(f, UF_gyroscope_y, uplink_s16(p + 2) * 0.01);
+			uplink_set(f, UF_gyroscope_z, uplink_s16(p + 4) * 0.01);
+			break;
+		case 0x0902:
+			uplink_set(f, UF_magnetometer_x, uplink_s16(p) * 0.01);
+			break;
+		case 0x0a02:
+			uplink_set(f, UF_magnetometer_y, uplink_s16(p) * 0.01);
+			break;
+		case 0x0b02:
+			uplink_set(f, UF_magnetometer_z, uplink_s16(p) * 0.01);
+			break;
+		case 0x0c02:
+			// renogy_data_s, copied from the node's memory: little endian
+			uplink_set(f, UF_battCapacity, uplink_u16le(p));
+			uplink_set(f, UF_battVoltage, uplink_u16le(p + 2) * 0.1);
+			uplink_set(f, UF_battChargeCurrent, uplink_u16le(p + 4) * 0.01);
+			uplink_set(f, UF_battTemperature, uplink_renogy_temp(p[6]));
+			uplink_set(f, UF_controllerTemperature, uplink_renogy_temp(p[7]));
+			uplink_set(f, UF_loadVoltage, uplink_u16le(p + 8) * 0.1);
+			uplink_set(f, UF_loadCurrent, uplink_u16le(p + 10) * 0.01);
+			uplink_set(f, UF_loadPower, uplink_u16le(p + 12));
+			uplink_set(f, UF_panelVoltage, uplink_u16le(p + 14) * 0.1);
+			uplink_set(f, UF_panelCurrent, uplink_u16le(p + 16) * 0.01);
+			uplink_set(f, UF_panelPower, uplink_u16le(p + 18));
+			uplink_set(f, UF_errorStatus1, uplink_u16le(p + 20));
+			uplink_set(f, UF_errorStatus2, uplink_u16le(p + 22));
+			break;
+		}
+		idx += 2 + clen;
+	}
+	return f->status;
+}
+
+/**
+ * @brief Length of the complete records at the start of an archive chunk
+ *
+ * @param buf chunk
+ * @param size chunk length
+ * @param records number of complete records, can be NULL
+ * @return size_t bytes of complete records, the rest belongs to the next chunk
+ */
+static inline size_t uplink_archive_split(const uint8_t *buf, size_t size, size_t *records)
+{
+	size_t pos = 0;
+	size_t count = 0;
+	while (pos + UPLINK_RECORD_HEADER <= size)
+	{
+		size_t rec = UPLINK_RECORD_HEADER + buf[pos + 5];
+		if (pos + rec > size)
+		{
+			break;
+		}
+		pos += rec;
+		count++;
+	}
+	if (records)
+	{
+		*records = count;
+	}
+	return pos;
+}
+
+/**
+ * @brief Decode the complete records of an archive chunk
+ *
+ * @param buf chunk, starting at a record
+ * @param size bytes of complete records, see uplink_archive_split()
+ * @param frames room for every record in the chunk
+ * @return size_t number of frames decoded
+ */
+static inline size_t uplink_decode_records(const uint8_t *buf, size_t size, uplink_frame_s *frames)
+{
+	size_t pos = 0;
+	size_t count = 0;
+	while (pos + UPLINK_RECORD_HEADER <= size)
+	{
+		uplink_frame_s *f = &frames[count++];
+		f->rx_time = (uint32_t)buf[pos] | ((uint32_t)buf[pos + 1] << 8) | ((uint32_t)buf[pos + 2] << 16) | ((uint32_t)buf[pos + 3] << 24);
+		f->port = buf[pos + 4];
+		uint8_t len = buf[pos + 5];
+		uplink_decode(&buf[pos + UPLINK_RECORD_HEADER], len, f);
+		pos += UPLINK_RECORD_HEADER + len;
+	}
+	return count;
+}
+
+#endif
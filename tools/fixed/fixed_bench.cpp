@@ -0,0 +1,207 @@
+/**
+ * @file fixed_bench.cpp
+ * @brief Host check and timing of the integer conversions in src/fixed_point.h
+ *        Every input is compared with the float expression the conversion
+ *        replaced and with a reference of the formula (long double for the
+ *        SHTC3, exact 64 bit integers for the GNSS digits): all 65536 SHTC3
+ *        ticks, and for GNSS every 0.0001 deg payload step of both
+ *        hemispheres with its neighbours. A difference to the float path is
+ *        fine where the float path itself misses the reference, the integer
+ *        path must match the reference everywhere.
+ *
+ *        The timing is host ns and cycles per conversion. The node logs its
+ *        own cycle counts at boot (fx_benchmark() in src/main.cpp, MY_DEBUG
+ *        builds), that is where the soft-float double path shows.
+ *
+ *        g++ -std=c++17 -O2 -Isrc tools/fixed/fixed_bench.cpp -o fixed_bench
+ * @version 0.1
+ * @date 2022-12-31
+ */
+
+#include "fixed_point.h"
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+/** Result of comparing one conversion */
+struct check_s
+{
+	const char *name;
+	size_t inputs = 0;
+	size_t float_diff = 0;	// integer path != float path
+	size_t float_wrong = 0; // of those, the float path misses the reference
+	size_t fixed_wrong = 0; // integer path misses the reference
+	char example[96] = "";
+};
+
+static void report(const check_s &c)
+{
+	printf("%-14s %9zu %12zu %14zu %14zu  %s\n", c.name, c.inputs, c.float_diff, c.float_wrong, c.fixed_wrong, c.example);
+}
+
+/**
+ * @brief Compare one input
+ *
+ * @param what input, for the first example
+ */
+static void check(check_s &c, long fixed, long flt, long ref, const char *what)
+{
+	c.inputs++;
+	if (fixed != flt)
+	{
+		c.float_diff++;
+		c.float_wrong += flt != ref;
+		if (!c.example[0])
+		{
+			snprintf(c.example, sizeof(c.example), "%s: fixed %ld float %ld ref %ld", what, fixed, flt, ref);
+		}
+	}
+	if (fixed != ref)
+	{
+		c.fixed_wrong++;
+		snprintf(c.example, sizeof(c.example), "%s: fixed %ld ref %ld", what, fixed, ref);
+	}
+}
+
+static check_s check_shtc3_temp(void)
+{
+	check_s c;
+	c.name = "SHTC3 T";
+	char what[32];
+	for (uint32_t ticks = 0; ticks <= 65535; ticks++)
+	{
+		long double ref = truncl((-45.0L + 175.0L * ticks / 65535.0L) * 10.0L);
+		snprintf(what, sizeof(what), "ticks %u", ticks);
+		check(c, fx_shtc3_temp::convert(ticks), fx_float_shtc3_temp((uint16_t)ticks), (long)ref, what);
+	}
+	return c;
+}
+
+static check_s check_shtc3_humid(void)
+{
+	check_s c;
+	c.name = "SHTC3 RH";
+	char what[32];
+	for (uint32_t ticks = 0; ticks <= 65535; ticks++)
+	{
+		long double ref = truncl(200.0L * ticks / 65535.0L);
+		snprintf(what, sizeof(what), "ticks %u", ticks);
+		check(c, fx_shtc3_humid::convert(ticks), fx_float_shtc3_humid((uint16_t)ticks), (long)ref, what);
+	}
+	return c;
+}
+
+/**
+ * @brief Every payload step up to max_deg, on both sides of its boundary, both signs
+ */
+static check_s check_gnss(const char *name, uint16_t max_deg)
+{
+	static const int32_t around[] = {-1, 0, 1, 50000};
+	check_s c;
+	c.name = name;
+	char what[48];
+	for (uint16_t deg = 0; deg <= max_deg; deg++)
+	{
+		for (uint32_t step = 0; step < (deg == max_deg ? 1u : 10000u); step++)
+		{
+			for (int32_t d : around)
+			{
+				int64_t b = (int64_t)step * 100000 + d;
+				if (b < 0 || b >= 1000000000)
+				{
+					continue;
+				}
+				for (int neg = 0; neg < 2; neg++)
+				{
+					// Exact: billionths of a degree in 64 bit, decimal digits are not exact in long double either
+					int64_t ref = ((int64_t)deg * 1000000000 + b) / 100000;
+					ref = neg ? -ref : ref;
+					snprintf(what, sizeof(what), "%s%u.%09lld", neg ? "-" : "", deg, (long long)b);
+					check(c, fx_gnss_deg(deg, (uint32_t)b, neg), fx_float_gnss_deg(deg, (uint32_t)b, neg), (long)ref, what);
+				}
+			}
+		}
+	}
+	return c;
+}
+
+static inline uint64_t ticks_now(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/** Keeps the results alive */
+static volatile int64_t g_sink;
+
+/**
+ * @brief ns and TSC cycles per conversion
+ */
+template <typename F>
+static void time_one(const char *name, F fn)
+{
+	const uint32_t rounds = 200;
+	int64_t sink = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	uint64_t c0 = ticks_now();
+	for (uint32_t r = 0; r < rounds; r++)
+	{
+		for (uint32_t idx = 0; idx < 65536; idx++)
+		{
+			sink += fn(idx ^ r);
+		}
+	}
+	uint64_t c1 = ticks_now();
+	auto t1 = std::chrono::steady_clock::now();
+	g_sink = sink;
+	double n = 65536.0 * rounds;
+	printf("%-22s %8.2f %10.2f\n", name, std::chrono::duration<double, std::nano>(t1 - t0).count() / n, (c1 - c0) / n);
+}
+
+int main(int argc, char **argv)
+{
+	(void)argv;
+	if (argc != 1)
+	{
+		fprintf(stderr, "usage: fixed_bench\n");
+		exit(1);
+	}
+
+	std::vector<check_s> checks = {check_shtc3_temp(), check_shtc3_humid(), check_gnss("GNSS latitude", 90), check_gnss("GNSS longitude", 180)};
+	printf("conversion        inputs  float differs  float wrong    fixed wrong   first difference\n");
+	bool ok = true;
+	for (auto &c : checks)
+	{
+		report(c);
+		ok = ok && c.fixed_wrong == 0;
+	}
+
+	printf("\nconversion            ns/conv  cycles/conv%s\n", ticks_now() ? "" : " (no TSC)");
+	time_one("SHTC3 T float", [](uint32_t t) { return (int64_t)fx_float_shtc3_temp((uint16_t)t); });
+	time_one("SHTC3 T fixed", [](uint32_t t) { return (int64_t)fx_shtc3_temp::convert((uint16_t)t); });
+	time_one("SHTC3 RH float", [](uint32_t t) { return (int64_t)fx_float_shtc3_humid((uint16_t)t); });
+	time_one("SHTC3 RH fixed", [](uint32_t t) { return (int64_t)fx_shtc3_humid::convert((uint16_t)t); });
+	time_one("GNSS deg float", [](uint32_t t) { return (int64_t)fx_float_gnss_deg(t % 180, t * 15259, t & 1); });
+	time_one("GNSS deg fixed", [](uint32_t t) { return (int64_t)fx_gnss_deg(t % 180, t * 15259, t & 1); });
+	time_one("fx_str 1 decimal", [](uint32_t t) {
+		char buf[FX_STR_LEN];
+		return (int64_t)fx_str(buf, (int32_t)t - 32768, 1)[1];
+	});
+	time_one("snprintf %f", [](uint32_t t) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%f", ((float)t - 32768) * 0.1);
+		return (int64_t)buf[1];
+	});
+	return ok ? 0 : 1;
+}
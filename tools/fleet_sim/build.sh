@@ -0,0 +1,35 @@
+#!/bin/sh
+# Build the fleet simulator, run from the repository root:
+#   sh tools/fleet_sim/build.sh [output]
+#
+# The application sources are compiled as one relocatable image whose
+# writable data is collected into the app_data and app_bss sections
+# (app_image.ld), which fleet_sim.cpp swaps per node. The image must not be
+# position independent, its statics are addressed directly.
+#
+# TRACE=1 builds the trace recorder in (ENABLE_TRACE, src/trace.cpp): one
+# node run with -v logs its peripheral trace, which tools/trace/trace_replay
+# replays, e.g. tools/trace/fleet_node.log:
+#   TRACE=1 sh tools/fleet_sim/build.sh fleet_trace
+#   ./fleet_trace -n 1 -i 300 -d 0.1 -v > fleet_node.log
+set -e
+
+OUT=${1:-fleet_sim}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# src/batt_adc.cpp (SAADC registers) and src/wdt.cpp (WDT registers) are replaced by the models in fleet_sim.cpp
+CXXFLAGS="-std=gnu++17 -O2 -fno-pie -fno-common -DNRF52_SERIES -DMY_DEBUG=0 -Itools/host/shim -Isrc"
+APP="src/main.cpp src/sensor_registry.cpp src/battery.cpp src/env.cpp src/acc.cpp src/energy.cpp \
+	src/renogy_rs232.cpp src/gnss.cpp src/vibration.cpp src/supervisor.cpp src/i2c_probe.cpp src/batch.cpp src/time_sync.cpp src/config.cpp src/load.cpp src/vedirect.cpp src/fuota.cpp tools/fleet_sim/wisblock_state.cpp"
+if [ "$TRACE" = 1 ]; then
+	CXXFLAGS="$CXXFLAGS -DENABLE_TRACE"
+	APP="$APP src/trace.cpp"
+fi
+
+for src in $APP; do
+	g++ $CXXFLAGS -c "$src" -o "$TMP/$(basename "$src" .cpp).o"
+done
+ld -r -T tools/fleet_sim/app_image.ld "$TMP"/*.o -o "$TMP/app_image.o"
+
+g++ $CXXFLAGS -no-pie tools/fleet_sim/fleet_sim.cpp tools/host/host_port.cpp "$TMP/app_image.o" -o "$OUT"
@@ -0,0 +1,1427 @@
+/**
+ * @file fleet_sim.cpp
+ * @brief LoRaWAN fleet simulator running the real application code
+ *        Every virtual node runs the unmodified src/ sources (setup_app(),
+ *        init_app(), app_event_handler(), lora_data_handler(), the sensor
+ *        registry, energy scheduling and the Renogy Modbus poll) on a
+ *        virtual clock. The application's writable data is linked into two
+ *        sections (app_image.ld) and swapped per node, so one copy of the
+ *        code serves the whole fleet.
+ *
+ *        Around the nodes: a US915 channel and collision model for pure
+ *        ALOHA with capture effect, log-distance path loss to a few
+ *        gateways, a network server stand-in that de-duplicates frames, a
+ *        Renogy or Victron VE.Direct controller model behind Serial1, a
+ *        solar/battery model and a node LiPo with internal resistance in
+ *        place of the SAADC (src/batt_adc.cpp).
+ *        Reported per fleet size and send interval: packet delivery ratio,
+ *        airtime and energy per node.
+ *
+ *        Downlinks (-D) are queued for every node at a given time and
+ *        delivered in RX1 of the next uplink the network server receives, or
+ *        right away while the node is in Class C. Reported: delivery latency
+ *        and Class C time. Downlinks themselves are never lost.
+ *
+ *        The network server answers the clock requests of the nodes
+ *        (AppTimeReq on LORAWAN_CLOCK_PORT) with the correction to the
+ *        simulated time, in RX1 like a queued downlink.
+ *
+ *        Build with tools/fleet_sim/build.sh, run from the repository root.
+ * @version 0.1
+ * @date 2022-10-29
+ */
+
+#include "app.h"
+#include <SparkFun_SHTC3.h>
+#include <SparkFunLIS3DH.h>
+#include <InternalFileSystem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+/** The application entry points, see src/main.cpp */
+void setup_app(void);
+bool init_app(void);
+void app_event_handler(void);
+void lora_data_handler(void);
+
+/** Writable data of the application image, see app_image.ld */
+extern "C" uint8_t __start_app_data[];
+extern "C" uint8_t __stop_app_data[];
+extern "C" uint8_t __start_app_bss[];
+extern "C" uint8_t __stop_app_bss[];
+
+/** Radio */
+#define SIM_CHANNELS 8			// US915 sub-band, 125 kHz channels
+#define SIM_TX_POWER_DBM 20.0	// TX_POWER_0, RAK4631 PA limit
+#define SIM_ANTENNA_GAIN_DB 2.0 // node and gateway together
+#define SIM_CAPTURE_DB 6.0		// stronger frame survives a collision with this margin
+#define SIM_SHADOWING_DB 6.0	// log-normal shadowing per link
+#define SIM_FADING_DB 2.0		// per frame
+#define SIM_RX1_DELAY_US 1000000
+#define SIM_RX2_DELAY_US 2000000
+#define SIM_RX_WINDOW_US 60000
+
+/** Power, LiPo at 3.7 V */
+#define SIM_VOLT 3.7
+#define SIM_I_SLEEP_MA 0.025 // nRF52840 + SX1262 sleep, sensors idle
+#define SIM_I_MCU_MA 3.5	 // app task running
+#define SIM_I_TX_MA 110.0	 // SX1262 at 20 dBm
+#define SIM_I_RX_MA 5.3		 // RX windows
+#define SIM_I_BLE_MA 0.6	 // advertising, average
+
+/** Node LiPo, kept charged by the enclosure */
+#define SIM_LIPO_MV 3900
+#define SIM_LIPO_RINT_MOHM 150 // median, a few aged cells have several times that
+#define SIM_LIPO_NOISE_MV 3	   // ADC noise after oversampling
+#define SIM_SAG_PERIOD_US 4000 // BATT_ADC_SAG_PERIOD_US
+
+/** Renogy RS232 line */
+#define SIM_RENOGY_CHAR_US 1042 // 10 bits at 9600 Bd
+#define SIM_RENOGY_LATENCY_US 20000
+/** VE.Direct, 19200 Bd, one block per second */
+#define SIM_VEDIRECT_CHAR_US 521
+#define SIM_VEDIRECT_PERIOD_US 1000000
+
+/** Simulation start, 2022-06-01 00:00 UTC, for the archive */
+#define SIM_EPOCH 1654041600
+/** GPS time = Unix time - SIM_GPS_OFFSET, GPS epoch and 18 leap seconds */
+#define SIM_GPS_OFFSET (315964800 - 18)
+
+/** US915 uplink data rates */
+struct sim_dr_s
+{
+	uint8_t sf;
+	uint16_t bw_khz;
+	float sensitivity_dbm;
+	uint8_t max_payload;
+};
+static const sim_dr_s sim_dr[] = {
+	{10, 125, -132.0f, 11},
+	{9, 125, -129.0f, 53},
+	{8, 125, -126.0f, 125},
+	{7, 125, -123.0f, 242},
+	{8, 500, -119.0f, 242},
+};
+
+/** Downlink for every node, -D */
+struct sim_downlink_s
+{
+	uint64_t time_us;
+	uint8_t port;
+	std::vector<uint8_t> payload;
+};
+
+/** Simulation options */
+struct sim_config_s
+{
+	std::vector<int> fleet_sizes = {100};
+	std::vector<int> intervals_s = {900};
+	double days = 7.0;
+	int gateways = 3;
+	double area_km = 10.0;
+	double renogy_share = 1.0;
+	double victron_share = 0.0;
+	double motion_per_day = 0.0;
+	uint32_t seed = 1;
+	const char *archive = NULL;
+	int archive_node = -1;
+	const char *node_csv = NULL;
+	std::vector<sim_downlink_s> downlinks;
+};
+
+/**
+ * @brief Renogy controller on Serial1
+ *        Answers function 0x03 and 0x06 from a solar and battery model with
+ *        RS232 timing on the virtual clock.
+ */
+class RenogyPeer : public HostUartPeer
+{
+public:
+	/** Solar and battery model */
+	double panel_peak_w = 200.0;
+	double load_w = 20.0;
+	double batt_wh = 1200.0;
+	double soc = 0.8;
+	double panel_w = 0.0;
+	uint16_t load_on = 1;
+
+	void receive(const uint8_t *buffer, size_t size) override
+	{
+		// Blocking write, the UART sends at 9600 Bd
+		host_virtual_us += size * SIM_RENOGY_CHAR_US;
+		_req.insert(_req.end(), buffer, buffer + size);
+		if (_req.size() < 8)
+		{
+			return;
+		}
+		std::vector<uint8_t> req(_req.begin(), _req.begin() + 8);
+		_req.clear();
+		if (crc16(req.data(), 8) != 0)
+		{
+			return;
+		}
+		_rsp.clear();
+		_rsp_read = 0;
+		uint16_t addr = (req[2] << 8) | req[3];
+		uint16_t qty = (req[4] << 8) | req[5];
+		_rsp.push_back(req[0]);
+		if (req[1] == 0x03)
+		{
+			_rsp.push_back(0x03);
+			_rsp.push_back((uint8_t)(2 * qty));
+			for (uint16_t idx = 0; idx < qty; idx++)
+			{
+				uint16_t val = reg(addr + idx);
+				_rsp.push_back((uint8_t)(val >> 8));
+				_rsp.push_back((uint8_t)val);
+			}
+		}
+		else if (req[1] == 0x06 && addr == 0x010A)
+		{
+			load_on = qty ? 1 : 0;
+			_rsp.insert(_rsp.end(), req.begin() + 1, req.begin() + 6);
+		}
+		else
+		{
+			_rsp.push_back(req[1] | 0x80);
+			_rsp.push_back(0x01);
+		}
+		uint16_t crc = crc16(_rsp.data(), _rsp.size());
+		_rsp.push_back((uint8_t)crc);
+		_rsp.push_back((uint8_t)(crc >> 8));
+		_rsp_start = host_virtual_us + SIM_RENOGY_LATENCY_US;
+	}
+
+	int available(void) override
+	{
+		if (_rsp_read >= _rsp.size() || host_virtual_us < _rsp_start)
+		{
+			return 0;
+		}
+		size_t arrived = (host_virtual_us - _rsp_start) / SIM_RENOGY_CHAR_US;
+		arrived = arrived > _rsp.size() ? _rsp.size() : arrived;
+		return arrived > _rsp_read ? (int)(arrived - _rsp_read) : 0;
+	}
+
+	int read(void) override
+	{
+		return available() ? _rsp[_rsp_read++] : -1;
+	}
+
+	/**
+	 * @brief Advance the battery to now
+	 *
+	 * @param hours elapsed time
+	 * @param sun 0 .. 1 irradiance
+	 */
+	double batt_v(void) const { return 11.8 + 1.6 * soc; }
+	double panel_v(void) const { return panel_w > 0.0 ? 18.0 + 3.0 * (panel_w / panel_peak_w) : 0.0; }
+
+	void update(double hours, double sun)
+	{
+		panel_w = panel_peak_w * sun;
+		double net_wh = (panel_w - (load_on ? load_w : 0.0)) * hours;
+		soc += net_wh / batt_wh;
+		soc = soc > 1.0 ? 1.0 : soc < 0.0 ? 0.0 : soc;
+		if (soc < 0.05)
+		{
+			// Low voltage disconnect
+			load_on = 0;
+		}
+	}
+
+private:
+	std::vector<uint8_t> _req;
+	std::vector<uint8_t> _rsp;
+	size_t _rsp_read = 0;
+	uint64_t _rsp_start = 0;
+
+	static uint16_t crc16(const uint8_t *buf, size_t len)
+	{
+		uint16_t crc = 0xFFFF;
+		for (size_t i = 0; i < len; i++)
+		{
+			crc ^= buf[i];
+			for (int b = 0; b < 8; b++)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+			}
+		}
+		return crc;
+	}
+
+	uint16_t reg(uint16_t addr) const
+	{
+		double batt_v = this->batt_v();
+		double panel_v = this->panel_v();
+		double load = load_on ? load_w : 0.0;
+		switch (addr)
+		{
+		case 0x100:
+			return (uint16_t)(soc * 100.0 + 0.5);
+		case 0x101:
+			return (uint16_t)(batt_v * 10.0);
+		case 0x102:
+			return (uint16_t)(panel_w / batt_v * 100.0);
+		case 0x103:
+			return (uint16_t)((30 << 8) | 22);
+		case 0x104:
+			return load_on ? (uint16_t)(batt_v * 10.0) : 0;
+		case 0x105:
+			return (uint16_t)(load / batt_v * 100.0);
+		case 0x106:
+			return (uint16_t)load;
+		case 0x107:
+			return (uint16_t)(panel_v * 10.0);
+		case 0x108:
+			return panel_v > 0.0 ? (uint16_t)(panel_w / panel_v * 100.0) : 0;
+		case 0x109:
+			return (uint16_t)panel_w;
+		case 0x120:
+			// Load state, charging state 2 (MPPT) while the sun is up
+			return (uint16_t)((load_on << 15) | (panel_w > 0.0 ? 2 : 0));
+		default:
+			return 0;
+		}
+	}
+};
+
+/**
+ * @brief Victron MPPT on Serial1, pushes a VE.Direct text block every second
+ *        The blocks are sent whether the node listens or not, a node that
+ *        opens the UART starts in the middle of one.
+ */
+class VeDirectPeer : public HostUartPeer
+{
+public:
+	/** Solar and battery model, shared with the Renogy stand-in of the node */
+	const RenogyPeer *model = NULL;
+
+	void receive(const uint8_t *buffer, size_t size) override
+	{
+		// Text mode, what the node sends is ignored
+		(void)buffer;
+		(void)size;
+	}
+
+	int available(void) override
+	{
+		advance();
+		uint64_t now = host_virtual_us;
+		uint64_t start = _block_no * SIM_VEDIRECT_PERIOD_US;
+		if (now < start)
+		{
+			return 0;
+		}
+		size_t arrived = std::min(_block.size(), (size_t)((now - start) / SIM_VEDIRECT_CHAR_US) + 1);
+		return arrived > _pos ? (int)(arrived - _pos) : 0;
+	}
+
+	int read(void) override
+	{
+		return available() ? (uint8_t)_block[_pos++] : -1;
+	}
+
+private:
+	std::string _block;
+	uint64_t _block_no = 0;
+	size_t _pos = 0;
+
+	/** Move to the block on the line now, bytes nobody read are gone */
+	void advance(void)
+	{
+		uint64_t now_block = host_virtual_us / SIM_VEDIRECT_PERIOD_US;
+		if (!_block.empty() && now_block == _block_no)
+		{
+			return;
+		}
+		bool stale = _block.empty() || now_block != _block_no + 1;
+		_block_no = now_block;
+		build();
+		_pos = 0;
+		if (stale)
+		{
+			// UART opened in the middle of a block
+			uint64_t since = host_virtual_us - _block_no * SIM_VEDIRECT_PERIOD_US;
+			_pos = std::min(_block.size(), (size_t)(since / SIM_VEDIRECT_CHAR_US));
+		}
+	}
+
+	void build(void)
+	{
+		double batt_v = model->batt_v();
+		double panel_v = model->panel_v();
+		double load_a = model->load_on ? model->load_w / batt_v : 0.0;
+		double charge_a = model->panel_w / batt_v;
+		char buf[320];
+		int len = snprintf(buf, sizeof(buf),
+						   "\r\nPID\t0xA053\r\nFW\t159\r\nSER#\tHQ2122ABCDE\r\nV\t%d\r\nI\t%d\r\nVPV\t%d\r\nPPV\t%d"
+						   "\r\nCS\t%d\r\nMPPT\t%d\r\nOR\t0x%08X\r\nERR\t0\r\nLOAD\t%s\r\nIL\t%d\r\nH19\t1234\r\nH20\t12"
+						   "\r\nH21\t85\r\nH22\t10\r\nH23\t80\r\nHSDS\t17\r\nChecksum\t",
+						   (int)(batt_v * 1000), (int)(charge_a * 1000), (int)(panel_v * 1000), (int)model->panel_w,
+						   model->panel_w > 0.0 ? 3 : 0, model->panel_w > 0.0 ? 2 : 0, model->panel_w > 0.0 ? 0u : 1u,
+						   model->load_on ? "ON" : "OFF", (int)(load_a * 1000));
+		uint8_t sum = 0;
+		for (int idx = 0; idx < len; idx++)
+		{
+			sum += (uint8_t)buf[idx];
+		}
+		_block.assign(buf, len);
+		_block.push_back((char)(uint8_t)(256 - sum));
+	}
+};
+
+/** One frame on air */
+struct sim_frame_s
+{
+	uint32_t node;
+	uint8_t channel;
+	uint8_t dr;
+	uint8_t port;
+	uint64_t start_us;
+	uint64_t end_us;
+	std::vector<float> rssi; // per gateway
+	std::vector<uint8_t> payload;
+};
+
+/** A timer of the application (SoftwareTimer) */
+struct sim_timer_s
+{
+	SoftwareTimer *timer;
+	uint32_t gen;
+};
+
+/** A downlink the network server keeps for a node */
+struct sim_queued_dl_s
+{
+	int index; // into cfg.downlinks, -1 for an answer of the network server
+	uint64_t queued_us;
+	uint8_t port;
+	std::vector<uint8_t> payload;
+};
+
+/** One virtual node */
+struct sim_node_s
+{
+	uint32_t id;
+	double x_km;
+	double y_km;
+	std::vector<float> link_db; // mean RSSI per gateway
+	std::vector<uint8_t> image; // app_data + app_bss
+	bool has_renogy;
+	bool has_victron;
+	RenogyPeer renogy;
+	VeDirectPeer victron;
+	double temp_offset;
+	double rint_mohm;
+	uint64_t last_update_us = 0;
+
+	/** WisBlock-API state outside the image */
+	uint32_t api_period_ms = 0;
+	uint32_t api_gen = 0;
+	std::vector<sim_timer_s> timers;
+	uint64_t radio_busy_until = 0;
+	uint32_t fcnt = 0;
+	bool serial1_open = false;
+	std::map<std::string, std::vector<uint8_t>> flash;
+	bool class_c = false;
+	uint64_t class_c_since = 0;
+	uint64_t tx_start_us = 0;
+	uint64_t tx_end_us = 0;
+	/** ADC burst armed by the battery driver */
+	int16_t *burst_buf = NULL;
+	uint16_t burst_count = 0;
+	uint64_t burst_start_us = 0;
+
+	/** Network server downlink queue */
+	std::deque<sim_queued_dl_s> dl_queue;
+	bool dl_scheduled = false;
+
+	/** Statistics */
+	uint32_t sent = 0;
+	uint32_t busy = 0;
+	uint32_t too_big = 0;
+	uint32_t delivered = 0;
+	uint32_t collided = 0;
+	uint32_t out_of_range = 0;
+	uint64_t airtime_us = 0;
+	uint64_t active_us = 0;
+	double charge_mas = 0.0; // mA * s above sleep
+	uint64_t class_c_us = 0;
+	uint8_t tier = ENERGY_NORMAL;
+	uint64_t tier_us[4] = {0};
+	uint64_t tier_since = 0;
+};
+
+enum sim_event_e
+{
+	EV_API_TIMER,
+	EV_APP_TIMER,
+	EV_TX_END,
+	EV_TX_FIN,
+	EV_MOTION,
+	EV_DL_QUEUE,
+	EV_DL_RX,
+};
+
+struct sim_event_s
+{
+	uint64_t time_us;
+	uint64_t seq;
+	uint8_t type;
+	uint32_t node;
+	uint64_t arg;
+	uint32_t gen;
+	bool operator>(const sim_event_s &o) const { return time_us != o.time_us ? time_us > o.time_us : seq > o.seq; }
+};
+
+/** Delivery of one -D downlink over the fleet */
+struct sim_dl_stats_s
+{
+	uint32_t delivered = 0;
+	uint64_t latency_us = 0;
+	uint64_t latency_max_us = 0;
+};
+
+/** Network server stand-in: de-duplicated frames, optional archive in uplink_decode format */
+struct sim_netserver_s
+{
+	FILE *archive = NULL;
+	int archive_node = -1;
+	uint64_t frames = 0;
+	uint64_t gateway_copies = 0;
+
+	void deliver(const sim_frame_s &f, int copies)
+	{
+		frames++;
+		gateway_copies += copies;
+		if (archive && (archive_node < 0 || (uint32_t)archive_node == f.node))
+		{
+			uint32_t rx_time = SIM_EPOCH + (uint32_t)(f.end_us / 1000000);
+			uint8_t rec[6] = {(uint8_t)rx_time, (uint8_t)(rx_time >> 8), (uint8_t)(rx_time >> 16), (uint8_t)(rx_time >> 24),
+							  f.port, (uint8_t)f.payload.size()};
+			fwrite(rec, 1, sizeof(rec), archive);
+			fwrite(f.payload.data(), 1, f.payload.size(), archive);
+		}
+	}
+};
+
+/** Simulation state */
+static sim_config_s cfg;
+static std::mt19937_64 rng;
+static std::vector<sim_node_s> nodes;
+static std::vector<double> gw_x;
+static std::vector<double> gw_y;
+static std::priority_queue<sim_event_s, std::vector<sim_event_s>, std::greater<sim_event_s>> events;
+static uint64_t event_seq = 0;
+static std::vector<sim_frame_s> frames;
+static std::deque<uint32_t> on_air[SIM_CHANNELS];
+static sim_netserver_s netserver;
+static std::vector<sim_dl_stats_s> dl_stats;
+static sim_node_s *cur = NULL;
+static std::vector<uint8_t> pristine;
+static double cloud_today = 1.0;
+static int cloud_day = -1;
+
+static size_t data_size(void) { return __stop_app_data - __start_app_data; }
+static size_t bss_size(void) { return __stop_app_bss - __start_app_bss; }
+
+static void schedule(uint64_t time_us, uint8_t type, uint32_t node, uint64_t arg = 0, uint32_t gen = 0)
+{
+	events.push({time_us, event_seq++, type, node, arg, gen});
+}
+
+/**
+ * @brief Time on air, Semtech AN1200.13, explicit header, CRC, CR 4/5, 8 symbol preamble
+ */
+static uint64_t airtime_us(uint8_t dr, size_t app_len)
+{
+	const sim_dr_s &d = sim_dr[dr];
+	double tsym = (double)(1 << d.sf) / (d.bw_khz * 1000.0);
+	int de = tsym > 0.016 ? 1 : 0;
+	// MHDR + FHDR + FPort + MIC
+	int pl = (int)app_len + 13;
+	double num = 8.0 * pl - 4.0 * d.sf + 28 + 16;
+	double sym = 8 + std::max(ceil(num / (4.0 * (d.sf - 2 * de))) * 5, 0.0);
+	return (uint64_t)(((8 + 4.25) + sym) * tsym * 1e6);
+}
+
+/** Sun 0 .. 1, clear sky daylight curve times the cloud cover of the day */
+static double sun_at(uint64_t t_us)
+{
+	double hours = t_us / 3.6e9;
+	int day = (int)(hours / 24.0);
+	if (day != cloud_day)
+	{
+		std::uniform_real_distribution<double> cloud(0.15, 1.0);
+		cloud_today = cloud(rng);
+		cloud_day = day;
+	}
+	double h = fmod(hours, 24.0);
+	return (h > 6.0 && h < 20.0) ? sin(M_PI * (h - 6.0) / 14.0) * cloud_today : 0.0;
+}
+
+/**
+ * @brief Make a node current: load its image and its sensor inputs
+ */
+static void node_enter(sim_node_s &n, uint64_t now)
+{
+	memcpy(__start_app_data, n.image.data(), data_size());
+	memcpy(__start_app_bss, n.image.data() + data_size(), bss_size());
+	cur = &n;
+	host_virtual_us = now;
+
+	double hours = (now - n.last_update_us) / 3.6e9;
+	n.renogy.update(hours, sun_at(now));
+	n.last_update_us = now;
+	host_shtc3.temp_c = (float)(18.0 + n.temp_offset + 8.0 * sun_at(now));
+	host_shtc3.humidity = (float)(70.0 - 30.0 * sun_at(now));
+	Serial1.attach(n.has_victron ? (HostUartPeer *)&n.victron : n.has_renogy ? (HostUartPeer *)&n.renogy : (HostUartPeer *)NULL);
+	// UART and flash belong to the node, not to the image
+	if (n.serial1_open)
+	{
+		Serial1.begin(0);
+	}
+	else
+	{
+		Serial1.end();
+	}
+	host_flash.swap(n.flash);
+}
+
+static void node_leave(sim_node_s &n)
+{
+	memcpy(n.image.data(), __start_app_data, data_size());
+	memcpy(n.image.data() + data_size(), __start_app_bss, bss_size());
+	n.serial1_open = Serial1;
+	host_flash.swap(n.flash);
+	cur = NULL;
+}
+
+/**
+ * @brief The WisBlock-API loop: handle events until the app task would sleep again
+ */
+static void node_loop(sim_node_s &n, uint64_t started)
+{
+	for (int pass = 0; g_task_event_type && pass < 4; pass++)
+	{
+		app_event_handler();
+		lora_data_handler();
+	}
+	g_task_event_type = 0;
+
+	uint64_t active = host_virtual_us - started;
+	n.active_us += active;
+	n.charge_mas += (SIM_I_MCU_MA - SIM_I_SLEEP_MA) * active / 1e6;
+	if (g_energy_tier != n.tier)
+	{
+		n.tier_us[n.tier] += started - n.tier_since;
+		n.tier_since = started;
+		n.tier = g_energy_tier;
+	}
+}
+
+/** WisBlock-API calls, always on behalf of cur */
+
+void api_wake_loop(uint16_t reason)
+{
+	g_task_event_type |= reason;
+}
+
+void api_timer_restart(uint32_t new_time)
+{
+	cur->api_period_ms = new_time;
+	cur->api_gen++;
+	schedule(host_virtual_us + (uint64_t)new_time * 1000, EV_API_TIMER, cur->id, 0, cur->api_gen);
+}
+
+void host_timer_start(SoftwareTimer *timer)
+{
+	for (auto &t : cur->timers)
+	{
+		if (t.timer == timer)
+		{
+			schedule(host_virtual_us + (uint64_t)timer->period * 1000, EV_APP_TIMER, cur->id, (uintptr_t)timer, ++t.gen);
+			return;
+		}
+	}
+	cur->timers.push_back({timer, 1});
+	schedule(host_virtual_us + (uint64_t)timer->period * 1000, EV_APP_TIMER, cur->id, (uintptr_t)timer, 1);
+}
+
+void host_timer_stop(SoftwareTimer *timer)
+{
+	for (auto &t : cur->timers)
+	{
+		if (t.timer == timer)
+		{
+			t.gen++;
+		}
+	}
+}
+
+void api_set_version(uint16_t sw_1, uint16_t sw_2, uint16_t sw_3)
+{
+	(void)sw_1;
+	(void)sw_2;
+	(void)sw_3;
+}
+
+void api_read_credentials(void) {}
+void api_set_credentials(void) {}
+void api_reset(void) {}
+void at_serial_input(uint8_t cmd) { (void)cmd; }
+
+void restart_advertising(uint16_t timeout)
+{
+	cur->charge_mas += (SIM_I_BLE_MA - SIM_I_SLEEP_MA) * timeout;
+}
+
+float read_batt(void)
+{
+	return (float)SIM_LIPO_MV;
+}
+
+/** LiPo voltage at time t, sagging while the radio sends */
+static int16_t lipo_mv(const sim_node_s &n, uint64_t t)
+{
+	std::uniform_int_distribution<int> noise(-SIM_LIPO_NOISE_MV, SIM_LIPO_NOISE_MV);
+	bool tx = (t >= n.tx_start_us) && (t < n.tx_end_us);
+	return (int16_t)(SIM_LIPO_MV - (tx ? SIM_I_TX_MA * n.rint_mohm / 1000.0 : 0.0) + noise(rng));
+}
+
+/** LiPo voltage as the 14 bit SAADC result, src/batt_adc.cpp converts it back */
+static int16_t lipo_raw(const sim_node_s &n, uint64_t t)
+{
+	return (int16_t)((((uint32_t)lipo_mv(n, t) << 16) + BATT_ADC_MV_Q16 / 2) / BATT_ADC_MV_Q16);
+}
+
+/** The SAADC backend, results in the units of the nRF52 so a trace of a node replays */
+bool batt_adc_init(void)
+{
+	return true;
+}
+
+int16_t batt_adc_read(void)
+{
+	return lipo_raw(*cur, host_virtual_us);
+}
+
+bool batt_adc_burst_start(int16_t *buf, uint16_t count)
+{
+	cur->burst_buf = buf;
+	cur->burst_count = count;
+	cur->burst_start_us = host_virtual_us;
+	return true;
+}
+
+uint16_t batt_adc_burst_end(void)
+{
+	sim_node_s &n = *cur;
+	uint16_t done = 0;
+	for (; done < n.burst_count; done++)
+	{
+		uint64_t t = n.burst_start_us + (uint64_t)done * SIM_SAG_PERIOD_US;
+		if (t > host_virtual_us)
+		{
+			break;
+		}
+		n.burst_buf[done] = lipo_raw(n, t);
+	}
+	n.burst_buf = NULL;
+	return done;
+}
+
+/** As src/batt_adc.cpp on the nRF52 */
+uint16_t batt_adc_mv(int16_t raw)
+{
+	return raw <= 0 ? 0 : (uint16_t)(((uint32_t)raw * BATT_ADC_MV_Q16 + 0x8000) >> 16);
+}
+
+/** The watchdog backend of src/wdt.cpp, a simulated node does not hang */
+bool wdt_start(uint32_t timeout_ms)
+{
+	(void)timeout_ms;
+	return false;
+}
+
+void wdt_feed(void) {}
+
+bool wdt_caused_reset(void)
+{
+	return false;
+}
+
+bool wdt_warm_reset(void)
+{
+	return false;
+}
+
+uint8_t wdt_retained(void)
+{
+	return 0;
+}
+
+void wdt_retain(uint8_t value) { (void)value; }
+
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	sim_node_s &n = *cur;
+	uint8_t dr = g_lorawan_settings.data_rate;
+	if (host_virtual_us < n.radio_busy_until)
+	{
+		// TX or RX windows of the previous uplink still running
+		n.busy++;
+		return LMH_BUSY;
+	}
+	if (size > sim_dr[dr].max_payload)
+	{
+		n.too_big++;
+		return LMH_ERROR;
+	}
+
+	sim_frame_s f;
+	f.node = n.id;
+	f.channel = (uint8_t)(rng() % SIM_CHANNELS);
+	f.dr = dr;
+	f.port = fport ? fport : g_lorawan_settings.app_port;
+	f.start_us = host_virtual_us;
+	f.end_us = f.start_us + airtime_us(dr, size);
+	f.payload.assign(data, data + size);
+	std::normal_distribution<float> fading(0.0f, SIM_FADING_DB);
+	for (size_t gw = 0; gw < gw_x.size(); gw++)
+	{
+		f.rssi.push_back(n.link_db[gw] + fading(rng));
+	}
+
+	uint64_t air = f.end_us - f.start_us;
+	n.tx_start_us = f.start_us;
+	n.tx_end_us = f.end_us;
+	n.sent++;
+	n.fcnt++;
+	n.airtime_us += air;
+	n.charge_mas += (SIM_I_TX_MA - SIM_I_SLEEP_MA) * air / 1e6 + (SIM_I_RX_MA - SIM_I_SLEEP_MA) * 2 * SIM_RX_WINDOW_US / 1e6;
+	n.radio_busy_until = f.end_us + SIM_RX2_DELAY_US + SIM_RX_WINDOW_US;
+
+	uint32_t idx = (uint32_t)frames.size();
+	frames.push_back(std::move(f));
+	on_air[frames[idx].channel].push_back(idx);
+	schedule(frames[idx].end_us, EV_TX_END, n.id, idx);
+	schedule(n.radio_busy_until, EV_TX_FIN, n.id);
+	return LMH_SUCCESS;
+}
+
+/** Receiver on since class_c_since, charge it up to now */
+static void class_c_charge(sim_node_s &n, uint64_t now)
+{
+	n.class_c_us += now - n.class_c_since;
+	n.charge_mas += (SIM_I_RX_MA - SIM_I_SLEEP_MA) * (now - n.class_c_since) / 1e6;
+	n.class_c_since = now;
+}
+
+/**
+ * @brief Deliver the next queued downlink at time or when the radio is free
+ */
+static void schedule_downlink(sim_node_s &n, uint64_t time)
+{
+	if (n.dl_queue.empty() || n.dl_scheduled)
+	{
+		return;
+	}
+	n.dl_scheduled = true;
+	schedule(std::max(time, n.radio_busy_until), EV_DL_RX, n.id);
+}
+
+lmh_error_status lmh_class_request(DeviceClass_t new_class)
+{
+	sim_node_s &n = *cur;
+	if ((new_class == CLASS_C) == n.class_c)
+	{
+		return LMH_SUCCESS;
+	}
+	if (n.class_c)
+	{
+		class_c_charge(n, host_virtual_us);
+	}
+	n.class_c = new_class == CLASS_C;
+	n.class_c_since = host_virtual_us;
+	if (n.class_c)
+	{
+		schedule_downlink(n, host_virtual_us);
+	}
+	return LMH_SUCCESS;
+}
+
+/**
+ * @brief Network server part of the clock sync: AppTimeAns to an AppTimeReq
+ *        The correction is taken at reception, in whole seconds like TS003.
+ *
+ * @return true the frame held a request, ans is the answer
+ */
+static bool clock_answer(const sim_frame_s &f, std::vector<uint8_t> &ans)
+{
+	const std::vector<uint8_t> &p = f.payload;
+	size_t idx = 0;
+	while (idx < p.size())
+	{
+		switch (p[idx])
+		{
+		case 0x00: // PackageVersionAns
+			idx += 3;
+			break;
+		case 0x02: // DeviceAppTimePeriodicityAns
+			idx += 6;
+			break;
+		case 0x01: // AppTimeReq
+		{
+			if (idx + 6 > p.size())
+			{
+				return false;
+			}
+			uint32_t device = p[idx + 1] | (p[idx + 2] << 8) | (p[idx + 3] << 16) | ((uint32_t)p[idx + 4] << 24);
+			uint32_t gps = SIM_EPOCH - SIM_GPS_OFFSET + (uint32_t)(f.end_us / 1000000);
+			uint32_t corr = gps - device;
+			ans = {0x01, (uint8_t)corr, (uint8_t)(corr >> 8), (uint8_t)(corr >> 16), (uint8_t)(corr >> 24), (uint8_t)(p[idx + 5] & 0x0F)};
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Decide the fate of a frame once it is off air
+ *        Received by a gateway if above sensitivity and at least SIM_CAPTURE_DB
+ *        stronger than every overlapping frame on the same channel and data rate.
+ */
+static void tx_end(uint32_t idx)
+{
+	const sim_frame_s &f = frames[idx];
+	sim_node_s &n = nodes[f.node];
+	std::deque<uint32_t> &air = on_air[f.channel];
+	// Frames that ended long ago cannot overlap anything still to be decided
+	while (!air.empty() && frames[air.front()].end_us + 10000000ULL < f.end_us)
+	{
+		air.pop_front();
+	}
+
+	int copies = 0;
+	bool in_range = false;
+	for (size_t gw = 0; gw < gw_x.size(); gw++)
+	{
+		if (f.rssi[gw] < sim_dr[f.dr].sensitivity_dbm)
+		{
+			continue;
+		}
+		in_range = true;
+		bool lost = false;
+		for (uint32_t other : air)
+		{
+			const sim_frame_s &o = frames[other];
+			if (other == idx || o.dr != f.dr || o.end_us <= f.start_us || o.start_us >= f.end_us)
+			{
+				continue;
+			}
+			if (f.rssi[gw] - o.rssi[gw] < SIM_CAPTURE_DB)
+			{
+				lost = true;
+				break;
+			}
+		}
+		copies += lost ? 0 : 1;
+	}
+
+	if (copies > 0)
+	{
+		n.delivered++;
+		netserver.deliver(f, copies);
+		std::vector<uint8_t> ans;
+		if (f.port == LORAWAN_CLOCK_PORT && clock_answer(f, ans))
+		{
+			n.dl_queue.push_back({-1, f.end_us, LORAWAN_CLOCK_PORT, ans});
+		}
+		// Queued downlink goes out in RX1
+		schedule_downlink(n, f.end_us + SIM_RX1_DELAY_US);
+	}
+	else if (in_range)
+	{
+		n.collided++;
+	}
+	else
+	{
+		n.out_of_range++;
+	}
+}
+
+/** Accelerometer burst: a knock with a spike on one axis */
+static void motion_burst(void)
+{
+	std::uniform_int_distribution<int> spike(-4000, 4000);
+	std::normal_distribution<double> noise(0.0, 80.0);
+	int axis = rng() % 3;
+	for (int idx = 0; idx < 32; idx++)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			host_lis3dh.fifo[idx][a] = (int16_t)(host_lis3dh.rest[a] + noise(rng));
+		}
+	}
+	host_lis3dh.fifo[16][axis] = (int16_t)spike(rng);
+	host_lis3dh.fifo_level = 32;
+	host_lis3dh.fifo_read = 0;
+}
+
+/**
+ * @brief Place gateways and nodes, boot every node
+ */
+static void build_fleet(int count, int interval_s)
+{
+	nodes.clear();
+	nodes.resize(count);
+	frames.clear();
+	for (auto &air : on_air)
+	{
+		air.clear();
+	}
+	while (!events.empty())
+	{
+		events.pop();
+	}
+	gw_x.clear();
+	gw_y.clear();
+	rng.seed(cfg.seed);
+	cloud_day = -1;
+
+	std::uniform_real_distribution<double> pos(0.0, cfg.area_km);
+	for (int gw = 0; gw < cfg.gateways; gw++)
+	{
+		gw_x.push_back(pos(rng));
+		gw_y.push_back(pos(rng));
+	}
+
+	std::normal_distribution<double> shadow(0.0, SIM_SHADOWING_DB);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	for (int id = 0; id < count; id++)
+	{
+		sim_node_s &n = nodes[id];
+		n.id = id;
+		n.x_km = pos(rng);
+		n.y_km = pos(rng);
+		for (int gw = 0; gw < cfg.gateways; gw++)
+		{
+			double d = hypot(n.x_km - gw_x[gw], n.y_km - gw_y[gw]);
+			d = d < 0.05 ? 0.05 : d;
+			// Okumura-Hata, suburban, 915 MHz, gateway mast 30 m, node 1.5 m
+			double path_loss = 116.6 + 35.2 * log10(d);
+			n.link_db.push_back((float)(SIM_TX_POWER_DBM + SIM_ANTENNA_GAIN_DB - path_loss + shadow(rng)));
+		}
+		n.has_renogy = unit(rng) < cfg.renogy_share;
+		n.has_victron = n.has_renogy && unit(rng) < cfg.victron_share;
+		n.victron.model = &n.renogy;
+		n.renogy.panel_peak_w = 100.0 + 300.0 * unit(rng);
+		n.renogy.load_w = 5.0 + 40.0 * unit(rng);
+		n.renogy.batt_wh = 12.0 * (50.0 + 150.0 * unit(rng));
+		n.renogy.soc = 0.5 + 0.5 * unit(rng);
+		n.temp_offset = 4.0 * unit(rng) - 2.0;
+		n.rint_mohm = SIM_LIPO_RINT_MOHM * std::exp(0.3 * shadow(rng) / SIM_SHADOWING_DB) * (unit(rng) < 0.05 ? 4.0 : 1.0);
+		n.image = pristine;
+
+		// Boot at a random point of the first interval
+		uint64_t boot = (uint64_t)(unit(rng) * interval_s * 1e6);
+		n.last_update_us = boot;
+		n.tier_since = boot;
+		node_enter(n, boot);
+		setup_app();
+		g_lorawan_settings.send_repeat_time = (uint32_t)interval_s * 1000;
+		init_app();
+		g_join_result = true;
+		api_wake_loop(LORA_JOIN_FIN);
+		node_loop(n, boot);
+		n.api_period_ms = g_lorawan_settings.send_repeat_time;
+		node_leave(n);
+		schedule(boot + (uint64_t)n.api_period_ms * 1000, EV_API_TIMER, id, 0, n.api_gen);
+		if (cfg.motion_per_day > 0.0)
+		{
+			std::exponential_distribution<double> next(cfg.motion_per_day / 86400e6);
+			schedule(boot + (uint64_t)next(rng), EV_MOTION, id);
+		}
+		for (size_t dl = 0; dl < cfg.downlinks.size(); dl++)
+		{
+			schedule(cfg.downlinks[dl].time_us, EV_DL_QUEUE, id, dl);
+		}
+	}
+}
+
+/**
+ * @brief Run the event queue until the end of the simulated time
+ */
+static void run_fleet(uint64_t end_us)
+{
+	while (!events.empty() && events.top().time_us < end_us)
+	{
+		sim_event_s ev = events.top();
+		events.pop();
+		sim_node_s &n = nodes[ev.node];
+		switch (ev.type)
+		{
+		case EV_API_TIMER:
+			if (ev.gen != n.api_gen)
+			{
+				break;
+			}
+			node_enter(n, ev.time_us);
+			api_wake_loop(STATUS);
+			node_loop(n, ev.time_us);
+			node_leave(n);
+			if (ev.gen == n.api_gen)
+			{
+				schedule(ev.time_us + (uint64_t)n.api_period_ms * 1000, EV_API_TIMER, n.id, 0, n.api_gen);
+			}
+			break;
+		case EV_APP_TIMER:
+		{
+			SoftwareTimer *timer = (SoftwareTimer *)(uintptr_t)ev.arg;
+			bool live = false;
+			for (auto &t : n.timers)
+			{
+				live |= (t.timer == timer) && (t.gen == ev.gen);
+			}
+			if (!live)
+			{
+				break;
+			}
+			node_enter(n, ev.time_us);
+			if (timer->cb)
+			{
+				timer->cb(NULL);
+			}
+			bool repeat = timer->repeat;
+			uint32_t period = timer->period;
+			node_loop(n, ev.time_us);
+			node_leave(n);
+			if (repeat)
+			{
+				schedule(ev.time_us + (uint64_t)period * 1000, EV_APP_TIMER, n.id, ev.arg, ev.gen);
+			}
+			break;
+		}
+		case EV_TX_END:
+			tx_end((uint32_t)ev.arg);
+			break;
+		case EV_TX_FIN:
+			node_enter(n, ev.time_us);
+			g_rx_fin_result = true;
+			api_wake_loop(LORA_TX_FIN);
+			node_loop(n, ev.time_us);
+			node_leave(n);
+			break;
+		case EV_MOTION:
+		{
+			node_enter(n, ev.time_us);
+			motion_burst();
+			host_interrupt(WB_IO5);
+			node_loop(n, ev.time_us);
+			node_leave(n);
+			std::exponential_distribution<double> next(cfg.motion_per_day / 86400e6);
+			schedule(ev.time_us + (uint64_t)next(rng), EV_MOTION, n.id);
+			break;
+		}
+		case EV_DL_QUEUE:
+			n.dl_queue.push_back({(int)ev.arg, ev.time_us, cfg.downlinks[ev.arg].port, cfg.downlinks[ev.arg].payload});
+			if (n.class_c)
+			{
+				schedule_downlink(n, ev.time_us);
+			}
+			break;
+		case EV_DL_RX:
+		{
+			n.dl_scheduled = false;
+			if (n.dl_queue.empty())
+			{
+				break;
+			}
+			if (ev.time_us < n.radio_busy_until)
+			{
+				// Class C, the node started an uplink in the meantime
+				schedule_downlink(n, n.radio_busy_until);
+				break;
+			}
+			sim_queued_dl_s dl = std::move(n.dl_queue.front());
+			n.dl_queue.pop_front();
+			if (dl.index >= 0)
+			{
+				sim_dl_stats_s &st = dl_stats[dl.index];
+				uint64_t latency = ev.time_us - dl.queued_us;
+				st.delivered++;
+				st.latency_us += latency;
+				st.latency_max_us = std::max(st.latency_max_us, latency);
+			}
+
+			node_enter(n, ev.time_us);
+			memcpy(g_rx_lora_data, dl.payload.data(), dl.payload.size());
+			g_rx_data_len = (uint8_t)dl.payload.size();
+			g_last_fport = dl.port;
+			g_last_rssi = (int16_t)*std::max_element(n.link_db.begin(), n.link_db.end());
+			api_wake_loop(LORA_DATA);
+			node_loop(n, ev.time_us);
+			node_leave(n);
+			if (n.class_c)
+			{
+				schedule_downlink(n, ev.time_us + SIM_RX1_DELAY_US);
+			}
+			break;
+		}
+		}
+	}
+}
+
+static std::vector<int> parse_list(const char *arg)
+{
+	std::vector<int> list;
+	std::string s(arg);
+	size_t pos = 0;
+	while (pos <= s.size())
+	{
+		size_t comma = s.find(',', pos);
+		list.push_back(atoi(s.substr(pos, comma - pos).c_str()));
+		if (comma == std::string::npos)
+		{
+			break;
+		}
+		pos = comma + 1;
+	}
+	return list;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s [options]\n"
+			"  -n 100,500,1000  fleet sizes\n"
+			"  -i 900,300       send intervals in s\n"
+			"  -d 7             simulated days\n"
+			"  -g 3             gateways\n"
+			"  -a 10            side of the square area in km\n"
+			"  -r 1.0           share of nodes with a charge controller on Serial1\n"
+			"  -V 0.0           share of those with a Victron VE.Direct controller instead of a Renogy\n"
+			"  -m 0             accelerometer events per node and day\n"
+			"  -s 1             random seed\n"
+			"  -o file          archive of the delivered frames (tools/decoder format), last run\n"
+			"  -N id            archive only the frames of this node\n"
+			"  -c file          per node CSV, last run\n"
+			"  -D s:port:hex    downlink to every node at time s, repeatable\n"
+			"  -v               application log (build with MY_DEBUG=1)\n",
+			name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-v")
+		{
+			host_verbose = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+		}
+		const char *val = argv[++i];
+		if (arg == "-n")
+		{
+			cfg.fleet_sizes = parse_list(val);
+		}
+		else if (arg == "-i")
+		{
+			cfg.intervals_s = parse_list(val);
+		}
+		else if (arg == "-d")
+		{
+			cfg.days = atof(val);
+		}
+		else if (arg == "-g")
+		{
+			cfg.gateways = atoi(val);
+		}
+		else if (arg == "-a")
+		{
+			cfg.area_km = atof(val);
+		}
+		else if (arg == "-r")
+		{
+			cfg.renogy_share = atof(val);
+		}
+		else if (arg == "-V")
+		{
+			cfg.victron_share = atof(val);
+		}
+		else if (arg == "-m")
+		{
+			cfg.motion_per_day = atof(val);
+		}
+		else if (arg == "-s")
+		{
+			cfg.seed = (uint32_t)atol(val);
+		}
+		else if (arg == "-o")
+		{
+			cfg.archive = val;
+		}
+		else if (arg == "-N")
+		{
+			cfg.archive_node = atoi(val);
+		}
+		else if (arg == "-c")
+		{
+			cfg.node_csv = val;
+		}
+		else if (arg == "-D")
+		{
+			sim_downlink_s dl;
+			char hex[2 * 242 + 1] = {0};
+			unsigned port = 0;
+			double at_s = 0.0;
+			if (sscanf(val, "%lf:%u:%484[0-9a-fA-F]", &at_s, &port, hex) != 3 || strlen(hex) % 2 || port == 0 || port > 223)
+			{
+				usage(argv[0]);
+			}
+			dl.time_us = (uint64_t)(at_s * 1e6);
+			dl.port = (uint8_t)port;
+			for (size_t idx = 0; hex[idx]; idx += 2)
+			{
+				dl.payload.push_back((uint8_t)strtoul(std::string(hex + idx, 2).c_str(), NULL, 16));
+			}
+			cfg.downlinks.push_back(dl);
+		}
+		else
+		{
+			usage(argv[0]);
+		}
+	}
+
+	host_virtual_time = true;
+	host_shtc3.present = true;
+	host_lis3dh.present = true;
+
+	// Application image as left by the static initializers, every node boots from it
+	pristine.resize(data_size() + bss_size());
+	memcpy(pristine.data(), __start_app_data, data_size());
+	memcpy(pristine.data() + data_size(), __start_app_bss, bss_size());
+
+	printf("application image %zu bytes per node, %d gateways, %.0f km x %.0f km, %.1f days\n",
+		   pristine.size(), cfg.gateways, cfg.area_km, cfg.area_km, cfg.days);
+	printf("  nodes interval    uplinks   busy  delivered    PDR  collided  no cover  airtime s/day avg/max  energy mAh/day avg/max  tier crit/save/norm/surp %%  runtime\n");
+
+	uint64_t end_us = (uint64_t)(cfg.days * 86400e6);
+	for (size_t ni = 0; ni < cfg.fleet_sizes.size(); ni++)
+	{
+		for (size_t ii = 0; ii < cfg.intervals_s.size(); ii++)
+		{
+			bool last = (ni + 1 == cfg.fleet_sizes.size()) && (ii + 1 == cfg.intervals_s.size());
+			netserver = sim_netserver_s();
+			if (last && cfg.archive)
+			{
+				netserver.archive = fopen(cfg.archive, "wb");
+				netserver.archive_node = cfg.archive_node;
+			}
+
+			dl_stats.assign(cfg.downlinks.size(), sim_dl_stats_s());
+			auto t0 = std::chrono::steady_clock::now();
+			build_fleet(cfg.fleet_sizes[ni], cfg.intervals_s[ii]);
+			run_fleet(end_us);
+			auto t1 = std::chrono::steady_clock::now();
+
+			uint64_t sent = 0, busy = 0, delivered = 0, collided = 0, out_of_range = 0;
+			double air_max = 0.0, air_sum = 0.0, mah_max = 0.0, mah_sum = 0.0;
+			uint64_t tier_us[4] = {0};
+			for (auto &n : nodes)
+			{
+				if (end_us > n.tier_since)
+				{
+					n.tier_us[n.tier] += end_us - n.tier_since;
+				}
+				if (n.class_c)
+				{
+					class_c_charge(n, end_us);
+				}
+				sent += n.sent;
+				busy += n.busy;
+				delivered += n.delivered;
+				collided += n.collided;
+				out_of_range += n.out_of_range;
+				double air = n.airtime_us / 1e6 / cfg.days;
+				double mah = (SIM_I_SLEEP_MA * 86400.0 + n.charge_mas / cfg.days) / 3600.0;
+				air_sum += air;
+				mah_sum += mah;
+				air_max = std::max(air_max, air);
+				mah_max = std::max(mah_max, mah);
+				for (int t = 0; t < 4; t++)
+				{
+					tier_us[t] += n.tier_us[t];
+				}
+			}
+			double all_us = (double)end_us * nodes.size();
+			printf("%7zu %7ds %10llu %6llu %10llu %5.1f%% %9llu %9llu %10.2f / %-8.2f %11.2f / %-8.2f %5.1f/%4.1f/%4.1f/%4.1f  %6.1fs\n",
+				   nodes.size(), cfg.intervals_s[ii], (unsigned long long)sent, (unsigned long long)busy,
+				   (unsigned long long)delivered, sent ? 100.0 * delivered / sent : 0.0,
+				   (unsigned long long)collided, (unsigned long long)out_of_range,
+				   air_sum / nodes.size(), air_max, mah_sum / nodes.size(), mah_max,
+				   100.0 * tier_us[0] / all_us, 100.0 * tier_us[1] / all_us, 100.0 * tier_us[2] / all_us, 100.0 * tier_us[3] / all_us,
+				   std::chrono::duration<double>(t1 - t0).count());
+			for (size_t dl = 0; dl < dl_stats.size(); dl++)
+			{
+				const sim_dl_stats_s &st = dl_stats[dl];
+				printf("         downlink %zu at %.0fs: %u of %zu delivered, latency avg %.1f s max %.1f s\n",
+					   dl + 1, cfg.downlinks[dl].time_us / 1e6, st.delivered, nodes.size(),
+					   st.delivered ? st.latency_us / 1e6 / st.delivered : 0.0, st.latency_max_us / 1e6);
+			}
+			if (!dl_stats.empty())
+			{
+				uint64_t class_c_us = 0;
+				for (auto &n : nodes)
+				{
+					class_c_us += n.class_c_us;
+				}
+				printf("         Class C %.1f min per node\n", class_c_us / 60e6 / nodes.size());
+			}
+			fflush(stdout);
+
+			if (netserver.archive)
+			{
+				fclose(netserver.archive);
+			}
+			if (last && cfg.node_csv)
+			{
+				FILE *csv = fopen(cfg.node_csv, "w");
+				if (!csv)
+				{
+					perror(cfg.node_csv);
+					return 1;
+				}
+				fprintf(csv, "node,x_km,y_km,best_rssi_dbm,renogy,sent,busy,delivered,collided,no_cover,airtime_s,active_s,energy_mah,tier,rint_mohm\n");
+				for (auto &n : nodes)
+				{
+					float best = *std::max_element(n.link_db.begin(), n.link_db.end());
+					fprintf(csv, "%u,%.3f,%.3f,%.1f,%d,%u,%u,%u,%u,%u,%.3f,%.3f,%.3f,%d,%.0f\n", n.id, n.x_km, n.y_km, best,
+							n.has_renogy ? 1 : 0, n.sent, n.busy, n.delivered, n.collided, n.out_of_range,
+							n.airtime_us / 1e6, n.active_us / 1e6,
+							(SIM_I_SLEEP_MA * cfg.days * 86400.0 + n.charge_mas) / 3600.0, n.tier, n.rint_mohm);
+				}
+				fclose(csv);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file wisblock_state.cpp
+ * @brief WisBlock-API globals of one simulated node
+ *        Linked into the application image, so every node has its own copy
+ *        (see app_image.ld).
+ * @version 0.1
+ * @date 2022-10-29
+ */
+
+#include <WisBlock-API.h>
+
+s_lorawan_settings g_lorawan_settings;
+volatile uint16_t g_task_event_type = 0;
+bool g_enable_ble = false;
+bool g_join_result = false;
+bool g_rx_fin_result = false;
+uint8_t g_rx_lora_data[256];
+uint8_t g_rx_data_len = 0;
+int16_t g_last_rssi = 0;
+int8_t g_last_snr = 0;
+uint8_t g_last_fport = 0;
@@ -0,0 +1,307 @@
+/**
+ * @file fuota_diff.h
+ * @brief Delta patch generator for src/fuota_codec.h, host only
+ *        Greedy, bsdiff style: for every position of the new image the best
+ *        approximate match in the old image is searched (hash chains over 8
+ *        byte windows, plus the alignment of the previous match). A match
+ *        may contain changed bytes, it scores matches minus mismatches.
+ *        Matches become DIFF operations, the bytes between them ADD.
+ *        Code that moved keeps its instructions but not its branch and
+ *        literal offsets, those end up as short changed runs in a DIFF.
+ * @version 0.1
+ * @date 2022-12-10
+ */
+
+#ifndef FUOTA_DIFF_H
+#define FUOTA_DIFF_H
+
+#include "fuota_codec.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/** Hash window, chain search depth, smallest match score worth a DIFF */
+#define FUOTA_DIFF_WINDOW 8
+#define FUOTA_DIFF_CHAIN 24
+#define FUOTA_DIFF_MIN_SCORE 16
+#define FUOTA_DIFF_HASH_BITS 20
+/** Unchanged bytes that end a changed run, shorter gaps are cheaper as changed bytes */
+#define FUOTA_DIFF_GAP 3
+
+static inline uint32_t fuota_diff_hash(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return (uint32_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - FUOTA_DIFF_HASH_BITS));
+}
+
+static inline void fuota_diff_varint(std::vector<uint8_t> &out, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+/** Approximate match of old[o..] and nw[i..]: best length and score (matches - mismatches) */
+struct fuota_match_s
+{
+	uint32_t old_pos;
+	uint32_t len;
+	int32_t score;
+};
+
+static inline fuota_match_s fuota_diff_extend(const std::vector<uint8_t> &old, const std::vector<uint8_t> &nw, uint32_t o, uint32_t i)
+{
+	fuota_match_s m = {o, 0, 0};
+	int32_t s = 0;
+	for (uint32_t j = 0; o + j < old.size() && i + j < nw.size(); j++)
+	{
+		s += old[o + j] == nw[i + j] ? 1 : -1;
+		if (s > m.score)
+		{
+			m.score = s;
+			m.len = j + 1;
+		}
+		else if (s < m.score - 32)
+		{
+			break;
+		}
+	}
+	return m;
+}
+
+/** DIFF old[o .. o + len) to nw[i .. i + len) */
+static inline void fuota_diff_emit(std::vector<uint8_t> &out, const std::vector<uint8_t> &old, const std::vector<uint8_t> &nw,
+								   uint32_t old_cur, uint32_t o, uint32_t i, uint32_t len)
+{
+	int32_t seek = (int32_t)(o - old_cur);
+	out.push_back(FUOTA_OP_DIFF);
+	fuota_diff_varint(out, ((uint32_t)seek << 1) ^ (uint32_t)(seek >> 31));
+	fuota_diff_varint(out, len);
+	uint32_t j = 0;
+	while (j < len)
+	{
+		uint32_t same = 0;
+		while (j + same < len && old[o + j + same] == nw[i + j + same])
+		{
+			same++;
+		}
+		uint32_t changed = 0;
+		uint32_t gap = 0;
+		while (j + same + changed + gap < len)
+		{
+			uint32_t k = j + same + changed + gap;
+			if (old[o + k] != nw[i + k])
+			{
+				changed += gap + 1;
+				gap = 0;
+			}
+			else if (++gap >= FUOTA_DIFF_GAP)
+			{
+				break;
+			}
+		}
+		if (j + same + changed + gap == len)
+		{
+			// Trailing unchanged bytes are the next run's
+			gap = 0;
+		}
+		fuota_diff_varint(out, same);
+		fuota_diff_varint(out, changed);
+		for (uint32_t k = j + same; k < j + same + changed; k++)
+		{
+			out.push_back((uint8_t)(nw[i + k] - old[o + k]));
+		}
+		j += same + changed;
+	}
+}
+
+static inline void fuota_diff_add(std::vector<uint8_t> &out, const std::vector<uint8_t> &nw, uint32_t from, uint32_t to)
+{
+	if (to > from)
+	{
+		out.push_back(FUOTA_OP_ADD);
+		fuota_diff_varint(out, to - from);
+		out.insert(out.end(), nw.begin() + from, nw.begin() + to);
+	}
+}
+
+/**
+ * @brief Patch that turns old into nw
+ *
+ */
+static inline std::vector<uint8_t> fuota_diff(const std::vector<uint8_t> &old, const std::vector<uint8_t> &nw)
+{
+	std::vector<uint8_t> out(FUOTA_HEADER_LEN);
+	out[0] = 'F';
+	out[1] = 'D';
+	out[2] = FUOTA_PATCH_VERSION;
+	out[3] = 0;
+	fuota_put32(&out[4], (uint32_t)old.size());
+	fuota_put32(&out[8], fuota_crc32(0, old.data(), (uint32_t)old.size()));
+	fuota_put32(&out[12], (uint32_t)nw.size());
+	fuota_put32(&out[16], fuota_crc32(0, nw.data(), (uint32_t)nw.size()));
+
+	// Hash chains over the old image, newest position first
+	std::vector<int32_t> head(1u << FUOTA_DIFF_HASH_BITS, -1);
+	std::vector<int32_t> next(old.size(), -1);
+	for (uint32_t o = 0; o + FUOTA_DIFF_WINDOW <= old.size(); o++)
+	{
+		uint32_t h = fuota_diff_hash(&old[o]);
+		next[o] = head[h];
+		head[h] = (int32_t)o;
+	}
+
+	uint32_t old_cur = 0;  // old position after the last DIFF
+	int64_t align = 0;	   // old - new offset of the last DIFF
+	uint32_t literal = 0;  // first new byte not covered yet
+	uint32_t i = 0;
+	while (i < nw.size())
+	{
+		fuota_match_s best = {0, 0, 0};
+		int64_t o_align = (int64_t)i + align;
+		if (o_align >= 0 && o_align < (int64_t)old.size())
+		{
+			best = fuota_diff_extend(old, nw, (uint32_t)o_align, i);
+		}
+		if (i + FUOTA_DIFF_WINDOW <= nw.size())
+		{
+			int32_t o = head[fuota_diff_hash(&nw[i])];
+			for (int depth = 0; o >= 0 && depth < FUOTA_DIFF_CHAIN; depth++, o = next[o])
+			{
+				fuota_match_s m = fuota_diff_extend(old, nw, (uint32_t)o, i);
+				if (m.score > best.score)
+				{
+					best = m;
+				}
+			}
+		}
+		if (best.score < FUOTA_DIFF_MIN_SCORE)
+		{
+			i++;
+			continue;
+		}
+
+		// Grow backwards into the literal bytes while that scores
+		uint32_t back = 0;
+		int32_t s = 0;
+		int32_t best_s = 0;
+		for (uint32_t b = 1; b <= i - literal && b <= best.old_pos; b++)
+		{
+			s += old[best.old_pos - b] == nw[i - b] ? 1 : -1;
+			if (s > best_s)
+			{
+				best_s = s;
+				back = b;
+			}
+			else if (s < best_s - 8)
+			{
+				break;
+			}
+		}
+		uint32_t start = i - back;
+		uint32_t o = best.old_pos - back;
+		uint32_t len = best.len + back;
+		fuota_diff_add(out, nw, literal, start);
+		fuota_diff_emit(out, old, nw, old_cur, o, start, len);
+		old_cur = o + len;
+		align = (int64_t)o - start;
+		i = start + len;
+		literal = i;
+	}
+	fuota_diff_add(out, nw, literal, (uint32_t)nw.size());
+	out.push_back(FUOTA_OP_END);
+	return out;
+}
+
+/** fuota_io_s on memory */
+struct fuota_mem_io_s
+{
+	const std::vector<uint8_t> *old;
+	const std::vector<uint8_t> *patch;
+	std::vector<uint8_t> *out;
+};
+
+static inline bool fuota_mem_read_old(void *ctx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	const std::vector<uint8_t> &v = *((fuota_mem_io_s *)ctx)->old;
+	if (offset + len > v.size())
+	{
+		return false;
+	}
+	memcpy(buf, &v[offset], len);
+	return true;
+}
+
+static inline bool fuota_mem_read_patch(void *ctx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	const std::vector<uint8_t> &v = *((fuota_mem_io_s *)ctx)->patch;
+	if (offset + len > v.size())
+	{
+		return false;
+	}
+	memcpy(buf, &v[offset], len);
+	return true;
+}
+
+static inline bool fuota_mem_write_new(void *ctx, uint32_t offset, const uint8_t *buf, uint16_t len)
+{
+	std::vector<uint8_t> &v = *((fuota_mem_io_s *)ctx)->out;
+	if (v.size() < offset + len)
+	{
+		v.resize(offset + len);
+	}
+	memcpy(&v[offset], buf, len);
+	return true;
+}
+
+/**
+ * @brief Apply a patch in memory with the firmware's applier
+ *
+ * @return uint8_t fuota_result_e
+ */
+static inline uint8_t fuota_mem_apply(const std::vector<uint8_t> &old, const std::vector<uint8_t> &patch, std::vector<uint8_t> &out)
+{
+	fuota_mem_io_s ctx = {&old, &patch, &out};
+	fuota_io_s io = {&ctx, fuota_mem_read_old, fuota_mem_read_patch, fuota_mem_write_new};
+	fuota_header_s h;
+	out.clear();
+	return fuota_patch_apply(&io, (uint32_t)patch.size(), 0xFFFFFFFF, &h);
+}
+
+static inline bool fuota_load(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *in = fopen(path, "rb");
+	if (!in)
+	{
+		perror(path);
+		return false;
+	}
+	data.clear();
+	uint8_t buf[4096];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), in)) > 0)
+	{
+		data.insert(data.end(), buf, buf + got);
+	}
+	fclose(in);
+	return true;
+}
+
+static inline bool fuota_save(const char *path, const std::vector<uint8_t> &data)
+{
+	FILE *out = fopen(path, "wb");
+	if (!out)
+	{
+		perror(path);
+		return false;
+	}
+	bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+	return (fclose(out) == 0) && ok;
+}
+
+#endif
@@ -0,0 +1,409 @@
+/**
+ * @file fuota_ns.cpp
+ * @brief Network server stand-in for the delta firmware update, runs src/fuota.cpp
+ *        Makes the patch from two application images, puts the old image in
+ *        bank 0 of the host flash and runs the TS004 session against the
+ *        unmodified firmware code: FragSessionSetupReq, the uncoded
+ *        fragments, then coded fragments until the node sends its
+ *        FRAG_PATCH_RESULT. Downlinks are lost at random, as they are at
+ *        the edge of coverage.
+ *
+ *        Every run checks that bank 1 holds the new image. Built with
+ *        -DFUOTA_ACTIVATE it checks that the bootloader settings describe
+ *        the new image and that the node restarted, without it that the
+ *        settings are untouched and the node runs on. A
+ *        session that has lost more fragments than the node can recover
+ *        is counted apart (FragSessionStatusAns), the exit code reports
+ *        the other failures.
+ *        Reported per loss rate: coded fragments needed, downlinks and
+ *        downlink airtime, against sending the full image.
+ *
+ *        g++ -std=c++17 -O2 -DNRF52_SERIES -DMY_DEBUG=0 -Itools/host/shim -Isrc -Itools/fuota tools/fuota/fuota_ns.cpp src/fuota.cpp tools/host/host_port.cpp -o fuota_ns
+ *
+ *        fuota_ns [options] old.bin new.bin
+ * @version 0.1
+ * @date 2022-12-10
+ */
+
+#include "app.h"
+#include <flash/flash_nrf5x.h>
+
+#include "fuota_diff.h"
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <string>
+
+/** Largest fragment of src/fuota.cpp */
+#define NS_FRAG_MAX 128
+/** Coded fragments sent before the server gives up, src/fuota.cpp recovers 32 lost */
+#define NS_MAX_CODED 96
+/** Legacy banked DFU, bank valid */
+#define BANK_VALID_APP 0x01
+/** LoRaWAN MHDR, FHDR, FPort and MIC around every application payload */
+#define LORAWAN_OVERHEAD 13
+
+/** US915 downlink data rates, 500 kHz, largest FRMPayload */
+struct ns_dr_s
+{
+	uint8_t sf;
+	uint8_t max_payload;
+};
+static const ns_dr_s ns_dr[6] = {{12, 53}, {11, 129}, {10, 242}, {9, 242}, {8, 242}, {7, 242}};
+
+/** Node side: answers of the node, restart request */
+static std::vector<std::vector<uint8_t>> uplinks;
+static bool node_reset = false;
+
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	if (fport == LORAWAN_FUOTA_PORT)
+	{
+		uplinks.push_back(std::vector<uint8_t>(data, data + size));
+	}
+	return LMH_SUCCESS;
+}
+
+void api_reset(void)
+{
+	node_reset = true;
+}
+
+/**
+ * @brief Downlink time on air, Semtech AN1200.13, explicit header, no CRC, CR 4/5, 8 symbol preamble
+ */
+static double airtime_s(uint8_t dr, size_t app_len)
+{
+	uint8_t sf = ns_dr[dr - 8].sf;
+	double tsym = (double)(1 << sf) / 500000.0;
+	int de = tsym > 0.016 ? 1 : 0;
+	int pl = (int)app_len + LORAWAN_OVERHEAD;
+	double num = 8.0 * pl - 4.0 * sf + 28;
+	double sym = 8 + std::max(ceil(num / (4.0 * (sf - 2 * de))) * 5, 0.0);
+	return ((8 + 4.25) + sym) * tsym;
+}
+
+/** CRC-16/CCITT-FALSE like the bootloader */
+static uint16_t crc16(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		crc ^= (uint16_t)buf[idx] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/** One downlink the way main.cpp hands it over, TX_FIN of the answer right away */
+static void downlink(const std::vector<uint8_t> &frame)
+{
+	fuota_command(frame.data(), (uint8_t)frame.size());
+	if (fuota_send())
+	{
+		fuota_tx_fin();
+	}
+}
+
+struct ns_cfg_s
+{
+	std::vector<double> loss_pct = {0, 5, 10, 20};
+	uint8_t dr = 8;
+	uint8_t frag_size = 0;
+	int runs = 20;
+	uint32_t seed = 1;
+};
+static ns_cfg_s cfg;
+
+/** Result of one session */
+struct ns_run_s
+{
+	bool ok;
+	bool too_many_lost; // more lost than the node can recover, a new session is needed
+	const char *error;
+	uint32_t coded;
+	uint32_t downlinks;
+};
+
+static ns_run_s run_session(const std::vector<uint8_t> &old_img, const std::vector<uint8_t> &new_img,
+							const std::vector<uint8_t> &patch, double loss, std::mt19937 &rng)
+{
+	ns_run_s run = {false, false, "no result", 0, 0};
+	uint8_t size = cfg.frag_size;
+
+	// Node flashed over serial, bank 0 valid
+	std::fill(host_nvm.begin(), host_nvm.end(), 0xFF);
+	std::copy(old_img.begin(), old_img.end(), host_nvm.begin() + FUOTA_BANK0);
+	const uint32_t boot[8] = {BANK_VALID_APP, crc16(old_img.data(), old_img.size()), 0, (uint32_t)old_img.size(), 0, 0, (uint32_t)old_img.size(), 0};
+	uint32_t settings[8];
+	memcpy(&host_nvm[FUOTA_BOOT_SETTINGS], boot, sizeof(boot));
+	uplinks.clear();
+	node_reset = false;
+
+	uint16_t m = (uint16_t)((patch.size() + size - 1) / size);
+	uint8_t padding = (uint8_t)((uint32_t)m * size - patch.size());
+	std::vector<uint8_t> data(patch);
+	data.resize((size_t)m * size, 0);
+	uint32_t descriptor = fuota_crc32(0, patch.data(), (uint32_t)patch.size());
+
+	// Setup is repeated until answered, it is not part of the loss model
+	std::vector<uint8_t> setup = {FRAG_PACKAGE_VERSION, FRAG_SESSION_SETUP, 0x00, (uint8_t)m, (uint8_t)(m >> 8), size, 0x00, padding, 0, 0, 0, 0};
+	fuota_put32(&setup[8], descriptor);
+	downlink(setup);
+	std::vector<uint8_t> expect = {FRAG_PACKAGE_VERSION, FRAG_PACKAGE_ID, FRAG_PACKAGE_VER, FRAG_SESSION_SETUP, 0x00};
+	if (uplinks.size() != 1 || uplinks[0] != expect)
+	{
+		run.error = "setup not accepted";
+		return run;
+	}
+
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	std::vector<uint8_t> line((m + 7) / 8);
+	std::vector<uint8_t> frame(3 + size);
+	frame[0] = FRAG_DATA_FRAGMENT;
+	for (uint32_t n = 1; n <= (uint32_t)m + NS_MAX_CODED; n++)
+	{
+		frame[1] = (uint8_t)n;
+		frame[2] = (uint8_t)((n >> 8) & 0x3F);
+		fuota_matrix_line((uint16_t)n, m, line.data());
+		std::fill(frame.begin() + 3, frame.end(), 0);
+		for (uint16_t idx = 0; idx < m; idx++)
+		{
+			if ((line[idx / 8] >> (idx & 7)) & 1)
+			{
+				for (uint8_t b = 0; b < size; b++)
+				{
+					frame[3 + b] ^= data[(size_t)idx * size + b];
+				}
+			}
+		}
+		run.downlinks++;
+		run.coded += n > m ? 1 : 0;
+		if (chance(rng) < loss)
+		{
+			continue;
+		}
+		downlink(frame);
+		if (uplinks.size() > 1)
+		{
+			break;
+		}
+	}
+	if (uplinks.size() < 2)
+	{
+		// Given up, ask the node why
+		downlink({FRAG_SESSION_STATUS, 0x00});
+		const std::vector<uint8_t> &status = uplinks.back();
+		if (uplinks.size() == 2 && status.size() == 5 && status[0] == FRAG_SESSION_STATUS && (status[4] & 0x01))
+		{
+			run.too_many_lost = true;
+			run.error = "too many fragments lost";
+		}
+		return run;
+	}
+
+	const std::vector<uint8_t> &ans = uplinks[1];
+	if (ans.size() != 6 || ans[0] != FRAG_PATCH_RESULT || ans[1] != FUOTA_OK)
+	{
+		run.error = "patch result not ok";
+		return run;
+	}
+	if (fuota_get32(&ans[2]) != fuota_crc32(0, new_img.data(), (uint32_t)new_img.size()))
+	{
+		run.error = "wrong CRC in the result";
+		return run;
+	}
+	if (!std::equal(new_img.begin(), new_img.end(), host_nvm.begin() + FUOTA_BANK1))
+	{
+		run.error = "bank 1 differs from the new image";
+		return run;
+	}
+	memcpy(settings, &host_nvm[FUOTA_BOOT_SETTINGS], sizeof(settings));
+#ifdef FUOTA_ACTIVATE
+	if (settings[0] != BANK_VALID_APP || settings[1] != crc16(new_img.data(), new_img.size()) || settings[2] != BANK_VALID_APP ||
+		settings[3] != new_img.size() || settings[6] != new_img.size())
+	{
+		run.error = "bootloader settings";
+		return run;
+	}
+	if (!node_reset)
+	{
+		run.error = "no restart";
+		return run;
+	}
+#else
+	if (memcmp(settings, boot, sizeof(settings)) != 0)
+	{
+		run.error = "bootloader settings changed without FUOTA_ACTIVATE";
+		return run;
+	}
+	if (node_reset)
+	{
+		run.error = "restart without FUOTA_ACTIVATE";
+		return run;
+	}
+#endif
+	run.ok = true;
+	run.error = NULL;
+	return run;
+}
+
+static std::vector<double> parse_list(const char *arg)
+{
+	std::vector<double> list;
+	std::string s = arg;
+	size_t pos = 0;
+	while (pos <= s.size())
+	{
+		size_t comma = s.find(',', pos);
+		if (comma == std::string::npos)
+		{
+			comma = s.size();
+		}
+		list.push_back(atof(s.substr(pos, comma - pos).c_str()));
+		pos = comma + 1;
+	}
+	return list;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s [options] old.bin new.bin\n"
+			"  -l 0,5,10,20     downlink loss in %%\n"
+			"  -d 8             US915 downlink data rate, 8 .. 13\n"
+			"  -f size          fragment size, default the largest for the data rate\n"
+			"  -r 20            sessions per loss rate\n"
+			"  -s 1             random seed\n"
+			"  -v               application log (build with MY_DEBUG=1)\n",
+			name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<const char *> files;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-v")
+		{
+			host_verbose = true;
+			continue;
+		}
+		if (arg[0] != '-')
+		{
+			files.push_back(argv[i]);
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+		}
+		const char *val = argv[++i];
+		if (arg == "-l")
+		{
+			cfg.loss_pct = parse_list(val);
+		}
+		else if (arg == "-d")
+		{
+			cfg.dr = (uint8_t)atoi(val);
+		}
+		else if (arg == "-f")
+		{
+			cfg.frag_size = (uint8_t)atoi(val);
+		}
+		else if (arg == "-r")
+		{
+			cfg.runs = atoi(val);
+		}
+		else if (arg == "-s")
+		{
+			cfg.seed = (uint32_t)atol(val);
+		}
+		else
+		{
+			usage(argv[0]);
+		}
+	}
+	if (files.size() != 2 || cfg.dr < 8 || cfg.dr > 13 || cfg.runs < 1)
+	{
+		usage(argv[0]);
+	}
+	uint8_t max_frag = (uint8_t)std::min(ns_dr[cfg.dr - 8].max_payload - 3, NS_FRAG_MAX);
+	if (cfg.frag_size == 0)
+	{
+		cfg.frag_size = max_frag;
+	}
+	if (cfg.frag_size > max_frag)
+	{
+		fprintf(stderr, "Largest fragment at DR%d is %d bytes\n", cfg.dr, max_frag);
+		return 1;
+	}
+
+	std::vector<uint8_t> old_img, new_img;
+	if (!fuota_load(files[0], old_img) || !fuota_load(files[1], new_img))
+	{
+		return 1;
+	}
+	if (old_img.size() > FUOTA_BANK1 - FUOTA_BANK0 || new_img.size() > FUOTA_BANK_SIZE)
+	{
+		fprintf(stderr, "Image larger than a bank\n");
+		return 1;
+	}
+	std::vector<uint8_t> patch = fuota_diff(old_img, new_img);
+	uint32_t m = (uint32_t)((patch.size() + cfg.frag_size - 1) / cfg.frag_size);
+	uint32_t m_full = (uint32_t)((new_img.size() + cfg.frag_size - 1) / cfg.frag_size);
+	double frag_air = airtime_s(cfg.dr, 3 + cfg.frag_size);
+	printf("old %zu bytes, new %zu bytes, patch %zu bytes (%.2f %%)\n", old_img.size(), new_img.size(), patch.size(),
+		   100.0 * patch.size() / new_img.size());
+	printf("DR%d SF%d BW500, %d byte fragments, %.3f s each: patch %u fragments, full image %u fragments\n",
+		   cfg.dr, ns_dr[cfg.dr - 8].sf, cfg.frag_size, frag_air, m, m_full);
+	if (patch.size() > FUOTA_SCRATCH_SIZE)
+	{
+		fprintf(stderr, "Patch larger than the scratch area\n");
+		return 1;
+	}
+
+	std::mt19937 rng(cfg.seed);
+	int failed = 0;
+	printf("  loss %%  runs    ok  too many lost  coded avg/max  downlinks avg  airtime s avg  full image airtime s\n");
+	for (double pct : cfg.loss_pct)
+	{
+		double loss = pct / 100.0;
+		int ok = 0;
+		int too_many_lost = 0;
+		uint64_t coded_sum = 0, downlink_sum = 0;
+		uint32_t coded_max = 0;
+		for (int r = 0; r < cfg.runs; r++)
+		{
+			ns_run_s run = run_session(old_img, new_img, patch, loss, rng);
+			if (run.ok)
+			{
+				ok++;
+				coded_sum += run.coded;
+				coded_max = std::max(coded_max, run.coded);
+			}
+			else
+			{
+				too_many_lost += run.too_many_lost ? 1 : 0;
+				failed += run.too_many_lost ? 0 : 1;
+				if (host_verbose)
+				{
+					printf("  run %d: %s\n", r, run.error);
+				}
+			}
+			downlink_sum += run.downlinks;
+		}
+		double downlinks = (double)downlink_sum / cfg.runs;
+		// Full image with an ideal code: every fragment lost costs one more
+		double full_air = m_full / (1.0 - std::min(loss, 0.99)) * frag_air;
+		printf("  %6.1f  %4d  %4d  %13d  %6.1f/%-6u  %13.1f  %13.1f  %20.0f\n", pct, cfg.runs, ok, too_many_lost,
+			   ok ? (double)coded_sum / ok : 0.0, coded_max, downlinks, downlinks * frag_air, full_air);
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file fuota_patch.cpp
+ * @brief Makes and applies delta patches for the firmware update (src/fuota.cpp)
+ *        The images are the application binaries as flashed to bank 0, e.g.
+ *        arm-none-eabi-objcopy -O binary firmware.elf app.bin of the
+ *        PlatformIO build. Every patch is applied again with the firmware's
+ *        applier (src/fuota_codec.h) before it is written.
+ *
+ *        g++ -std=c++17 -O2 -Isrc -Itools/fuota tools/fuota/fuota_patch.cpp -o fuota_patch
+ *
+ *        fuota_patch old.bin new.bin out.patch
+ *        fuota_patch -a old.bin in.patch new.bin
+ * @version 0.1
+ * @date 2022-12-10
+ */
+
+#include "fuota_diff.h"
+
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+
+static const char *result_name(uint8_t result)
+{
+	static const char *names[] = {"ok", "bad header", "wrong image", "bad patch", "bad result", "flash error", "bad descriptor", "lost too many"};
+	return result < sizeof(names) / sizeof(names[0]) ? names[result] : "?";
+}
+
+static int make_patch(const char *old_path, const char *new_path, const char *patch_path)
+{
+	std::vector<uint8_t> old_img, new_img;
+	if (!fuota_load(old_path, old_img) || !fuota_load(new_path, new_img))
+	{
+		return 1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	std::vector<uint8_t> patch = fuota_diff(old_img, new_img);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<uint8_t> check;
+	uint8_t result = fuota_mem_apply(old_img, patch, check);
+	if (result != FUOTA_OK || check != new_img)
+	{
+		fprintf(stderr, "Patch does not reproduce %s: %s\n", new_path, result_name(result));
+		return 1;
+	}
+	if (!fuota_save(patch_path, patch))
+	{
+		return 1;
+	}
+	printf("old %zu bytes, new %zu bytes, patch %zu bytes (%.2f %% of new), CRC-32 %08X, %.0f ms\n",
+		   old_img.size(), new_img.size(), patch.size(), 100.0 * patch.size() / new_img.size(),
+		   fuota_crc32(0, patch.data(), (uint32_t)patch.size()), ms);
+	return 0;
+}
+
+static int apply_patch(const char *old_path, const char *patch_path, const char *new_path)
+{
+	std::vector<uint8_t> old_img, patch, new_img;
+	if (!fuota_load(old_path, old_img) || !fuota_load(patch_path, patch))
+	{
+		return 1;
+	}
+	uint8_t result = fuota_mem_apply(old_img, patch, new_img);
+	if (result != FUOTA_OK)
+	{
+		fprintf(stderr, "%s: %s\n", patch_path, result_name(result));
+		return 1;
+	}
+	printf("new %zu bytes\n", new_img.size());
+	return fuota_save(new_path, new_img) ? 0 : 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s old.bin new.bin out.patch     make a patch\n"
+			"       %s -a old.bin in.patch new.bin   apply a patch\n",
+			name, name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 5 && std::string(argv[1]) == "-a")
+	{
+		return apply_patch(argv[2], argv[3], argv[4]);
+	}
+	if (argc != 4 || argv[1][0] == '-')
+	{
+		usage(argv[0]);
+	}
+	return make_patch(argv[1], argv[2], argv[3]);
+}
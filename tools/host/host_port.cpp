@@ -0,0 +1,298 @@
+/**
+ * @file host_port.cpp
+ * @brief Implementation of the host (Linux) stand-ins in tools/host/shim
+ *        Link this together with the sources from src/ that a host tool needs.
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <SparkFun_SHTC3.h>
+#include <SparkFunLIS3DH.h>
+#include <WisBlock-API.h>
+#include <InternalFileSystem.h>
+#include <flash/flash_nrf5x.h>
+
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+bool host_verbose = false;
+bool host_virtual_time = false;
+uint64_t host_virtual_us = 0;
+
+HardwareSerial Serial(STDOUT_FILENO);
+HardwareSerial Serial1;
+TwoWire Wire;
+host_shtc3_s host_shtc3 = {false, 0.0f, 0.0f};
+std::map<std::string, std::vector<uint8_t>> host_flash;
+InternalFileSystem InternalFS;
+std::vector<uint8_t> host_nvm(HOST_NVM_SIZE, 0xFF);
+host_lis3dh_s host_lis3dh = {false, {0, 0, 1000}, {{0}}, 0, 0};
+BLEUart g_ble_uart;
+bool g_ble_uart_is_connected = false;
+
+bool host_i2c_ack(uint8_t address)
+{
+	switch (address)
+	{
+	case 0x70:
+		return host_shtc3.present;
+	case 0x18:
+		return host_lis3dh.present;
+	default:
+		return false;
+	}
+}
+
+static uint8_t pin_state[64];
+static void (*pin_handler[64])(void);
+
+static const std::chrono::steady_clock::time_point boot_time = std::chrono::steady_clock::now();
+
+uint32_t millis(void)
+{
+	if (host_virtual_time)
+	{
+		return (uint32_t)(host_virtual_us / 1000);
+	}
+	return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
+
+uint32_t micros(void)
+{
+	if (host_virtual_time)
+	{
+		return (uint32_t)host_virtual_us;
+	}
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
+
+void delay(uint32_t ms)
+{
+	if (host_virtual_time)
+	{
+		host_virtual_us += (uint64_t)ms * 1000;
+		return;
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	if (host_virtual_time)
+	{
+		host_virtual_us += us;
+		return;
+	}
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint32_t pin, uint32_t mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void digitalWrite(uint32_t pin, uint32_t val)
+{
+	pin_state[pin & 63] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint32_t pin)
+{
+	return pin_state[pin & 63];
+}
+
+void attachInterrupt(uint32_t pin, void (*handler)(void), uint32_t mode)
+{
+	(void)mode;
+	pin_handler[pin & 63] = handler;
+}
+
+void detachInterrupt(uint32_t pin)
+{
+	pin_handler[pin & 63] = NULL;
+}
+
+void host_interrupt(uint32_t pin)
+{
+	if (pin_handler[pin & 63])
+	{
+		pin_handler[pin & 63]();
+	}
+}
+
+int host_printf(const char *fmt, ...)
+{
+	if (!host_verbose)
+	{
+		return 0;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int n = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return n;
+}
+
+int Print::printf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (n > 0)
+	{
+		write((const uint8_t *)buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+	}
+	return n;
+}
+
+int flash_nrf5x_write(uint32_t dst, void const *src, int len)
+{
+	if (len < 0 || dst + (uint32_t)len > HOST_NVM_SIZE)
+	{
+		return 0;
+	}
+	memcpy(&host_nvm[dst], src, len);
+	return len;
+}
+
+int flash_nrf5x_read(void *dst, uint32_t src, int len)
+{
+	if (len < 0 || src + (uint32_t)len > HOST_NVM_SIZE)
+	{
+		return 0;
+	}
+	memcpy(dst, &host_nvm[src], len);
+	return len;
+}
+
+bool flash_nrf5x_erase(uint32_t addr)
+{
+	if (addr >= HOST_NVM_SIZE)
+	{
+		return false;
+	}
+	addr &= ~(uint32_t)(HOST_NVM_PAGE - 1);
+	memset(&host_nvm[addr], 0xFF, HOST_NVM_PAGE);
+	return true;
+}
+
+void flash_nrf5x_flush(void) {}
+
+void HardwareSerial::begin(uint32_t baud)
+{
+	(void)baud;
+	_open = true;
+	_peek = -1;
+	if (_fd >= 0 && isatty(_fd))
+	{
+		// Raw 8N1, the baudrate of a pty has no effect
+		struct termios tio;
+		if (tcgetattr(_fd, &tio) == 0)
+		{
+			cfmakeraw(&tio);
+			tcsetattr(_fd, TCSANOW, &tio);
+		}
+		fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+	}
+}
+
+int HardwareSerial::available(void)
+{
+	if (_open && _peer)
+	{
+		return _peer->available() + (_peek >= 0 ? 1 : 0);
+	}
+	if (!_open || _fd < 0)
+	{
+		return 0;
+	}
+	int pending = 0;
+	if (ioctl(_fd, FIONREAD, &pending) < 0)
+	{
+		pending = 0;
+	}
+	return pending + (_peek >= 0 ? 1 : 0);
+}
+
+int HardwareSerial::peek(void)
+{
+	if (_peek < 0)
+	{
+		_peek = read();
+	}
+	return _peek;
+}
+
+int HardwareSerial::read(void)
+{
+	if (_peek >= 0)
+	{
+		int c = _peek;
+		_peek = -1;
+		return c;
+	}
+	if (_open && _peer)
+	{
+		return _peer->read();
+	}
+	if (!_open || _fd < 0)
+	{
+		return -1;
+	}
+	uint8_t c;
+	return (::read(_fd, &c, 1) == 1) ? c : -1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+	if (_out_fd >= 0)
+	{
+		// USB console
+		return host_verbose ? (size_t)::write(_out_fd, buffer, size) : size;
+	}
+	if (_open && _peer)
+	{
+		_peer->receive(buffer, size);
+		return size;
+	}
+	if (!_open || _fd < 0)
+	{
+		return size;
+	}
+	size_t done = 0;
+	while (done < size)
+	{
+		ssize_t n = ::write(_fd, buffer + done, size - done);
+		if (n > 0)
+		{
+			done += n;
+		}
+		else
+		{
+			struct pollfd pfd = {_fd, POLLOUT, 0};
+			if (poll(&pfd, 1, 100) <= 0)
+			{
+				break;
+			}
+		}
+	}
+	return done;
+}
+
+void HardwareSerial::flush(void)
+{
+	if (_open && _fd >= 0 && isatty(_fd))
+	{
+		tcdrain(_fd);
+	}
+}
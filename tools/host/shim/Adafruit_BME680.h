@@ -0,0 +1,13 @@
+/**
+ * @file Adafruit_BME680.h
+ * @brief Host stand-in, app.h includes it unconditionally
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef HOST_ADAFRUIT_BME680_H
+#define HOST_ADAFRUIT_BME680_H
+
+#include <Adafruit_Sensor.h>
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * @file Adafruit_LittleFS.h
+ * @brief Host stand-in for the LittleFS wrapper of the Adafruit nRF52 core
+ *        Files live in host_flash (host_port.cpp), in memory, one flash
+ *        for the whole process.
+ * @version 0.1
+ * @date 2022-11-12
+ */
+
+#ifndef HOST_ADAFRUIT_LITTLEFS_H
+#define HOST_ADAFRUIT_LITTLEFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/** The simulated flash, file name to content */
+extern std::map<std::string, std::vector<uint8_t>> host_flash;
+
+class Adafruit_LittleFS
+{
+public:
+	bool begin(void) { return true; }
+	bool exists(const char *path) { return host_flash.count(path) != 0; }
+	bool remove(const char *path) { return host_flash.erase(path) != 0; }
+	bool rename(const char *from, const char *to)
+	{
+		auto it = host_flash.find(from);
+		if (it == host_flash.end())
+		{
+			return false;
+		}
+		host_flash[to] = it->second;
+		host_flash.erase(from);
+		return true;
+	}
+};
+
+namespace Adafruit_LittleFS_Namespace
+{
+#define FILE_O_READ 0
+#define FILE_O_WRITE 1
+
+	class File
+	{
+	public:
+		File(Adafruit_LittleFS &fs) { (void)fs; }
+		bool open(const char *path, uint8_t mode)
+		{
+			if (mode == FILE_O_READ && !host_flash.count(path))
+			{
+				return false;
+			}
+			_path = path;
+			_pos = mode == FILE_O_READ ? 0 : host_flash[path].size();
+			_open = true;
+			return true;
+		}
+		int read(void *buf, uint16_t nbyte)
+		{
+			if (!_open)
+			{
+				return -1;
+			}
+			std::vector<uint8_t> &data = host_flash[_path];
+			size_t n = _pos + nbyte > data.size() ? data.size() - _pos : nbyte;
+			memcpy(buf, data.data() + _pos, n);
+			_pos += n;
+			return (int)n;
+		}
+		size_t write(const uint8_t *buf, size_t size)
+		{
+			if (!_open)
+			{
+				return 0;
+			}
+			std::vector<uint8_t> &data = host_flash[_path];
+			data.insert(data.end(), buf, buf + size);
+			_pos = data.size();
+			return size;
+		}
+		uint32_t size(void) { return _open ? (uint32_t)host_flash[_path].size() : 0; }
+		void close(void) { _open = false; }
+		operator bool(void) { return _open; }
+
+	private:
+		std::string _path;
+		size_t _pos = 0;
+		bool _open = false;
+	};
+}
+
+#endif
@@ -0,0 +1,13 @@
+/**
+ * @file Adafruit_Sensor.h
+ * @brief Host stand-in, app.h includes it unconditionally
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef HOST_ADAFRUIT_SENSOR_H
+#define HOST_ADAFRUIT_SENSOR_H
+
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * @file Arduino.h
+ * @brief Host (Linux) stand-in for the Arduino core
+ *        Only what the application sources in src/ use. Serial ports can be
+ *        attached to a file descriptor (pty, pipe) or to an in-process
+ *        device model (HostUartPeer). Time is the wall clock, or a virtual
+ *        clock that only delay() advances when host_virtual_time is set.
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+
+#define LED_GREEN 35
+#define LED_BLUE 36
+#define PIN_WIRE_SDA 13
+#define PIN_WIRE_SCL 14
+#define WB_IO1 17
+#define WB_IO2 34
+#define WB_IO3 21
+#define WB_IO4 4
+#define WB_IO5 9
+#define WB_IO6 10
+#define WB_A0 5
+
+#define lowWord(w) ((uint16_t)((w)&0xffff))
+#define highWord(w) ((uint16_t)((w) >> 16))
+#define lowByte(w) ((uint8_t)((w)&0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+/** Time base, see host_port.cpp */
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+/** Host only: virtual clock, simulators set host_virtual_time and drive host_virtual_us */
+extern bool host_virtual_time;
+extern uint64_t host_virtual_us;
+
+/** GPIO, the pin state is only remembered */
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t val);
+int digitalRead(uint32_t pin);
+
+/** Interrupts are only called by host_interrupt() */
+void attachInterrupt(uint32_t pin, void (*handler)(void), uint32_t mode);
+void detachInterrupt(uint32_t pin);
+/** Host only: raise the interrupt of a pin */
+void host_interrupt(uint32_t pin);
+
+/** Log output of the host build, silent unless host_verbose is set */
+extern bool host_verbose;
+int host_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define PRINTF host_printf
+
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size)
+	{
+		size_t n = 0;
+		while (size--)
+		{
+			n += write(*buffer++);
+		}
+		return n;
+	}
+	size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+	size_t print(const char *str) { return write(str); }
+	size_t println(const char *str = "")
+	{
+		size_t n = write(str);
+		return n + write("\r\n");
+	}
+	int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+	virtual int available(void) = 0;
+	virtual int read(void) = 0;
+	virtual int peek(void) = 0;
+	virtual void flush(void) {}
+};
+
+/**
+ * @brief Host only: a device on the other end of a UART, modelled in-process
+ *        The model decides when bytes arrive, usually from host_virtual_us.
+ */
+class HostUartPeer
+{
+public:
+	virtual ~HostUartPeer() {}
+	/** Bytes the MCU sent */
+	virtual void receive(const uint8_t *buffer, size_t size) = 0;
+	/** Bytes ready for the MCU */
+	virtual int available(void) = 0;
+	virtual int read(void) = 0;
+};
+
+/**
+ * @brief UART stand-in
+ *        Unattached ports swallow output and never receive anything,
+ *        attached ports read and write the given file descriptor or peer.
+ *        Like the Adafruit core the port is always true, open or not.
+ */
+class HardwareSerial : public Stream
+{
+public:
+	HardwareSerial(int out_fd = -1) : _fd(-1), _out_fd(out_fd), _peek(-1), _open(false), _peer(NULL) {}
+	void begin(uint32_t baud);
+	void end(void) { _open = false; }
+	operator bool() const { return true; }
+
+	int available(void) override;
+	int read(void) override;
+	int peek(void) override;
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t *buffer, size_t size) override;
+	using Print::write;
+	void flush(void) override;
+
+	/** Host only: connect the port to a file descriptor */
+	void attach(int fd) { _fd = fd; }
+	/** Host only: connect the port to a device model */
+	void attach(HostUartPeer *peer) { _peer = peer; }
+
+private:
+	int _fd;
+	int _out_fd;
+	int _peek;
+	bool _open;
+	HostUartPeer *_peer;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * @file InternalFileSystem.h
+ * @brief Host stand-in for InternalFS of the Adafruit nRF52 core, see Adafruit_LittleFS.h
+ * @version 0.1
+ * @date 2022-11-12
+ */
+
+#ifndef HOST_INTERNALFILESYSTEM_H
+#define HOST_INTERNALFILESYSTEM_H
+
+#include "Adafruit_LittleFS.h"
+
+class InternalFileSystem : public Adafruit_LittleFS
+{
+};
+
+extern InternalFileSystem InternalFS;
+
+#endif
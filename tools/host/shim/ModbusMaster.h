@@ -0,0 +1,215 @@
+/**
+ * @file ModbusMaster.h
+ * @brief Host stand-in for 4-20ma/ModbusMaster
+ *        Same API subset and the same transaction state machine as the
+ *        library (flush RX, send ADU, collect reply byte by byte, 2000 ms
+ *        response timeout, CRC check), so a host build of
+ *        src/renogy_rs232.cpp sees the controller the way the node does.
+ *        Every transaction is counted in host_modbus_stats.
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef HOST_MODBUSMASTER_H
+#define HOST_MODBUSMASTER_H
+
+#include <Arduino.h>
+
+/** Per result code transaction counters, host only */
+struct host_modbus_stats_s
+{
+	uint32_t transactions = 0;
+	uint32_t result[256] = {0};
+	uint64_t busy_us = 0;
+};
+inline host_modbus_stats_s host_modbus_stats;
+
+class ModbusMaster
+{
+public:
+	static const uint8_t ku8MBIllegalFunction = 0x01;
+	static const uint8_t ku8MBIllegalDataAddress = 0x02;
+	static const uint8_t ku8MBIllegalDataValue = 0x03;
+	static const uint8_t ku8MBSlaveDeviceFailure = 0x04;
+	static const uint8_t ku8MBSuccess = 0x00;
+	static const uint8_t ku8MBInvalidSlaveID = 0xE0;
+	static const uint8_t ku8MBInvalidFunction = 0xE1;
+	static const uint8_t ku8MBResponseTimedOut = 0xE2;
+	static const uint8_t ku8MBInvalidCRC = 0xE3;
+
+	void begin(uint8_t slave, Stream &serial)
+	{
+		_slave = slave;
+		_serial = &serial;
+	}
+	void idle(void (*cb)()) { _idle = cb; }
+	void preTransmission(void (*cb)()) { _pre = cb; }
+	void postTransmission(void (*cb)()) { _post = cb; }
+
+	uint16_t getResponseBuffer(uint8_t index) { return index < ku8MaxBufferSize ? _rsp[index] : 0xFFFF; }
+	void clearResponseBuffer(void) { memset(_rsp, 0, sizeof(_rsp)); }
+	uint8_t setTransmitBuffer(uint8_t index, uint16_t value)
+	{
+		if (index >= ku8MaxBufferSize)
+		{
+			return ku8MBIllegalDataAddress;
+		}
+		_tx[index] = value;
+		return ku8MBSuccess;
+	}
+	void clearTransmitBuffer(void) { memset(_tx, 0, sizeof(_tx)); }
+
+	uint8_t readHoldingRegisters(uint16_t addr, uint16_t qty)
+	{
+		_addr = addr;
+		_qty = qty;
+		return transaction(ku8MBReadHoldingRegisters);
+	}
+	uint8_t writeSingleRegister(uint16_t addr, uint16_t value)
+	{
+		_addr = addr;
+		_qty = 0;
+		_tx[0] = value;
+		return transaction(ku8MBWriteSingleRegister);
+	}
+
+private:
+	static const uint8_t ku8MaxBufferSize = 64;
+	static const uint16_t ku16MBResponseTimeout = 2000;
+	static const uint8_t ku8MBReadHoldingRegisters = 0x03;
+	static const uint8_t ku8MBWriteSingleRegister = 0x06;
+
+	Stream *_serial = nullptr;
+	uint8_t _slave = 1;
+	uint16_t _addr = 0;
+	uint16_t _qty = 0;
+	uint16_t _tx[ku8MaxBufferSize] = {0};
+	uint16_t _rsp[ku8MaxBufferSize] = {0};
+	void (*_idle)() = nullptr;
+	void (*_pre)() = nullptr;
+	void (*_post)() = nullptr;
+
+	static uint16_t crc16(const uint8_t *buf, size_t len)
+	{
+		uint16_t crc = 0xFFFF;
+		for (size_t i = 0; i < len; i++)
+		{
+			crc ^= buf[i];
+			for (int b = 0; b < 8; b++)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+			}
+		}
+		return crc;
+	}
+
+	uint8_t transaction(uint8_t function)
+	{
+		uint8_t adu[256];
+		uint8_t size = 0;
+		uint8_t left = 8;
+		uint8_t status = ku8MBSuccess;
+		uint32_t start_us = micros();
+
+		adu[size++] = _slave;
+		adu[size++] = function;
+		adu[size++] = highByte(_addr);
+		adu[size++] = lowByte(_addr);
+		if (function == ku8MBReadHoldingRegisters)
+		{
+			adu[size++] = highByte(_qty);
+			adu[size++] = lowByte(_qty);
+		}
+		else
+		{
+			adu[size++] = highByte(_tx[0]);
+			adu[size++] = lowByte(_tx[0]);
+		}
+		uint16_t crc = crc16(adu, size);
+		adu[size++] = lowByte(crc);
+		adu[size++] = highByte(crc);
+
+		// Flush receive buffer before transmitting request
+		while (_serial->read() != -1)
+		{
+		}
+		if (_pre)
+		{
+			_pre();
+		}
+		_serial->write(adu, size);
+		_serial->flush();
+		if (_post)
+		{
+			_post();
+		}
+
+		size = 0;
+		uint32_t start = millis();
+		while (left && !status)
+		{
+			if (_serial->available())
+			{
+				adu[size++] = (uint8_t)_serial->read();
+				left--;
+			}
+			else if (_idle)
+			{
+				_idle();
+			}
+			else
+			{
+				delayMicroseconds(50);
+			}
+
+			// Evaluate slave ID, function code once enough bytes have been read
+			if (size == 5)
+			{
+				if (adu[0] != _slave)
+				{
+					status = ku8MBInvalidSlaveID;
+					break;
+				}
+				if ((adu[1] & 0x7F) != function)
+				{
+					status = ku8MBInvalidFunction;
+					break;
+				}
+				if (adu[1] & 0x80)
+				{
+					status = adu[2];
+					break;
+				}
+				left = (function == ku8MBReadHoldingRegisters) ? adu[2] : 3;
+			}
+			if ((millis() - start) > ku16MBResponseTimeout)
+			{
+				status = ku8MBResponseTimedOut;
+			}
+		}
+
+		if (!status && size >= 5)
+		{
+			crc = crc16(adu, size - 2);
+			if (lowByte(crc) != adu[size - 2] || highByte(crc) != adu[size - 1])
+			{
+				status = ku8MBInvalidCRC;
+			}
+		}
+
+		if (!status && function == ku8MBReadHoldingRegisters)
+		{
+			for (uint8_t i = 0; i < (adu[2] >> 1) && i < ku8MaxBufferSize; i++)
+			{
+				_rsp[i] = (adu[2 * i + 3] << 8) | adu[2 * i + 4];
+			}
+		}
+
+		host_modbus_stats.transactions++;
+		host_modbus_stats.result[status]++;
+		host_modbus_stats.busy_us += micros() - start_us;
+		return status;
+	}
+};
+
+#endif
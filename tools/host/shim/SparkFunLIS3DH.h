@@ -0,0 +1,107 @@
+/**
+ * @file SparkFunLIS3DH.h
+ * @brief Host stand-in for sparkfun/SparkFun_LIS3DH_Arduino_Library
+ *        Absent unless host_lis3dh.present is set. The output registers
+ *        return host_lis3dh.rest (gravity) until samples are queued in
+ *        host_lis3dh.fifo, FIFO_SRC reports the queued samples.
+ * @version 0.1
+ * @date 2022-10-29
+ */
+
+#ifndef HOST_SPARKFUNLIS3DH_H
+#define HOST_SPARKFUNLIS3DH_H
+
+#include <Wire.h>
+
+#define LIS3DH_WHO_AM_I 0x0F
+#define LIS3DH_CTRL_REG1 0x20
+#define LIS3DH_CTRL_REG2 0x21
+#define LIS3DH_CTRL_REG3 0x22
+#define LIS3DH_CTRL_REG4 0x23
+#define LIS3DH_CTRL_REG5 0x24
+#define LIS3DH_CTRL_REG6 0x25
+#define LIS3DH_REFERENCE 0x26
+#define LIS3DH_OUT_X_L 0x28
+#define LIS3DH_FIFO_CTRL_REG 0x2E
+#define LIS3DH_FIFO_SRC_REG 0x2F
+#define LIS3DH_INT1_CFG 0x30
+#define LIS3DH_INT1_SRC 0x31
+#define LIS3DH_INT1_THS 0x32
+#define LIS3DH_INT1_DURATION 0x33
+
+typedef enum
+{
+	IMU_SUCCESS,
+	IMU_HW_ERROR,
+	IMU_NOT_SUPPORTED,
+	IMU_GENERIC_ERROR,
+	IMU_OUT_OF_BOUNDS,
+	IMU_ALL_ONES_WARNING,
+} status_t;
+
+typedef enum
+{
+	I2C_MODE,
+	SPI_MODE
+} interface_mode_t;
+
+/** The simulated sensor in mg, see host_port.cpp */
+struct host_lis3dh_s
+{
+	bool present;
+	int16_t rest[3];
+	int16_t fifo[32][3];
+	uint8_t fifo_level; // samples queued
+	uint8_t fifo_read;	// next sample to read
+};
+extern host_lis3dh_s host_lis3dh;
+
+class LIS3DH
+{
+public:
+	LIS3DH(interface_mode_t mode = I2C_MODE, uint8_t address = 0x19)
+	{
+		(void)mode;
+		(void)address;
+	}
+	status_t begin(void) { return host_lis3dh.present ? IMU_SUCCESS : IMU_HW_ERROR; }
+	status_t writeRegister(uint8_t offset, uint8_t data)
+	{
+		(void)offset;
+		(void)data;
+		return host_lis3dh.present ? IMU_SUCCESS : IMU_HW_ERROR;
+	}
+	status_t readRegister(uint8_t *out, uint8_t offset)
+	{
+		*out = 0;
+		if (offset == LIS3DH_FIFO_SRC_REG)
+		{
+			*out = host_lis3dh.fifo_level >= 32 ? 0x40 : host_lis3dh.fifo_level;
+		}
+		return host_lis3dh.present ? IMU_SUCCESS : IMU_HW_ERROR;
+	}
+	status_t readRegisterRegion(uint8_t *out, uint8_t offset, uint8_t length)
+	{
+		memset(out, 0, length);
+		if (offset != LIS3DH_OUT_X_L || length != 6)
+		{
+			return IMU_NOT_SUPPORTED;
+		}
+		const int16_t *mg = host_lis3dh.rest;
+		if (host_lis3dh.fifo_level > 0)
+		{
+			mg = host_lis3dh.fifo[host_lis3dh.fifo_read++ & 31];
+			host_lis3dh.fifo_level--;
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// Left aligned 10 bit, 16 mg/digit at +/-8g
+			int16_t raw = (int16_t)((mg[axis] / 16) * 64);
+			out[2 * axis] = (uint8_t)raw;
+			out[2 * axis + 1] = (uint8_t)(raw >> 8);
+		}
+		return host_lis3dh.present ? IMU_SUCCESS : IMU_HW_ERROR;
+	}
+};
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file SparkFun_SHTC3.h
+ * @brief Host stand-in for sparkfun/SparkFun_SHTC3_Arduino_Library
+ *        Absent unless host_shtc3.present is set, then it reads back
+ *        host_shtc3.temp_c and host_shtc3.humidity as raw ticks, converted
+ *        with the library's formulas.
+ * @version 0.1
+ * @date 2022-10-29
+ */
+
+#ifndef HOST_SPARKFUN_SHTC3_H
+#define HOST_SPARKFUN_SHTC3_H
+
+#include <Wire.h>
+
+typedef enum
+{
+	SHTC3_Status_Nominal = 0,
+	SHTC3_Status_Error,
+	SHTC3_Status_CRC_Fail,
+	SHTC3_Status_ID_Fail
+} SHTC3_Status_TypeDef;
+
+/** The simulated sensor, see host_port.cpp */
+struct host_shtc3_s
+{
+	bool present;
+	float temp_c;
+	float humidity;
+};
+extern host_shtc3_s host_shtc3;
+
+class SHTC3
+{
+public:
+	SHTC3_Status_TypeDef lastStatus = SHTC3_Status_Error;
+	bool passIDcrc = false;
+	bool passRHcrc = false;
+	bool passTcrc = false;
+	uint16_t ID = 0;
+	uint16_t RH = 0;
+	uint16_t T = 0;
+
+	SHTC3_Status_TypeDef begin(TwoWire &wirePort = Wire)
+	{
+		(void)wirePort;
+		passIDcrc = host_shtc3.present;
+		ID = host_shtc3.present ? 0x0807 : 0;
+		lastStatus = host_shtc3.present ? SHTC3_Status_Nominal : SHTC3_Status_Error;
+		return lastStatus;
+	}
+	SHTC3_Status_TypeDef update(void)
+	{
+		passRHcrc = passTcrc = host_shtc3.present;
+		T = ticks((host_shtc3.temp_c + 45.0f) / 175.0f);
+		RH = ticks(host_shtc3.humidity / 100.0f);
+		lastStatus = host_shtc3.present ? SHTC3_Status_Nominal : SHTC3_Status_Error;
+		return lastStatus;
+	}
+	float toDegC(void) { return -45 + 175 * ((float)T / 65535); }
+	float toPercent(void) { return 100 * ((float)RH / 65535); }
+
+private:
+	static uint16_t ticks(float share)
+	{
+		share = share < 0.0f ? 0.0f : (share > 1.0f ? 1.0f : share);
+		return (uint16_t)(share * 65535 + 0.5f);
+	}
+};
+
+#endif
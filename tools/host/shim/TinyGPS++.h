@@ -0,0 +1,85 @@
+/**
+ * @file TinyGPS++.h
+ * @brief Host stand-in for mikalhart/TinyGPSPlus
+ *        app.h includes it unconditionally, the host builds run without GNSS:
+ *        encode() never completes a sentence, location, altitude, date and
+ *        time stay invalid.
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef HOST_TINYGPSPLUS_H
+#define HOST_TINYGPSPLUS_H
+
+#include <Arduino.h>
+
+struct RawDegrees
+{
+	uint16_t deg = 0;
+	uint32_t billionths = 0;
+	bool negative = false;
+};
+
+class TinyGPSLocation
+{
+public:
+	bool isValid(void) const { return false; }
+	bool isUpdated(void) const { return false; }
+	const RawDegrees &rawLat(void) const { return _lat; }
+	const RawDegrees &rawLng(void) const { return _lng; }
+	double lat(void) const { return 0.0; }
+	double lng(void) const { return 0.0; }
+
+private:
+	RawDegrees _lat;
+	RawDegrees _lng;
+};
+
+class TinyGPSAltitude
+{
+public:
+	bool isValid(void) const { return false; }
+	bool isUpdated(void) const { return false; }
+	int32_t value(void) const { return 0; }
+	double meters(void) const { return 0.0; }
+};
+
+class TinyGPSDate
+{
+public:
+	bool isValid(void) const { return false; }
+	bool isUpdated(void) const { return false; }
+	uint32_t age(void) const { return 0xFFFFFFFF; }
+	uint16_t year(void) const { return 2000; }
+	uint8_t month(void) const { return 0; }
+	uint8_t day(void) const { return 0; }
+};
+
+class TinyGPSTime
+{
+public:
+	bool isValid(void) const { return false; }
+	bool isUpdated(void) const { return false; }
+	uint32_t age(void) const { return 0xFFFFFFFF; }
+	uint8_t hour(void) const { return 0; }
+	uint8_t minute(void) const { return 0; }
+	uint8_t second(void) const { return 0; }
+	uint8_t centisecond(void) const { return 0; }
+};
+
+class TinyGPSPlus
+{
+public:
+	TinyGPSLocation location;
+	TinyGPSAltitude altitude;
+	TinyGPSDate date;
+	TinyGPSTime time;
+
+	bool encode(char c)
+	{
+		(void)c;
+		return false;
+	}
+};
+
+#endif
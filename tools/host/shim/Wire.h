@@ -0,0 +1,53 @@
+/**
+ * @file Wire.h
+ * @brief Host stand-in for the Arduino I2C driver
+ *        Only the simulated sensors that are present ACK their address
+ *        (host_i2c_ack() in host_port.cpp), no transaction returns data.
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include <Arduino.h>
+
+/** A simulated sensor is present at address */
+bool host_i2c_ack(uint8_t address);
+
+class TwoWire : public Stream
+{
+public:
+	void begin(void) {}
+	void end(void) {}
+	void setClock(uint32_t clock) { (void)clock; }
+	void beginTransmission(uint8_t address) { tx_address = address; }
+	uint8_t endTransmission(bool stop = true)
+	{
+		(void)stop;
+		return host_i2c_ack(tx_address) ? 0 : 2; // 2: address NAK
+	}
+	uint8_t requestFrom(uint8_t address, size_t len, bool stop = true)
+	{
+		(void)address;
+		(void)len;
+		(void)stop;
+		return 0;
+	}
+	size_t write(uint8_t c) override
+	{
+		(void)c;
+		return 1;
+	}
+	using Print::write;
+	int available(void) override { return 0; }
+	int read(void) override { return -1; }
+	int peek(void) override { return -1; }
+
+private:
+	uint8_t tx_address = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * @file WisBlock-API.h
+ * @brief Host stand-in for beegee-tokyo/WisBlock-API
+ *        Globals, types and calls the application sources in src/
+ *        reference. The LoRaWAN, BLE and timer calls are implemented by the
+ *        host tool that runs the application (see tools/fleet_sim).
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef HOST_WISBLOCK_API_H
+#define HOST_WISBLOCK_API_H
+
+#include <Arduino.h>
+
+/** LoRaMac data rates */
+#define DR_0 0
+#define DR_1 1
+#define DR_2 2
+#define DR_3 3
+#define DR_4 4
+
+#define TX_POWER_0 0
+#define CLASS_A 0
+#define CLASS_C 2
+#define LMH_UNCONFIRMED_MSG 0
+#define LMH_CONFIRMED_MSG 1
+#define LORAMAC_REGION_US915 8
+#define LORAWAN_APP_PORT 2
+
+/** App task wake up reasons */
+#define STATUS 0b0000000000000001
+#define N_STATUS 0b1111111111111110
+#define BLE_CONFIG 0b0000000000000010
+#define N_BLE_CONFIG 0b1111111111111101
+#define BLE_DATA 0b0000000000000100
+#define N_BLE_DATA 0b1111111111111011
+#define LORA_DATA 0b0000000000001000
+#define N_LORA_DATA 0b1111111111110111
+#define LORA_TX_FIN 0b0000000000010000
+#define N_LORA_TX_FIN 0b1111111111101111
+#define AT_CMD 0b0000000000100000
+#define N_AT_CMD 0b1111111111011111
+#define LORA_JOIN_FIN 0b0000000001000000
+#define N_LORA_JOIN_FIN 0b1111111110111111
+
+typedef enum
+{
+	LMH_SUCCESS = 0,
+	LMH_BUSY = -1,
+	LMH_ERROR = -2,
+} lmh_error_status;
+
+struct s_lorawan_settings
+{
+	uint8_t valid_mark_1 = 0xAA;
+	uint8_t valid_mark_2 = 0x55;
+	uint8_t node_device_eui[8] = {0};
+	uint8_t node_app_eui[8] = {0};
+	uint8_t node_app_key[16] = {0};
+	uint32_t node_dev_addr = 0;
+	uint8_t node_nws_key[16] = {0};
+	uint8_t node_apps_key[16] = {0};
+	bool otaa_enabled = true;
+	bool adr_enabled = false;
+	bool public_network = true;
+	bool duty_cycle_enabled = false;
+	uint32_t send_repeat_time = 120000;
+	uint8_t join_trials = 5;
+	uint8_t tx_power = TX_POWER_0;
+	uint8_t data_rate = DR_3;
+	uint8_t lora_class = CLASS_A;
+	uint8_t subband_channels = 1;
+	bool auto_join = false;
+	uint8_t app_port = LORAWAN_APP_PORT;
+	uint8_t confirmed_msg_enabled = LMH_UNCONFIRMED_MSG;
+	bool resetRequest = true;
+	bool lorawan_enable = true;
+	uint8_t lora_region = LORAMAC_REGION_US915;
+};
+
+/** BLE UART, never connected on the host */
+class BLEUart : public Print
+{
+public:
+	size_t write(uint8_t c) override
+	{
+		(void)c;
+		return 1;
+	}
+	using Print::write;
+	int available(void) { return 0; }
+	int read(void) { return -1; }
+};
+
+typedef void *TimerHandle_t;
+
+/**
+ * @brief FreeRTOS software timer of the Adafruit nRF52 core
+ *        start() and stop() go to the host tool, host_timer_start/stop()
+ */
+class SoftwareTimer;
+void host_timer_start(SoftwareTimer *timer);
+void host_timer_stop(SoftwareTimer *timer);
+
+class SoftwareTimer
+{
+public:
+	void begin(uint32_t ms, void (*callback)(TimerHandle_t), void *timerID = NULL, bool repeating = true)
+	{
+		(void)timerID;
+		period = ms;
+		cb = callback;
+		repeat = repeating;
+	}
+	void setPeriod(uint32_t ms) { period = ms; }
+	void start(void) { host_timer_start(this); }
+	void stop(void) { host_timer_stop(this); }
+
+	uint32_t period = 0;
+	void (*cb)(TimerHandle_t) = NULL;
+	bool repeat = true;
+};
+
+extern BLEUart g_ble_uart;
+extern bool g_ble_uart_is_connected;
+
+/** API state, see tools/fleet_sim/wisblock_state.cpp */
+extern s_lorawan_settings g_lorawan_settings;
+extern volatile uint16_t g_task_event_type;
+extern bool g_enable_ble;
+extern bool g_join_result;
+extern bool g_rx_fin_result;
+extern uint8_t g_rx_lora_data[256];
+extern uint8_t g_rx_data_len;
+extern int16_t g_last_rssi;
+extern int8_t g_last_snr;
+extern uint8_t g_last_fport;
+
+/** API calls */
+void api_wake_loop(uint16_t reason);
+void api_timer_restart(uint32_t new_time);
+void api_set_version(uint16_t sw_1, uint16_t sw_2, uint16_t sw_3);
+void api_read_credentials(void);
+void api_set_credentials(void);
+void api_reset(void);
+void restart_advertising(uint16_t timeout);
+void at_serial_input(uint8_t cmd);
+float read_batt(void);
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport = 0);
+
+/** LoRaMac helper of SX126x-Arduino */
+typedef uint8_t DeviceClass_t;
+lmh_error_status lmh_class_request(DeviceClass_t new_class);
+
+#endif
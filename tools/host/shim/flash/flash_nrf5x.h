@@ -0,0 +1,27 @@
+/**
+ * @file flash_nrf5x.h
+ * @brief Host stand-in for the internal flash access of the Adafruit nRF52 core
+ *        The whole 1 MB flash is host_nvm (host_port.cpp), erased at start.
+ *        The core writes through a one page cache that erases as needed, so
+ *        a write simply overwrites here.
+ * @version 0.1
+ * @date 2022-12-10
+ */
+
+#ifndef HOST_FLASH_NRF5X_H
+#define HOST_FLASH_NRF5X_H
+
+#include <stdint.h>
+#include <vector>
+
+#define HOST_NVM_SIZE 0x100000
+#define HOST_NVM_PAGE 4096
+
+extern std::vector<uint8_t> host_nvm;
+
+int flash_nrf5x_write(uint32_t dst, void const *src, int len);
+int flash_nrf5x_read(void *dst, uint32_t src, int len);
+bool flash_nrf5x_erase(uint32_t addr);
+void flash_nrf5x_flush(void);
+
+#endif
@@ -0,0 +1,1020 @@
+/**
+ * @file ingest.cpp
+ * @brief Telemetry ingest and query service for the uplinks of this firmware
+ *        Decodes uplinks with tools/decoder/uplink_decoder.h, expands batch
+ *        frames (fPort LORAWAN_BATCH_PORT) with src/batch_codec.h and appends
+ *        every channel to the store of ts_store.h: one memory-mapped column
+ *        per field, time partitioned segments, min/max/sum block index.
+ *
+ *        Uplinks come from archives (see uplink_decoder.h, one node per
+ *        archive), from text lines on stdin or from a local HTTP stand-in for
+ *        the network server integration. A line is
+ *
+ *        node rx_time fport payload_hex
+ *
+ *        so an MQTT subscriber with a format string can be piped in as well.
+ *        HTTP, 127.0.0.1 only: POST /uplink with lines as body,
+ *        GET /query?node=..&field=..[&from=..&to=..&bucket=..|&agg=1]
+ *
+ *        Query results are JSON lines: points, or per bucket count, min, max
+ *        and avg. The benchmark ingests a synthetic fleet and reports
+ *        uplinks/s and the latency of trend and range queries, with and
+ *        without the block index. Ingest goes to the page cache, the kernel
+ *        writes the mapped pages back later, so the rate does not include
+ *        the disk.
+ *
+ *        g++ -std=c++17 -O2 -Isrc -Itools/decoder tools/ingest/ingest.cpp -o ingest
+ *
+ *        ingest -s store [-p days] [-N node] archive...
+ *        ingest -s store -                  lines from stdin
+ *        ingest -s store -l port            HTTP on 127.0.0.1
+ *        ingest -s store -q node field [-f from] [-t to] [-a] [-w bucket]
+ *        ingest -s store -L
+ *        ingest -B [-s store] [-n nodes] [-d days] [-i interval]
+ * @version 0.1
+ * @date 2022-12-24
+ */
+
+#include "batch_codec.h"
+#include "ts_store.h"
+#include "uplink_decoder.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <ftw.h>
+#include <netinet/in.h>
+#include <random>
+#include <signal.h>
+#include <sys/socket.h>
+
+/** fPort of the FUOTA answers, LORAWAN_FUOTA_PORT of the firmware, not telemetry */
+#define FUOTA_PORT 201
+/** fPort of the clock requests, LORAWAN_CLOCK_PORT of the firmware, not telemetry */
+#define CLOCK_PORT 202
+/** Sample time channel, the time of the points instead of a column */
+#define SAMPLE_TIME_CHANNEL 0x1285
+/** Largest HTTP request accepted */
+#define HTTP_MAX (1024 * 1024)
+
+/** An uplink channel and the fields it carries, in column order */
+struct channel_s
+{
+	uint16_t id;
+	uint8_t len;
+	uint8_t fields;
+	uint8_t field[TS_FIELDS_MAX];
+};
+
+static std::vector<channel_s> g_channels;
+/** Index into g_channels by channel id, -1 unknown */
+static int8_t g_channel_index[65536];
+/** Channel and column of every field, channel -1 if no channel has it */
+static int8_t g_field_channel[UF_COUNT];
+static uint8_t g_field_column[UF_COUNT];
+
+static volatile sig_atomic_t g_stop = 0;
+
+struct ingest_stats_s
+{
+	size_t frames = 0;	// uplinks
+	size_t samples = 0; // payloads decoded, batch frames count each sample
+	size_t points = 0;	// values stored
+	size_t skipped = 0; // uplinks without telemetry
+	size_t bad = 0;		// unknown channel, truncated frame or store error
+};
+
+/** A query, from the command line or HTTP */
+struct query_s
+{
+	std::string node;
+	int field = -1;
+	uint32_t from = 0;
+	uint32_t to = UINT32_MAX;
+	bool aggregate = false;
+	uint32_t bucket = 0; // s, 0: one result over the range
+};
+
+/**
+ * @brief Channel table: the decoder is asked which fields a zero payload of every known channel yields
+ */
+static void channels_init(void)
+{
+	memset(g_channel_index, -1, sizeof(g_channel_index));
+	memset(g_field_channel, -1, sizeof(g_field_channel));
+	for (uint32_t id = 0; id < 0x10000; id++)
+	{
+		int len = uplink_channel_len((uint16_t)id);
+		if (len < 0)
+		{
+			continue;
+		}
+		uint8_t buf[2 + 255] = {(uint8_t)(id >> 8), (uint8_t)id};
+		uplink_frame_s f;
+		uplink_decode(buf, (uint8_t)(2 + len), &f);
+		channel_s c = {(uint16_t)id, (uint8_t)len, 0, {0}};
+		for (int field = 0; field < UF_COUNT; field++)
+		{
+			if ((f.present >> field) & 1)
+			{
+				g_field_channel[field] = (int8_t)g_channels.size();
+				g_field_column[field] = c.fields;
+				c.field[c.fields++] = (uint8_t)field;
+			}
+		}
+		g_channel_index[id] = (int8_t)g_channels.size();
+		g_channels.push_back(c);
+	}
+}
+
+/**
+ * @brief Store the channels of one payload
+ *
+ * @param t reception time, the node's sample time replaces it if the payload has one
+ */
+static void ingest_sample(ts_store_s *st, const std::string &node, uint32_t t, const uint8_t *buf, uint8_t len, ingest_stats_s *stats)
+{
+	stats->samples++;
+	for (uint16_t idx = 0; len - idx > 2;)
+	{
+		uint16_t id = uplink_u16(&buf[idx]);
+		int clen = uplink_channel_len(id);
+		if (clen < 0 || idx + 2 + clen > len)
+		{
+			break;
+		}
+		if (id == SAMPLE_TIME_CHANNEL)
+		{
+			t = ((uint32_t)uplink_u16(&buf[idx + 2]) << 16) | uplink_u16(&buf[idx + 4]);
+		}
+		idx += 2 + clen;
+	}
+	uint16_t idx = 0;
+	// Same walk as uplink_decode(), one channel at a time
+	while (len - idx > 2)
+	{
+		int ci = g_channel_index[uplink_u16(&buf[idx])];
+		if (ci < 0 || idx + 2 + g_channels[ci].len > len)
+		{
+			stats->bad++;
+			return;
+		}
+		const channel_s &c = g_channels[ci];
+		if (c.id == SAMPLE_TIME_CHANNEL)
+		{
+			idx += 2 + c.len;
+			continue;
+		}
+		uplink_frame_s f;
+		uplink_decode(&buf[idx], (uint8_t)(2 + c.len), &f);
+		float v[TS_FIELDS_MAX];
+		for (uint8_t col = 0; col < c.fields; col++)
+		{
+			v[col] = (float)f.value[c.field[col]];
+		}
+		if (!ts_store_append(st, node, c.id, c.fields, t, v))
+		{
+			stats->bad++;
+			return;
+		}
+		stats->points += c.fields;
+		idx += 2 + c.len;
+	}
+}
+
+/**
+ * @brief Store one uplink, batch frames sample by sample at their sample time
+ */
+static void ingest_frame(ts_store_s *st, const std::string &node, uint32_t rx_time, uint8_t port, const uint8_t *payload, uint8_t len, ingest_stats_s *stats)
+{
+	static batch_decoder_s d;
+	stats->frames++;
+	if (port == FUOTA_PORT || port == CLOCK_PORT)
+	{
+		stats->skipped++;
+		return;
+	}
+	if (port != LORAWAN_BATCH_PORT)
+	{
+		ingest_sample(st, node, rx_time, payload, len, stats);
+		return;
+	}
+	if (batch_decode_begin(&d, payload, len) != BATCH_OK)
+	{
+		stats->bad++;
+		return;
+	}
+	// Times are relative to the first sample, the last one is at the frame's time, or
+	// age s before the uplink from a node without a set clock.
+	// The last time is only known at the end, so the samples are kept until then.
+	std::vector<std::pair<int32_t, std::vector<uint8_t>>> samples;
+	while (batch_decode_next(&d))
+	{
+		samples.push_back({d.time, std::vector<uint8_t>(d.sample, d.sample + d.len)});
+	}
+	if (d.index != d.count)
+	{
+		stats->bad++;
+	}
+	int32_t last = d.index ? d.time : 0;
+	uint32_t last_time = d.last_unix ? d.last_unix : rx_time - d.age;
+	for (auto &s : samples)
+	{
+		ingest_sample(st, node, last_time - (uint32_t)(last - s.first), s.second.data(), (uint8_t)s.second.size(), stats);
+	}
+}
+
+/**
+ * @brief Ingest an archive, all records belong to one node
+ */
+static bool ingest_archive(ts_store_s *st, const char *path, const std::string &node, ingest_stats_s *stats)
+{
+	FILE *in = fopen(path, "rb");
+	if (!in)
+	{
+		perror(path);
+		return false;
+	}
+	uint8_t rec[UPLINK_RECORD_HEADER + 255];
+	while (fread(rec, 1, UPLINK_RECORD_HEADER, in) == UPLINK_RECORD_HEADER)
+	{
+		if (fread(&rec[UPLINK_RECORD_HEADER], 1, rec[5], in) != rec[5])
+		{
+			break;
+		}
+		uint32_t rx_time = rec[0] | (rec[1] << 8) | (rec[2] << 16) | ((uint32_t)rec[3] << 24);
+		ingest_frame(st, node, rx_time, rec[4], &rec[UPLINK_RECORD_HEADER], rec[5], stats);
+	}
+	fclose(in);
+	return true;
+}
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	c = (char)tolower((unsigned char)c);
+	return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+/**
+ * @brief Ingest one text line: node rx_time fport payload_hex
+ *
+ * @return false malformed line
+ */
+static bool ingest_line(ts_store_s *st, const char *line, ingest_stats_s *stats)
+{
+	char node[128];
+	char hex[2 * 255 + 2];
+	unsigned long rx_time = 0;
+	unsigned port = 0;
+	if (sscanf(line, "%127s %lu %u %511s", node, &rx_time, &port, hex) != 4 || port > 255)
+	{
+		return false;
+	}
+	size_t n = strlen(hex);
+	if (n % 2 || n > 2 * 255)
+	{
+		return false;
+	}
+	uint8_t payload[255];
+	for (size_t idx = 0; idx < n; idx += 2)
+	{
+		int hi = hex_nibble(hex[idx]);
+		int lo = hex_nibble(hex[idx + 1]);
+		if (hi < 0 || lo < 0)
+		{
+			return false;
+		}
+		payload[idx / 2] = (uint8_t)((hi << 4) | lo);
+	}
+	ingest_frame(st, node, (uint32_t)rx_time, (uint8_t)port, payload, (uint8_t)(n / 2), stats);
+	return true;
+}
+
+/**
+ * @brief Ingest the lines of a buffer
+ *
+ * @return size_t malformed lines
+ */
+static size_t ingest_lines(ts_store_s *st, const std::string &text, ingest_stats_s *stats)
+{
+	size_t bad = 0;
+	size_t pos = 0;
+	while (pos < text.size())
+	{
+		size_t end = text.find('\n', pos);
+		end = end == std::string::npos ? text.size() : end;
+		std::string line = text.substr(pos, end - pos);
+		if (line.find_first_not_of(" \t\r") != std::string::npos && !ingest_line(st, line.c_str(), stats))
+		{
+			bad++;
+		}
+		pos = end + 1;
+	}
+	return bad;
+}
+
+static int field_by_name(const std::string &name)
+{
+	for (int field = 0; field < UF_COUNT; field++)
+	{
+		if (name == uplink_fields[field].name)
+		{
+			return field;
+		}
+	}
+	return -1;
+}
+
+static void append_number(std::string &out, double v, int decimals)
+{
+	char num[48];
+	snprintf(num, sizeof(num), "%.*f", decimals, v);
+	out += num;
+}
+
+/**
+ * @brief Run a query, JSON lines into out
+ *
+ * @return false the field is not stored
+ */
+static bool run_query(ts_store_s *st, const query_s &q, std::string &out, ts_query_stats_s *stats)
+{
+	if (q.field < 0 || g_field_channel[q.field] < 0)
+	{
+		return false;
+	}
+	const channel_s &c = g_channels[g_field_channel[q.field]];
+	const uplink_field_s &desc = uplink_fields[q.field];
+	char num[48];
+	if (!q.aggregate)
+	{
+		std::vector<std::pair<uint32_t, float>> points;
+		ts_range(st, q.node, c.id, g_field_column[q.field], q.from, q.to, points, stats);
+		for (auto &p : points)
+		{
+			snprintf(num, sizeof(num), "{\"time\":%u,\"", p.first);
+			out += num;
+			out += desc.name;
+			out += "\":";
+			append_number(out, p.second, desc.decimals);
+			out += "}\n";
+		}
+		return true;
+	}
+	std::map<uint32_t, ts_result_s> buckets;
+	ts_aggregate(st, q.node, c.id, g_field_column[q.field], q.from, q.to, q.bucket, buckets, stats);
+	for (auto &b : buckets)
+	{
+		snprintf(num, sizeof(num), "{\"time\":%u,\"count\":%u,\"min\":", b.second.start, b.second.count);
+		out += num;
+		append_number(out, b.second.min, desc.decimals);
+		out += ",\"max\":";
+		append_number(out, b.second.max, desc.decimals);
+		out += ",\"avg\":";
+		// One more decimal than the field, the average is finer than the samples
+		append_number(out, b.second.sum / b.second.count, desc.decimals + 1);
+		out += "}\n";
+	}
+	return true;
+}
+
+/**
+ * @brief Nodes and series of a store with their points and time range, one line each
+ */
+static void list_store(const ts_store_s *st)
+{
+	DIR *d = opendir(st->dir.c_str());
+	if (!d)
+	{
+		perror(st->dir.c_str());
+		return;
+	}
+	std::vector<std::string> nodes;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL)
+	{
+		if (e->d_name[0] != '.' && strcmp(e->d_name, "STORE") != 0)
+		{
+			nodes.push_back(e->d_name);
+		}
+	}
+	closedir(d);
+	std::sort(nodes.begin(), nodes.end());
+	printf("span %u s\n", st->span);
+	printf("node             channel  segments    points       first        last  fields\n");
+	for (auto &node : nodes)
+	{
+		for (auto &c : g_channels)
+		{
+			auto segs = ts_series_segments(st, node, c.id);
+			if (segs.empty())
+			{
+				continue;
+			}
+			size_t points = 0;
+			uint32_t first = UINT32_MAX;
+			uint32_t last = 0;
+			for (auto &seg : segs)
+			{
+				ts_segment_s s;
+				if (ts_segment_open(&s, seg.second, false, c.id, 0, 0, 0))
+				{
+					points += s.hdr->count;
+					first = s.hdr->count && s.hdr->t_min < first ? s.hdr->t_min : first;
+					last = s.hdr->count && s.hdr->t_max > last ? s.hdr->t_max : last;
+					ts_segment_close(&s);
+				}
+			}
+			std::string fields;
+			for (uint8_t col = 0; col < c.fields; col++)
+			{
+				fields += (col ? "," : "");
+				fields += uplink_fields[c.field[col]].name;
+			}
+			printf("%-16s  0x%04x  %8zu  %8zu  %10u  %10u  %s\n", node.c_str(), c.id, segs.size(), points, points ? first : 0, last, fields.c_str());
+		}
+	}
+}
+
+/** Value of a query string parameter, empty if absent */
+static std::string http_param(const std::string &query, const char *name)
+{
+	std::string key = std::string(name) + "=";
+	size_t pos = 0;
+	while (pos < query.size())
+	{
+		size_t end = query.find('&', pos);
+		end = end == std::string::npos ? query.size() : end;
+		if (query.compare(pos, key.size(), key) == 0)
+		{
+			return query.substr(pos + key.size(), end - pos - key.size());
+		}
+		pos = end + 1;
+	}
+	return "";
+}
+
+static void http_reply(int fd, int status, const char *type, const std::string &body)
+{
+	char hdr[160];
+	int n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+					 status, status == 200 ? "OK" : (status == 404 ? "Not Found" : "Bad Request"), type, body.size());
+	std::string out(hdr, n);
+	out += body;
+	size_t sent = 0;
+	while (sent < out.size())
+	{
+		ssize_t w = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+		if (w <= 0)
+		{
+			break;
+		}
+		sent += w;
+	}
+}
+
+/**
+ * @brief One HTTP request per connection
+ */
+static void http_handle(ts_store_s *st, int fd, ingest_stats_s *stats)
+{
+	std::string req;
+	char buf[4096];
+	size_t body_at = std::string::npos;
+	size_t length = 0;
+	while (req.size() < HTTP_MAX)
+	{
+		if (body_at != std::string::npos && req.size() >= body_at + length)
+		{
+			break;
+		}
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+		{
+			break;
+		}
+		req.append(buf, n);
+		if (body_at == std::string::npos && (body_at = req.find("\r\n\r\n")) != std::string::npos)
+		{
+			body_at += 4;
+			std::string head = req.substr(0, body_at);
+			for (char &c : head)
+			{
+				c = (char)tolower((unsigned char)c);
+			}
+			size_t cl = head.find("\r\ncontent-length:");
+			length = cl == std::string::npos ? 0 : strtoul(head.c_str() + cl + 17, NULL, 10);
+		}
+	}
+	if (body_at == std::string::npos || req.size() < body_at + length)
+	{
+		http_reply(fd, 400, "text/plain", "incomplete request\n");
+		return;
+	}
+	char method[8] = {0};
+	char target[1024] = {0};
+	if (sscanf(req.c_str(), "%7s %1023s", method, target) != 2)
+	{
+		http_reply(fd, 400, "text/plain", "bad request line\n");
+		return;
+	}
+	std::string path = target;
+	std::string query;
+	size_t qm = path.find('?');
+	if (qm != std::string::npos)
+	{
+		query = path.substr(qm + 1);
+		path = path.substr(0, qm);
+	}
+
+	if (strcmp(method, "POST") == 0 && path == "/uplink")
+	{
+		ingest_stats_s s;
+		size_t bad_lines = ingest_lines(st, req.substr(body_at, length), &s);
+		stats->frames += s.frames;
+		stats->samples += s.samples;
+		stats->points += s.points;
+		stats->skipped += s.skipped;
+		stats->bad += s.bad;
+		char body[160];
+		snprintf(body, sizeof(body), "{\"frames\":%zu,\"points\":%zu,\"bad\":%zu,\"bad_lines\":%zu}\n", s.frames, s.points, s.bad, bad_lines);
+		http_reply(fd, bad_lines ? 400 : 200, "application/json", body);
+	}
+	else if (strcmp(method, "GET") == 0 && path == "/query")
+	{
+		query_s q;
+		q.node = http_param(query, "node");
+		q.field = field_by_name(http_param(query, "field"));
+		std::string v;
+		if (!(v = http_param(query, "from")).empty())
+		{
+			q.from = (uint32_t)strtoul(v.c_str(), NULL, 10);
+		}
+		if (!(v = http_param(query, "to")).empty())
+		{
+			q.to = (uint32_t)strtoul(v.c_str(), NULL, 10);
+		}
+		if (!(v = http_param(query, "bucket")).empty())
+		{
+			q.bucket = (uint32_t)strtoul(v.c_str(), NULL, 10);
+		}
+		q.aggregate = q.bucket || http_param(query, "agg") == "1";
+		std::string out;
+		if (q.node.empty() || !run_query(st, q, out, NULL))
+		{
+			http_reply(fd, 400, "text/plain", "need node and a stored field\n");
+			return;
+		}
+		http_reply(fd, 200, "application/x-ndjson", out);
+	}
+	else
+	{
+		http_reply(fd, 404, "text/plain", "POST /uplink, GET /query\n");
+	}
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	g_stop = 1;
+}
+
+/**
+ * @brief HTTP stand-in on 127.0.0.1:port until SIGINT or SIGTERM
+ */
+static int http_serve(ts_store_s *st, int port)
+{
+	int lfd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0 || bind(lfd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 16) != 0)
+	{
+		perror("listen");
+		return 1;
+	}
+	// No SA_RESTART: the signal ends accept()
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	fprintf(stderr, "listening on 127.0.0.1:%d\n", port);
+
+	ingest_stats_s stats;
+	while (!g_stop)
+	{
+		int fd = accept(lfd, NULL, NULL);
+		if (fd < 0)
+		{
+			continue;
+		}
+		// One connection at a time, a silent client must not block the others for long
+		timeval tv = {2, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		http_handle(st, fd, &stats);
+		close(fd);
+	}
+	close(lfd);
+	fprintf(stderr, "%zu frames, %zu points, %zu bad\n", stats.frames, stats.points, stats.bad);
+	return 0;
+}
+
+static size_t g_disk_bytes;
+static int add_disk_bytes(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+	(void)path;
+	(void)ftw;
+	if (type == FTW_F)
+	{
+		g_disk_bytes += (size_t)sb->st_blocks * 512;
+	}
+	return 0;
+}
+
+/** One synthetic uplink of the benchmark */
+struct bench_uplink_s
+{
+	uint16_t node;
+	uint32_t rx_time;
+	uint8_t len;
+	uint8_t payload[40];
+};
+
+static double percentile(std::vector<double> &v, double p)
+{
+	std::sort(v.begin(), v.end());
+	return v.empty() ? 0.0 : v[(size_t)(p * (v.size() - 1))];
+}
+
+/**
+ * @brief Time one kind of query on random nodes
+ */
+static void bench_queries(ts_store_s *st, const char *name, std::vector<query_s> &queries, bool use_index)
+{
+	st->use_index = use_index;
+	std::vector<double> us;
+	ts_query_stats_s stats;
+	size_t lines = 0;
+	// Warm up: segments mapped once
+	for (auto &q : queries)
+	{
+		std::string out;
+		run_query(st, q, out, NULL);
+	}
+	for (auto &q : queries)
+	{
+		std::string out;
+		auto t0 = std::chrono::steady_clock::now();
+		run_query(st, q, out, &stats);
+		auto t1 = std::chrono::steady_clock::now();
+		us.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+		lines += std::count(out.begin(), out.end(), '\n');
+	}
+	double mean = 0.0;
+	for (double v : us)
+	{
+		mean += v / us.size();
+	}
+	double n = (double)queries.size();
+	printf("%-34s %8.0f %8.0f %8.0f %8.1f %8.1f %9.0f %7.0f\n", name, mean, percentile(us, 0.5), percentile(us, 0.99),
+		   stats.blocks_index / n, stats.blocks_scanned / n, stats.points / n, lines / n);
+	st->use_index = true;
+}
+
+/**
+ * @brief Ingest a synthetic fleet, then time trend and range queries
+ *        Every node sends a tracker packet (battery with a slow decline and
+ *        a daily swing, battery under TX, humidity, temperature) each
+ *        interval, every 4th uplink is a renogy_data_s packet.
+ */
+static int benchmark(const std::string &dir, uint32_t span, int nodes, int days, int interval)
+{
+	std::mt19937 rng(7);
+	const uint32_t t_start = 1640995200;
+	const uint32_t t_end = t_start + days * 86400;
+	std::vector<bench_uplink_s> uplinks;
+	uplinks.reserve((size_t)nodes * (t_end - t_start) / interval);
+	for (uint32_t t = t_start; t < t_end; t += interval)
+	{
+		for (int node = 0; node < nodes; node++)
+		{
+			bench_uplink_s u;
+			u.node = (uint16_t)node;
+			u.rx_time = t + node % interval;
+			uint8_t *p = u.payload;
+			uint8_t len = 0;
+			double day = (u.rx_time - t_start) / 86400.0;
+			uint16_t batt = (uint16_t)(410 - day * 0.5 + 8 * sin(day * 2 * M_PI) + rng() % 4);
+			uint16_t tx_min = batt - 10 - rng() % 20;
+			uint16_t rint = 100 + rng() % 100;
+			int16_t temp = (int16_t)(150 + 80 * sin(day * 2 * M_PI) + rng() % 10);
+			uint8_t tracker[] = {0x08, 0x02, (uint8_t)(batt >> 8), (uint8_t)batt,
+								 0x11, 0x02, (uint8_t)(tx_min >> 8), (uint8_t)tx_min, (uint8_t)(rint >> 8), (uint8_t)rint,
+								 0x07, 0x68, (uint8_t)(60 + rng() % 80),
+								 0x02, 0x67, (uint8_t)(temp >> 8), (uint8_t)temp};
+			memcpy(p, tracker, sizeof(tracker));
+			len = sizeof(tracker);
+			if (((t - t_start) / interval + node) % 4 == 0)
+			{
+				uint16_t regs[12] = {(uint16_t)(50 + rng() % 51), (uint16_t)(120 + rng() % 20), (uint16_t)(rng() % 2000), 0x1419,
+									 (uint16_t)(120 + rng() % 20), (uint16_t)(rng() % 500), (uint16_t)(rng() % 60),
+									 (uint16_t)(rng() % 250), (uint16_t)(rng() % 1500), (uint16_t)(rng() % 300), 0, 0};
+				p[len++] = 0x0C;
+				p[len++] = 0x02;
+				for (int idx = 0; idx < 12; idx++)
+				{
+					p[len++] = (uint8_t)regs[idx];
+					p[len++] = (uint8_t)(regs[idx] >> 8);
+				}
+			}
+			u.len = len;
+			uplinks.push_back(u);
+		}
+	}
+	std::vector<std::string> names;
+	for (int node = 0; node < nodes; node++)
+	{
+		char name[16];
+		snprintf(name, sizeof(name), "node%04d", node);
+		names.push_back(name);
+	}
+
+	ts_store_s st;
+	if (!ts_store_open(&st, dir, span))
+	{
+		fprintf(stderr, "%s: not a store\n", dir.c_str());
+		return 1;
+	}
+	ingest_stats_s stats;
+	size_t archive_bytes = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (auto &u : uplinks)
+	{
+		ingest_frame(&st, names[u.node], u.rx_time, 2, u.payload, u.len, &stats);
+		archive_bytes += UPLINK_RECORD_HEADER + u.len;
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	ts_store_close(&st);
+	auto t2 = std::chrono::steady_clock::now();
+	double secs = std::chrono::duration<double>(t1 - t0).count();
+	g_disk_bytes = 0;
+	nftw(dir.c_str(), add_disk_bytes, 16, FTW_PHYS);
+
+	printf("store %s, span %u s, %d nodes, %d days, %d s interval\n", dir.c_str(), st.span, nodes, days, interval);
+	printf("ingest: %zu uplinks, %zu points, %zu bad in %.3f s (unmap %.3f s)\n", stats.frames, stats.points, stats.bad, secs,
+		   std::chrono::duration<double>(t2 - t1).count());
+	printf("        %.0f uplinks/s, %.0f points/s\n", stats.frames / secs, stats.points / secs);
+	printf("disk:   %.1f MB, %.1f bytes/point, archive %.1f MB\n", g_disk_bytes / 1e6, (double)g_disk_bytes / stats.points, archive_bytes / 1e6);
+
+	// Store reopened, queries run against the files as a separate reader would
+	ts_store_open(&st, dir, span);
+	const int count = 200;
+	std::vector<query_s> trend, weekly, total, range;
+	for (int n = 0; n < count; n++)
+	{
+		query_s q;
+		q.node = names[rng() % nodes];
+		q.field = UF_battery;
+		q.from = t_start;
+		q.to = t_end;
+		q.aggregate = true;
+		q.bucket = 86400;
+		trend.push_back(q);
+		q.field = UF_battVoltage;
+		q.bucket = 7 * 86400;
+		weekly.push_back(q);
+		q.field = UF_battery;
+		q.bucket = 0;
+		total.push_back(q);
+		q.aggregate = false;
+		q.from = t_start + (rng() % days) * 86400;
+		q.to = q.from + 86400;
+		range.push_back(q);
+	}
+	printf("\nquery (%d each, random node)          mean us   p50 us   p99 us  idx blk scan blk  points  results\n", count);
+	bench_queries(&st, "battery daily min/max/avg", trend, true);
+	bench_queries(&st, "  same, block index off", trend, false);
+	bench_queries(&st, "battVoltage weekly min/max/avg", weekly, true);
+	bench_queries(&st, "  same, block index off", weekly, false);
+	bench_queries(&st, "battery min/max/avg, all days", total, true);
+	bench_queries(&st, "  same, block index off", total, false);
+	bench_queries(&st, "battery points of one day", range, true);
+	ts_store_close(&st);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s -s store [-p days] [-N node] archive...\n"
+			"       %s -s store -\n"
+			"       %s -s store -l port\n"
+			"       %s -s store -q node field [-f from] [-t to] [-a] [-w bucket]\n"
+			"       %s -s store -L\n"
+			"       %s -B [-s store] [-n nodes] [-d days] [-i interval]\n"
+			"  -s  store directory, created if missing\n"
+			"  -p  partition span of a new store in days, default 30\n"
+			"  -N  node id of the archives, default: archive file name without extension\n"
+			"  -   uplink lines on stdin: node rx_time fport payload_hex\n"
+			"  -l  HTTP on 127.0.0.1: POST /uplink (lines), GET /query?node=&field=&from=&to=&bucket=&agg=1\n"
+			"  -q  points of a field (uplink_decode names) in [from, to), times in s\n"
+			"  -a  count, min, max, avg over the range instead of points\n"
+			"  -w  same per bucket of this many s\n"
+			"  -L  list nodes and series\n"
+			"  -B  benchmark: ingest a synthetic fleet, time queries; default 100 nodes, 90 days, 900 s\n",
+			name, name, name, name, name, name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	std::string dir;
+	uint32_t span = TS_SPAN_DEFAULT;
+	std::string node;
+	std::vector<const char *> archives;
+	bool from_stdin = false;
+	int http_port = 0;
+	bool list = false;
+	bool bench = false;
+	int nodes = 100;
+	int days = 90;
+	int interval = 900;
+	query_s q;
+	bool have_query = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-s" && i + 1 < argc)
+		{
+			dir = argv[++i];
+		}
+		else if (arg == "-p" && i + 1 < argc)
+		{
+			span = (uint32_t)(atof(argv[++i]) * 86400);
+		}
+		else if (arg == "-N" && i + 1 < argc)
+		{
+			node = argv[++i];
+		}
+		else if (arg == "-")
+		{
+			from_stdin = true;
+		}
+		else if (arg == "-l" && i + 1 < argc)
+		{
+			http_port = atoi(argv[++i]);
+		}
+		else if (arg == "-q" && i + 2 < argc)
+		{
+			q.node = argv[++i];
+			q.field = field_by_name(argv[++i]);
+			have_query = true;
+			if (q.field < 0)
+			{
+				fprintf(stderr, "unknown field %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-f" && i + 1 < argc)
+		{
+			q.from = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (arg == "-t" && i + 1 < argc)
+		{
+			q.to = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (arg == "-a")
+		{
+			q.aggregate = true;
+		}
+		else if (arg == "-w" && i + 1 < argc)
+		{
+			q.bucket = (uint32_t)strtoul(argv[++i], NULL, 10);
+			q.aggregate = true;
+		}
+		else if (arg == "-L")
+		{
+			list = true;
+		}
+		else if (arg == "-B")
+		{
+			bench = true;
+		}
+		else if (arg == "-n" && i + 1 < argc)
+		{
+			nodes = atoi(argv[++i]);
+		}
+		else if (arg == "-d" && i + 1 < argc)
+		{
+			days = atoi(argv[++i]);
+		}
+		else if (arg == "-i" && i + 1 < argc)
+		{
+			interval = atoi(argv[++i]);
+		}
+		else if (arg[0] != '-')
+		{
+			archives.push_back(argv[i]);
+		}
+		else
+		{
+			usage(argv[0]);
+		}
+	}
+	if (span == 0 || nodes < 1 || days < 1 || interval < 1)
+	{
+		usage(argv[0]);
+	}
+	channels_init();
+
+	if (bench)
+	{
+		if (dir.empty())
+		{
+			char tmpl[] = "/tmp/ingest_bench.XXXXXX";
+			if (!mkdtemp(tmpl))
+			{
+				perror("mkdtemp");
+				return 1;
+			}
+			dir = tmpl;
+		}
+		return benchmark(dir, span, nodes, days, interval);
+	}
+	if (dir.empty() || (archives.empty() && !from_stdin && !http_port && !have_query && !list))
+	{
+		usage(argv[0]);
+	}
+
+	ts_store_s st;
+	if (!ts_store_open(&st, dir, span))
+	{
+		fprintf(stderr, "%s: not a store\n", dir.c_str());
+		return 1;
+	}
+	int result = 0;
+	if (have_query)
+	{
+		std::string out;
+		ts_query_stats_s stats;
+		auto t0 = std::chrono::steady_clock::now();
+		run_query(&st, q, out, &stats);
+		auto t1 = std::chrono::steady_clock::now();
+		fputs(out.c_str(), stdout);
+		fprintf(stderr, "%zu segments, %zu blocks from the index, %zu scanned, %zu points in %.3f ms\n", stats.segments, stats.blocks_index,
+				stats.blocks_scanned, stats.points, std::chrono::duration<double, std::milli>(t1 - t0).count());
+	}
+	else if (list)
+	{
+		list_store(&st);
+	}
+	else if (http_port)
+	{
+		result = http_serve(&st, http_port);
+	}
+	else
+	{
+		ingest_stats_s stats;
+		size_t bad_lines = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for (const char *path : archives)
+		{
+			std::string id = node;
+			if (id.empty())
+			{
+				// File name without directory and extension
+				id = path;
+				id = id.substr(id.find_last_of('/') + 1);
+				id = id.substr(0, id.find('.'));
+			}
+			if (!ingest_archive(&st, path, id, &stats))
+			{
+				result = 1;
+			}
+		}
+		if (from_stdin)
+		{
+			char line[1024];
+			while (fgets(line, sizeof(line), stdin))
+			{
+				if (strspn(line, " \t\r\n") != strlen(line) && !ingest_line(&st, line, &stats))
+				{
+					bad_lines++;
+				}
+			}
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		fprintf(stderr, "%zu frames, %zu samples, %zu points, %zu skipped, %zu bad, %zu bad lines in %.3f s\n", stats.frames, stats.samples,
+				stats.points, stats.skipped, stats.bad, bad_lines, std::chrono::duration<double>(t1 - t0).count());
+	}
+	ts_store_close(&st);
+	return result;
+}
@@ -0,0 +1,610 @@
+/**
+ * @file ts_store.h
+ * @brief Memory-mapped columnar time series store for tools/ingest
+ *        One series per node and uplink channel (0x0802 battery, 0x0c02
+ *        renogy_data_s, ...), the fields of a channel are its columns. A
+ *        channel always carries all of its fields, so the columns of a
+ *        series have no holes and share one time column.
+ *
+ *        A series is split into segments by time: partition = t / span, at
+ *        most TS_SEGMENT_POINTS points per segment file, a full partition
+ *        continues in the next sequence number:
+ *
+ *        <store>/<node>/<channel, 4 hex digits>/<partition start>-<seq>.seg
+ *
+ *        Segment file, little endian, created at full size (sparse, only
+ *        the pages written take disk space):
+ *
+ *        ts_header_s
+ *        block index  per TS_BLOCK points: ts_block_s, ts_agg_s per field
+ *        u32 time[TS_SEGMENT_POINTS]                 page aligned
+ *        f32 value[fields][TS_SEGMENT_POINTS]        one column per field
+ *
+ *        Points are appended in arrival order, not sorted: late samples of
+ *        a backlog go to the segment of their own partition. Queries prune
+ *        by partition, segment and block time range, blocks that lie
+ *        completely in the query range (and in one bucket) are answered
+ *        from the block index without touching the columns.
+ * @version 0.1
+ * @date 2022-12-24
+ */
+
+#ifndef TS_STORE_H
+#define TS_STORE_H
+
+#include <algorithm>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <list>
+#include <map>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define TS_MAGIC 0x47455354 // "TSEG"
+#define TS_VERSION 1
+/** Points per block index entry */
+#define TS_BLOCK 256
+/** Points per segment file */
+#define TS_SEGMENT_POINTS 16384
+#define TS_BLOCKS (TS_SEGMENT_POINTS / TS_BLOCK)
+/** Columns per series, renogy_data_s has the most fields */
+#define TS_FIELDS_MAX 16
+/** Default partition span, s */
+#define TS_SPAN_DEFAULT (30 * 86400)
+/** Segments the writer keeps mapped, least recently used are unmapped */
+#define TS_OPEN_MAX 4096
+/** Segments the queries keep mapped, all are unmapped when full */
+#define TS_READERS_MAX 4096
+#define TS_PAGE 4096
+
+/** Segment file header */
+struct ts_header_s
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t channel;
+	uint32_t start; // partition start, s
+	uint32_t span;	// partition length, s
+	uint32_t count; // points written, updated after the point
+	uint32_t t_min;
+	uint32_t t_max;
+	uint8_t fields;
+	uint8_t reserved[35];
+};
+static_assert(sizeof(ts_header_s) == 64, "segment header is 64 bytes");
+
+/** Block index entry, followed by one ts_agg_s per field */
+struct ts_block_s
+{
+	uint32_t t_min;
+	uint32_t t_max;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+/** Aggregate of one field over one block */
+struct ts_agg_s
+{
+	float min;
+	float max;
+	double sum;
+};
+
+/** One mapped segment */
+struct ts_segment_s
+{
+	int fd = -1;
+	uint8_t *map = NULL;
+	size_t size = 0;
+	ts_header_s *hdr = NULL;
+	size_t block_size = 0; // ts_block_s and its ts_agg_s
+	uint32_t *time = NULL;
+	float *value = NULL; // column f at value + f * TS_SEGMENT_POINTS
+};
+
+/** Aggregate of one field over a bucket */
+struct ts_result_s
+{
+	uint32_t start;
+	uint32_t count = 0;
+	double min = INFINITY;
+	double max = -INFINITY;
+	double sum = 0.0;
+};
+
+/** Query cost, what the index saved */
+struct ts_query_stats_s
+{
+	size_t segments = 0;	   // segments in the time range
+	size_t blocks_index = 0;   // answered from the block index
+	size_t blocks_scanned = 0; // read point by point
+	size_t points = 0;		   // points read from the columns
+};
+
+/** Open store, the segments mapped by the writer and by the queries */
+struct ts_store_s
+{
+	std::string dir;
+	uint32_t span = TS_SPAN_DEFAULT;
+	bool use_index = true; // false: every block is scanned, for the benchmark
+	std::unordered_map<std::string, std::pair<ts_segment_s, std::list<std::string>::iterator>> open;
+	std::list<std::string> lru; // most recently used first
+	// Read only mappings by path, files never change size, so they stay valid while the writer appends
+	std::unordered_map<std::string, ts_segment_s> readers;
+};
+
+static inline size_t ts_index_size(uint8_t fields)
+{
+	return sizeof(ts_header_s) + TS_BLOCKS * (sizeof(ts_block_s) + fields * sizeof(ts_agg_s));
+}
+
+static inline size_t ts_file_size(uint8_t fields)
+{
+	size_t index = (ts_index_size(fields) + TS_PAGE - 1) / TS_PAGE * TS_PAGE;
+	return index + (size_t)(1 + fields) * TS_SEGMENT_POINTS * 4;
+}
+
+static inline ts_block_s *ts_block(const ts_segment_s *s, uint32_t b)
+{
+	return (ts_block_s *)(s->map + sizeof(ts_header_s) + b * s->block_size);
+}
+
+static inline ts_agg_s *ts_block_agg(const ts_segment_s *s, uint32_t b)
+{
+	return (ts_agg_s *)(ts_block(s, b) + 1);
+}
+
+/**
+ * @brief Map a segment file
+ *
+ * @param fields columns of a new file, 0: the file must exist
+ * @return false missing, wrong format or no space
+ */
+static inline bool ts_segment_open(ts_segment_s *s, const std::string &path, bool write, uint16_t channel, uint8_t fields, uint32_t start, uint32_t span)
+{
+	s->fd = open(path.c_str(), write ? (fields ? O_RDWR | O_CREAT : O_RDWR) : O_RDONLY, 0644);
+	if (s->fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	fstat(s->fd, &st);
+	bool created = st.st_size == 0;
+	if (created)
+	{
+		if (!fields || ftruncate(s->fd, ts_file_size(fields)) != 0)
+		{
+			close(s->fd);
+			s->fd = -1;
+			return false;
+		}
+		st.st_size = ts_file_size(fields);
+	}
+	s->size = st.st_size;
+	void *map = mmap(NULL, s->size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, s->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		close(s->fd);
+		s->fd = -1;
+		return false;
+	}
+	s->map = (uint8_t *)map;
+	s->hdr = (ts_header_s *)map;
+	if (created)
+	{
+		s->hdr->magic = TS_MAGIC;
+		s->hdr->version = TS_VERSION;
+		s->hdr->channel = channel;
+		s->hdr->start = start;
+		s->hdr->span = span;
+		s->hdr->fields = fields;
+		s->hdr->t_min = UINT32_MAX;
+	}
+	if (s->hdr->magic != TS_MAGIC || s->hdr->version != TS_VERSION || s->hdr->fields > TS_FIELDS_MAX || s->size != ts_file_size(s->hdr->fields))
+	{
+		munmap(s->map, s->size);
+		close(s->fd);
+		s->fd = -1;
+		return false;
+	}
+	s->block_size = sizeof(ts_block_s) + s->hdr->fields * sizeof(ts_agg_s);
+	s->time = (uint32_t *)(s->map + (ts_index_size(s->hdr->fields) + TS_PAGE - 1) / TS_PAGE * TS_PAGE);
+	s->value = (float *)(s->time + TS_SEGMENT_POINTS);
+	return true;
+}
+
+static inline void ts_segment_close(ts_segment_s *s)
+{
+	if (s->fd >= 0)
+	{
+		munmap(s->map, s->size);
+		close(s->fd);
+		s->fd = -1;
+	}
+}
+
+/**
+ * @brief Append one point, the segment must have room
+ */
+static inline void ts_segment_append(ts_segment_s *s, uint32_t t, const float *v)
+{
+	ts_header_s *h = s->hdr;
+	uint32_t idx = h->count;
+	s->time[idx] = t;
+	for (uint8_t f = 0; f < h->fields; f++)
+	{
+		s->value[f * TS_SEGMENT_POINTS + idx] = v[f];
+	}
+
+	ts_block_s *b = ts_block(s, idx / TS_BLOCK);
+	ts_agg_s *agg = ts_block_agg(s, idx / TS_BLOCK);
+	if (idx % TS_BLOCK == 0)
+	{
+		b->t_min = t;
+		b->t_max = t;
+		for (uint8_t f = 0; f < h->fields; f++)
+		{
+			agg[f].min = v[f];
+			agg[f].max = v[f];
+			agg[f].sum = 0.0;
+		}
+	}
+	b->t_min = t < b->t_min ? t : b->t_min;
+	b->t_max = t > b->t_max ? t : b->t_max;
+	for (uint8_t f = 0; f < h->fields; f++)
+	{
+		agg[f].min = v[f] < agg[f].min ? v[f] : agg[f].min;
+		agg[f].max = v[f] > agg[f].max ? v[f] : agg[f].max;
+		agg[f].sum += v[f];
+	}
+	b->count = idx % TS_BLOCK + 1;
+	h->t_min = t < h->t_min ? t : h->t_min;
+	h->t_max = t > h->t_max ? t : h->t_max;
+	h->count = idx + 1;
+}
+
+/** Node ids become directory names, anything but [0-9A-Za-z_-] is replaced */
+static inline std::string ts_node_dir(const std::string &node)
+{
+	std::string out = node;
+	for (char &c : out)
+	{
+		if (!isalnum((unsigned char)c) && c != '_' && c != '-')
+		{
+			c = '_';
+		}
+	}
+	return out.empty() ? "_" : out;
+}
+
+static inline std::string ts_series_dir(const ts_store_s *st, const std::string &node, uint16_t channel)
+{
+	char chan[8];
+	snprintf(chan, sizeof(chan), "%04x", channel);
+	return st->dir + "/" + ts_node_dir(node) + "/" + chan;
+}
+
+static inline std::string ts_segment_path(const std::string &series, uint32_t start, uint32_t seq)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%u-%u.seg", start, seq);
+	return series + name;
+}
+
+/**
+ * @brief Open or create a store, the span of an existing store is kept
+ *
+ * @param span partition span of a new store, s
+ */
+static inline bool ts_store_open(ts_store_s *st, const std::string &dir, uint32_t span)
+{
+	st->dir = dir;
+	mkdir(dir.c_str(), 0755);
+	std::string meta = dir + "/STORE";
+	FILE *f = fopen(meta.c_str(), "r");
+	if (f)
+	{
+		unsigned version = 0;
+		unsigned s = 0;
+		bool ok = fscanf(f, "tsstore %u span %u", &version, &s) == 2 && version == TS_VERSION && s > 0;
+		fclose(f);
+		st->span = s;
+		return ok;
+	}
+	f = fopen(meta.c_str(), "w");
+	if (!f)
+	{
+		return false;
+	}
+	st->span = span;
+	fprintf(f, "tsstore %u span %u\n", TS_VERSION, span);
+	fclose(f);
+	return true;
+}
+
+static inline void ts_store_close(ts_store_s *st)
+{
+	for (auto &e : st->open)
+	{
+		ts_segment_close(&e.second.first);
+	}
+	st->open.clear();
+	st->lru.clear();
+	for (auto &e : st->readers)
+	{
+		ts_segment_close(&e.second);
+	}
+	st->readers.clear();
+}
+
+/**
+ * @brief Read only mapping of a segment file, kept for the next query
+ *
+ * @return NULL missing or not a segment
+ */
+static inline const ts_segment_s *ts_store_reader(ts_store_s *st, const std::string &path)
+{
+	auto it = st->readers.find(path);
+	if (it != st->readers.end())
+	{
+		return &it->second;
+	}
+	if (st->readers.size() >= TS_READERS_MAX)
+	{
+		for (auto &e : st->readers)
+		{
+			ts_segment_close(&e.second);
+		}
+		st->readers.clear();
+	}
+	ts_segment_s s;
+	if (!ts_segment_open(&s, path, false, 0, 0, 0, 0))
+	{
+		return NULL;
+	}
+	return &st->readers.emplace(path, s).first->second;
+}
+
+/**
+ * @brief Append one point of a channel
+ *
+ * @param fields columns, the same for every point of a channel
+ * @return false the segment could not be created
+ */
+static inline bool ts_store_append(ts_store_s *st, const std::string &node, uint16_t channel, uint8_t fields, uint32_t t, const float *v)
+{
+	uint32_t start = t - t % st->span;
+	char key_tail[24];
+	snprintf(key_tail, sizeof(key_tail), "\t%04x\t%u", channel, start);
+	std::string key = node + key_tail;
+
+	auto it = st->open.find(key);
+	if (it != st->open.end())
+	{
+		st->lru.splice(st->lru.begin(), st->lru, it->second.second);
+	}
+	else
+	{
+		if (st->open.size() >= TS_OPEN_MAX)
+		{
+			auto old = st->open.find(st->lru.back());
+			ts_segment_close(&old->second.first);
+			st->open.erase(old);
+			st->lru.pop_back();
+		}
+		std::string series = ts_series_dir(st, node, channel);
+		mkdir((st->dir + "/" + ts_node_dir(node)).c_str(), 0755);
+		mkdir(series.c_str(), 0755);
+		// The last segment of the partition takes the point
+		uint32_t seq = 0;
+		struct stat sb;
+		while (stat(ts_segment_path(series, start, seq + 1).c_str(), &sb) == 0)
+		{
+			seq++;
+		}
+		ts_segment_s s;
+		if (!ts_segment_open(&s, ts_segment_path(series, start, seq), true, channel, fields, start, st->span))
+		{
+			return false;
+		}
+		st->lru.push_front(key);
+		it = st->open.emplace(key, std::make_pair(s, st->lru.begin())).first;
+	}
+
+	ts_segment_s *s = &it->second.first;
+	if (s->hdr->fields != fields || s->hdr->channel != channel)
+	{
+		return false;
+	}
+	if (s->hdr->count == TS_SEGMENT_POINTS)
+	{
+		// Partition continues in the next file
+		std::string series = ts_series_dir(st, node, channel);
+		uint32_t seq = 0;
+		struct stat sb;
+		while (stat(ts_segment_path(series, start, seq).c_str(), &sb) == 0)
+		{
+			seq++;
+		}
+		ts_segment_close(s);
+		if (!ts_segment_open(s, ts_segment_path(series, start, seq), true, channel, fields, start, st->span))
+		{
+			st->lru.erase(it->second.second);
+			st->open.erase(it);
+			return false;
+		}
+	}
+	ts_segment_append(s, t, v);
+	return true;
+}
+
+/** Segment files of a series, partition start and path */
+static inline std::vector<std::pair<uint32_t, std::string>> ts_series_segments(const ts_store_s *st, const std::string &node, uint16_t channel)
+{
+	std::vector<std::pair<uint32_t, std::string>> out;
+	std::string series = ts_series_dir(st, node, channel);
+	DIR *d = opendir(series.c_str());
+	if (!d)
+	{
+		return out;
+	}
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL)
+	{
+		unsigned start = 0;
+		unsigned seq = 0;
+		char ext[8] = {0};
+		if (sscanf(e->d_name, "%u-%u.%3s", &start, &seq, ext) == 3 && strcmp(ext, "seg") == 0)
+		{
+			out.push_back({start, series + "/" + e->d_name});
+		}
+	}
+	closedir(d);
+	std::sort(out.begin(), out.end());
+	return out;
+}
+
+static inline void ts_result_add(ts_result_s *r, double v)
+{
+	r->count++;
+	r->min = v < r->min ? v : r->min;
+	r->max = v > r->max ? v : r->max;
+	r->sum += v;
+}
+
+/**
+ * @brief Aggregate one column over [from, to)
+ *
+ * @param column field index within the channel
+ * @param bucket bucket length in s, buckets start at multiples of it; 0: one bucket
+ * @param out buckets by start time, only those with points
+ * @param stats what was read, can be NULL
+ */
+static inline void ts_aggregate(ts_store_s *st, const std::string &node, uint16_t channel, uint8_t column, uint32_t from, uint32_t to, uint32_t bucket,
+								std::map<uint32_t, ts_result_s> &out, ts_query_stats_s *stats)
+{
+	ts_query_stats_s local;
+	stats = stats ? stats : &local;
+	auto bucket_of = [&](uint32_t t) { return bucket ? t - t % bucket : from; };
+	for (auto &seg : ts_series_segments(st, node, channel))
+	{
+		if (seg.first >= to || (uint64_t)seg.first + st->span <= from)
+		{
+			continue;
+		}
+		const ts_segment_s *sp = ts_store_reader(st, seg.second);
+		if (!sp)
+		{
+			continue;
+		}
+		const ts_segment_s &s = *sp;
+		stats->segments++;
+		const ts_header_s *h = s.hdr;
+		if (column >= h->fields || h->count == 0 || h->t_min >= to || h->t_max < from)
+		{
+			continue;
+		}
+		const uint32_t *time = s.time;
+		const float *value = s.value + column * TS_SEGMENT_POINTS;
+		uint32_t blocks = (h->count + TS_BLOCK - 1) / TS_BLOCK;
+		for (uint32_t b = 0; b < blocks; b++)
+		{
+			const ts_block_s *blk = ts_block(&s, b);
+			if (blk->t_min >= to || blk->t_max < from)
+			{
+				continue;
+			}
+			if (st->use_index && blk->t_min >= from && blk->t_max < to && bucket_of(blk->t_min) == bucket_of(blk->t_max))
+			{
+				const ts_agg_s *agg = &ts_block_agg(&s, b)[column];
+				ts_result_s &r = out[bucket_of(blk->t_min)];
+				r.start = bucket_of(blk->t_min);
+				r.count += blk->count;
+				r.min = agg->min < r.min ? agg->min : r.min;
+				r.max = agg->max > r.max ? agg->max : r.max;
+				r.sum += agg->sum;
+				stats->blocks_index++;
+				continue;
+			}
+			stats->blocks_scanned++;
+			// Neighbouring points mostly fall into the same bucket
+			ts_result_s *r = NULL;
+			uint32_t r_start = 0;
+			uint32_t end = b * TS_BLOCK + blk->count;
+			for (uint32_t idx = b * TS_BLOCK; idx < end; idx++)
+			{
+				uint32_t t = time[idx];
+				if (t >= from && t < to)
+				{
+					if (!r || bucket_of(t) != r_start)
+					{
+						r_start = bucket_of(t);
+						r = &out[r_start];
+						r->start = r_start;
+					}
+					ts_result_add(r, value[idx]);
+				}
+			}
+			stats->points += blk->count;
+		}
+	}
+}
+
+/**
+ * @brief Points of one column in [from, to), sorted by time
+ */
+static inline void ts_range(ts_store_s *st, const std::string &node, uint16_t channel, uint8_t column, uint32_t from, uint32_t to,
+							std::vector<std::pair<uint32_t, float>> &out, ts_query_stats_s *stats)
+{
+	ts_query_stats_s local;
+	stats = stats ? stats : &local;
+	for (auto &seg : ts_series_segments(st, node, channel))
+	{
+		if (seg.first >= to || (uint64_t)seg.first + st->span <= from)
+		{
+			continue;
+		}
+		const ts_segment_s *sp = ts_store_reader(st, seg.second);
+		if (!sp)
+		{
+			continue;
+		}
+		const ts_segment_s &s = *sp;
+		stats->segments++;
+		const ts_header_s *h = s.hdr;
+		uint32_t blocks = column < h->fields ? (h->count + TS_BLOCK - 1) / TS_BLOCK : 0;
+		for (uint32_t b = 0; b < blocks; b++)
+		{
+			const ts_block_s *blk = ts_block(&s, b);
+			if (blk->t_min >= to || blk->t_max < from)
+			{
+				continue;
+			}
+			stats->blocks_scanned++;
+			const float *value = s.value + column * TS_SEGMENT_POINTS;
+			uint32_t end = b * TS_BLOCK + blk->count;
+			for (uint32_t idx = b * TS_BLOCK; idx < end; idx++)
+			{
+				if (s.time[idx] >= from && s.time[idx] < to)
+				{
+					out.push_back({s.time[idx], value[idx]});
+				}
+			}
+			stats->points += blk->count;
+		}
+	}
+	std::stable_sort(out.begin(), out.end(), [](const std::pair<uint32_t, float> &a, const std::pair<uint32_t, float> &b) { return a.first < b.first; });
+}
+
+#endif
@@ -0,0 +1,104 @@
+"""
+@file ram_budget.py
+@brief Checks the static RAM of every application object against its RAM_BUDGET() limit
+       The bytes argument of RAM_BUDGET() is a hand written sizeof() sum, a
+       global added later without it is not counted there. This check takes
+       the real .bss and .data of each object file (nm, function statics and
+       library objects defined in the module included) and fails the build if
+       a module is above the limit of its RAM_BUDGET() line.
+
+       env:wiscore_rak4631_zero_heap runs it after linking, with the nm of
+       the toolchain. On its own:
+       python3 tools/ram_budget/ram_budget.py <nm> <object dir> [source dir]
+       Objects are found as foo.cpp.o (PlatformIO) or foo.o
+       (tools/fleet_sim/build.sh). A module with a budget but no object
+       fails the check, a wrong object directory must not pass.
+@version 0.1
+@date 2022-10-08
+"""
+
+import os
+import re
+import subprocess
+import sys
+
+BUDGET_RE = re.compile(r"^RAM_BUDGET\((\w+),[^;]*,\s*(\d+)\);", re.M)
+
+# nm types of static RAM: bss, data, small data, common
+RAM_TYPES = set("bBdDsSC")
+
+
+def budgets(src_dir):
+    """Limit per source file, the largest if #ifdef branches declare it twice"""
+    result = {}
+    for name in sorted(os.listdir(src_dir)):
+        if not name.endswith(".cpp"):
+            continue
+        with open(os.path.join(src_dir, name), encoding="utf-8", errors="replace") as f:
+            found = BUDGET_RE.findall(f.read())
+        if found:
+            result[name] = (found[0][0], max(int(limit) for _, limit in found))
+    return result
+
+
+def ram_bytes(nm, obj):
+    """.bss and .data of one object file and its three largest symbols"""
+    out = subprocess.run([nm, "-S", "-C", "--size-sort", obj], capture_output=True, text=True, check=True).stdout
+    total = 0
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) == 4 and parts[2] in RAM_TYPES:
+            size = int(parts[1], 16)
+            total += size
+            symbols.append((size, parts[3]))
+    symbols.sort(reverse=True)
+    return total, symbols[:3]
+
+
+def find_object(obj_dir, name):
+    """Object file of a source, None if the build has none"""
+    for obj in (name + ".o", os.path.splitext(name)[0] + ".o"):
+        if os.path.exists(os.path.join(obj_dir, obj)):
+            return os.path.join(obj_dir, obj)
+    return None
+
+
+def check(nm, obj_dir, src_dir):
+    """Report every module, returns the number above their limit or without an object"""
+    over = 0
+    print("%-10s %-22s %6s %6s  largest" % ("module", "object", "bytes", "limit"))
+    for name, (module, limit) in budgets(src_dir).items():
+        obj = find_object(obj_dir, name)
+        if obj is None:
+            over += 1
+            print("%-10s %-22s %6s %6d  no object in %s" % (module, name, "-", limit, obj_dir))
+            continue
+        total, largest = ram_bytes(nm, obj)
+        mark = ""
+        if total > limit:
+            over += 1
+            mark = "  OVER"
+        print("%-10s %-22s %6d %6d  %s%s" % (module, name, total, limit, ", ".join("%s %d" % (s, n) for n, s in largest), mark))
+    return over
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        sys.stderr.write("usage: ram_budget.py <nm> <object dir> [source dir]\n")
+        sys.exit(2)
+    sys.exit(1 if check(sys.argv[1], sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else "src") else 0)
+else:
+    # PlatformIO extra script
+    Import("env")  # noqa: F821 pylint: disable=undefined-variable
+
+    def _after_link(target, source, env):
+        # The platform defines no $NM, the toolchain bin directory is on the env PATH
+        nm = env.subst("$NM") or "arm-none-eabi-nm"
+        nm = env.WhereIs(nm) or nm
+        obj_dir = os.path.join(env.subst("$BUILD_DIR"), "src")
+        if check(nm, obj_dir, env.subst("$PROJECT_SRC_DIR")):
+            sys.stderr.write("Static RAM above its RAM_BUDGET() limit or object missing\n")
+            env.Exit(1)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", _after_link)  # noqa: F821 pylint: disable=undefined-variable
@@ -0,0 +1,189 @@
+/**
+ * @file renogy_bench.cpp
+ * @brief RS232 poll path benchmark against the Renogy emulator
+ *        Runs the unmodified src/renogy_rs232.cpp on the host (through the
+ *        shims in tools/host) against an in-process emulator on a pty and
+ *        reports transactions per second, the wake window per poll plan and
+ *        the Modbus result codes under error injection. The load plan
+ *        toggles the load switch with read back, as a downlink command does.
+ *
+ *        g++ -std=c++17 -O2 -pthread -DNRF52_SERIES -Itools/host/shim -Isrc \
+ *            tools/renogy_emu/renogy_bench.cpp src/renogy_rs232.cpp src/vedirect.cpp tools/host/host_port.cpp -o renogy_bench
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#include "app.h"
+#include "renogy_emu.h"
+
+#include <ModbusMaster.h>
+
+#include <string>
+#include <vector>
+
+/** renogy_sample() reads the poll set from it, the bench calls the poll functions directly */
+app_config_s g_app_config;
+
+/** src/supervisor.cpp, the bench has no phase budgets */
+bool supervisor_expired(void)
+{
+	return false;
+}
+
+/** Poll plan: which Modbus transactions one wake cycle performs */
+struct poll_plan_s
+{
+	const char *name;
+	bool data;
+	bool errors;
+	bool load;
+};
+
+static const poll_plan_s plans[] = {
+	{"data", true, false, false},
+	{"errors", false, true, false},
+	{"data+errors", true, true, false}, // what app_event_handler() does today
+	{"load", false, false, true},		 // load switch and read back, see load.cpp
+};
+
+static double percentile(std::vector<double> v, double p)
+{
+	if (v.empty())
+	{
+		return 0.0;
+	}
+	std::sort(v.begin(), v.end());
+	return v[(size_t)(p * (v.size() - 1))];
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+			"usage: %s [options]\n"
+			"  --cycles N        wake cycles per poll plan (default 50)\n"
+			"  --plan NAME       data, errors, data+errors, load or all (default all)\n"
+			"  --verbose         show the firmware log output\n" EMU_OPTIONS_HELP,
+			prog);
+}
+
+int main(int argc, char **argv)
+{
+	emu_config_s cfg;
+	int cycles = 50;
+	std::string plan_name = "all";
+	for (int i = 1; i < argc; i++)
+	{
+		std::string opt(argv[i]);
+		if (opt == "--verbose")
+		{
+			host_verbose = true;
+		}
+		else if (i + 1 < argc && opt == "--cycles")
+		{
+			cycles = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && opt == "--plan")
+		{
+			plan_name = argv[++i];
+		}
+		else if (i + 1 < argc && emu_parse_option(cfg, argv[i], argv[i + 1]))
+		{
+			i++;
+		}
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	RenogyEmulator emu(cfg);
+	if (!emu.open_pty())
+	{
+		perror("posix_openpt");
+		return 1;
+	}
+	std::atomic<bool> stop(false);
+	std::thread emu_thread([&]() { emu.run(stop); });
+
+	int fd = open(emu.slave_path().c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+	{
+		perror(emu.slave_path().c_str());
+		stop = true;
+		emu_thread.join();
+		return 1;
+	}
+	Serial1.attach(fd);
+	init_renogy_rs232();
+
+	printf("emulator %s: latency %u+%u ms, %u baud, crc %.3f, timeout %.3f, partial %.3f\n",
+		   emu.slave_path().c_str(), cfg.latency_ms, cfg.jitter_ms, cfg.baud,
+		   cfg.crc_error_rate, cfg.timeout_rate, cfg.partial_rate);
+	printf("%-12s %8s %10s %10s %10s %10s %8s %6s %6s %6s\n",
+		   "plan", "cycles", "trans/s", "wake avg", "wake p50", "wake p95", "ok", "tmo", "crc", "other");
+
+	for (const poll_plan_s &plan : plans)
+	{
+		if (plan_name != "all" && plan_name != plan.name)
+		{
+			continue;
+		}
+		host_modbus_stats = host_modbus_stats_s();
+		std::vector<double> wake_ms;
+		uint32_t mismatches = 0;
+		uint32_t start = micros();
+		for (int c = 0; c < cycles; c++)
+		{
+			uint32_t t0 = micros();
+			if (plan.data)
+			{
+				renogyPollRs232Data();
+			}
+			if (plan.errors)
+			{
+				renogyPollRs232Errors();
+			}
+			if (plan.load)
+			{
+				bool on = c & 1;
+				bool state = !on;
+				if (renogyWriteLoad(on, &state) && state != on)
+				{
+					mismatches++;
+				}
+			}
+			wake_ms.push_back((micros() - t0) / 1000.0);
+		}
+		double elapsed_s = (micros() - start) / 1e6;
+
+		double avg = 0.0;
+		for (double w : wake_ms)
+		{
+			avg += w;
+		}
+		avg /= wake_ms.empty() ? 1 : wake_ms.size();
+
+		const host_modbus_stats_s &s = host_modbus_stats;
+		uint32_t ok = s.result[ModbusMaster::ku8MBSuccess];
+		uint32_t tmo = s.result[ModbusMaster::ku8MBResponseTimedOut];
+		uint32_t crc = s.result[ModbusMaster::ku8MBInvalidCRC];
+		printf("%-12s %8d %10.2f %8.1fms %8.1fms %8.1fms %8u %6u %6u %6u\n",
+			   plan.name, cycles, s.transactions / elapsed_s, avg,
+			   percentile(wake_ms, 0.5), percentile(wake_ms, 0.95),
+			   ok, tmo, crc, s.transactions - ok - tmo - crc);
+		if (mismatches)
+		{
+			printf("%-12s %u load states read back wrong\n", "", mismatches);
+		}
+	}
+
+	stop = true;
+	emu_thread.join();
+	close(fd);
+
+	const emu_stats_s &e = emu.stats();
+	printf("emulator: requests %u replies %u injected crc %u timeouts %u partial %u, bad frames %u\n",
+		   e.requests, e.replies, e.crc_errors, e.timeouts, e.partials, e.bad_frames);
+	return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file renogy_emu.cpp
+ * @brief Stand-alone Renogy controller emulator
+ *        Prints the pty path, point anything that speaks Modbus RTU at it.
+ *
+ *        g++ -std=c++17 -O2 -pthread -Isrc tools/renogy_emu/renogy_emu.cpp -o renogy_emu
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#include "renogy_emu.h"
+
+#include <signal.h>
+
+static std::atomic<bool> stop_flag(false);
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop_flag = true;
+}
+
+int main(int argc, char **argv)
+{
+	emu_config_s cfg;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc && emu_parse_option(cfg, argv[i], argv[i + 1]))
+		{
+			i++;
+			continue;
+		}
+		fprintf(stderr, "usage: %s [options]\n" EMU_OPTIONS_HELP, argv[0]);
+		return 1;
+	}
+
+	RenogyEmulator emu(cfg);
+	if (!emu.open_pty())
+	{
+		perror("posix_openpt");
+		return 1;
+	}
+	printf("%s\n", emu.slave_path().c_str());
+	fflush(stdout);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	emu.run(stop_flag);
+
+	const emu_stats_s &s = emu.stats();
+	fprintf(stderr, "requests %u replies %u exceptions %u crc %u timeouts %u partial %u bad frames %u\n",
+			s.requests, s.replies, s.exceptions, s.crc_errors, s.timeouts, s.partials, s.bad_frames);
+	return 0;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file renogy_emu.h
+ * @brief Renogy Wanderer emulator, Modbus RTU slave on a Linux pseudo-terminal
+ *        Serves the register layout from src/renogy_regs.h, including the
+ *        load switch (function 0x06), with configurable
+ *        response latency and error injection (bad CRC, no reply, partial
+ *        frame). Used stand-alone by renogy_emu.cpp and in-process by
+ *        renogy_bench.cpp.
+ * @version 0.1
+ * @date 2022-09-10
+ */
+
+#ifndef RENOGY_EMU_H
+#define RENOGY_EMU_H
+
+#include "renogy_regs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/** Emulator settings */
+struct emu_config_s
+{
+	uint8_t slave_id = RENOGY_SLAVE_ID;
+	uint32_t baud = RENOGY_BAUDRATE; // 0 = no line time emulation
+	uint32_t latency_ms = 20;		 // controller processing time before the reply
+	uint32_t jitter_ms = 0;			 // uniform random extra latency
+	double crc_error_rate = 0.0;	 // reply with corrupted CRC
+	double timeout_rate = 0.0;		 // drop the request, no reply at all
+	double partial_rate = 0.0;		 // reply is cut off after a random number of bytes
+	uint32_t seed = 1;
+};
+
+/** Emulator counters */
+struct emu_stats_s
+{
+	uint32_t requests = 0;
+	uint32_t replies = 0;
+	uint32_t exceptions = 0;
+	uint32_t crc_errors = 0;
+	uint32_t timeouts = 0;
+	uint32_t partials = 0;
+	uint32_t bad_frames = 0;
+};
+
+class RenogyEmulator
+{
+public:
+	explicit RenogyEmulator(const emu_config_s &cfg) : _cfg(cfg), _rng(cfg.seed)
+	{
+		_regs.assign(0x200, 0);
+		_regs[RENOGY_REG_BATT_CAPACITY] = 87;
+		_regs[RENOGY_REG_BATT_VOLTAGE] = 132;
+		_regs[RENOGY_REG_CHARGE_CURRENT] = 154;
+		_regs[RENOGY_REG_TEMPERATURE] = (27 << 8) | 21;
+		_regs[RENOGY_REG_LOAD_VOLTAGE] = 132;
+		_regs[RENOGY_REG_LOAD_CURRENT] = 61;
+		_regs[RENOGY_REG_LOAD_POWER] = 8;
+		_regs[RENOGY_REG_PANEL_VOLTAGE] = 182;
+		_regs[RENOGY_REG_PANEL_CURRENT] = 121;
+		_regs[RENOGY_REG_PANEL_POWER] = 22;
+		_regs[loadStatusRegister] = RENOGY_LOAD_STATUS_ON | 2; // load on, MPPT charging
+	}
+
+	~RenogyEmulator()
+	{
+		if (_master >= 0)
+		{
+			close(_master);
+		}
+	}
+
+	/**
+	 * @brief Create the pseudo-terminal
+	 *
+	 * @return true pty created, slave_path() is valid
+	 */
+	bool open_pty(void)
+	{
+		_master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (_master < 0 || grantpt(_master) != 0 || unlockpt(_master) != 0)
+		{
+			return false;
+		}
+		struct termios tio;
+		tcgetattr(_master, &tio);
+		cfmakeraw(&tio);
+		tcsetattr(_master, TCSANOW, &tio);
+		_slave_path = ptsname(_master);
+		return true;
+	}
+
+	const std::string &slave_path(void) const { return _slave_path; }
+	const emu_stats_s &stats(void) const { return _stats; }
+
+	/**
+	 * @brief Serve requests until stop is set
+	 *        Frames are delimited by 3.5 character times of silence like on
+	 *        the real line.
+	 */
+	void run(const std::atomic<bool> &stop)
+	{
+		std::vector<uint8_t> frame;
+		int t35_ms = _cfg.baud ? (int)((35000 + _cfg.baud - 1) / _cfg.baud) + 1 : 2;
+		while (!stop)
+		{
+			struct pollfd pfd = {_master, POLLIN, 0};
+			int ready = poll(&pfd, 1, frame.empty() ? 50 : t35_ms);
+			if (ready > 0 && (pfd.revents & POLLIN))
+			{
+				uint8_t buf[64];
+				ssize_t n = read(_master, buf, sizeof(buf));
+				if (n > 0)
+				{
+					frame.insert(frame.end(), buf, buf + n);
+				}
+				continue;
+			}
+			if (!frame.empty())
+			{
+				handle_frame(frame);
+				frame.clear();
+			}
+		}
+	}
+
+	static uint16_t crc16(const uint8_t *buf, size_t len)
+	{
+		uint16_t crc = 0xFFFF;
+		for (size_t i = 0; i < len; i++)
+		{
+			crc ^= buf[i];
+			for (int b = 0; b < 8; b++)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+			}
+		}
+		return crc;
+	}
+
+private:
+	emu_config_s _cfg;
+	emu_stats_s _stats;
+	std::mt19937 _rng;
+	std::vector<uint16_t> _regs;
+	int _master = -1;
+	std::string _slave_path;
+
+	bool chance(double rate)
+	{
+		return rate > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(_rng) < rate;
+	}
+
+	/** Time the given number of bytes occupy the line, 10 bits per byte */
+	std::chrono::microseconds line_time(size_t bytes) const
+	{
+		return std::chrono::microseconds(_cfg.baud ? bytes * 10 * 1000000ULL / _cfg.baud : 0);
+	}
+
+	/** Let the live values wander a little so consecutive reads differ */
+	void update_values(void)
+	{
+		std::uniform_int_distribution<int> step(-1, 1);
+		_regs[RENOGY_REG_BATT_VOLTAGE] = (uint16_t)std::min(150, std::max(110, _regs[RENOGY_REG_BATT_VOLTAGE] + step(_rng)));
+		_regs[RENOGY_REG_PANEL_CURRENT] = (uint16_t)std::min(800, std::max(0, _regs[RENOGY_REG_PANEL_CURRENT] + step(_rng)));
+		_regs[RENOGY_REG_PANEL_POWER] = (uint16_t)(_regs[RENOGY_REG_PANEL_VOLTAGE] * _regs[RENOGY_REG_PANEL_CURRENT] / 1000);
+	}
+
+	void handle_frame(const std::vector<uint8_t> &req)
+	{
+		if (req.size() < 4 || crc16(req.data(), req.size() - 2) != (req[req.size() - 2] | (req[req.size() - 1] << 8)))
+		{
+			// A real slave silently drops garbage
+			_stats.bad_frames++;
+			return;
+		}
+		if (req[0] != _cfg.slave_id)
+		{
+			return;
+		}
+		_stats.requests++;
+
+		std::vector<uint8_t> rsp;
+		rsp.push_back(req[0]);
+		uint8_t function = req[1];
+		uint16_t addr = req.size() >= 6 ? (req[2] << 8) | req[3] : 0;
+		uint16_t qty = req.size() >= 6 ? (req[4] << 8) | req[5] : 0;
+
+		if (function == 0x03 && req.size() == 8)
+		{
+			if (qty == 0 || qty > 125 || addr + qty > _regs.size())
+			{
+				exception(rsp, function, 0x02);
+			}
+			else
+			{
+				update_values();
+				rsp.push_back(function);
+				rsp.push_back((uint8_t)(qty * 2));
+				for (uint16_t i = 0; i < qty; i++)
+				{
+					rsp.push_back(_regs[addr + i] >> 8);
+					rsp.push_back(_regs[addr + i] & 0xFF);
+				}
+			}
+		}
+		else if (function == 0x06 && req.size() == 8)
+		{
+			if (addr != loadSwitchRegister || qty > 1)
+			{
+				exception(rsp, function, addr != loadSwitchRegister ? 0x02 : 0x03);
+			}
+			else
+			{
+				// Reply echoes the request, the load state follows the switch
+				_regs[loadStatusRegister] = (_regs[loadStatusRegister] & ~RENOGY_LOAD_STATUS_ON) | (qty ? RENOGY_LOAD_STATUS_ON : 0);
+				_regs[RENOGY_REG_LOAD_VOLTAGE] = qty ? _regs[RENOGY_REG_BATT_VOLTAGE] : 0;
+				_regs[RENOGY_REG_LOAD_CURRENT] = qty ? 61 : 0;
+				_regs[RENOGY_REG_LOAD_POWER] = qty ? 8 : 0;
+				rsp.insert(rsp.end(), req.begin() + 1, req.begin() + 6);
+			}
+		}
+		else
+		{
+			exception(rsp, function, 0x01);
+		}
+		uint16_t crc = crc16(rsp.data(), rsp.size());
+		rsp.push_back(crc & 0xFF);
+		rsp.push_back(crc >> 8);
+
+		if (chance(_cfg.timeout_rate))
+		{
+			_stats.timeouts++;
+			return;
+		}
+		if (chance(_cfg.crc_error_rate))
+		{
+			_stats.crc_errors++;
+			rsp.back() ^= 0x5A;
+		}
+		else if (chance(_cfg.partial_rate))
+		{
+			_stats.partials++;
+			rsp.resize(std::uniform_int_distribution<size_t>(1, rsp.size() - 1)(_rng));
+		}
+
+		uint32_t latency = _cfg.latency_ms;
+		if (_cfg.jitter_ms)
+		{
+			latency += std::uniform_int_distribution<uint32_t>(0, _cfg.jitter_ms)(_rng);
+		}
+		// The request has only just finished arriving on a real line
+		std::this_thread::sleep_for(line_time(req.size()) + std::chrono::milliseconds(latency) + line_time(rsp.size()));
+		if (write(_master, rsp.data(), rsp.size()) == (ssize_t)rsp.size())
+		{
+			_stats.replies++;
+		}
+	}
+
+	void exception(std::vector<uint8_t> &rsp, uint8_t function, uint8_t code)
+	{
+		_stats.exceptions++;
+		rsp.push_back(function | 0x80);
+		rsp.push_back(code);
+	}
+};
+
+/**
+ * @brief Parse one --option value pair into the emulator settings
+ *
+ * @return true option was an emulator option
+ */
+inline bool emu_parse_option(emu_config_s &cfg, const char *opt, const char *val)
+{
+	std::string o(opt);
+	if (o == "--latency")
+		cfg.latency_ms = (uint32_t)atoi(val);
+	else if (o == "--jitter")
+		cfg.jitter_ms = (uint32_t)atoi(val);
+	else if (o == "--baud")
+		cfg.baud = (uint32_t)atoi(val);
+	else if (o == "--crc-errors")
+		cfg.crc_error_rate = atof(val);
+	else if (o == "--timeouts")
+		cfg.timeout_rate = atof(val);
+	else if (o == "--partial")
+		cfg.partial_rate = atof(val);
+	else if (o == "--seed")
+		cfg.seed = (uint32_t)atoi(val);
+	else if (o == "--slave")
+		cfg.slave_id = (uint8_t)atoi(val);
+	else
+		return false;
+	return true;
+}
+
+#define EMU_OPTIONS_HELP                                                   \
+	"  --latency MS      controller response latency (default 20)\n"       \
+	"  --jitter MS       random extra latency 0..MS (default 0)\n"         \
+	"  --baud N          emulated line speed, 0 = instant (default 9600)\n" \
+	"  --crc-errors P    probability of a reply with bad CRC\n"             \
+	"  --timeouts P      probability of no reply at all\n"                  \
+	"  --partial P       probability of a truncated reply\n"                \
+	"  --seed N          random seed (default 1)\n"                         \
+	"  --slave N         Modbus slave address (default 1)\n"
+
+#endif
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Build the trace replay runner, run from the repository root:
+#   sh tools/trace/build.sh [output]
+#
+# The application sources are compiled with ENABLE_TRACE, trace_replay.cpp
+# implements their trace hooks in place of src/trace.cpp.
+set -e
+
+OUT=${1:-trace_replay}
+
+# src/batt_adc.cpp (SAADC registers), src/wdt.cpp (WDT registers) and src/trace.cpp (the recorder) are replaced by trace_replay.cpp
+CXXFLAGS="-std=gnu++17 -O2 -DNRF52_SERIES -DMY_DEBUG=0 -DENABLE_TRACE -Itools/host/shim -Isrc"
+APP="src/main.cpp src/sensor_registry.cpp src/battery.cpp src/env.cpp src/acc.cpp src/energy.cpp \
+	src/renogy_rs232.cpp src/gnss.cpp src/vibration.cpp src/supervisor.cpp src/i2c_probe.cpp src/batch.cpp src/time_sync.cpp src/config.cpp src/load.cpp src/vedirect.cpp src/fuota.cpp tools/fleet_sim/wisblock_state.cpp"
+
+g++ $CXXFLAGS tools/trace/trace_replay.cpp tools/host/host_port.cpp $APP -o "$OUT"
@@ -0,0 +1,899 @@
+/**
+ * @file trace_replay.cpp
+ * @brief Replays a peripheral trace of the node through the application code
+ *        The trace is recorded by the firmware built with ENABLE_TRACE
+ *        (env:wiscore_rak4631_trace, src/trace.cpp): the USB log with its
+ *        TRACE_LINE_TAG lines, or the raw records with -b.
+ *
+ *        The unmodified src/ sources run natively on a virtual clock, the
+ *        hooks of src/trace.h are implemented here. Every recorded wake calls
+ *        its handler with the recorded events and downlink. Whatever the
+ *        code reads from a peripheral (UART bytes, I2C sensor results, ADC
+ *        samples, radio results) comes from the trace, at the recorded time.
+ *        Whatever it sends (UART bytes, uplink payloads, class changes) is
+ *        compared with the trace. Differences are reported with the wake
+ *        they happened in, as are records the code no longer consumes.
+ *        Reported per phase (src/trace.h): count and average duration on the
+ *        node against the host.
+ *
+ *        tools/trace/fleet_node.log is the trace of one simulated node,
+ *        recorded by tools/fleet_sim built with TRACE=1. It replays without a
+ *        difference, one after a change to src/ is a change of behaviour.
+ *
+ *        Build with tools/trace/build.sh, run from the repository root.
+ *
+ *        trace_replay [options] trace.log
+ * @version 0.1
+ * @date 2022-12-17
+ */
+
+#include "app.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+
+/** The application entry points, see src/main.cpp */
+void setup_app(void);
+bool init_app(void);
+void app_event_handler(void);
+void lora_data_handler(void);
+
+/** One record, at its absolute time */
+struct replay_record_s
+{
+	uint8_t type;
+	uint64_t ms;
+	std::vector<uint8_t> data;
+};
+
+/** One boot of the node */
+struct replay_session_s
+{
+	std::vector<replay_record_s> records;
+	/** TRACE_REC_PHASE records, kept apart */
+	std::vector<replay_record_s> phases;
+	uint32_t wakes = 0;
+};
+
+/** Replay options */
+struct replay_config_s
+{
+	int session = 0;
+	bool binary = false;
+	bool list = false;
+	int max_diffs = 50;
+};
+static replay_config_s cfg;
+
+/** Phase durations, node and host */
+struct replay_phase_s
+{
+	uint32_t node_count = 0;
+	uint64_t node_us = 0;
+	uint32_t host_count = 0;
+	double host_us = 0.0;
+	std::chrono::steady_clock::time_point start;
+};
+static replay_phase_s phases[TRACE_PHASE_MAX];
+
+/** Replay state: the session, the next record, the end of the wake in progress */
+static replay_session_s *trace = NULL;
+static size_t cursor = 0;
+static size_t wake_end = 0;
+/** Bytes of the UART record at the cursor already read or compared */
+static size_t part = 0;
+/** Wake in progress, 0 is init_app() */
+static uint32_t wake_no = 0;
+static bool uart_state = false;
+static uint32_t diff_count = 0;
+
+/** Tee in front of Serial1, the hooks below stand in for the recording */
+TraceUart g_trace_uart(Serial1);
+
+static const char *type_name(uint8_t type)
+{
+	switch (type)
+	{
+	case TRACE_REC_BOOT:
+		return "boot";
+	case TRACE_REC_CONFIG:
+		return "config";
+	case TRACE_REC_WAKE:
+		return "wake";
+	case TRACE_REC_PHASE:
+		return "phase";
+	case TRACE_REC_UART_BEGIN:
+		return "UART begin";
+	case TRACE_REC_UART_END:
+		return "UART end";
+	case TRACE_REC_UART_RX:
+		return "UART RX";
+	case TRACE_REC_UART_TX:
+		return "UART TX";
+	case TRACE_REC_UART_STATE:
+		return "UART state";
+	case TRACE_REC_I2C_READ:
+		return "I2C read";
+	case TRACE_REC_ADC:
+		return "ADC";
+	case TRACE_REC_LORA_TX:
+		return "LoRa TX";
+	case TRACE_REC_LORA_CLASS:
+		return "LoRa class";
+	}
+	return "?";
+}
+
+static std::string phase_name(uint8_t phase)
+{
+	static const char *names[] = {"init", "uplink", "downlink", "tx_fin", "acc"};
+	if (phase < TRACE_PHASE_SENSOR)
+	{
+		return names[phase];
+	}
+	if (phase - TRACE_PHASE_SENSOR < SENSOR_COUNT)
+	{
+		return std::string("sensor ") + g_sensors[phase - TRACE_PHASE_SENSOR]->name;
+	}
+	return "phase " + std::to_string(phase);
+}
+
+static std::string hex(const uint8_t *data, size_t len)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	std::string s;
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		s += digits[data[idx] >> 4];
+		s += digits[data[idx] & 0x0F];
+	}
+	return s;
+}
+
+/**
+ * @brief Report a difference between the trace and the replay
+ *
+ */
+static void diff(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void diff(const char *fmt, ...)
+{
+	if (++diff_count > (uint32_t)cfg.max_diffs)
+	{
+		return;
+	}
+	char msg[512];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	if (wake_no == 0)
+	{
+		printf("init              %s\n", msg);
+	}
+	else
+	{
+		printf("wake %5lu %8.1f s  %s\n", (unsigned long)wake_no, host_virtual_us / 1e6, msg);
+	}
+}
+
+/** The clock moves on to the time of a record, never back */
+static void advance_to(const replay_record_s &r)
+{
+	if (host_virtual_us < r.ms * 1000)
+	{
+		host_virtual_us = r.ms * 1000;
+	}
+}
+
+/** Next record of the wake in progress, NULL at its end */
+static replay_record_s *peek(void)
+{
+	return cursor < wake_end ? &trace->records[cursor] : NULL;
+}
+
+static void consume(void)
+{
+	cursor++;
+	part = 0;
+}
+
+/** Records of the wake the code did not ask for */
+static void skip_to(size_t idx)
+{
+	for (; cursor < idx; consume())
+	{
+		const replay_record_s &r = trace->records[cursor];
+		diff("%s not consumed (%zu bytes%s)", type_name(r.type), r.data.size() - part, part ? " left" : "");
+	}
+}
+
+/**
+ * @brief Find the record a hook asks for
+ *        The record at the cursor, or a later one of the same wake that
+ *        matches, the records in between were not consumed.
+ *
+ * @param key bytes the record data must start with, the address of an I2C read
+ * @return replay_record_s* the record, now at the cursor, NULL if the wake has none
+ */
+static replay_record_s *expect(uint8_t type, const uint8_t *key, size_t key_len)
+{
+	for (size_t idx = cursor; idx < wake_end; idx++)
+	{
+		const replay_record_s &r = trace->records[idx];
+		if ((r.type == type) && (r.data.size() >= key_len) && (memcmp(r.data.data(), key, key_len) == 0))
+		{
+			skip_to(idx);
+			advance_to(trace->records[cursor]);
+			return &trace->records[cursor];
+		}
+	}
+	return NULL;
+}
+
+/** Hooks of src/trace.h */
+
+void trace_init(void)
+{
+	replay_record_s *r = expect(TRACE_REC_BOOT, NULL, 0);
+	if (r)
+	{
+		consume();
+	}
+}
+
+void trace_config(void *config, uint8_t len)
+{
+	replay_record_s *r = expect(TRACE_REC_CONFIG, NULL, 0);
+	if (!r)
+	{
+		diff("configuration not in the trace");
+		return;
+	}
+	if (r->data.size() != len)
+	{
+		diff("configuration is %d bytes, trace %zu", len, r->data.size());
+	}
+	memcpy(config, r->data.data(), std::min((size_t)len, r->data.size()));
+	consume();
+}
+
+void trace_wake(uint8_t handler)
+{
+	replay_record_s *r = peek();
+	if (!r || (r->type != TRACE_REC_WAKE) || (r->data[0] != handler))
+	{
+		return;
+	}
+	consume();
+	for (wake_end = cursor; wake_end < trace->records.size(); wake_end++)
+	{
+		if (trace->records[wake_end].type == TRACE_REC_WAKE)
+		{
+			break;
+		}
+	}
+}
+
+void trace_phase_begin(uint8_t phase)
+{
+	if (phase < TRACE_PHASE_MAX)
+	{
+		phases[phase].start = std::chrono::steady_clock::now();
+	}
+}
+
+void trace_phase_end(uint8_t phase)
+{
+	if (phase < TRACE_PHASE_MAX)
+	{
+		phases[phase].host_count++;
+		phases[phase].host_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - phases[phase].start).count();
+	}
+}
+
+void trace_flush(void) {}
+
+uint8_t trace_i2c_read(uint8_t addr, uint8_t reg, uint8_t status, uint8_t *data, uint8_t len)
+{
+	uint8_t key[2] = {addr, reg};
+	replay_record_s *r = expect(TRACE_REC_I2C_READ, key, sizeof(key));
+	if (!r)
+	{
+		diff("I2C read %02X:%02X not in the trace", addr, reg);
+		return status;
+	}
+	size_t got = r->data.size() - 3;
+	if (got != len)
+	{
+		diff("I2C read %02X:%02X is %d bytes, trace %zu", addr, reg, len, got);
+	}
+	memcpy(data, &r->data[3], std::min((size_t)len, got));
+	status = r->data[2];
+	consume();
+	return status;
+}
+
+uint16_t trace_adc(int16_t *raw, uint16_t count)
+{
+	replay_record_s *r = expect(TRACE_REC_ADC, NULL, 0);
+	if (!r)
+	{
+		diff("ADC read not in the trace");
+		return count;
+	}
+	uint16_t got = (uint16_t)std::min((size_t)count, r->data.size() / 2);
+	for (uint16_t idx = 0; idx < got; idx++)
+	{
+		raw[idx] = (int16_t)(r->data[2 * idx] | (r->data[2 * idx + 1] << 8));
+	}
+	consume();
+	return got;
+}
+
+lmh_error_status trace_lora_tx(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	replay_record_s *r = expect(TRACE_REC_LORA_TX, &fport, 1);
+	if (!r)
+	{
+		diff("uplink fPort %d not in the trace: %s", fport, hex(data, size).c_str());
+		return LMH_ERROR;
+	}
+	if ((r->data.size() - 2 != size) || (memcmp(&r->data[2], data, size) != 0))
+	{
+		diff("uplink fPort %d differs\n                    replay %s\n                    trace  %s", fport,
+			 hex(data, size).c_str(), hex(&r->data[2], r->data.size() - 2).c_str());
+	}
+	lmh_error_status result = (lmh_error_status)(int8_t)r->data[1];
+	consume();
+	return result;
+}
+
+lmh_error_status trace_lora_class(DeviceClass_t new_class)
+{
+	replay_record_s *r = expect(TRACE_REC_LORA_CLASS, &new_class, 1);
+	if (!r)
+	{
+		diff("class %d request not in the trace", new_class);
+		return LMH_ERROR;
+	}
+	lmh_error_status result = (lmh_error_status)(int8_t)r->data[1];
+	consume();
+	return result;
+}
+
+void trace_uart_begin(uint32_t baud)
+{
+	replay_record_s *r = expect(TRACE_REC_UART_BEGIN, NULL, 0);
+	if (!r)
+	{
+		diff("UART begin not in the trace");
+		return;
+	}
+	uint32_t recorded = r->data[0] | (r->data[1] << 8) | (r->data[2] << 16) | ((uint32_t)r->data[3] << 24);
+	if (recorded != baud)
+	{
+		diff("UART begin at %lu Bd, trace %lu Bd", (unsigned long)baud, (unsigned long)recorded);
+	}
+	consume();
+}
+
+void trace_uart_end(void)
+{
+	if (!expect(TRACE_REC_UART_END, NULL, 0))
+	{
+		diff("UART end not in the trace");
+		return;
+	}
+	consume();
+}
+
+bool trace_uart_state(bool open)
+{
+	(void)open;
+	replay_record_s *r = peek();
+	if (r && (r->type == TRACE_REC_UART_STATE))
+	{
+		uart_state = r->data[0] != 0;
+		consume();
+	}
+	return uart_state;
+}
+
+/**
+ * @brief Bytes of the RX record at the cursor
+ *        An empty poll lets the time run on to the next record of the wake
+ *        (the node waited for it), or by 1 ms.
+ *
+ */
+int trace_uart_available(int count)
+{
+	(void)count;
+	replay_record_s *r = peek();
+	if (r && (r->type == TRACE_REC_UART_RX))
+	{
+		advance_to(*r);
+		return (int)(r->data.size() - part);
+	}
+	if (r && (r->ms * 1000 > host_virtual_us))
+	{
+		advance_to(*r);
+	}
+	else
+	{
+		host_virtual_us += 1000;
+	}
+	return 0;
+}
+
+int trace_uart_peek(int c)
+{
+	(void)c;
+	replay_record_s *r = peek();
+	return (r && (r->type == TRACE_REC_UART_RX)) ? r->data[part] : -1;
+}
+
+/** Reads that found nothing on the node are not in the trace, -1 here as well */
+int trace_uart_read(int c)
+{
+	(void)c;
+	replay_record_s *r = peek();
+	if (!r || (r->type != TRACE_REC_UART_RX))
+	{
+		return -1;
+	}
+	advance_to(*r);
+	int byte = r->data[part++];
+	if (part == r->data.size())
+	{
+		consume();
+	}
+	return byte;
+}
+
+void trace_uart_write(const uint8_t *buffer, size_t size)
+{
+	std::vector<uint8_t> recorded;
+	size_t idx = 0;
+	for (; idx < size; idx++)
+	{
+		replay_record_s *r = peek();
+		if (!r || (r->type != TRACE_REC_UART_TX))
+		{
+			break;
+		}
+		recorded.push_back(r->data[part++]);
+		if (part == r->data.size())
+		{
+			consume();
+		}
+	}
+	if ((idx < size) || (memcmp(recorded.data(), buffer, size) != 0))
+	{
+		diff("UART TX differs\n                    replay %s\n                    trace  %s",
+			 hex(buffer, size).c_str(), hex(recorded.data(), recorded.size()).c_str());
+	}
+}
+
+/** WisBlock-API calls, the wakes come from the trace */
+
+void api_wake_loop(uint16_t reason)
+{
+	(void)reason;
+}
+
+void api_timer_restart(uint32_t new_time)
+{
+	(void)new_time;
+}
+
+void host_timer_start(SoftwareTimer *timer)
+{
+	(void)timer;
+}
+
+void host_timer_stop(SoftwareTimer *timer)
+{
+	(void)timer;
+}
+
+void api_set_version(uint16_t sw_1, uint16_t sw_2, uint16_t sw_3)
+{
+	(void)sw_1;
+	(void)sw_2;
+	(void)sw_3;
+}
+
+void api_read_credentials(void) {}
+void api_set_credentials(void) {}
+void api_reset(void) {}
+void at_serial_input(uint8_t cmd) { (void)cmd; }
+void restart_advertising(uint16_t timeout) { (void)timeout; }
+
+float read_batt(void)
+{
+	return 0.0f;
+}
+
+/** The SAADC backend of src/batt_adc.cpp, the samples come from the trace */
+static uint16_t burst_count = 0;
+
+bool batt_adc_init(void)
+{
+	return true;
+}
+
+int16_t batt_adc_read(void)
+{
+	return 0;
+}
+
+bool batt_adc_burst_start(int16_t *buf, uint16_t count)
+{
+	(void)buf;
+	burst_count = count;
+	return true;
+}
+
+/** The whole buffer, trace_adc() limits it to what the node measured */
+uint16_t batt_adc_burst_end(void)
+{
+	return burst_count;
+}
+
+/** As src/batt_adc.cpp on the nRF52, BATT_ADC_MV_Q16 */
+uint16_t batt_adc_mv(int16_t raw)
+{
+	return raw <= 0 ? 0 : (uint16_t)(((uint32_t)raw * BATT_ADC_MV_Q16 + 0x8000) >> 16);
+}
+
+/** The watchdog backend of src/wdt.cpp, the replay does not reset */
+bool wdt_start(uint32_t timeout_ms)
+{
+	(void)timeout_ms;
+	return false;
+}
+
+void wdt_feed(void) {}
+
+bool wdt_caused_reset(void)
+{
+	return false;
+}
+
+bool wdt_warm_reset(void)
+{
+	return false;
+}
+
+uint8_t wdt_retained(void)
+{
+	return 0;
+}
+
+void wdt_retain(uint8_t value) { (void)value; }
+
+/** Trace input */
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	if (c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+/**
+ * @brief The record streams of a USB log, one per boot
+ *        A stream starts at offset 0, a gap ends it.
+ *
+ */
+static bool read_log(FILE *in, std::vector<std::vector<uint8_t>> &streams)
+{
+	char line[1024];
+	size_t tag_len = strlen(TRACE_LINE_TAG);
+	bool gap = false;
+	while (fgets(line, sizeof(line), in))
+	{
+		char *tag = strstr(line, TRACE_LINE_TAG);
+		if (!tag)
+		{
+			continue;
+		}
+		char *end;
+		unsigned long offset = strtoul(tag + tag_len, &end, 16);
+		if (end == tag + tag_len || *end != ' ')
+		{
+			continue;
+		}
+		std::vector<uint8_t> bytes;
+		for (char *p = end + 1; hex_digit(p[0]) >= 0 && hex_digit(p[1]) >= 0; p += 2)
+		{
+			bytes.push_back((uint8_t)(hex_digit(p[0]) << 4 | hex_digit(p[1])));
+		}
+		if (offset == 0)
+		{
+			streams.emplace_back();
+			gap = false;
+		}
+		else if (streams.empty() || gap)
+		{
+			continue;
+		}
+		else if (offset != streams.back().size())
+		{
+			fprintf(stderr, "Trace %zu: %lu bytes missing at offset %zX, the rest is ignored\n",
+					streams.size(), offset - streams.back().size(), streams.back().size());
+			gap = true;
+			continue;
+		}
+		streams.back().insert(streams.back().end(), bytes.begin(), bytes.end());
+	}
+	return !streams.empty();
+}
+
+/**
+ * @brief Split the records of a stream into sessions at TRACE_REC_BOOT
+ *
+ */
+static void parse_stream(const std::vector<uint8_t> &stream, std::vector<replay_session_s> &sessions)
+{
+	size_t pos = 0;
+	uint64_t ms = 0;
+	bool in_session = false;
+	trace_record_s r;
+	while (trace_next(stream.data(), stream.size(), &pos, &r))
+	{
+		ms += r.dt_ms;
+		if (r.type == TRACE_REC_BOOT)
+		{
+			if ((r.len != 3) || (r.data[0] != 'T') || (r.data[1] != 'R') || (r.data[2] != TRACE_VERSION))
+			{
+				fprintf(stderr, "Trace version %d not supported\n", r.len == 3 ? r.data[2] : 0);
+				in_session = false;
+				continue;
+			}
+			sessions.emplace_back();
+			in_session = true;
+			ms = r.dt_ms;
+		}
+		if (!in_session)
+		{
+			continue;
+		}
+		replay_record_s rec = {r.type, ms, std::vector<uint8_t>(r.data, r.data + r.len)};
+		replay_session_s &s = sessions.back();
+		if (r.type == TRACE_REC_PHASE)
+		{
+			s.phases.push_back(rec);
+			continue;
+		}
+		if ((r.type == TRACE_REC_WAKE) && (r.len < TRACE_WAKE_HEADER))
+		{
+			fprintf(stderr, "Wake record of %lu bytes ignored\n", (unsigned long)r.len);
+			continue;
+		}
+		s.wakes += r.type == TRACE_REC_WAKE;
+		s.records.push_back(rec);
+	}
+	if (pos != stream.size())
+	{
+		fprintf(stderr, "Truncated record at offset %zX\n", pos);
+	}
+}
+
+/** Set the API state the handler runs with */
+static void apply_wake(const replay_record_s &r)
+{
+	const uint8_t *d = r.data.data();
+	g_task_event_type = d[1] | (d[2] << 8);
+	g_last_fport = d[3];
+	g_last_rssi = (int16_t)(d[4] | (d[5] << 8));
+	g_last_snr = (int8_t)d[6];
+	g_rx_fin_result = (d[7] & TRACE_WAKE_RX_FIN) != 0;
+	g_join_result = (d[7] & TRACE_WAKE_JOIN) != 0;
+	g_rx_data_len = (uint8_t)(r.data.size() - TRACE_WAKE_HEADER);
+	memcpy(g_rx_lora_data, &d[TRACE_WAKE_HEADER], g_rx_data_len);
+}
+
+/**
+ * @brief Run the application through one session
+ *
+ */
+static void replay(replay_session_s &s)
+{
+	trace = &s;
+	host_virtual_time = true;
+	host_virtual_us = 0;
+	cursor = 0;
+	part = 0;
+	wake_no = 0;
+	for (wake_end = 0; wake_end < s.records.size() && s.records[wake_end].type != TRACE_REC_WAKE; wake_end++)
+	{
+	}
+
+	setup_app();
+	init_app();
+	skip_to(wake_end);
+
+	while (cursor < s.records.size())
+	{
+		const replay_record_s &r = s.records[cursor];
+		wake_no++;
+		advance_to(r);
+		apply_wake(r);
+		if (cfg.list)
+		{
+			printf("wake %5lu %8.1f s  %s events %04X fPort %d%s\n", (unsigned long)wake_no, r.ms / 1e3,
+				   r.data[0] == TRACE_WAKE_LORA ? "lora" : "app ", g_task_event_type, g_last_fport,
+				   g_rx_data_len ? (" " + hex(g_rx_lora_data, g_rx_data_len)).c_str() : "");
+		}
+		size_t wake_at = cursor;
+		wake_end = cursor + 1;
+		if (r.data[0] == TRACE_WAKE_LORA)
+		{
+			lora_data_handler();
+		}
+		else
+		{
+			app_event_handler();
+		}
+		if (cursor == wake_at)
+		{
+			diff("handler did not call TRACE_WAKE");
+			consume();
+		}
+		skip_to(wake_end);
+	}
+}
+
+static void print_phases(const replay_session_s &s)
+{
+	for (const replay_record_s &r : s.phases)
+	{
+		size_t pos = 1;
+		uint32_t us;
+		if ((r.data.size() > 1) && (r.data[0] < TRACE_PHASE_MAX) && trace_get_varint(r.data.data(), r.data.size(), &pos, &us))
+		{
+			phases[r.data[0]].node_count++;
+			phases[r.data[0]].node_us += us;
+		}
+	}
+	printf("\n%-16s %8s %10s %8s %10s\n", "phase", "node n", "avg ms", "host n", "avg us");
+	for (uint8_t phase = 0; phase < TRACE_PHASE_MAX; phase++)
+	{
+		const replay_phase_s &p = phases[phase];
+		if (p.node_count == 0 && p.host_count == 0)
+		{
+			continue;
+		}
+		printf("%-16s %8lu %10.2f %8lu %10.1f\n", phase_name(phase).c_str(), (unsigned long)p.node_count,
+			   p.node_count ? p.node_us / 1e3 / p.node_count : 0.0, (unsigned long)p.host_count,
+			   p.host_count ? p.host_us / p.host_count : 0.0);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"usage: %s [options] trace.log\n"
+			"  -S 0             session to replay, a session is one boot\n"
+			"  -b               the file holds the raw records\n"
+			"  -l               list the wakes\n"
+			"  -m 50            differences to print\n"
+			"  -v               application log (build with MY_DEBUG=1)\n",
+			name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-v")
+		{
+			host_verbose = true;
+			continue;
+		}
+		if (arg == "-b")
+		{
+			cfg.binary = true;
+			continue;
+		}
+		if (arg == "-l")
+		{
+			cfg.list = true;
+			continue;
+		}
+		if (arg[0] != '-' && !file)
+		{
+			file = argv[i];
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+		}
+		const char *val = argv[++i];
+		if (arg == "-S")
+		{
+			cfg.session = atoi(val);
+		}
+		else if (arg == "-m")
+		{
+			cfg.max_diffs = atoi(val);
+		}
+		else
+		{
+			usage(argv[0]);
+		}
+	}
+	if (!file)
+	{
+		usage(argv[0]);
+	}
+
+	FILE *in = fopen(file, cfg.binary ? "rb" : "r");
+	if (!in)
+	{
+		perror(file);
+		return 1;
+	}
+	std::vector<std::vector<uint8_t>> streams;
+	if (cfg.binary)
+	{
+		streams.emplace_back();
+		uint8_t buf[4096];
+		size_t got;
+		while ((got = fread(buf, 1, sizeof(buf), in)) > 0)
+		{
+			streams.back().insert(streams.back().end(), buf, buf + got);
+		}
+	}
+	else if (!read_log(in, streams))
+	{
+		fprintf(stderr, "%s: no trace lines\n", file);
+		fclose(in);
+		return 1;
+	}
+	fclose(in);
+
+	std::vector<replay_session_s> sessions;
+	for (const std::vector<uint8_t> &stream : streams)
+	{
+		parse_stream(stream, sessions);
+	}
+	if (cfg.session < 0 || cfg.session >= (int)sessions.size())
+	{
+		fprintf(stderr, "%s: %zu sessions, no session %d\n", file, sessions.size(), cfg.session);
+		return 1;
+	}
+	replay_session_s &s = sessions[cfg.session];
+	printf("session %d of %zu: %zu records, %lu wakes, %.1f s\n\n", cfg.session, sessions.size(), s.records.size(),
+		   (unsigned long)s.wakes, s.records.empty() ? 0.0 : s.records.back().ms / 1e3);
+
+	auto start = std::chrono::steady_clock::now();
+	replay(s);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	print_phases(s);
+	if (diff_count > (uint32_t)cfg.max_diffs)
+	{
+		printf("\n%lu more differences not shown\n", (unsigned long)(diff_count - cfg.max_diffs));
+	}
+	printf("\n%lu differences, replay %.1f ms\n", (unsigned long)diff_count, ms);
+	return diff_count ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file vib_bench.cpp
+ * @brief Host reference for the vibration features in src/vib_features.h
+ *        A double precision reference (direct DFT) checks the scalar
+ *        firmware kernels on synthetic captures and both are timed. The
+ *        CMSIS-DSP timing is logged by the node itself at boot
+ *        (vib_benchmark() in src/vibration.cpp, MY_DEBUG builds).
+ *
+ *        g++ -std=c++17 -O2 -Isrc tools/vibration/vib_bench.cpp -o vib_bench
+ * @version 0.1
+ * @date 2022-09-24
+ */
+
+#include "vib_features.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * @brief Reference: double precision, direct DFT, same window and rounding rules
+ */
+static void vib_features_reference(const float *x, vib_features_s *f)
+{
+	double sum2 = 0.0;
+	double peak = 0.0;
+	for (int idx = 0; idx < VIB_SAMPLES; idx++)
+	{
+		sum2 += (double)x[idx] * x[idx];
+		peak = fabs(x[idx]) > peak ? fabs(x[idx]) : peak;
+	}
+	vib_set_levels((float)sqrt(sum2 / VIB_SAMPLES), (float)peak, f);
+
+	float mag[VIB_SAMPLES / 2];
+	for (int bin = 0; bin < VIB_SAMPLES / 2; bin++)
+	{
+		double re = 0.0;
+		double im = 0.0;
+		for (int idx = 0; idx < VIB_SAMPLES; idx++)
+		{
+			double w = 0.5 - 0.5 * cos(2.0 * M_PI * idx / VIB_SAMPLES);
+			re += x[idx] * w * cos(2.0 * M_PI * bin * idx / VIB_SAMPLES);
+			im -= x[idx] * w * sin(2.0 * M_PI * bin * idx / VIB_SAMPLES);
+		}
+		mag[bin] = (float)sqrt(re * re + im * im);
+	}
+	vib_pick_peaks(mag, f);
+}
+
+/**
+ * @brief Synthetic capture: gravity on one axis, a few tones and noise on another
+ */
+static void make_capture(std::mt19937 &rng, int16_t *xyz)
+{
+	std::uniform_real_distribution<double> freq(5.0, VIB_ODR_HZ / 2 - 10.0);
+	std::uniform_real_distribution<double> amp(20.0, 800.0);
+	std::normal_distribution<double> noise(0.0, 15.0);
+	double f1 = freq(rng);
+	double f2 = freq(rng);
+	double a1 = amp(rng);
+	double a2 = amp(rng) / 3.0;
+	int axis = rng() % 3;
+	for (int idx = 0; idx < VIB_SAMPLES; idx++)
+	{
+		double t = (double)idx / VIB_ODR_HZ;
+		double v = a1 * sin(2.0 * M_PI * f1 * t) + a2 * sin(2.0 * M_PI * f2 * t) + noise(rng);
+		for (int a = 0; a < 3; a++)
+		{
+			double g = (a == 2) ? 1000.0 : 0.0;
+			double s = g + (a == axis ? v : noise(rng));
+			// Quantized like the LIS3DH at +/-8g, 16 mg/digit
+			xyz[3 * idx + a] = (int16_t)(lround(s / 16.0) * 16);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int captures = argc > 1 ? atoi(argv[1]) : 1000;
+	std::mt19937 rng(42);
+	std::vector<int16_t> raw(VIB_SAMPLES * 3);
+	float signal[VIB_SAMPLES];
+	float work[VIB_SAMPLES];
+
+	int mismatch = 0;
+	double ref_ns = 0.0;
+	double scalar_ns = 0.0;
+	for (int c = 0; c < captures; c++)
+	{
+		make_capture(rng, raw.data());
+		vib_select_axis(raw.data(), VIB_SAMPLES, signal);
+
+		vib_features_s ref;
+		vib_features_s out;
+		auto t0 = std::chrono::steady_clock::now();
+		vib_features_reference(signal, &ref);
+		auto t1 = std::chrono::steady_clock::now();
+		memcpy(work, signal, sizeof(work));
+		vib_features_scalar(work, &out);
+		auto t2 = std::chrono::steady_clock::now();
+		ref_ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+		scalar_ns += std::chrono::duration<double, std::nano>(t2 - t1).count();
+
+		// Levels may differ by rounding, frequencies must match exactly
+		if (abs(ref.rms_mg - out.rms_mg) > 1 || abs(ref.peak_mg - out.peak_mg) > 1 ||
+			abs(ref.crest_10 - out.crest_10) > 1 || ref.freq_1 != out.freq_1 || ref.freq_2 != out.freq_2)
+		{
+			if (mismatch++ < 5)
+			{
+				printf("capture %d: ref %u/%u/%u %u/%u Hz, scalar %u/%u/%u %u/%u Hz\n", c,
+					   ref.rms_mg, ref.peak_mg, ref.crest_10, ref.freq_1, ref.freq_2,
+					   out.rms_mg, out.peak_mg, out.crest_10, out.freq_1, out.freq_2);
+			}
+		}
+	}
+
+	printf("%d captures of %d samples at %d Hz, %d mismatches\n", captures, VIB_SAMPLES, VIB_ODR_HZ, mismatch);
+	printf("reference (direct DFT) %10.0f ns/capture\n", ref_ns / captures);
+	printf("scalar kernels         %10.0f ns/capture\n", scalar_ns / captures);
+	return mismatch ? 1 : 0;
+}